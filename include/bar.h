@@ -49,4 +49,36 @@ void Compute_Bar_Location(  Image *im,      // The bar should be bright.
                             double r_low,   // Minimum circumscribed radius to consider
                             double r_high );// Maximum circumscribed radius to consider 
 
+/* Reentrant version of Compute_Bar_Location.
+ *
+ * Scratch space is kept in the Bar_Locator so repeated calls don't
+ * re-allocate.  Use one Bar_Locator per thread; calls with different
+ * locators may run concurrently.
+ */
+typedef struct _Bar_Locator Bar_Locator;
+
+SHARED_EXPORT Bar_Locator *Make_Bar_Locator( void );
+SHARED_EXPORT void         Free_Bar_Locator( Bar_Locator *self );
+/* Enables a coarse-to-fine search when `scale` is greater than 1.
+ *
+ * The bar is first located in a copy of the frame box-filtered down by
+ * `scale`, with the gap, length and radius limits scaled to match.  That
+ * estimate is then refined at full resolution in a window about twice
+ * `r_high` around it.  Since building the component tree dominates the cost,
+ * this is much faster on large frames.  If either pass finds nothing, the
+ * whole frame is searched at full resolution.  The default is 1 (off).
+ */
+SHARED_EXPORT void         Bar_Locator_Set_Scale( Bar_Locator *self, int scale );
+SHARED_EXPORT
+void Compute_Bar_Location_r( Bar_Locator *self,
+                             Image *im,
+                             double *x,
+                             double *y,
+                             int gap,
+                             int minlen,
+                             int lvl_low,
+                             int lvl_high,
+                             double r_low,
+                             double r_high );
+
 #endif //H_WHISK_BAR
@@ -47,4 +47,26 @@
 #define SHARED_EXPORT __declspec(dllexport)
 #endif
 
+// Storage class for statics that must be private to each thread, e.g.
+// scratch buffers kept between calls by the tracing code.
+#ifndef THREAD_LOCAL
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+#endif
+
+// 64-bit file offsets.  `long`, and so fseek and ftell, is 32 bits on
+// Windows.  Include <stdio.h> (and <sys/types.h> for off_t) before use.
+#ifndef FSEEK64
+#ifdef _MSC_VER
+#define FSEEK64 _fseeki64
+#define FTELL64 _ftelli64
+#else
+#define FSEEK64 fseeko
+#define FTELL64 ftello
+#endif
+#endif
+
 #endif //#define _H_COMPAT_
@@ -39,9 +39,11 @@ typedef enum { LE, EQ, GE } Comparator;
 
 Contour *Trace_Region(Image *image, int pixel, Comparator cmprsn, int level, int iscon4);
 
-//  Produce outer-contours of a level set or a watershed partition
+//  Produce outer-contours of a level set or a watershed partition.  Trace_Level_Set_In
+//    takes the component tree of r instead of using the current one.
 
 Contour *Trace_Level_Set(Level_Set *r);
+Contour *Trace_Level_Set_In(Component_Tree *tree, Level_Set *r);
 Contour *Trace_Watershed(Watershed_2D *w, int cb);
 
 //  Storage management as per convention
@@ -54,7 +56,7 @@ void     Reset_Contour();
 int      Contour_Usage();
 
 //  Extent of a contour in pixel coordinates: a return bundle and not an object
-//    (i.e. a pointer to a static copy within the producing routine that is
+//    (i.e. a pointer to a per-thread static copy within the producing routine that is
 //          *reused* on every invocation).
 
 typedef struct _Contour_Extent
@@ -62,6 +62,12 @@
 //      Calling FFMPEG_Fetch may invalidate any previous returned Images.       
 //                                                                              
 //      Not thread safe.                                                        
+//
+//    <FFMPEG_Set_Crop>
+//      Restricts conversion to a rectangle of the decoded frame.  Subsequent
+//      fetches return width x height images.  Pass width or height <= 0 to
+//      restore full frames.  Returns 1 on success, 0 if the movie's pixel
+//      format can't be cropped this way (the crop is left unchanged).
 
 #include "image_lib.h"
 
@@ -69,6 +75,7 @@ SHARED_EXPORT         void *FFMPEG_Open       (const char* filename);
 SHARED_EXPORT         void  FFMPEG_Close      (void *context);             
 SHARED_EXPORT        Image *FFMPEG_Fetch      (void *context, int iframe); 
 SHARED_EXPORT unsigned int  FFMPEG_Frame_Count(void*);
+SHARED_EXPORT          int  FFMPEG_Set_Crop   (void *context, int x, int y, int width, int height);
 
 //--- UI2.PY interface
 
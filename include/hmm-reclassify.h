@@ -8,6 +8,7 @@
  */
 #ifndef H_HMM_RECLASSIFY
 #define H_HMM_RECLASSIFY
+#include "traj.h"
 
 typedef struct _measurements_reference
 { Measurements  *frame;     // points to head of a set of whisker segmens (e.g. those in a frame)
@@ -16,6 +17,11 @@ typedef struct _measurements_reference
   int nwhiskers;            // the number of whisker id's in the domain of the map.
 } Measurements_Reference;
 
+// Relabels `table` in place, starting from an initial guess at the identity
+// of many of the segments.  If nwhisk < 1, the number of whiskers is taken
+// from the initial guess.  Returns 0 if there was nothing to do.
+SHARED_EXPORT int HMM_Reclassify_Watershed( Measurements *table, int nrows, int nwhisk );
+
 
 #endif  //H_HMM_RECLASSIFY 
 
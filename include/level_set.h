@@ -32,6 +32,14 @@ typedef void Component_Tree;         // Component tree of level sets of a GREY i
 Component_Tree *Build_2D_Component_Tree(Image *image, int iscon4);
 Component_Tree *Build_3D_Component_Tree(Stack *stack, int iscon6);
 
+/* Rebuild_2D_Component_Tree builds the tree for "image" in the space of "tree", which is
+   returned.  A tree holds the workspace used to build it as well as its nodes.  Both are
+   only reallocated if "image" is larger than any image the tree was built from before, so
+   a tree kept from frame to frame isn't re-allocated.  If "tree" is NULL, this is the same
+   as Build_2D_Component_Tree.                                                              */
+
+Component_Tree *Rebuild_2D_Component_Tree(Component_Tree *tree, Image *image, int iscon4);
+
 void            Print_Component_Tree(Component_Tree *t, int indent, FILE *file);
 
 Component_Tree *Copy_Component_Tree(Component_Tree *tree);
@@ -44,7 +52,8 @@ int             Component_Tree_Usage();
 
 /* All the tree traversal and information routines below work off an implicit
    current component tree which is set with "Set_Current_Component_Tree"
-   (or by "Build_Component_Tree" above).                                          */
+   (or by "Build_Component_Tree" above).  Each thread has its own current tree.
+   Trees may be built on several threads at once.                                 */
 
 typedef void Level_Set;        // Vertex of component tree (corresponds to a level set);
 
@@ -60,6 +69,7 @@ Level_Set *Level_Set_Sibling(Level_Set *r);
 int        Level_Set_Size(Level_Set *r);
 int        Level_Set_Level(Level_Set *r);
 int        Level_Set_Peak(Level_Set *r);
+int        Level_Set_Leftmost(Level_Set *r);
 int        Level_Set_Background(Level_Set *r);
 int        Level_Set_Id(Level_Set *r);
 
@@ -70,4 +80,20 @@ int        Level_Set_Id(Level_Set *r);
 
 void       List_Level_Set(Level_Set *r, void (*handler)(int));
 
+/* The "_In" routines are the same as those above but take the tree that "r" belongs to
+   instead of using the current tree.  They don't touch any global state.  Level_Set_Background
+   doesn't depend on the current tree and has no "_In" form.  List_Level_Set_In passes "arg"
+   through to "handler".                                                                    */
+
+Level_Set *Level_Set_Root_In(Component_Tree *tree);
+Level_Set *Level_Set_Child_In(Component_Tree *tree, Level_Set *r);
+Level_Set *Level_Set_Sibling_In(Component_Tree *tree, Level_Set *r);
+int        Level_Set_Size_In(Component_Tree *tree, Level_Set *r);
+int        Level_Set_Level_In(Component_Tree *tree, Level_Set *r);
+int        Level_Set_Peak_In(Component_Tree *tree, Level_Set *r);
+int        Level_Set_Leftmost_In(Component_Tree *tree, Level_Set *r);
+int        Level_Set_Id_In(Component_Tree *tree, Level_Set *r);
+
+void       List_Level_Set_In(Component_Tree *tree, Level_Set *r, void (*handler)(int,void *), void *arg);
+
 #endif
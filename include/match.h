@@ -31,6 +31,23 @@ typedef struct _Assignment
 SHARED_EXPORT Assignment match( double* distMatrixIn, int nOfRows, int nOfColumns );
 SHARED_EXPORT void assignmentoptimal(double *assignment, double *cost, double *distMatrixIn, int nOfRows, int nOfColumns);
 
+/* Minimum cost assignment for a sparse cost matrix.
+ *
+ * Costs are given in compressed-row form: the candidate columns for row i are
+ * col[rowptr[i]] ... col[rowptr[i+1]-1] with costs cost[rowptr[i]] ...  Costs
+ * must be non-negative.  Any row may instead be left unassigned for
+ * `unassignedCost`, so a solution always exists.  Pairs that aren't listed
+ * can't be assigned.
+ *
+ * Uses shortest augmenting paths (Dijkstra with potentials), so the work
+ * depends on the number of listed pairs rather than nOfRows*nOfColumns.
+ *
+ * On return assignment[i] is the column for row i or -1, and *cost is the
+ * total including unassigned rows.  Returns the number of assigned rows, or
+ * -1 if a cost is negative.
+ */
+SHARED_EXPORT int assignmentsparse(int *assignment, double *cost, const int *rowptr, const int *col, const float *costs, int nOfRows, int nOfColumns, double unassignedCost);
+
 /* Matrix printing functions (for debuging mostly)*/
 void pmat( double* array, int m, int n);
 void pimat( int* array, int m, int n);
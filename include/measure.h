@@ -19,6 +19,10 @@ Measurements *Whisker_Segments_Measure(
     Whisker_Seg *wv, int wvn, 
     int facex, int facey, char face_axis );
 
+/** Face position from a hint ("left", "right", "top" or "bottom") and the
+ *  extent of the segments */
+void face_point_from_hint( Whisker_Seg *wv, int wvn, char* hint, int *x, int *y, char *face_axis );
+
 
 #ifdef __cplusplus
 }
@@ -18,8 +18,10 @@ SHARED_EXPORT MeasurementsFile Measurements_File_Open       (const char* filenam
 SHARED_EXPORT void             Measurements_File_Close      (MeasurementsFile fp);
 SHARED_EXPORT void             Measurements_File_Write      (MeasurementsFile fp, Measurements *table, int n);
 SHARED_EXPORT Measurements*    Measurements_File_Read       (MeasurementsFile fp, int *n);
+SHARED_EXPORT Measurements*    Measurements_File_Read_Range (MeasurementsFile fp, int fid_begin, int fid_end, int *n); // frames in [fid_begin,fid_end)
 
 SHARED_EXPORT Measurements*    Measurements_Table_From_Filename (const char *filename, char *format, int *n );
+SHARED_EXPORT Measurements*    Measurements_Table_From_Filename_Range (const char *filename, char *format, int fid_begin, int fid_end, int *n );
 SHARED_EXPORT int              Measurements_Table_To_Filename   (const char *filename, char *format, Measurements *table, int n );
 
 #endif //H_WHISKER_IO
@@ -17,5 +17,6 @@ FILE*             open_measurements_v3 ( const char* filename, const char* mode)
 void             close_measurements_v3 ( FILE* file);
 void             write_measurements_v3 ( FILE* file, Measurements *table, int n);
 Measurements*     read_measurements_v3 ( FILE* file, int *n);
+Measurements*     read_measurements_range_v3 ( FILE* file, int fid_begin, int fid_end, int *n);
 
 #endif //H_MEASUREMENTS_IO_V3
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#ifndef H_WHISK_PROFILE
+#define H_WHISK_PROFILE
+/*
+ * Built-in stage timers and counters.
+ *
+ * Probes are compiled into the pipeline but are off until profile_start()
+ * is called.  When off, a probe is a test of one global flag.
+ *
+ * profile_start() takes the paths for a JSON summary and, optionally, a
+ * timeline in the Chrome trace event format (load it in chrome://tracing or
+ * https://ui.perfetto.dev).  Either may be NULL.  The files are written by
+ * profile_stop(), which is also registered to run at exit.
+ *
+ * Stage spans nest.  A stage's time includes any stages nested inside it.
+ * Each thread keeps its own spans and counts; the summary sums them over
+ * threads, so stage seconds are thread-seconds.  Call profile_start() and
+ * profile_stop() while no other thread is recording.
+ */
+#include "compat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _profile_stage_t
+{ PROFILE_DECODE = 0,   // video_get
+  PROFILE_SEED,         // find_segment_seeds
+  PROFILE_TRACE,        // trace_segment_seeds
+  PROFILE_MERGE,        // Remove_Overlapping_Whiskers_One_Frame
+  PROFILE_READ,         // whisker and measurements file reads
+  PROFILE_WRITE,        // whisker and measurements file writes
+  PROFILE_MEASURE,      // Whisker_Segments_Measure
+  PROFILE_CLASSIFY,     // length threshold and labelling by order
+  PROFILE_RECLASSIFY,   // HMM_Reclassify_Watershed
+  PROFILE_NSTAGES
+} profile_stage_t;
+
+typedef enum _profile_counter_t
+{ PROFILE_FRAMES_DECODED = 0,
+  PROFILE_FRAMES_TRACED,
+  PROFILE_SEEDS,
+  PROFILE_SEGMENTS,
+  PROFILE_EVAL_LINE,        // eval_line and eval_line_no_debug calls
+  PROFILE_EVAL_HALF_SPACE,  // eval_half_space calls
+  PROFILE_LINE_ADJUST,      // adjust_line_start iterations
+  PROFILE_BYTES_READ,
+  PROFILE_BYTES_WRITTEN,
+  PROFILE_NCOUNTERS
+} profile_counter_t;
+
+SHARED_EXPORT extern int profile_on;
+
+#define PROFILE_BEGIN(stage)     do{ if(profile_on) profile_begin(stage);     }while(0)
+#define PROFILE_END(stage)       do{ if(profile_on) profile_end(stage);       }while(0)
+#define PROFILE_COUNT(counter,n) do{ if(profile_on) profile_count(counter,n); }while(0)
+
+SHARED_EXPORT int          profile_start       (const char *summary_path, const char *timeline_path); // returns 0 on failure
+SHARED_EXPORT void         profile_stop        (void);
+SHARED_EXPORT void         profile_begin       (profile_stage_t stage);
+SHARED_EXPORT void         profile_end         (profile_stage_t stage);
+SHARED_EXPORT void         profile_count       (profile_counter_t counter, int64_t n);
+
+SHARED_EXPORT const char  *profile_stage_name  (profile_stage_t stage);
+SHARED_EXPORT const char  *profile_counter_name(profile_counter_t counter);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //H_WHISK_PROFILE
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#ifndef H_WHISK_ROI
+#define H_WHISK_ROI
+/*
+ * Region of interest for tracing.
+ *
+ * A region is a bounding box in full-frame pixel coordinates together with a
+ * GREY8 mask covering just that box.  Mask pixels that are nonzero are in the
+ * region.  Rectangles, polygons and per-pixel mask images all reduce to this
+ * form, so they can be intersected with each other.
+ *
+ * Tracing uses a window: the region's box grown by a margin so that detectors
+ * centered near the edge of the region still see real pixels.  The window's
+ * origin is kept on even coordinates so that alternate-line (scan bias)
+ * corrections line up with the full frame.  Frames are decoded to the window
+ * (see video_set_crop()), seeds and traces are restricted to the region's
+ * mask in window coordinates, and results are moved back to full-frame
+ * coordinates with Roi_Translate_Segments().
+ */
+#include "compat.h"
+#include "image_lib.h"
+#include "trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _Roi
+{ int    x, y;            // top left corner of the bounding box (frame pixels)
+  int    width, height;   // size of the bounding box
+  Image *mask;            // GREY8, width x height.  Nonzero pixels are in the region.
+} Roi;
+
+typedef struct _Roi_Window
+{ int    x, y;            // top left corner in frame pixels (even)
+  int    width, height;
+} Roi_Window;
+
+SHARED_EXPORT Roi    *Make_Roi_Rect         (int x, int y, int width, int height);
+SHARED_EXPORT Roi    *Make_Roi_Polygon      (float *xy, int npoints);     // xy holds npoints (x,y) pairs
+SHARED_EXPORT Roi    *Make_Roi_From_Mask    (Image *mask);                // nonzero pixels of a full-frame GREY8 image
+SHARED_EXPORT Roi    *Read_Roi_Mask         (char *filename);             // NULL on failure
+SHARED_EXPORT Roi    *Roi_Parse             (char *spec);                 // "x,y,w,h" or "x0,y0,x1,y1,x2,y2[,...]".  NULL on failure.
+SHARED_EXPORT void    Free_Roi              (Roi *self);
+
+SHARED_EXPORT Roi    *Roi_Intersect         (Roi *a, Roi *b);             // returns a new region, NULL if empty
+SHARED_EXPORT Roi    *Roi_Clip              (Roi *self, int width, int height); // frees self. Returns a new region, NULL if empty
+SHARED_EXPORT int     Roi_Area              (Roi *self);                  // number of pixels in the region
+
+SHARED_EXPORT void    Roi_Get_Window        (Roi *self, int margin, int frame_width, int frame_height, Roi_Window *window);
+SHARED_EXPORT Image  *Roi_Window_Mask       (Roi *self, Roi_Window *window); // GREY8 window-sized mask.  Caller frees.
+SHARED_EXPORT void    Roi_Translate_Segments(Whisker_Seg *wv, int n, Roi_Window *window); // window to frame coordinates
+
+#ifdef __cplusplus
+}
+#endif
+#endif //H_WHISK_ROI
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#ifndef H_WHISK_TEST_FIXTURES
+#define H_WHISK_TEST_FIXTURES
+/*
+ * Fixtures shared by the in-file tests (the TEST_* blocks).  Not part of the
+ * library.  Include only from inside a test block.
+ *
+ * The synthetic movies have TEST_NFRAMES frames.  Frame f has
+ * TEST_ROWS_IN_FRAME(f) whiskers, so frames 1, 5, 9,... are empty.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "utilities.h"
+
+#define TEST_NFRAMES          20
+#define TEST_ROWS_IN_FRAME(f) ((7*(f)+1)%4)
+
+// Returns the file's contents and its size in *n.  NULL on failure.
+static char *_test_read_file( const char *name, long *n )
+{ FILE *fp = fopen( name, "rb" );
+  char *buf;
+  if( !fp )
+    return NULL;
+  fseek( fp, 0, SEEK_END );
+  *n = ftell( fp );
+  fseek( fp, 0, SEEK_SET );
+  buf = (char*) Guarded_Malloc( *n+1, "test" );
+  if( fread( buf, 1, *n, fp )!=(size_t)*n )
+  { free(buf);
+    buf = NULL;
+  }
+  fclose( fp );
+  return buf;
+}
+
+// Keeps the first `n` bytes of the file.
+static int _test_truncate_file( const char *name, long n )
+{ long size;
+  char *buf = _test_read_file(name,&size);
+  FILE *fp;
+  int ok;
+  if( !buf || n<0 || n>size || !(fp = fopen(name,"wb")) )
+  { if(buf) free(buf);
+    return 0;
+  }
+  ok = fwrite( buf, 1, n, fp )==(size_t)n;
+  fclose( fp );
+  free( buf );
+  return ok;
+}
+
+static long _test_file_size( const char *name )
+{ FILE *fp = fopen( name, "rb" );
+  long n = -1;
+  if( !fp )
+    return -1;
+  if( fseek( fp, 0, SEEK_END )==0 )
+    n = ftell( fp );
+  fclose( fp );
+  return n;
+}
+
+#endif //H_WHISK_TEST_FIXTURES
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#ifndef H_WHISK_THREAD
+#define H_WHISK_THREAD
+/*
+ * Minimal portable threading layer (pthreads or Win32).
+ *
+ * Most of the tracing code keeps its scratch buffers in function statics and
+ * is therefore NOT reentrant.  Only call code from a worker thread that is
+ * documented as safe to do so.  find_segments() and
+ * Remove_Overlapping_Whiskers_One_Frame() keep their scratch in THREAD_LOCAL
+ * statics and may run on several threads at once, provided the detector banks
+ * have been loaded first (see load_detector_banks() in trace.h).  So do the
+ * component tree and contour routines used for seeding and bar location, and
+ * Compute_Bar_Location_r() with one Bar_Locator per thread.
+ *
+ * The number of workers used by default is the number of online processors.
+ * It can be overridden by setting the WHISK_THREADS environment variable.
+ */
+#include "compat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _thread_t    thread_t;
+typedef struct _mutex_t     mutex_t;
+typedef struct _condition_t condition_t;
+
+typedef void* (*pf_thread_main)   (void *arg);
+typedef void  (*pf_parallel_body) (void *ctx, int i);
+
+SHARED_EXPORT thread_t    *thread_create       (pf_thread_main fn, void *arg);
+SHARED_EXPORT void        *thread_join         (thread_t **self);
+
+SHARED_EXPORT mutex_t     *mutex_create        (void);
+SHARED_EXPORT void         mutex_destroy       (mutex_t **self);
+SHARED_EXPORT void         mutex_lock          (mutex_t *self);
+SHARED_EXPORT void         mutex_unlock        (mutex_t *self);
+SHARED_EXPORT mutex_t     *mutex_lazy_create   (mutex_t **self); // creates *self once, safe to race. Use for statics.
+
+SHARED_EXPORT condition_t *condition_create    (void);
+SHARED_EXPORT void         condition_destroy   (condition_t **self);
+SHARED_EXPORT void         condition_wait      (condition_t *self, mutex_t *lock);
+SHARED_EXPORT void         condition_signal    (condition_t *self);
+SHARED_EXPORT void         condition_broadcast (condition_t *self);
+
+SHARED_EXPORT int          thread_count        (void);
+
+// Seconds from an arbitrary origin.  Monotonic.  Use differences for timing;
+// clock() counts cpu time summed over all threads.
+SHARED_EXPORT double       wall_clock          (void);
+
+// Calls body(ctx,i) for i in [0,n) using up to nthreads workers.
+// Indexes are handed out dynamically, one at a time, so bodies may vary in
+// cost.  If nthreads<=0, thread_count() is used.  Runs serially when
+// nthreads==1 or n<2.  Returns after every body has returned.  Calls made
+// from inside a body run serially.  The worker threads are kept and reused
+// by later calls, so per-thread scratch on them lives as long as the process.
+// A call made while another thread's call is running runs serially.
+SHARED_EXPORT void         parallel_for        (int n, int nthreads, pf_parallel_body body, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //H_WHISK_THREAD
@@ -83,9 +83,34 @@ typedef struct _Whisker_Seg       //
 
  SHARED_EXPORT  Array *get_line_detector_bank   (Range *off, Range *wid, Range *ang);
  SHARED_EXPORT  int    read_line_detector_bank  (char *filename, Array **bank, Range *off, Range *wid, Range *ang );
+ SHARED_EXPORT  int    load_detector_banks      (void); // Loads the shared banks.  Call before tracing on more than one thread.
+
+ typedef struct _Hat_Filter Hat_Filter; // Mexican-hat filter with reusable buffers.  Used for SEED_ON_MHAT_CONTOURS.
+ SHARED_EXPORT  Hat_Filter   *Make_Hat_Filter               (double sigma);
+ SHARED_EXPORT  void          Free_Hat_Filter               (Hat_Filter *self);
+ SHARED_EXPORT  Image        *Hat_Filter_Apply              (Hat_Filter *self, Image *image); // GREY8 only.  NULL for other kinds.
 
  SHARED_EXPORT  Whisker_Seg  *find_segments                 (int iFrame, Image *image, Image *bg, int *nseg );
+
+ // find_segments in two steps.
+ //   find_segment_seeds  scores candidate seeds (per SEED_METHOD) and
+ //                       returns them sorted by increasing score.  Returns
+ //                       a per-thread buffer that is reused by the next call.
+ //   trace_segment_seeds traces from the seeds, highest score first,
+ //                       skipping seeds covered by an earlier trace.
+ // Either may be given a GREY8 mask the size of the image (or NULL).  Seeds
+ // are only taken, and traces only extend, over nonzero mask pixels.
+ typedef struct _Seed_Candidate
+ { Seed  seed;        // start point and direction for trace_whisker
+   int   idx;         // pixel index of the seed
+   float score;       // eval_line response at the seed
+ } Seed_Candidate;
+ SHARED_EXPORT  Seed_Candidate *find_segment_seeds          (Image *image, Image *mask, int *nseeds );
+ SHARED_EXPORT  Whisker_Seg  *trace_segment_seeds           (int iFrame, Image *image, Image *mask, Seed_Candidate *seeds, int nseeds, int *nseg );
  SHARED_EXPORT  Image        *compute_background            (Stack *movie);
+
+ typedef Image* (*pf_background_fetch)(void *ctx, int iframe); // returned image is freed by the caller of fetch
+ SHARED_EXPORT  Image        *compute_background_streaming  (pf_background_fetch fetch, void *ctx, int nframes, int nsamples);
  SHARED_EXPORT  Zone         *compute_zone                  (Stack *movie);
  SHARED_EXPORT  float         eval_line                     (Line_Params *line, Image *image, int p);
 
@@ -95,6 +120,18 @@ typedef struct _Whisker_Seg       //
  SHARED_EXPORT  int           adjust_line_start             (Line_Params *line, Image *image, int *pp,
                                                              Interval *roff, Interval *rang, Interval *rwid);
 
+ // Thresholds behind is_local_area_trusted() and is_local_area_trusted_conservative().
+ // By default they are computed from the first image traced on a thread and
+ // kept until a different image array comes along.  Pinning fixes them for
+ // the calling thread instead.  Pass NULL to go back to the default.
+ typedef struct _Local_Area_Thresholds
+ { float thresh;
+   float conservative;
+ } Local_Area_Thresholds;
+ SHARED_EXPORT  void          compute_local_area_thresholds (Image *image, Local_Area_Thresholds *out);
+ SHARED_EXPORT  void          pin_local_area_thresholds     (Local_Area_Thresholds *t);
+
  SHARED_EXPORT  Whisker_Seg  *trace_whisker                 (Seed *s, Image *image);
+ SHARED_EXPORT  Whisker_Seg  *trace_whisker_in_mask         (Seed *s, Image *image, Image *mask); // stops where mask is zero.  mask may be NULL.
 
 #endif
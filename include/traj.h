@@ -13,6 +13,7 @@
 
 #include "compat.h"
 #include <stdio.h>
+#include <limits.h>
 
 typedef struct _Measurements
 { int row;           // offset from head of data buffer ... Note: the type limits size of table
@@ -40,6 +41,7 @@ typedef struct _Distributions
   double *bin_min;    // array of n_measures elements
   double *bin_delta;  // array of n_measures elements
   double *data;       // array of holding histogram information with dimensions (n_bins,n_measures,n_states)
+  double *by_state;   // NULL, or a copy of data with dimensions (n_states,n_bins,n_measures).  See Distributions_Index_States.
 } Distributions;
 
 SHARED_EXPORT Measurements  *Alloc_Measurements_Table                          ( int n_rows, int n_measurements );
@@ -93,6 +95,27 @@ SHARED_EXPORT void Measurements_Table_Select_Velocities_By_State( Measurements *
 // `data` should be the appropriate size. See `Measurements_Table_Size_Select_Velocities`
 SHARED_EXPORT void Measurements_Table_Select_Shape_By_State( Measurements *table, int n_rows, int state, double *data );
 
+// Shape data for all rows is one contiguous (n_rows,n) row-major block,
+// followed immediately by the (n_rows,n) velocity block.  Table row i is
+// stored at row table[i].row of each block.
+SHARED_EXPORT double *Measurements_Table_Data_Block( Measurements *table );
+SHARED_EXPORT double *Measurements_Table_Velocity_Block( Measurements *table, int n_rows );
+
+// Reorders the storage blocks in place so that table row i is stored at row i.
+// Call after sorting to get views of the blocks in table order.
+SHARED_EXPORT void Measurements_Table_Pack( Measurements *table, int n_rows );
+
+// Copies the integer columns in table order.  Any destination may be NULL.
+SHARED_EXPORT void Measurements_Table_Copy_Ids( Measurements *table, int n_rows, int *state, int *fid, int *wid, int *valid_velocity );
+
+SHARED_EXPORT void Measurements_Table_Set_States( Measurements *table, int n_rows, int *state );
+
+#define MEASUREMENTS_ANY_STATE (INT_MIN)
+// Writes the table index of every row with the queried state (or any state
+// for MEASUREMENTS_ANY_STATE) and fid in [fid_begin,fid_end) to `index`.
+// Returns the number of matches.  `index` may be NULL to just count.
+SHARED_EXPORT int Measurements_Table_Select( Measurements *table, int n_rows, int state, int fid_begin, int fid_end, int *index );
+
 SHARED_EXPORT void Enumerate_Measurements_Table( Measurements *table, int nrows );
 
 SHARED_EXPORT void Sort_Measurements_Table_State_Time( Measurements *table, int nrows );
@@ -133,8 +156,36 @@ SHARED_EXPORT double Eval_Likelihood_Log2( Distributions *dist, double *vec, int
 // prev and next must be arrays of length dist->n_measures
 // Assumes distributions encodes densities as log2 probability
 // Distributions should be functions of the differences between next and prev
+// Reentrant.
 SHARED_EXPORT double Eval_Velocity_Likelihood_Log2( Distributions *dist, double *prev, double *next, int istate );
 
+// Pre-binned queries
+//
+// Eval_Likelihood_Log2 finds the bin of each measurement every time it's
+// called.  When a row is scored more than once (against several states, or
+// along several paths) find the bins once and use the binned versions.
+// These give the same results as the unbinned versions.
+//
+// bins must be an array of length dist->n_measures.  For a table, bins is
+// n_rows x n_measures with the measures for a row contiguous.
+SHARED_EXPORT void   Distributions_Bin_Values   ( Distributions *dist, double *vec, int *bins );
+SHARED_EXPORT void   Distributions_Bin_Velocity ( Distributions *dist, double *prev, double *next, int *bins );
+SHARED_EXPORT void   Distributions_Bin_Table    ( Distributions *dist, Measurements *table, int n_rows, int *bins );
+SHARED_EXPORT double Eval_Binned_Likelihood_Log2( Distributions *dist, int *bins, int istate );
+
+// Builds dist->by_state, a copy of the histograms where the states for a
+// (measure,bin) are contiguous.  Scoring a row against every state is then
+// one unit-stride pass per measure.  Call after the histograms are final.
+// Dilate, Normalize and Apply_Log2 discard the copy.
+SHARED_EXPORT void   Distributions_Index_States ( Distributions *dist );
+
+// log2p must be an array of length dist->n_states.  Uses dist->by_state if
+// it has been built.
+SHARED_EXPORT void   Eval_Binned_Likelihood_Log2_All_States( Distributions *dist, int *bins, double *log2p );
+SHARED_EXPORT void   Eval_Likelihood_Log2_All_States       ( Distributions *dist, double *vec, double *log2p );
+// log2p must be n_rows x dist->n_states.  Each row is binned once.
+SHARED_EXPORT void   Eval_Table_Likelihood_Log2_All_States ( Distributions *dist, Measurements *table, int n_rows, double *log2p );
+
 // sorted_table must be sorted in ascending time order (i.e. ascending fid)
 // Start and end should have the same `state` property.
 // Algorithm here is to just take the transition with maximum liklihood at 
@@ -166,4 +217,55 @@ SHARED_EXPORT Measurements **Find_Path( Measurements *sorted_table,
 // observations on either side of the gray area.
 SHARED_EXPORT void Solve( Measurements *table, int n_rows, int n_shape_bins, int n_vel_bins );
 
+// Labelling (classify.c)
+//
+// Label_By_Threshold sets state to 1 where the measure in `col` is above
+// (is_gt) or at/below the threshold, and to 0 elsewhere.  The _And/_Or
+// variants combine with the existing state.
+//
+// The threshold estimates scan [low,high) in unit steps for the threshold
+// that makes the most frames agree on a segment count.  The table must be
+// sorted by time.  They overwrite state.
+//
+// Label_By_Order assigns identities 0..target_count-1 by position along the
+// face in frames with exactly target_count rows with state==1.  Other rows
+// get state -1.  Resorts the table.
+//
+// Classify runs the whole `classify` step: a follicle position threshold, a
+// length threshold and Label_By_Order.  Give the face as a hint ("top",
+// "left", "bottom", "right") or, with face==NULL, as a point and axis.
+// Thresholds are in pixels.  If count < 1 the number of whiskers is
+// estimated.  Returns the count used.
+SHARED_EXPORT void   Measurements_Table_Label_By_Threshold                    ( Measurements *table, int n_rows, int col, double threshold, int is_gt );
+SHARED_EXPORT void   Measurements_Table_Label_By_Threshold_And                ( Measurements *table, int n_rows, int col, double threshold, int is_gt );
+SHARED_EXPORT void   Measurements_Table_Label_By_Threshold_Or                 ( Measurements *table, int n_rows, int col, double threshold, int is_gt );
+SHARED_EXPORT double Measurements_Table_Estimate_Best_Threshold               ( Measurements *table, int n_rows, int column, double low, double high, int is_gt, int *target_count );
+SHARED_EXPORT double Measurements_Table_Estimate_Best_Threshold_For_Known_Count( Measurements *table, int n_rows, int column, double low, double high, int is_gt, int target_count );
+SHARED_EXPORT void   Measurements_Table_Label_By_Order                        ( Measurements *table, int n_rows, int target_count );
+SHARED_EXPORT int    Measurements_Table_Classify                              ( Measurements *table, int n_rows, char *face, int face_x, int face_y, char axis, int follicle, double low_px, double high_px, int count );
+
+// Comparing identities (report.c)
+//
+// Finds frames where two labelings of the same movie disagree.  Identities in
+// A are mapped to identities in B by majority vote over all frames, then each
+// frame is checked against that map.  Junk states in A are ignored, so the
+// diff is not symmetric.
+//
+// Both tables are re-sorted.  Work is split by frame range across
+// thread_count() workers.  Frames whose rows are identical in both tables
+// skip the likelihood search.
+//
+// Measurements_Tables_Stream_Diff_Frames calls emit(ctx,fid) for each
+// mismatched frame as soon as every frame before it has been checked.  Frames
+// arrive in ascending order.  emit may be called from a worker thread, but
+// never concurrently.  Returns the number of mismatched frames.
+//
+// Measurements_Tables_Get_Diff_Frames returns the mismatched frames in
+// ascending order.  Release the result with Measurements_Tables_Free_Diff_Frames.
+typedef void (*pf_diff_frame)( void *ctx, int fid );
+
+SHARED_EXPORT int  Measurements_Tables_Stream_Diff_Frames( Measurements *A, int nA, Measurements *B, int nB, pf_diff_frame emit, void *ctx );
+SHARED_EXPORT int *Measurements_Tables_Get_Diff_Frames   ( Measurements *A, int nA, Measurements *B, int nB, int *nframes );
+SHARED_EXPORT void Measurements_Tables_Free_Diff_Frames  ( int *frames );
+
 #endif//H_TRAJ
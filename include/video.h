@@ -11,6 +11,7 @@ void         video_close         (video_t **self);
 unsigned int video_frame_count   (video_t  *self);
 void         video_compute_stats (video_t  *self, int at_most_nframes);
 Image       *video_get           (video_t  *self, unsigned int iframe, int apply_line_bias_correction);
+int          video_set_crop      (video_t  *self, int x, int y, int width, int height); // width or height <= 0 for full frames
 
 int          is_video            (const char *path); 
 
@@ -11,14 +11,44 @@
 
 typedef void*          WhiskerFile;
 
+/* Flat (ragged array) representation of a whisker segment vector.
+ *
+ * Segment i has frame id fid[i], segment id wid[i] and owns points
+ * offset[i] through offset[i+1]-1 of the x, y, thick and scores arrays.
+ * There are n+1 offsets; offset[n] == npoints.
+ *
+ * This is meant for bulk transfer to array based environments like numpy.
+ * Each column is one contiguous block, so there's no per-segment allocation.
+ */
+typedef struct _Whisker_Seg_Flat
+{ int      n;
+  int64_t  npoints;
+  int     *fid;
+  int     *wid;
+  int64_t *offset;
+  float   *x;
+  float   *y;
+  float   *thick;
+  float   *scores;
+} Whisker_Seg_Flat;
+
 SHARED_EXPORT int           Whisker_File_Autodetect      (const char * filename, char** format );
 SHARED_EXPORT WhiskerFile   Whisker_File_Open            (const char* filename, char* format, const char* mode );
-SHARED_EXPORT void          Whisker_File_Close           (WhiskerFile wf);
+SHARED_EXPORT WhiskerFile   Whisker_File_Resume          (const char* filename, int *next_fid );             // reopen a partly written file for appending
+SHARED_EXPORT int           Whisker_File_Async           (WhiskerFile wf, size_t block_bytes );             // write appended frames in large blocks from a separate thread
+SHARED_EXPORT int           Whisker_File_Close           (WhiskerFile wf);
 SHARED_EXPORT void          Whisker_File_Append_Segments (WhiskerFile wf, Whisker_Seg *w, int n);
 SHARED_EXPORT void          Whisker_File_Write_Segments  (WhiskerFile wf, Whisker_Seg *w, int n);
 SHARED_EXPORT Whisker_Seg*  Whisker_File_Read_Segments   (WhiskerFile wf, int *n);
+SHARED_EXPORT int           Whisker_File_Read_Segment    (WhiskerFile wf, Whisker_Seg *w);
+SHARED_EXPORT Whisker_Seg*  Whisker_File_Read_Segments_Range (WhiskerFile wf, int fid_begin, int fid_end, int *n); // frames in [fid_begin,fid_end)
 
 SHARED_EXPORT Whisker_Seg  *Load_Whiskers                (const char *filename, char *format, int *n );
+SHARED_EXPORT Whisker_Seg  *Load_Whiskers_Range          (const char *filename, char *format, int fid_begin, int fid_end, int *n );
 SHARED_EXPORT int           Save_Whiskers                (const char *filename, char *format, Whisker_Seg *w, int n );
 
+SHARED_EXPORT int           Load_Whiskers_Flat           (const char *filename, char *format, Whisker_Seg_Flat *out );
+SHARED_EXPORT int           Save_Whiskers_Flat           (const char *filename, char *format, Whisker_Seg_Flat *in );
+SHARED_EXPORT void          Free_Whisker_Seg_Flat_Data   (Whisker_Seg_Flat *w);
+
 #endif //H_WHISKER_IO
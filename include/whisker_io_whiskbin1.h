@@ -14,6 +14,12 @@ int            is_file_whiskbin1         ( const char* filename);
 FILE          *open_whiskbin1            ( const char* filename, const char* mode);
 void           close_whiskbin1           ( FILE* fp);
 void           append_segments_whiskbin1 ( FILE *fp, Whisker_Seg *wv, int n );
+int            peek_whiskbin1_footer     ( FILE *file );
+size_t         pack_segments_whiskbin1   ( char *buf, Whisker_Seg *wv, int n );
+size_t         pack_whiskbin1_footer     ( char *buf, int nwhiskers );
 Whisker_Seg   *read_segments_whiskbin1   ( FILE *file, int *n);
+int            read_segment_whiskbin1    ( FILE *file, Whisker_Seg *w);
+int            skip_segment_whiskbin1    ( FILE *file, Whisker_Seg *w);
+FILE          *resume_whiskbin1          ( const char* filename, int *next_fid );
 
 #endif //H_WHISKER_IO_WHISKER1
@@ -15,5 +15,6 @@ FILE          *open_whisk1            ( const char* filename, const char* mode);
 void           close_whisk1           ( FILE* fp);
 void           append_segments_whisk1 ( FILE *fp, Whisker_Seg *wv, int n );
 Whisker_Seg   *read_segments_whisker1 ( FILE *file, int *n);
+int            read_segment_whisker1  ( FILE *file, Whisker_Seg *w);
 
 #endif //H_WHISKER_IO_WHISKER1
@@ -17,5 +17,7 @@ FILE          *open_whiskpoly1            ( const char* filename, const char* mo
 void           close_whiskpoly1           ( FILE* fp);
 void           append_segments_whiskpoly1 ( FILE *fp, Whisker_Seg *wv, int n );
 Whisker_Seg   *read_segments_whiskpoly1   ( FILE *file, int *n);
+int            read_segment_whiskpoly1    ( FILE *file, Whisker_Seg *w);
+int            skip_segment_whiskpoly1    ( FILE *file, Whisker_Seg *w);
 
 #endif //H_WHISKER_IO_WHISKPOLY1
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#ifndef H_WHISK_WHISKER_MATCH
+#define H_WHISK_WHISKER_MATCH
+/*
+ * Frame-to-frame whisker matching.
+ *
+ * Each segment is summarized once by its bounding box, its centroid and a
+ * polyline resampled to WHISKER_MATCH_NSAMPLES points evenly spaced along its
+ * arc length.  The distance between two segments is the mean distance between
+ * corresponding samples, taking the better of the two end-to-end orientations.
+ *
+ * Pairs farther apart than a radius are pruned before any distance is
+ * computed.  Two exact bounds are used.  A gap between bounding boxes, or the
+ * distance between centroids, can never exceed the sample distance.  So no
+ * pair within the radius is lost.
+ *
+ * Unlike the area-based distances in distance.c, segments are compared end
+ * to end.  A short fragment is far from the full whisker it came from.
+ */
+#include "compat.h"
+#include "trace.h"
+
+#define WHISKER_MATCH_NSAMPLES 16
+
+typedef struct _Whisker_Shapes Whisker_Shapes;
+
+typedef struct _Whisker_Distance_Matrix
+{ int    nrows,   // segments in the first set
+         ncols,   // segments in the second set
+         nnz;     // number of pairs kept
+  int   *rowptr;  // nrows+1 offsets.  Row i is [rowptr[i],rowptr[i+1])
+  int   *col;     // nnz column indexes, ascending within a row
+  float *dist;    // nnz distances
+} Whisker_Distance_Matrix;
+
+SHARED_EXPORT Whisker_Shapes          *Make_Whisker_Shapes            ( Whisker_Seg *wv, int n );
+SHARED_EXPORT void                     Free_Whisker_Shapes            ( Whisker_Shapes *self );
+SHARED_EXPORT int                      Whisker_Shapes_Count           ( Whisker_Shapes *self );
+
+// Distance between segment i of a and segment j of b.
+SHARED_EXPORT float                    Whisker_Shapes_Distance        ( Whisker_Shapes *a, int i, Whisker_Shapes *b, int j );
+
+// Keeps only the pairs with distance <= radius.  Returns NULL on failure.
+SHARED_EXPORT Whisker_Distance_Matrix *Whisker_Distance_Matrix_Pruned ( Whisker_Shapes *a, Whisker_Shapes *b, float radius );
+SHARED_EXPORT void                     Free_Whisker_Distance_Matrix   ( Whisker_Distance_Matrix *self );
+
+// Matches segments in a to segments in b so the total distance is minimal.
+// A segment farther than radius from every free partner is left unmatched.
+// On return, assignment[i] is the index into b matched to a's segment i, or
+// -1.  *cost, if not NULL, gets the total cost.  Each unmatched segment
+// counts as radius.  Returns the number of matched segments, or -1 on
+// failure.
+SHARED_EXPORT int                      Whisker_Match_Frames           ( Whisker_Shapes *a, Whisker_Shapes *b, float radius, int *assignment, double *cost );
+
+#endif //H_WHISK_WHISKER_MATCH
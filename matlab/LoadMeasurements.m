@@ -1,11 +1,21 @@
-function measurements = LoadMeasurements(filename)
+function varargout = LoadMeasurements(filename,varargin)
 %LoadMeasurements     Reads .measurements files.
 %
 %   USAGE:
 %
-%   measurements = LoadMeasurements(filename)
+%   measurements    = LoadMeasurements(filename)
+%   measurements    = LoadMeasurements(filename,frames)
+%   measurements    = LoadMeasurements(filename,frames,fields)
+%   [table,names]   = LoadMeasurements(filename,frames,fields,'matrix')
 %
 %   <filename>     is the path to a .measurements file.
+%   <frames>       is [first last].  Only rows on those frames (inclusive) are loaded.
+%                  Use [] for all frames.
+%   <fields>       is a cell array of field names (see below) selecting and ordering
+%                  the fields to load.  Use [] for all fields.
+%   <table>        in 'matrix' mode, a double matrix with one row per segment and
+%                  one column per field.
+%   <names>        in 'matrix' mode, a cell array with the name of each column.
 %   <measurements> is a struct array with the following fields:
 %
 %    fid           - Video frame where the segment was found
@@ -44,6 +54,8 @@ function measurements = LoadMeasurements(filename)
 %       tip_x
 %       tip_y 
 %
+%   >> [m,names] = LoadMeasurements('whisker_data_0250.measurements',[1000 1500],{'fid','label','angle'},'matrix');
+%
 %  Author: Nathan Clack <clackn@janelia.hhmi.org>
 %  Copyright 2010 Howard Hughes Medical Institute.
 %  All rights reserved.
@@ -53,7 +65,7 @@ function measurements = LoadMeasurements(filename)
 
 [s,attr,id] = fileattrib(filename); % get abs path
 if(s)
-  measurements = mexLoadMeasurements(attr.Name);
+  [varargout{1:max(nargout,1)}] = mexLoadMeasurements(attr.Name,varargin{:});
 else
   error(attr)
 end
@@ -1,13 +1,24 @@
-function [whiskers,format] = LoadWhiskers(filename)
+function varargout = LoadWhiskers(filename,varargin)
 %LoadWhiskers     Reads .whisker files.
 %
 %   USAGE:
 %
 %   whiskers          = LoadWhiskers(filename)
 %   [whiskers,format] = LoadWhiskers(filename)
+%   whiskers          = LoadWhiskers(filename,frames)
+%   whiskers          = LoadWhiskers(filename,frames,fields)
+%   [ids,points,format] = LoadWhiskers(filename,frames,fields,'matrix')
 %
 %   <whiskers> is a struct array with a number of fields describing the shape of traced whisker-like segments.
 %   <format>   is a string describing how the whisker data is stored.
+%   <frames>   is [first last].  Only segments on those frames (inclusive) are loaded.
+%              Use [] for all frames.
+%   <fields>   is a cell array with some of 'id','time','x','y','thick','scores'.
+%              Use [] for all fields.
+%   <ids>      in 'matrix' mode, an int32 matrix with one row per segment and one
+%              column for each requested 'id' or 'time' field.
+%   <points>   in 'matrix' mode, a struct with a cell array of point data (one
+%              cell per segment) for each requested point field.
 %
 %   EXAMPLES:
 %
@@ -23,6 +34,8 @@ function [whiskers,format] = LoadWhiskers(filename)
 %         thick                                                                           
 %         scores                                                                          
 %
+%     >> [ids,pts] = LoadWhiskers('whisker_data_0250.whiskers',[1000 1500],{'time','id','x','y'},'matrix');
+%
 %   If the file doesn't exist or something goes wrong, you'll get a bunch of warnings:
 %
 %     >> LoadWhiskers('does-not-exist.whiskers')                                                              
@@ -37,7 +50,7 @@ function [whiskers,format] = LoadWhiskers(filename)
 
 [s,attr,id] = fileattrib(filename); % get abs path
 if(s)
-  [whiskers,format] = mexLoadWhiskers(attr.Name);
+  [varargout{1:max(nargout,1)}] = mexLoadWhiskers(attr.Name,varargin{:});
 else
   error(attr)
 end
@@ -28,6 +28,14 @@
  *  Calling from Matlab console:
  *
  *    table = LoadMeasurements('path/to/file.measurements'); 
+ *    table = LoadMeasurements('path/to/file.measurements',[first last]); 
+ *    table = LoadMeasurements('path/to/file.measurements',[first last],{'fid','wid','angle'}); 
+ *    [M,names] = LoadMeasurements('path/to/file.measurements',[],{'fid','angle'},'matrix'); 
+ *
+ *  The optional frame range is inclusive and the optional cell array selects
+ *  and orders fields.  Pass [] for either to get everything.  In 'matrix'
+ *  mode a single double matrix with one column per field is returned along
+ *  with the field names.
  *
  *  Returned `table` is a `struct array` with the following fields:
  *    
@@ -68,31 +76,10 @@ Error:
   mexPrintf("%s(%d): Something went wrong trying to print an error message.\n",__FILE__,__LINE__);
 }
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{ size_t len;
-  char *filename;
-  Measurements *table;
-  int nrows;
-
-  set_reporter(mxreport);
+#include <limits.h>
+#include <string.h>
 
-  mxassert(nrhs==1           , "One input required.");
-  mxassert(nlhs<=1           , "Too many output arguments.");
-  mxassert(mxIsChar(prhs[0]) , "Input must be a string.");
-
-  len = mxGetM(prhs[0])*mxGetN(prhs[0])+1;
-  mxassert(
-      filename=mxArrayToString(prhs[0]),
-      "Could not convert input to string.");
-
-  mxassert(
-      table=Measurements_Table_From_Filename(filename,NULL,&nrows),
-      "Could not read Measurements file.");
-
-  if(nlhs==0)
-    goto Done;
-  
-  { const char *fields[] = {
+static const char *Fields[] = {
                             "fid",
                             "wid",
                             "label",
@@ -107,94 +94,149 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                             "tip_x",
                             "tip_y"
                            };
+#define NFIELDS (sizeof(Fields)/sizeof(char*))
+#define NINTFIELDS 5 // the first 5 fields are int32 in struct mode
+
+static double field_value(Measurements *row, int ifield)
+{ switch(ifield)
+  { case 0: return row->fid;
+    case 1: return row->wid;
+    case 2: return row->state;
+    case 3: return row->face_x;
+    case 4: return row->face_y;
+    default: return row->data[ifield-NINTFIELDS]; //see end of measure.c:Whisker_Segments_Measure for column assignments
+  }
+}
+
+/* frames = [first last], inclusive.  Missing or empty means all frames. */
+static int get_frames(int nrhs, const mxArray *prhs[], int *begin, int *end)
+{ const mxArray *arg = (nrhs>1)?prhs[1]:NULL;
+  *begin = INT_MIN;
+  *end   = INT_MAX;
+  if(!arg || mxIsEmpty(arg))
+    return 0;
+  mxassert(mxIsDouble(arg) && mxGetNumberOfElements(arg)==2, "Frame range must be given as [first last].");
+  *begin = (int) mxGetPr(arg)[0];
+  *end   = (int) mxGetPr(arg)[1] + 1;
+  return 1;
+}
+
+/* fields = cell array of field names.  Missing or empty means all fields.
+ * Fills sel with field indexes in the requested order and returns the count.
+ */
+static int get_fields(int nrhs, const mxArray *prhs[], int *sel)
+{ const mxArray *arg = (nrhs>2)?prhs[2]:NULL;
+  int i,j,n;
+  if(!arg || mxIsEmpty(arg))
+  { for(i=0;i<NFIELDS;++i)
+      sel[i]=i;
+    return NFIELDS;
+  }
+  mxassert(mxIsCell(arg) && (n=(int)mxGetNumberOfElements(arg))<=NFIELDS,
+           "Fields must be given as a cell array of field names.");
+  for(i=0;i<n;++i)
+  { char *name = mxArrayToString(mxGetCell(arg,i));
+    mxassert(name,"Fields must be given as a cell array of field names.");
+    for(j=0;j<NFIELDS;++j)
+      if(strcmp(name,Fields[j])==0)
+        break;
+    if(j==NFIELDS)
+    { mexPrintf("Unknown field: %s\n",name);
+      mxFree(name);
+      mxerror("Unknown field name.  See help LoadMeasurements.");
+    }
+    mxFree(name);
+    sel[i]=j;
+  }
+  return n;
+}
+
+static int is_matrix_mode(int nrhs, const mxArray *prhs[])
+{ char *mode;
+  int ok;
+  if(nrhs<4)
+    return 0;
+  mxassert(mode=mxArrayToString(prhs[3]),"Output mode must be a string.");
+  ok = strcmp(mode,"matrix")==0;
+  mxFree(mode);
+  mxassert(ok,"The only output mode option is 'matrix'.");
+  return 1;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{ char *filename;
+  Measurements *table;
+  int nrows,nsel,matrix,ranged,begin,end;
+  int sel[NFIELDS];
+
+  set_reporter(mxreport);
+
+  mxassert(nrhs>=1 && nrhs<=4, "One to four inputs required.");
+  mxassert(mxIsChar(prhs[0])  , "Input must be a string.");
+  ranged = get_frames(nrhs,prhs,&begin,&end);
+  nsel   = get_fields(nrhs,prhs,sel);
+  matrix = is_matrix_mode(nrhs,prhs);
+  mxassert(nlhs<=(matrix?2:1) , "Too many output arguments.");
+
+  mxassert(
+      filename=mxArrayToString(prhs[0]),
+      "Could not convert input to string.");
+
+  if(ranged)
+    table=Measurements_Table_From_Filename_Range(filename,NULL,begin,end,&nrows);
+  else
+    table=Measurements_Table_From_Filename(filename,NULL,&nrows);
+  mxassert(table, "Could not read Measurements file.");
+
+  if(nlhs==0)
+    goto Done;
+
+  if(matrix)
+  { int i,j;
+    double *d;
+    if(!(plhs[0] = mxCreateDoubleMatrix(nrows,nsel,mxREAL)))
+      goto AllocStructArrayException;
+    d = mxGetPr(plhs[0]);
+    for(j=0;j<nsel;++j)
+      for(i=0;i<nrows;++i)
+        *d++ = field_value(table+i,sel[j]); // column major
+    if(nlhs>1)
+    { if(!(plhs[1] = mxCreateCellMatrix(1,nsel)))
+        goto AllocStructArrayException;
+      for(j=0;j<nsel;++j)
+        mxSetCell(plhs[1],j,mxCreateString(Fields[sel[j]]));
+    }
+    goto Done;
+  }
+  
+  { const char *names[NFIELDS];
+    int j;
+    for(j=0;j<nsel;++j)
+      names[j] = Fields[sel[j]];
     plhs[0] = mxCreateStructMatrix(
               nrows
             , 1
-            , sizeof(fields)/sizeof(char*)
-            , fields);
+            , nsel
+            , names);
     if(!plhs[0])
       goto AllocStructArrayException;
 
   }
-  { int i;
+  { int i,j;
     for(i=0;i<nrows;++i)
-    { mxArray *fid,*wid,*label,*face_x,*face_y,*length,*score,*angle,*curvature,*follicle_x,*follicle_y,*tip_x,*tip_y;
-      int *pfid,*pwid,*plabel,*pface_x,*pface_y;
-      double *plength,*pscore,*pangle, *pcurvature,*pfollicle_x,*pfollicle_y, *ptip_x, *ptip_y;
-      int n;
-      
-      n = table[i].n;
-      fid         = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL);  
-      wid         = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL);  
-      label       = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL); 
-      face_x      = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL); 
-      face_y      = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL); 
-      length      = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL); 
-      score       = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);  
-      angle       = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL); 
-      curvature   = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);  
-      follicle_x  = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);  
-      follicle_y  = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL); 
-      tip_x       = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL); 
-      tip_y       = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL); 
-
-      if(!( fid        && 
-            wid        && 
-            label      && 
-            face_x     && 
-            face_y     && 
-            length     && 
-            score      && 
-            angle      && 
-            curvature  && 
-            follicle_x && 
-            follicle_y && 
-            tip_x      && 
-            tip_y))
-        goto AllocRowException;
-       
-      mxSetFieldByNumber(plhs[0],i,0, fid       );
-      mxSetFieldByNumber(plhs[0],i,1, wid       );
-      mxSetFieldByNumber(plhs[0],i,2, label     );
-      mxSetFieldByNumber(plhs[0],i,3, face_x    );
-      mxSetFieldByNumber(plhs[0],i,4, face_y    );
-      mxSetFieldByNumber(plhs[0],i,5, length    );
-      mxSetFieldByNumber(plhs[0],i,6, score     );
-      mxSetFieldByNumber(plhs[0],i,7, angle     );
-      mxSetFieldByNumber(plhs[0],i,8, curvature );
-      mxSetFieldByNumber(plhs[0],i,9, follicle_x);
-      mxSetFieldByNumber(plhs[0],i,10,follicle_y);
-      mxSetFieldByNumber(plhs[0],i,11,tip_x     );
-      mxSetFieldByNumber(plhs[0],i,12,tip_y     );
-      
-      pfid         = (   int*) mxGetData(fid       );
-      pwid         = (   int*) mxGetData(wid       );
-      plabel       = (   int*) mxGetData(label     );
-      pface_x      = (   int*) mxGetData(face_x    );
-      pface_y      = (   int*) mxGetData(face_y    );
-      plength      = (double*) mxGetData(length    );
-      pscore       = (double*) mxGetData(score     );
-      pangle       = (double*) mxGetData(angle     ); 
-      pcurvature   = (double*) mxGetData(curvature ); 
-      pfollicle_x  = (double*) mxGetData(follicle_x);
-      pfollicle_y  = (double*) mxGetData(follicle_y);
-      ptip_x       = (double*) mxGetData(tip_x     );
-      ptip_y       = (double*) mxGetData(tip_y     );
-
-      *pfid = table[i].fid;
-      *pwid = table[i].wid;
-      *plabel  = table[i].state;
-      *pface_x = table[i].face_x;
-      *pface_y = table[i].face_y;
-      *plength      = table[i].data[0]; //see end of measure.c:Whisker_Segments_Measure for column assignments
-      *pscore       = table[i].data[1];
-      *pangle       = table[i].data[2];
-      *pcurvature   = table[i].data[3];
-      *pfollicle_x  = table[i].data[4]; 
-      *pfollicle_y  = table[i].data[5]; 
-      *ptip_x       = table[i].data[6]; 
-      *ptip_y       = table[i].data[7]; 
-    }
+      for(j=0;j<nsel;++j)
+      { mxArray *v;
+        if(sel[j]<NINTFIELDS)
+        { if( (v = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL)) )
+            *(int*)mxGetData(v) = (int) field_value(table+i,sel[j]);
+        } else
+        { if( (v = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL)) )
+            *(double*)mxGetData(v) = field_value(table+i,sel[j]);
+        }
+        if(!v)
+          goto AllocRowException;
+        mxSetFieldByNumber(plhs[0],i,j,v);
+      }
   }
 
 Done:
@@ -202,7 +244,7 @@ Done:
   return;
 AllocStructArrayException:
   Free_Measurements_Table(table);
-  mexPrintf("Allocating struct array for %d rows.\n",nrows);
+  mexPrintf("Allocating output for %d rows.\n",nrows);
   mexErrMsgTxt("Allocation failed.\n");
   return;
 AllocRowException:
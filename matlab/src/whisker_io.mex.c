@@ -35,9 +35,20 @@
  *
  *   whiskers          = LoadWhiskers(filename)
  *   [whiskers,format] = LoadWhiskers(filename)
+ *   whiskers          = LoadWhiskers(filename,frames)
+ *   whiskers          = LoadWhiskers(filename,frames,fields)
+ *   [ids,points,format] = LoadWhiskers(filename,frames,fields,'matrix')
  *
  *   <whiskers> is a struct array with a number of fields describing the shape of traced whisker-like segments.
  *   <format>   is a string describing how the whisker data is stored.
+ *   <frames>   is [first last].  Only segments on those frames (inclusive) are read.  Use [] for all frames.
+ *   <fields>   is a cell array with some of 'id','time','x','y','thick','scores'.  Use [] for all fields.
+ *   <ids>      in 'matrix' mode, an int32 matrix with a row per segment and a column for each of
+ *              the requested 'id' and 'time' fields.
+ *   <points>   in 'matrix' mode, a struct with a cell array (one cell per segment) for each of the
+ *              requested point fields.
+ *
+ *   For the binary formats, point data for segments outside of <frames> is skipped without being read.
  *
  *   Example:
  *   -------
@@ -94,26 +105,172 @@ Error:
 }
 
 #ifdef LOAD_WHISKERS
+#include <limits.h>
+
+enum { F_ID, F_TIME, F_X, F_Y, F_THICK, F_SCORES, F_COUNT };
+static const char *Fields[F_COUNT] = {"id","time","x","y","thick","scores"};
+
+/* frames = [first last], inclusive.  Missing or empty means all frames. */
+static int get_frames(int nrhs, const mxArray *prhs[], int *begin, int *end)
+{ const mxArray *arg = (nrhs>1)?prhs[1]:NULL;
+  *begin = INT_MIN;
+  *end   = INT_MAX;
+  if(!arg || mxIsEmpty(arg))
+    return 0;
+  if(!mxIsDouble(arg) || mxGetNumberOfElements(arg)!=2)
+    mexErrMsgTxt("Frame range must be given as [first last].");
+  *begin = (int) mxGetPr(arg)[0];
+  *end   = (int) mxGetPr(arg)[1] + 1;
+  return 1;
+}
+
+/* fields = cell array of field names.  Missing or empty means all fields.
+ * Fills sel with field indexes in the requested order and returns the count.
+ */
+static int get_fields(int nrhs, const mxArray *prhs[], int *sel)
+{ const mxArray *arg = (nrhs>2)?prhs[2]:NULL;
+  int i,j,n;
+  if(!arg || mxIsEmpty(arg))
+  { for(i=0;i<F_COUNT;++i)
+      sel[i]=i;
+    return F_COUNT;
+  }
+  if(!mxIsCell(arg) || (n=(int)mxGetNumberOfElements(arg))>F_COUNT)
+    mexErrMsgTxt("Fields must be given as a cell array of field names.");
+  for(i=0;i<n;++i)
+  { char *name = mxArrayToString(mxGetCell(arg,i));
+    if(!name)
+      mexErrMsgTxt("Fields must be given as a cell array of field names.");
+    for(j=0;j<F_COUNT;++j)
+      if(strcmp(name,Fields[j])==0)
+        break;
+    if(j==F_COUNT)
+    { mexPrintf("Unknown field: %s\n",name);
+      mxFree(name);
+      mexErrMsgTxt("Field names must be some of: id, time, x, y, thick, scores.");
+    }
+    mxFree(name);
+    sel[i]=j;
+  }
+  return n;
+}
+
+static int is_matrix_mode(int nrhs, const mxArray *prhs[])
+{ char *mode;
+  int ok;
+  if(nrhs<4)
+    return 0;
+  if(!(mode=mxArrayToString(prhs[3])))
+    mexErrMsgTxt("Output mode must be a string.");
+  ok = strcmp(mode,"matrix")==0;
+  mxFree(mode);
+  if(!ok)
+    mexErrMsgTxt("The only output mode option is 'matrix'.");
+  return 1;
+}
+
+static float *point_field(Whisker_Seg *w, int ifield)
+{ switch(ifield)
+  { case F_X:      return w->x;
+    case F_Y:      return w->y;
+    case F_THICK:  return w->thick;
+    case F_SCORES: return w->scores;
+  }
+  return NULL;
+}
+
+static mxArray *point_array(Whisker_Seg *w, int ifield)
+{ mxArray *a = mxCreateNumericMatrix(w->len,1,mxSINGLE_CLASS,mxREAL);
+  if(a)
+    memcpy(mxGetData(a),point_field(w,ifield),w->len*sizeof(float));
+  return a;
+}
+
+static mxArray *make_struct_array(Whisker_Seg *ws, int nwhisk, int *sel, int nsel)
+{ const char *names[F_COUNT];
+  mxArray *out;
+  int i,j;
+  for(j=0;j<nsel;++j)
+    names[j] = Fields[sel[j]];
+  if(!(out = mxCreateStructMatrix(nwhisk,1,nsel,names)))
+    return NULL;
+  for(i=0;i<nwhisk;++i)
+    for(j=0;j<nsel;++j)
+    { mxArray *a;
+      if(sel[j]==F_ID || sel[j]==F_TIME)
+      { if( (a = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL)) )
+          *(int*)mxGetData(a) = (sel[j]==F_ID)?ws[i].id:ws[i].time;
+      } else
+        a = point_array(ws+i,sel[j]);
+      if(!a)
+      { mxDestroyArray(out);
+        return NULL;
+      }
+      mxSetFieldByNumber(out,i,j,a);
+    }
+  return out;
+}
+
+/* ids has one int32 column per selected scalar field.
+ * points is a struct with one cell array per selected point field.
+ */
+static int make_matrices(Whisker_Seg *ws, int nwhisk, int *sel, int nsel, mxArray **ids, mxArray **points)
+{ const char *names[F_COUNT];
+  int scalars[F_COUNT], pts[F_COUNT], nscalars=0, npts=0, i,j;
+  for(j=0;j<nsel;++j)
+    if(sel[j]==F_ID || sel[j]==F_TIME) scalars[nscalars++] = sel[j];
+    else                               pts[npts++]         = sel[j];
+
+  if(!(*ids = mxCreateNumericMatrix(nwhisk,nscalars,mxINT32_CLASS,mxREAL)))
+    return 0;
+  { int *d = (int*) mxGetData(*ids);
+    for(j=0;j<nscalars;++j)
+      for(i=0;i<nwhisk;++i)
+        *d++ = (scalars[j]==F_ID)?ws[i].id:ws[i].time; // column major
+  }
+
+  for(j=0;j<npts;++j)
+    names[j] = Fields[pts[j]];
+  if(!(*points = mxCreateStructMatrix(1,1,npts,names)))
+    return 0;
+  for(j=0;j<npts;++j)
+  { mxArray *c = mxCreateCellMatrix(nwhisk,1);
+    if(!c)
+      return 0;
+    for(i=0;i<nwhisk;++i)
+    { mxArray *a = point_array(ws+i,pts[j]);
+      if(!a)
+      { mxDestroyArray(c);
+        return 0;
+      }
+      mxSetCell(c,i,a);
+    }
+    mxSetFieldByNumber(*points,0,j,c);
+  }
+  return 1;
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{ size_t buflen; 
-  int nwhisk;
+{ int nwhisk,nsel,matrix,ranged,begin,end;
+  int sel[F_COUNT];
   char *filename;
   Whisker_Seg *ws;
 
   set_reporter(mxreport);
   
   /* check for proper number of arguments */
-  if(nrhs!=1) 
-    mexErrMsgTxt("One input required.");
-  else if(nlhs > 2) 
-    mexErrMsgTxt("Too many output arguments.");
+  if(nrhs<1 || nrhs>4) 
+    mexErrMsgTxt("One to four inputs required.");
 
   /* input must be a string */
   if ( mxIsChar(prhs[0]) != 1)
     mexErrMsgTxt("Input must be a string.");
 
-  /* get the length of the input string */
-  buflen = (mxGetM(prhs[0]) * mxGetN(prhs[0])) + 1;
+  ranged = get_frames(nrhs,prhs,&begin,&end);
+  nsel   = get_fields(nrhs,prhs,sel);
+  matrix = is_matrix_mode(nrhs,prhs);
+  if(nlhs > (matrix?3:2)) 
+    mexErrMsgTxt("Too many output arguments.");
 
   /* copy the string data from prhs[0] into a C string input_ buf.
    * */
@@ -124,77 +281,37 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
   //mexPrintf("Got %s\n",filename);
   
-  ws = Load_Whiskers(filename,NULL,&nwhisk);
+  if(ranged)
+    ws = Load_Whiskers_Range(filename,NULL,begin,end,&nwhisk);
+  else
+    ws = Load_Whiskers(filename,NULL,&nwhisk);
   if(!ws)
     mexErrMsgTxt("Could not load whiskers.\n");
   
   if(nlhs==0)
     goto Done;
   
-  if(nlhs==2)
+  if(nlhs==(matrix?3:2))
   { char *format=NULL;
     if( Whisker_File_Autodetect(filename,&format)==-1 ) 
       goto AutodetectException;
   
-    plhs[1] = mxCreateString(format);
-    if(!plhs[1])
+    plhs[nlhs-1] = mxCreateString(format);
+    if(!plhs[nlhs-1])
       goto AllocateFormatStringException;
   }
   
-  { const char *fields[] = {"id","time","x","y","thick","scores"};        
-    plhs[0] = mxCreateStructMatrix(
-              nwhisk
-            , 1
-            , sizeof(fields)/sizeof(char*)
-            , fields);
-    if(!plhs[0])
-    { Free_Whisker_Seg_Vec(ws,nwhisk);
-      mexPrintf("Allocating struct array for %d whiskers.\n",nwhisk);
-      mexErrMsgTxt("Allocation failed.\n");
-    }
-  }
-    
-  { int i;
-    for(i=0;i<nwhisk;++i)
-    { mxArray *id,*time,*x,*y,*thick,*scores;
-      int *pid,*ptime;
-      float *px, *py, *pthick, *pscores;
-      int n;
-      
-      n = ws[i].len;
-      
-      id     = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL);
-      time   = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL);
-      x      = mxCreateNumericMatrix(n,1,mxSINGLE_CLASS,mxREAL);
-      y      = mxCreateNumericMatrix(n,1,mxSINGLE_CLASS,mxREAL);
-      thick  = mxCreateNumericMatrix(n,1,mxSINGLE_CLASS,mxREAL);
-      scores = mxCreateNumericMatrix(n,1,mxSINGLE_CLASS,mxREAL);
-      if(!(id && time && x && y && thick && scores))
-      { Free_Whisker_Seg_Vec(ws,nwhisk);        
-        mexPrintf("Allocating space for whisker #%d (%d points).\n", i, ws[i].len);
-        mexErrMsgTxt("Allocation failed.\n");
-        return;
-      }
-      
-      mxSetFieldByNumber(plhs[0],i,0,id);
-      mxSetFieldByNumber(plhs[0],i,1,time);
-      mxSetFieldByNumber(plhs[0],i,2,x);
-      mxSetFieldByNumber(plhs[0],i,3,y);
-      mxSetFieldByNumber(plhs[0],i,4,thick);
-      mxSetFieldByNumber(plhs[0],i,5,scores);
-      
-      pid = (int*) mxGetData(id);
-      *pid = ws[i].id;
-      
-      ptime = (int*) mxGetData(time);
-      *ptime = ws[i].time;
-      
-      memcpy(mxGetData(x),ws[i].x,n*sizeof(float));
-      memcpy(mxGetData(y),ws[i].y,n*sizeof(float));
-      memcpy(mxGetData(thick),ws[i].thick,n*sizeof(float));
-      memcpy(mxGetData(scores),ws[i].scores,n*sizeof(float));
-      
-    }
+  if(matrix)
+  { mxArray *points = NULL;
+    if(!make_matrices(ws,nwhisk,sel,nsel,plhs,&points))
+      goto AllocateException;
+    if(nlhs>1)
+      plhs[1] = points;
+    else
+      mxDestroyArray(points);
+  } else
+  { if(!(plhs[0] = make_struct_array(ws,nwhisk,sel,nsel)))
+      goto AllocateException;
   }
   
 Done:
@@ -206,6 +323,10 @@ AutodetectException:
 AllocateFormatStringException:
   Free_Whisker_Seg_Vec(ws,nwhisk);
   mexErrMsgTxt("Allocation failed for format string.\n");
+AllocateException:
+  Free_Whisker_Seg_Vec(ws,nwhisk);
+  mexPrintf("Allocating output for %d whiskers.\n",nwhisk);
+  mexErrMsgTxt("Allocation failed.\n");
 }
 #endif
 
@@ -5,6 +5,7 @@ The functionality described here corresponds with that in trace.h.
 
 File I/O
   Load_Whiskers
+  Load_Whiskers_Flat
   Save_Whiskers
 
 Tracing
@@ -23,6 +24,7 @@ from ctypes import *
 from ctypes.util import find_library
 from numpy import zeros, float32, uint8, array, hypot, arctan2, pi, concatenate, float64, ndarray, int32
 from numpy import where, cos, sin, sum
+from numpy import int64, ascontiguousarray, cumsum, ctypeslib
 from warnings import warn
 
 
@@ -321,6 +323,94 @@ class Whisker_Seg(object):
     w.thick  = self.thick.copy()
     return w
 
+class cWhisker_Seg_Flat(Structure):                  #typedef struct
+  _fields_ = [( "n"        , c_int   ),              #{ int      n;
+              ( "npoints"  , c_int64 ),              #  int64_t  npoints;
+              ( "fid"      , POINTER( c_int   ) ),   #  int     *fid;
+              ( "wid"      , POINTER( c_int   ) ),   #  int     *wid;
+              ( "offset"   , POINTER( c_int64 ) ),   #  int64_t *offset;
+              ( "x"        , POINTER( c_float ) ),   #  float   *x;
+              ( "y"        , POINTER( c_float ) ),   #  float   *y;
+              ( "thick"    , POINTER( c_float ) ),   #  float   *thick;
+              ( "scores"   , POINTER( c_float ) )]   #  float   *scores;
+                                                     #} Whisker_Seg_Flat;
+
+class WhiskerArrays(object):
+  """ All the segments from a whiskers file in a few flat numpy arrays.
+
+  Segment `i` is from frame `fid[i]`, has segment id `wid[i]`, and owns points
+  `offset[i]` to `offset[i+1]-1` of the `x`, `y`, `thick` and `scores` arrays.
+
+  >>> wa = Load_Whiskers_Flat('test.whiskers')
+  >>> w  = wa.segment(0)          # a Whisker_Seg whose arrays are views into wa
+  >>> wv = wa.todict()            # same layout as Load_Whiskers
+  """
+  def __init__(self, fid, wid, offset, x, y, thick, scores):
+    self.fid    = fid
+    self.wid    = wid
+    self.offset = offset
+    self.x      = x
+    self.y      = y
+    self.thick  = thick
+    self.scores = scores
+
+  def __len__(self):
+    return len(self.fid)
+
+  def segment(self, i):
+    a,b = self.offset[i], self.offset[i+1]
+    w = Whisker_Seg()
+    w.id     = int(self.wid[i])
+    w.time   = int(self.fid[i])
+    w.x      = self.x     [a:b]
+    w.y      = self.y     [a:b]
+    w.thick  = self.thick [a:b]
+    w.scores = self.scores[a:b]
+    return w
+
+  def todict(self):
+    """ Returns a {frameid: {segmentid: Whisker_Seg}} dict.  The segments'
+    arrays are views into this object's arrays; no point data is copied. """
+    whiskers = {}
+    for i in xrange(len(self)):
+      w = self.segment(i)
+      whiskers.setdefault( w.time, {} )[ w.id ] = w
+    return whiskers
+
+  @staticmethod
+  def fromdict( whiskers ):
+    segs = [ (fid,wid,t) for fid,v in whiskers.iteritems() 
+                         for wid,t in v.iteritems() if t ]
+    lens = [ len(t.x) for fid,wid,t in segs ]
+    offset = zeros( len(segs)+1, dtype=int64 )
+    offset[1:] = cumsum(lens)
+    cat = lambda name: concatenate( [getattr(t,name) for fid,wid,t in segs] ).astype(float32) \
+                       if segs else zeros(0,dtype=float32)
+    return WhiskerArrays( array( [fid for fid,wid,t in segs], dtype=int32 ),
+                          array( [wid for fid,wid,t in segs], dtype=int32 ),
+                          offset,
+                          cat('x'), cat('y'), cat('thick'), cat('scores') )
+
+  def _cast(self):
+    """ Returns a cWhisker_Seg_Flat that refers to this object's arrays.
+    Arrays are made contiguous with the right type first. """
+    self.fid    = ascontiguousarray( self.fid   , dtype=int32   )
+    self.wid    = ascontiguousarray( self.wid   , dtype=int32   )
+    self.offset = ascontiguousarray( self.offset, dtype=int64   )
+    self.x      = ascontiguousarray( self.x     , dtype=float32 )
+    self.y      = ascontiguousarray( self.y     , dtype=float32 )
+    self.thick  = ascontiguousarray( self.thick , dtype=float32 )
+    self.scores = ascontiguousarray( self.scores, dtype=float32 )
+    return cWhisker_Seg_Flat( len(self.fid),
+                              int(self.offset[-1]),
+                              self.fid.ctypes.data_as   ( POINTER( c_int   ) ),
+                              self.wid.ctypes.data_as   ( POINTER( c_int   ) ),
+                              self.offset.ctypes.data_as( POINTER( c_int64 ) ),
+                              self.x.ctypes.data_as     ( POINTER( c_float ) ),
+                              self.y.ctypes.data_as     ( POINTER( c_float ) ),
+                              self.thick.ctypes.data_as ( POINTER( c_float ) ),
+                              self.scores.ctypes.data_as( POINTER( c_float ) ) )
+
 #
 # FILE I/O
 #
@@ -338,6 +428,51 @@ cWhisk.Save_Whiskers.argtypes = [
   POINTER( cWhisker_Seg ),
   c_int]
 
+cWhisk.Load_Whiskers_Flat.restype = c_int
+cWhisk.Load_Whiskers_Flat.argtypes = [
+  POINTER( c_char ),
+  POINTER( c_char ),
+  POINTER( cWhisker_Seg_Flat )]
+
+cWhisk.Save_Whiskers_Flat.restype = c_int
+cWhisk.Save_Whiskers_Flat.argtypes = [
+  POINTER( c_char ),
+  POINTER( c_char ),
+  POINTER( cWhisker_Seg_Flat )]
+
+cWhisk.Free_Whisker_Seg_Flat_Data.restype = None
+cWhisk.Free_Whisker_Seg_Flat_Data.argtypes = [ POINTER( cWhisker_Seg_Flat ) ]
+
+def _flat_column( ptr, n, dtype ):
+  if n == 0:
+    return zeros( 0, dtype=dtype )
+  return ctypeslib.as_array( ptr, shape=(n,) ).astype( dtype ) # copies
+
+def Load_Whiskers_Flat( filename ):
+  """ Reads whisker segments from a file into a WhiskerArrays.
+
+  The file is read in C into one contiguous block per column, and each block
+  is copied into a numpy array with a single copy.  There is no per-segment
+  work in python, so this is the fast way to load large files.
+  """
+  if not os.path.exists(filename):
+    raise IOError, "File not found."
+  flat = cWhisker_Seg_Flat()
+  if not cWhisk.Load_Whiskers_Flat( filename, None, byref(flat) ):
+    raise IOError, "Could not read whiskers from %s."%filename
+  try:
+    n, npoints = flat.n, flat.npoints
+    wa = WhiskerArrays( _flat_column( flat.fid   , n        , int32   ),
+                        _flat_column( flat.wid   , n        , int32   ),
+                        _flat_column( flat.offset, n+1      , int64   ),
+                        _flat_column( flat.x     , npoints  , float32 ),
+                        _flat_column( flat.y     , npoints  , float32 ),
+                        _flat_column( flat.thick , npoints  , float32 ),
+                        _flat_column( flat.scores, npoints  , float32 ) )
+  finally:
+    cWhisk.Free_Whisker_Seg_Flat_Data( byref(flat) )
+  return wa
+
 def Load_Whiskers( filename ):
   """ Reads whisker segments from a file.
 
@@ -354,33 +489,23 @@ def Load_Whiskers( filename ):
   >>> w.time == frameid
   True
 
-  The file is read using a ctypes call to a libwhisk(trace.h) function.  The
-  data is then copied into numpy containers and freed.
-
-  It's not clear to me how this effects the part of the heap hidden from
-  python's memmory management.  This is done for convenience, since later no
-  one needs to remember to free anything and one gets to use numpy.array's for
-  plotting, etc...
-
-  For the kinds of things I imaging doing in python this function will only get
-  called once per application instance.
+  The file is read with Load_Whiskers_Flat.  Each segment's arrays are views
+  into the flat arrays, so no point data is copied segment by segment.  Use
+  Load_Whiskers_Flat directly to skip building the dict.
   """
-  if not os.path.exists(filename):
-    raise IOError, "File not found."
-  nwhiskers = c_int(0)
-  wv = cWhisk.Load_Whiskers( filename, None, byref(nwhiskers) );
-  # organize into dictionary for ui.py {frameid}{segid}
-  whiskers = {}
-  for idx in xrange( nwhiskers.value ):
-    w = wv[idx]
-    whiskers[ w.time ] = {}
-  for idx in xrange( nwhiskers.value ):
-    w = Whisker_Seg(wv[idx])
-    whiskers[ w.time ][ w.id ] = w;
-  cWhisk.Free_Whisker_Seg_Vec( wv, nwhiskers )
-  return whiskers
+  return Load_Whiskers_Flat( filename ).todict()
 
 def Save_Whiskers( filename, whiskers ):
+  """ Writes whisker segments to a file.
+
+  `whiskers` may be a {frameid: {segmentid: Whisker_Seg}} dict, as returned by
+  Load_Whiskers, or a WhiskerArrays, as returned by Load_Whiskers_Flat.
+  """
+  if isinstance( whiskers, WhiskerArrays ):
+    flat = whiskers._cast()
+    if not cWhisk.Save_Whiskers_Flat( filename, None, byref(flat) ):
+      warn("Save Whiskers may have failed.")
+    return
   #count the whiskers
   n = 0
   for v in whiskers.itervalues():
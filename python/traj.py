@@ -12,7 +12,7 @@ import os,sys
 from ctypes import *
 from ctypes.util import find_library
 import numpy
-from numpy import zeros, double, fabs, ndarray, array
+from numpy import zeros, double, fabs, ndarray, array, int32, frombuffer, logical_and
 import trace
 from trace import cWhisker_Seg
 
@@ -36,6 +36,8 @@ except:
 if ctraj._name==None:
   raise ImportError("Can not load whisk or traj shared library");
 
+MEASUREMENTS_ANY_STATE = -2**31 # see traj.h
+
 _param_file = "default.parameters"
 if ctraj.Load_Params_File(_param_file)==1: #returns 0 on success, 1 on failure
   raise Exception("Could not load tracing parameters from file: %s"%_param_file)
@@ -77,7 +79,8 @@ class cDistributions(Structure):
               ("n_bins",       c_int               ),
               ("bin_min",      POINTER( c_double ) ),   # // array of n_measures elements                                                          
               ("bin_delta",    POINTER( c_double ) ),   # // array of n_measures elements                                                          
-              ("data",         POINTER( c_double ) )]   # // array of holding histogram information with dimensions (n_bins,n_measures,n_states)
+              ("data",         POINTER( c_double ) ),   # // array of holding histogram information with dimensions (n_bins,n_measures,n_states)
+              ("by_state",     POINTER( c_double ) )]   # // NULL, or a copy of data with dimensions (n_states,n_bins,n_measures)
   def asarray(self):
     d = zeros( (self.n_states, self.n_measures, self.n_bins) )
     ctraj.Copy_Distribution_To_Doubles( byref(self), d.ctypes.data_as( POINTER(c_double) ) )
@@ -173,13 +176,119 @@ class MeasurementsTable(object):
     """
     if self._nrows==0:
       return []
+    state,fid,wid,valid = self.get_ids()
     data = zeros( (self._nrows, self._measurements[0].n+3), dtype=double )
-    ctraj.Measurements_Table_Data_To_Doubles(self._measurements, 
-                                             self._nrows, 
-                                             data.ctypes.data_as( POINTER( c_double ))
-                                            );
+    data[:,0]  = state
+    data[:,1]  = fid
+    data[:,2]  = wid
+    data[:,3:] = self.shape_view()
     return data
 
+  def pack(self):
+    """
+    Reorders the table's storage so row `i` of the shape and velocity blocks
+    holds row `i` of the table.  Cheap when the table is already packed.
+    Sorting the table unpacks it.
+
+    >>> from numpy.random import rand
+    >>> data = rand(200,10)
+    >>> data[:,1] = range(199,-1,-1)
+    >>> table = MeasurementsTable(data).sort_by_time().pack()
+    >>> (table.shape_view()[:,0] == data[::-1,3]).all()
+    True
+    """
+    ctraj.Measurements_Table_Pack( self._measurements, self._nrows )
+    return self
+
+  def _block_view(self, block):
+    n   = self._measurements[0].n
+    buf = (c_double*(self._nrows*n)).from_address( addressof(block.contents) )
+    buf._table = self # keeps the table alive as long as a view is referenced
+    return frombuffer( buf, dtype=double ).reshape( (self._nrows, n) )
+
+  def shape_view(self):
+    """
+    Returns an (nrows, n) array viewing the table's shape data in place.
+    Columns are strided views, e.g. `table.shape_view()[:,0]`.  Writes go
+    through to the table.  The view is in table order; it is invalidated by
+    sorting or resizing the table.
+
+    >>> from numpy.random import rand
+    >>> data = rand(200,10)
+    >>> table = MeasurementsTable(data)
+    >>> view = table.shape_view()
+    >>> (view == data[:,3:]).all()
+    True
+    >>> view[0,0] = -1.0
+    >>> table.asarray()[0,3]
+    -1.0
+    """
+    if self._nrows==0:
+      return zeros( (0,0), dtype=double )
+    self.pack()
+    return self._block_view( ctraj.Measurements_Table_Data_Block( self._measurements ) )
+
+  def velocity_view(self):
+    """
+    Returns an (nrows, n) array viewing the table's velocities in place.
+    Rows where the velocity is not valid hold stale values.
+    See `shape_view`.
+
+    >>> data = numpy.load('data/testing/seq140[autotraj].npy')
+    >>> table = MeasurementsTable(data).update_velocities()
+    >>> (table.velocity_view()[table.select(1)] == table.get_velocities(1)).all()
+    True
+    """
+    if self._nrows==0:
+      return zeros( (0,0), dtype=double )
+    self.pack()
+    return self._block_view( ctraj.Measurements_Table_Velocity_Block( self._measurements, self._nrows ) )
+
+  def get_ids(self):
+    """
+    Returns the `state`, `fid`, `wid` and `valid_velocity` columns as int32
+    arrays in table order.
+
+    >>> from numpy.random import rand
+    >>> data = rand(200,10)
+    >>> data[:,1] = range(200)
+    >>> state,fid,wid,valid = MeasurementsTable(data).get_ids()
+    >>> (fid == data[:,1]).all()
+    True
+    """
+    cols = [ zeros( self._nrows, dtype=int32 ) for i in xrange(4) ]
+    if self._nrows:
+      ctraj.Measurements_Table_Copy_Ids( self._measurements, self._nrows,
+                                         *[ c.ctypes.data_as( POINTER(c_int) ) for c in cols ] )
+    return cols
+
+  def select(self, state = None, frames = None ):
+    """
+    Returns the table indexes of the rows with the requested `state` (or any
+    state if None) whose frame id lies in the half-open range `frames`,
+    given as (begin,end).  Order follows the table's sort order, so the result
+    can be used directly to index `shape_view()` or `velocity_view()`.
+
+    >>> from numpy.random import rand
+    >>> data = rand(200,10)
+    >>> data[:,0] = [ i%2 for i in xrange(200) ]
+    >>> data[:,1] = range(200)
+    >>> table = MeasurementsTable(data)
+    >>> list(table.select(1,(10,16)))
+    [11, 13, 15]
+    >>> len(table.select(frames=(0,50)))
+    50
+    """
+    if state is None:
+      state = MEASUREMENTS_ANY_STATE
+    begin,end = frames if not frames is None else (-2**31, 2**31-1)
+    n = ctraj.Measurements_Table_Select( self._measurements, self._nrows, int(state), int(begin), int(end), None )
+    index = zeros( n, dtype=int32 )
+    if n:
+      ctraj.Measurements_Table_Select( self._measurements, self._nrows, int(state), int(begin), int(end),
+                                       index.ctypes.data_as( POINTER(c_int) ) )
+    return index
+
   def get_trajectories(self):
     """
     >>> table = MeasurementsTable( "data/testing/seq140[autotraj].measurements" )
@@ -189,13 +298,11 @@ class MeasurementsTable(object):
     >>> traj.has_key(-1)
     False
     """
-    data = self.asarray()
+    state,fid,wid,valid = self.get_ids()
+    m = state!=-1
     t = {}
-    for row in data:
-      r = map(int,row[:3])
-      t.setdefault( r[0],{} ).setdefault( r[1], r[2] ) 
-    if -1 in t.keys():
-      del t[-1]
+    for s,f,w in zip( state[m].tolist(), fid[m].tolist(), wid[m].tolist() ):
+      t.setdefault( s,{} ).setdefault( f, w )
     return t
 
   def save_trajectories(self, filename, excludes=[]):
@@ -257,11 +364,10 @@ class MeasurementsTable(object):
       for k in t.iteritems():
         inv[k] = tid  
 
-    for i in xrange(self._nrows):  #update new
-      row = self._measurements[i]
-      s = inv.get( (row.fid,row.wid) )
-      row.state = s if (not s is None) else -1 
-
+    state,fid,wid,valid = self.get_ids()
+    state = array( [ inv.get(k,-1) for k in zip(fid.tolist(),wid.tolist()) ], dtype=int32 )
+    if self._nrows:
+      ctraj.Measurements_Table_Set_States( self._measurements, self._nrows, state.ctypes.data_as( POINTER(c_int) ) )
     return self
 
   def get_state_range(self):
@@ -304,12 +410,10 @@ class MeasurementsTable(object):
     >>> data = rand(200,10)
     >>> table = MeasurementsTable(data)
     >>> shape = table.get_shape_table()
+
+    Returns a copy in table order.  See `shape_view` to avoid the copy.
     """
-    shape = zeros( (self._nrows, self._measurements[0].n), dtype=double )
-    ctraj.Measurements_Table_Copy_Shape_Data( self._measurements, 
-                                              self._nrows, 
-                                              shape.ctypes.data_as( POINTER(c_double) ) )
-    return shape
+    return self.shape_view().copy()
 
   def get_time_and_mask(self, state, rows = None):
     """
@@ -320,16 +424,9 @@ class MeasurementsTable(object):
     >>> table = MeasurementsTable(data).update_velocities()
     >>> time,mask = table.get_time_and_mask(1)
     """
-    if rows is None:
-      rows = ctraj.Measurements_Table_Size_Select_State( self._measurements, self._nrows, int(state) )
-    time = zeros( rows, dtype = double )
-    mask = zeros( rows, dtype = int    )
-    ctraj.Measurements_Table_Select_Time_And_Mask_By_State( self._measurements, 
-                                                            self._nrows,
-                                                            int(state),
-                                                            time.ctypes.data_as (POINTER( c_double )), 
-                                                            mask.ctypes.data_as (POINTER( c_int    )) )
-    return time,mask
+    s,fid,wid,valid = self.get_ids()
+    m = s==int(state)
+    return fid[m].astype(double), valid[m].astype(int)
 
   def get_velocities(self, state, rows = None):
     """
@@ -342,14 +439,7 @@ class MeasurementsTable(object):
     <...MeasurementsTable object at ...>
     >>> velocities = table.get_velocities(1)
     """
-    if rows is None:
-      rows = ctraj.Measurements_Table_Size_Select_State( self._measurements, self._nrows, int(state) )
-    vel  = zeros( (rows, self._measurements[0].n ), dtype = double )
-    ctraj.Measurements_Table_Select_Velocities_By_State( self._measurements, 
-                                                         self._nrows,
-                                                         int(state),
-                                                         vel.ctypes.data_as (POINTER( c_double )) )
-    return vel
+    return self.velocity_view()[ self.select(state) ]
   
   def get_shape_data(self, state, rows = None):
     """
@@ -363,14 +453,7 @@ class MeasurementsTable(object):
     >>> table = MeasurementsTable('data/testing/seq140[autotraj].measurements').update_velocities()
     >>> shape = table.get_shape_data(1)
     """
-    if rows is None:
-      rows = ctraj.Measurements_Table_Size_Select_State( self._measurements, self._nrows, int(state) )
-    data  = zeros( (rows, self._measurements[0].n ), dtype = double )
-    ctraj.Measurements_Table_Select_Shape_By_State( self._measurements, 
-                                                    self._nrows,
-                                                    int(state),
-                                                    data.ctypes.data_as (POINTER( c_double )) )
-    return data
+    return self.shape_view()[ self.select(state) ]
 
   def get_data(self, state, rows = None ):
     """
@@ -395,11 +478,7 @@ class MeasurementsTable(object):
     >>> table = MeasurementsTable(data).update_velocities()
     >>> vel = table.get_velocities_table()
     """
-    vel = zeros( (self._nrows, self._measurements[0].n), dtype=double )
-    ctraj.Measurements_Table_Copy_Velocities( self._measurements, 
-                                              self._nrows, 
-                                              vel.ctypes.data_as( POINTER(c_double) ) )
-    return vel
+    return self.velocity_view().copy()
 
   def set_constant_face_position(self, x, y):
     """
@@ -565,7 +644,9 @@ class MeasurementsTable(object):
     frames = ctraj.Measurements_Tables_Get_Diff_Frames( self._measurements, self._nrows, 
                                                         table._measurements, table._nrows, 
                                                         byref(nframes) )
-    return [frames[i] for i in xrange(nframes.value)]
+    out = [frames[i] for i in xrange(nframes.value)]
+    ctraj.Measurements_Tables_Free_Diff_Frames( frames )
+    return out
 
   def est_length_threshold(self,lowpx=1.0/0.04,highpx=50.0/0.04):
     ncount = c_int(0)
@@ -856,6 +937,44 @@ ctraj.Measurements_Table_Copy_Velocities.argtypes = [
   c_int,                    # number of rows
   POINTER( c_double ) ]     # destination
 
+ctraj.Measurements_Table_Data_Block.restype = POINTER( c_double )
+ctraj.Measurements_Table_Data_Block.argtypes = [
+  POINTER( cMeasurements ) ] # the table
+
+ctraj.Measurements_Table_Velocity_Block.restype = POINTER( c_double )
+ctraj.Measurements_Table_Velocity_Block.argtypes = [
+  POINTER( cMeasurements ), # the table
+  c_int ]                   # number of rows
+
+ctraj.Measurements_Table_Pack.restype = None
+ctraj.Measurements_Table_Pack.argtypes = [
+  POINTER( cMeasurements ), # the table
+  c_int ]                   # number of rows
+
+ctraj.Measurements_Table_Copy_Ids.restype = None
+ctraj.Measurements_Table_Copy_Ids.argtypes = [
+  POINTER( cMeasurements ), # the table (the source)
+  c_int,                    # number of rows
+  POINTER( c_int ),         # (out) state          - may be NULL
+  POINTER( c_int ),         # (out) fid            - may be NULL
+  POINTER( c_int ),         # (out) wid            - may be NULL
+  POINTER( c_int ) ]        # (out) valid_velocity - may be NULL
+
+ctraj.Measurements_Table_Set_States.restype = None
+ctraj.Measurements_Table_Set_States.argtypes = [
+  POINTER( cMeasurements ), # the table
+  c_int,                    # number of rows
+  POINTER( c_int ) ]        # state for each row
+
+ctraj.Measurements_Table_Select.restype = c_int
+ctraj.Measurements_Table_Select.argtypes = [
+  POINTER( cMeasurements ), # the table
+  c_int,                    # number of rows
+  c_int,                    # state or MEASUREMENTS_ANY_STATE
+  c_int,                    # first frame id
+  c_int,                    # one past the last frame id
+  POINTER( c_int ) ]        # (out) table indexes - may be NULL to count
+
 ctraj.Measurements_Table_From_Filename.restype = POINTER(cMeasurements)
 ctraj.Measurements_Table_From_Filename.argtypes = [
   POINTER( c_char ),
@@ -895,7 +1014,10 @@ ctraj.Measurements_Tables_Get_Diff_Frames.argtypes = [
   c_int,                    #number of rows for table A
   POINTER( cMeasurements ), #table B                   
   c_int,                    #number of rows for table B
-  POINTER( c_int ) ]        #size of returned static array
+  POINTER( c_int ) ]        #size of returned array
+
+ctraj.Measurements_Tables_Free_Diff_Frames.restype = None
+ctraj.Measurements_Tables_Free_Diff_Frames.argtypes = [ POINTER( c_int ) ]
 
 ctraj.Measurements_Table_Estimate_Best_Threshold.restype = c_double
 ctraj.Measurements_Table_Estimate_Best_Threshold.argtypes = [
@@ -1,4 +1,5 @@
 #include <QtGui>
+#include <QtConcurrent>
 #include "Data.h"
 #include "LockedCalls.h"
 
@@ -29,38 +30,263 @@ struct result_t {
   video_t *v;
   Whisker_Seg *w; int wn;
   Measurements *m; int mn;
+  Data::frameMap_t frames;///< w and m sorted into frames by maybeLoadAll()
+  bool has_w,has_m;
+  Measurements proto;     ///< header of the first measurements row
   QString whisker_path,
           measurement_path;
   int face_x,face_y;
   char orientation;
+  bool save_w,save_m;     ///< which files savefunc() writes
+  struct ref_t { Measurements *row; Whisker_Seg *curve; } *refs; ///< live row and curve behind each m[i].  curve may be NULL.
 
   result_t()
     : kind(UNKNOWN)
     , v(0)
     , w(0), wn(0)
     , m(0), mn(0)
+    , has_w(0), has_m(0)
     , face_x(0)
     , face_y(0)
     , orientation('u')
-    {}
-  result_t(Data *d)
-    : kind(UNKNOWN)
-    , v(d->video_)
-    , w(d->curves_)      , wn(d->ncurves_)
-    , m(d->measurements_), mn(d->nmeasurements_)
-    , whisker_path(d->lastWhiskerFile_)
-    , measurement_path(d->lastMeasurementsFile_)
-    , face_x(0)
-    , face_y(0)
-    , orientation('u')
-    { if(!d->faceDefaultAnchor_.isNull())
-      { face_x = d->faceDefaultAnchor_.x();
-        face_y = d->faceDefaultAnchor_.y();
-        orientation = d->faceDefaultOrient_?'v':'h';
-      }
+    , save_w(0), save_m(0)
+    , refs(0)
+    { memset(&proto,0,sizeof(proto));
     }
+  result_t(Data *d, bool save_w, bool save_m);
 };
 
+static void ws_vec_free_rest(Whisker_Seg **wv, int nkeep, int ntotal)
+{ if(!wv) return;
+  if(!*wv) return;
+  for(int i=nkeep;i<ntotal;++i)
+    locked::Free_Whisker_Seg_Data(*wv+i);
+  free(*wv);
+  *wv=NULL;
+}
+
+/** One frame traced on a worker thread.
+ *
+ *  The segments are owned by this object until Data::mergeTracedFrame_()
+ *  takes them.  Results that are never merged (e.g. dropped by a cancelled
+ *  job) are released along with the last reference.
+ */
+struct traced_frame_t
+{ int iframe;
+  bool notify;            ///< emit success() once merged (single frame requests)
+  Whisker_Seg *ws;
+  int n,k;                ///< n segments kept after overlap removal out of k found
+
+  traced_frame_t(int iframe, bool notify)
+    : iframe(iframe)
+    , notify(notify)
+    , ws(0)
+    , n(0)
+    , k(0)
+    {}
+  ~traced_frame_t() {ws_vec_free_rest(&ws,0,k);}
+};
+
+/** Worker for QtConcurrent::mapped().
+ *  Only touches the video and the tracer, never the Data tables, so it does
+ *  not need the GlobalDataLock.
+ */
+struct traceOne
+{ typedef traced_frame_ptr_t result_type;
+  video_t *v;
+  bool autocorrect,notify;
+
+  traceOne(video_t *v, bool autocorrect, bool notify)
+    : v(v), autocorrect(autocorrect), notify(notify) {}
+
+  traced_frame_ptr_t operator()(int iframe) const
+  { traced_frame_ptr_t r(new traced_frame_t(iframe,notify));
+    Image *im=0;
+    TRY(im=locked::video_get(v,iframe,autocorrect));
+    TRY(r->ws=locked::find_segments(iframe,im,NULL,&r->k));
+    r->n = locked::Remove_Overlapping_Whiskers_One_Frame( r->ws, r->k,
+                                              im->width, im->height,
+                                              2.0,    // scale down by this
+                                              2.0,    // distance threshold
+                                              0.5 );  // significant overlap fraction
+  Error:
+    if(im) locked::Free_Image(im);
+    return r;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//  FRAME CACHE
+////////////////////////////////////////////////////////////////////////////////
+
+static const char frameCacheBudgetKey[] = "Whisk/Config/FrameCacheMB";
+#define DEFAULT_FRAME_CACHE_MB 256
+#define READ_AHEAD_STEP        16  // frames queued when stepping one at a time
+#define READ_AHEAD_JUMP         2  // frames queued when jumping
+
+static QVector<QRgb> make_grayscale()
+{ QVector<QRgb> grayscale;
+  for(int i=0;i<256;++i)
+    grayscale.append(qRgb(i,i,i));
+  return grayscale;
+}
+
+/** Converts an 8-bit Image.  Safe to call from a worker thread. */
+static QImage to_qimage(Image *im)
+{ static const QVector<QRgb> grayscale = make_grayscale();
+  QImage qim(im->width,im->height,QImage::Format_Indexed8);
+  qim.setColorTable(grayscale);
+  for(int i=0;i<im->height;++i)                     // scan lines are padded
+    memcpy(qim.scanLine(i),im->array+im->width*i,im->width);
+  return qim;
+}
+
+/** Worker for QtConcurrent::run().
+ *  Decodes the frames queued in \a d->readAhead_ into the frame cache until
+ *  the queue is empty.  Only one of these runs at a time.
+ */
+void readaheadfunc(Data *d)
+{ for(;;)
+  { int iframe;
+    bool autocorrect;
+    Image *im;
+    { QMutexLocker lock(&d->frameCacheLock_);
+      do
+      { if(d->readAhead_.isEmpty())
+        { d->readAheadRunning_ = false;
+          return;
+        }
+        iframe = d->readAhead_.takeFirst();
+      } while(d->frameCache_.contains(iframe));
+      autocorrect = d->frameCacheAutocorrect_;
+    }
+    if(!(im=locked::video_get(d->video_,iframe,autocorrect)))
+      continue;
+    { QImage *qim = new QImage(to_qimage(im));
+      locked::Free_Image(im);
+      QMutexLocker lock(&d->frameCacheLock_);
+      if(autocorrect==d->frameCacheAutocorrect_) // setting changed while decoding
+        d->frameCache_.insert(iframe,qim,qim->byteCount());
+      else
+        delete qim;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  FRAME CHUNKS
+////////////////////////////////////////////////////////////////////////////////
+
+typedef Data::Frame Frame;
+
+static void frame_clear_measurements(Frame *f)
+{ free(f->meas);   f->meas=NULL;
+  free(f->values); f->values=NULL;
+  f->nmeas=0;
+}
+
+static void frame_clear(Frame *f)
+{ for(int i=0;i<f->ncurves;++i)
+    locked::Free_Whisker_Seg_Data(f->curves+i);
+  free(f->curves);
+  f->curves=NULL;
+  f->ncurves=0;
+  frame_clear_measurements(f);
+}
+
+static void frame_free(Frame *f)
+{ if(!f) return;
+  frame_clear(f);
+  delete f;
+}
+
+/** Resizes the rows of \a f to \a n with \a ncols measurements each.
+ *  Existing rows keep their values.  New rows are zeroed.
+ *  \returns 0 on failure, leaving \a f unchanged.
+ */
+static int frame_resize_measurements(Frame *f, int n, int ncols)
+{ Measurements *m;
+  double *v;
+  TRY(m=(Measurements*)realloc(f->meas,sizeof(Measurements)*qMax(n,1)));
+  f->meas=m;
+  TRY(v=(double*)realloc(f->values,sizeof(double)*2*ncols*qMax(n,1)));
+  f->values=v;
+  if(n>f->nmeas)
+  { memset(m+f->nmeas,0,sizeof(Measurements)*(n-f->nmeas));
+    memset(v+2*ncols*f->nmeas,0,sizeof(double)*2*ncols*(n-f->nmeas));
+  }
+  for(int i=0;i<n;++i)
+  { m[i].row      = i;
+    m[i].n        = ncols;
+    m[i].data     = v+2*ncols*i;
+    m[i].velocity = v+2*ncols*i+ncols;
+  }
+  f->nmeas=n;
+  return 1;
+Error:
+  return 0;
+}
+
+/** Copies the header and values of \a src into row \a i of \a f. */
+static void frame_copy_row(Frame *f, int i, const Measurements *src)
+{ Measurements *row = f->meas+i;
+  double *data     = row->data,
+         *velocity = row->velocity;
+  int n = row->n;
+  *row = *src;
+  row->row      = i;
+  row->n        = n;
+  row->data     = data;
+  row->velocity = velocity;
+  memcpy(data,    src->data,    sizeof(double)*qMin(n,src->n));
+  memcpy(velocity,src->velocity,sizeof(double)*qMin(n,src->n));
+}
+
+static void frame_remove_measurement(Frame *f, int i)
+{ int n = f->meas[i].n;
+  memmove(f->meas+i,f->meas+i+1,sizeof(Measurements)*(f->nmeas-i-1));
+  memmove(f->values+2*n*i,f->values+2*n*(i+1),sizeof(double)*2*n*(f->nmeas-i-1));
+  --f->nmeas;
+  for(;i<f->nmeas;++i)
+  { f->meas[i].row      = i;
+    f->meas[i].data     = f->values+2*n*i;
+    f->meas[i].velocity = f->values+2*n*i+n;
+  }
+}
+
+/** Takes ownership of the point arrays in \a w. \returns 0 on failure. */
+static int frame_append_curve(Frame *f, const Whisker_Seg *w)
+{ Whisker_Seg *t;
+  TRY(t=(Whisker_Seg*)realloc(f->curves,sizeof(Whisker_Seg)*(f->ncurves+1)));
+  f->curves=t;
+  f->curves[f->ncurves++]=*w;
+  return 1;
+Error:
+  return 0;
+}
+
+static void frame_remove_curve(Frame *f, int i)
+{ locked::Free_Whisker_Seg_Data(f->curves+i);
+  memmove(f->curves+i,f->curves+i+1,sizeof(Whisker_Seg)*(f->ncurves-i-1));
+  --f->ncurves;
+}
+
+/** \returns the index of the curve with id \a wid, or -1 if not found. */
+static int frame_find_curve(const Frame *f, int wid)
+{ for(int i=0;i<f->ncurves;++i)
+    if(f->curves[i].id==wid)
+      return i;
+  return -1;
+}
+
+/** \returns the index of the row for \a wid, or -1 if not found. */
+static int frame_find_measurement(const Frame *f, int wid)
+{ for(int i=0;i<f->nmeas;++i)
+    if(f->meas[i].wid==wid)
+      return i;
+  return -1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //  PATH MANIPULATION
 ////////////////////////////////////////////////////////////////////////////////
@@ -186,6 +412,58 @@ Error:
   return r; // if there's an error the corresponding field(s) in r will be NULL.
 }
 
+/**
+ * Sorts the flat whisker and measurement arrays in \a r into per-frame chunks.
+ * The frames take over the segment data.  The flat arrays are released.
+ * Runs on the loader thread so the GUI thread only has to swap maps.
+ */
+static void build_frames(result_t *r)
+{ QHash<int,int> nw,nm;
+  int ncols = 0;
+  for(int i=0;i<r->wn;++i) ++nw[r->w[i].time];
+  for(int i=0;i<r->mn;++i) ++nm[r->m[i].fid];
+  if(r->m && r->mn)
+  { ncols = r->m[0].n;
+    r->proto = r->m[0];
+    r->proto.data = r->proto.velocity = NULL;
+  }
+
+  // allocate each chunk once...
+  foreach(int fid,nw.keys())
+  { Frame *&f = r->frames[fid];
+    if(!f) f = new Frame;
+    TRY(f->curves=(Whisker_Seg*)malloc(sizeof(Whisker_Seg)*nw[fid]));
+  }
+  foreach(int fid,nm.keys())
+  { Frame *&f = r->frames[fid];
+    if(!f) f = new Frame;
+    TRY(frame_resize_measurements(f,nm[fid],ncols));
+    f->nmeas=0; // used as a cursor below
+  }
+
+  // ...then fill
+  for(int i=0;i<r->wn;++i)
+  { Frame *f = r->frames.value(r->w[i].time);
+    f->curves[f->ncurves++] = r->w[i];
+  }
+  for(int i=0;i<r->mn;++i)
+  { Frame *f = r->frames.value(r->m[i].fid);
+    frame_copy_row(f,f->nmeas++,r->m+i);
+  }
+  foreach(Frame *f,r->frames)
+    locked::Whisker_Seg_Sort_By_Id(f->curves,f->ncurves);
+
+  r->has_w = r->w!=NULL;
+  r->has_m = r->m!=NULL && r->mn>0;
+  free(r->w);                                  // segment data now belongs to the frames
+  r->w = NULL;
+  if(r->m) locked::Free_Measurements_Table(r->m);
+  r->m = NULL;
+  return;
+Error:
+  qFatal("%s(%d): Out of memory while sorting curves into frames."ENDL,__FILE__,__LINE__);
+}
+
 result_t maybeLoadAll(const QString &path)
 { QFutureSynchronizer<result_t> sync;
   QString cur = path;
@@ -224,6 +502,7 @@ result_t maybeLoadAll(const QString &path)
         ;
     }
   }
+  build_frames(&out);
   return out;
 }
 
@@ -240,32 +519,96 @@ bool isOrientationCharSame(char a, char b)
   }
 }
 
-void savefunc(const result_t &r)
+/**
+ * Writes the snapshot in \a r.
+ *
+ * Rows measured against a different face anchor than the current one are
+ * re-measured first.  Only those rows are touched, so the cost tracks the
+ * edits rather than the size of the data set.
+ *
+ * The snapshot arrays are shallow copies.  They are released here but the
+ * data they point to belongs to the frames.
+ *
+ * \returns 1 on success, 0 otherwise.
+ */
+int savefunc(const result_t &r)
 { QByteArray wp = r.whisker_path.toLocal8Bit(),
              mp = r.measurement_path.toLocal8Bit();
-  if(r.w)
-    TRY(locked::Save_Whiskers(wp.data(),NULL,r.w,r.wn));
-  if(r.m && r.m)
-  { if( (r.face_x!=r.m[0].face_x)           // do we need to recompute measurements?
-      ||(r.face_y!=r.m[0].face_y)
-      ||(!isOrientationCharSame(r.orientation,r.m[0].face_axis))
-      )
-    { // order measurements table by whiskers      
-      LOCK;
-      TRY( r.wn==r.mn );
-      locked::Whisker_Seg_Sort_By_Id(r.w,r.wn);
-      locked::Sort_Measurements_Table_Segment_UID(r.m,r.mn);
-      locked::Whisker_Segments_Update_Measurements( // make sure measures are up to date ~ O(ncurves)
-          r.m,                                      // assumes whisker segments and measurements
-          r.w, r.wn,                                // are in direct correspondance
-          r.face_x,
-          r.face_y,
-          r.orientation);
+  int ok = 0;
+  if(r.m && r.save_m && r.orientation!='u')
+  { for(int i=0;i<r.mn;++i)
+    { Measurements *row = r.refs[i].row;
+      if( r.refs[i].curve
+        &&( (r.face_x!=row->face_x)               // do we need to recompute measurements?
+          ||(r.face_y!=row->face_y)
+          ||(!isOrientationCharSame(r.orientation,row->face_axis))))
+      { row->face_x    = r.m[i].face_x    = r.face_x;
+        row->face_y    = r.m[i].face_y    = r.face_y;
+        row->face_axis = r.m[i].face_axis = r.orientation;
+        locked::Whisker_Seg_Measure(r.refs[i].curve,row->data,r.face_x,r.face_y,r.orientation);
+      }
     }
-    TRY(locked::Measurements_Table_To_Filename(mp.data(),NULL,r.m,r.mn));
   }
+  if(r.w && r.save_w)
+    TRY(locked::Save_Whiskers(wp.data(),NULL,r.w,r.wn));
+  if(r.m && r.save_m)
+    TRY(locked::Measurements_Table_To_Filename(mp.data(),NULL,r.m,r.mn));
+  ok = 1;
 Error:
+  free(r.w);
+  free(r.m);
+  free(r.refs);
+  return ok;
+}
+
+/**
+ * Makes a shallow snapshot of the curves and measurements in \a d for
+ * savefunc().  Rows are listed with the curve they belong to so stale
+ * measurements can be refreshed without sorting the tables.
+ */
+result_t::result_t(Data *d, bool save_w, bool save_m)
+  : kind(UNKNOWN)
+  , v(d->video_)
+  , w(0), wn(0)
+  , m(0), mn(0)
+  , has_w(0), has_m(0)
+  , whisker_path(d->lastWhiskerFile_)
+  , measurement_path(d->lastMeasurementsFile_)
+  , face_x(0)
+  , face_y(0)
+  , orientation('u')
+  , save_w(save_w && d->ncurves_>0)
+  , save_m(save_m && d->hasMeasurements_)
+  , refs(0)
+{ memset(&proto,0,sizeof(proto));
+  if(!d->faceDefaultAnchor_.isNull())
+  { face_x = d->faceDefaultAnchor_.x();
+    face_y = d->faceDefaultAnchor_.y();
+    orientation = d->faceDefaultOrient_?'v':'h';
+  }
+  if(this->save_w)
+    TRY(w=(Whisker_Seg*)malloc(sizeof(Whisker_Seg)*d->ncurves_));
+  if(this->save_m)
+  { TRY(m=(Measurements*)malloc(sizeof(Measurements)*qMax(d->nmeasurements_,1)));
+    TRY(refs=(ref_t*)malloc(sizeof(ref_t)*qMax(d->nmeasurements_,1)));
+  }
+  foreach(Frame *f,d->frames_)
+  { if(w)
+      for(int i=0;i<f->ncurves;++i)
+        w[wn++]=f->curves[i];
+    if(m)
+      for(int i=0;i<f->nmeas;++i)
+      { int j = frame_find_curve(f,f->meas[i].wid);
+        refs[mn].row   = f->meas+i;
+        refs[mn].curve = (j<0)?NULL:(f->curves+j);
+        m[mn++] = f->meas[i];
+      }
+  }
   return;
+Error:
+  free(w);    w=0;    wn=0;
+  free(m);    m=0;    mn=0;
+  free(refs); refs=0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -275,34 +618,38 @@ Error:
 Data::Data(QObject *parent)
   : QObject(parent)
   , video_(0)
-  , curves_(0)
   , ncurves_(0)
-  , ncurves_capacity_(0)
-  , measurements_(0)
   , nmeasurements_(0)
-  , nmeasurements_capacity_(0)
+  , hasMeasurements_(false)
+  , curvesDirty_(false)
+  , measurementsDirty_(false)
   , minIdent_(-1)
   , maxIdent_(-1)
   , faceDefaultOrient_(UNKNOWN_ORIENTATION)
   , face_param_dirty_(0)
   , watcher_(0)
-{ watcher_ = new QFutureWatcher<result_t>(this);
+  , frameCacheAutocorrect_(true)
+  , lastFrameRequest_(-1)
+  , readAheadRunning_(false)
+{ memset(&measProto_,0,sizeof(measProto_));
+  setFrameCacheBudget(QSettings().value(frameCacheBudgetKey,DEFAULT_FRAME_CACHE_MB).toInt());
+  watcher_ = new QFutureWatcher<result_t>(this);
   TRY(connect(watcher_,SIGNAL(finished()),this,SLOT(commit())));
 
   save_watcher_ = new QFutureWatcher<void>(this);
   TRY(connect(save_watcher_,SIGNAL(finished()),this,SIGNAL(measurementsSaved())));
   TRY(connect(save_watcher_,SIGNAL(finished()),this,SIGNAL(curvesSaved())));
-  TRY(connect(save_watcher_,SIGNAL(finished()),this,SLOT(saveDone())));
   return;
 Error:
   DIE;
 }
 
 Data::~Data()
-{ saving_.waitForFinished();
+{ stopTracing_();
+  stopReadAhead_();
+  saving_.waitForFinished();
   if(video_)        locked::video_close(&video_);
-  if(curves_)       { locked::Free_Whisker_Seg_Vec(curves_,ncurves_); curves_ = NULL; }
-  if(measurements_) { locked::Free_Measurements_Table(measurements_); measurements_ = NULL; }
+  clearFrames_();
 }
 
 // DATA    Load and Save ///////////////////////////////////////////////////////
@@ -333,33 +680,39 @@ void Data::open(const QUrl& path)
 void Data::commit()
 { result_t r = watcher_->future().result();
 
+  stopTracing_(); // workers may hold the old video
+
   // commit in measurements -> whiskers -> video order
   // to respect dependencies
   saving_.waitForFinished();
   { LOCK;
-    // Get rid of the old stuff
-    { int dirty_whiskers = ((r.v!=NULL) || (r.w!=NULL)) && (curves_!=NULL);
-      if(dirty_whiskers)
-      { locked::Free_Whisker_Seg_Vec(curves_,ncurves_); // this takes a huge amount of time (in Debug on Win7)
-        curves_=NULL;
-        ncurves_=0;
-        ncurves_capacity_=0;
+    if(r.v || r.has_w)                       // new curves replace everything
+    { clearFrames_();
+      frames_ = r.frames;
+      foreach(Frame *f,frames_)
+      { ncurves_       += f->ncurves;
+        nmeasurements_ += f->nmeas;
       }
-      if(measurements_)
-      { locked::Free_Measurements_Table(measurements_);
-        measurements_=NULL;
-        nmeasurements_=0;
-        nmeasurements_capacity_=0;
+    } else if(r.has_m)                       // new measurements for the curves already loaded
+    { foreach(Frame *f,frames_)
+        frame_clear_measurements(f);
+      nmeasurements_=0;
+      for(Data::frameMap_t::iterator i=r.frames.begin();i!=r.frames.end();++i)
+      { Frame *dst = frame_(i.key()),
+              *src = i.value();
+        dst->meas   = src->meas;
+        dst->nmeas  = src->nmeas;
+        dst->values = src->values;
+        nmeasurements_ += src->nmeas;
+        delete src;
       }
     }
-    // Load the new stuff
-    if(r.m)
-    { measurements_  = r.m;
-      nmeasurements_ = r.mn;
-      nmeasurements_capacity_ = nmeasurements_;
+    hasMeasurements_ = r.has_m || (hasMeasurements_ && !(r.v || r.has_w));
+    if(r.has_m)
+    { measProto_ = r.proto;
       lastMeasurementsFile_ = r.measurement_path;
-      faceDefaultAnchor_ = QPointF(r.m[0].face_x,r.m[0].face_y);
-      switch(r.m[0].face_axis)
+      faceDefaultAnchor_ = QPointF(r.proto.face_x,r.proto.face_y);
+      switch(r.proto.face_axis)
       { case 'x':
         case 'h':
           faceDefaultOrient_ = HORIZONTAL;
@@ -374,28 +727,20 @@ void Data::commit()
       emit facePositionChanged(facePosition(NULL));
       emit faceOrientationChanged(faceOrientation());
     }
-    if(r.w)
-    { curves_  = r.w;
-      ncurves_ = r.wn;
-      ncurves_capacity_ = ncurves_;
+    if(r.has_w)
       lastWhiskerFile_ = r.whisker_path;
-    }
     if(r.v)
-    { if(video_) locked::video_close(&video_);
+    { clearFrameCache_();
+      if(video_) locked::video_close(&video_);
       video_ = r.v;
     }
+    dirty_.clear();
+    curvesDirty_ = measurementsDirty_ = false;
   } //end lock
-  buildMeasurementsIndex_();
-  buildCurveIndex_();
   updateIdentity_();
   emit loaded();
 }
 
-void Data::saveDone()
-{ buildMeasurementsIndex_();
-  buildCurveIndex_();
-}
-
 /**
  * Starts an asynchronous call to save current data.
  *
@@ -403,9 +748,19 @@ void Data::saveDone()
  * so the main thread isn't blocked.
  */
 void Data::save()
-{ result_t r(this);
-  saving_=QtConcurrent::run(savefunc,r);
-  save_watcher_->setFuture(saving_);
+{ if(hasMeasurements_)
+    maybeCommitFacePosition_();
+  if(!isDirty())                        // nothing to write
+  { emit curvesSaved();
+    emit measurementsSaved();
+    return;
+  }
+  { result_t r(this,curvesDirty_,measurementsDirty_);
+    dirty_.clear();                     // edits wait for the save to finish, so
+    curvesDirty_ = measurementsDirty_ = false; // anything marked from here on is new
+    saving_=QtConcurrent::run(savefunc,r);
+    save_watcher_->setFuture(saving_);
+  }
 }
 
 /** saves either the whiskers or the measurements file
@@ -445,10 +800,12 @@ void Data::saveAs(const QString &path)
 }
 
 void Data::saveWhiskersAs(const QString &path)
-{ if(curves_)
-    TRY(locked::Save_Whiskers(
-          path.toLocal8Bit().data(),
-          NULL,curves_,ncurves_));
+{ if(ncurves_)
+  { result_t r(this,true,false);
+    r.whisker_path = path;
+    saving_.waitForFinished();
+    TRY(savefunc(r));
+  }
   emit curvesSaved();
   return;
 Error:
@@ -458,11 +815,12 @@ Error:
 }
 
 void Data::saveMeasurementsAs(const QString &path)
-{
-  if(measurements_)
-    TRY(locked::Measurements_Table_To_Filename(
-          path.toLocal8Bit().data(),
-          NULL,measurements_,nmeasurements_));
+{ if(hasMeasurements_)
+  { result_t r(this,false,true);
+    r.measurement_path = path;
+    saving_.waitForFinished();
+    TRY(savefunc(r));
+  }
   emit measurementsSaved();
 Error:
   QMessageBox mb;
@@ -471,28 +829,21 @@ Error:
 }
 
 void Data::remove(int iframe, int wid)
-{ Whisker_Seg *w;
-  Measurements *m;
-  TRY(w=get_curve_by_wid_(iframe,wid));  // query for the Whisker_seg first
+{ Frame *f;
+  int i;
+  TRY(f=frames_.value(iframe,NULL));
+  TRY((i=frame_find_curve(f,wid))>=0);   // query for the Whisker_seg first
   saving_.waitForFinished();             // make sure the saving thread is done before changing anything
   { LOCK;
-    locked::Free_Whisker_Seg_Data(w);    // Do the whiskers first
-    memmove(w,w+1, ((curves_+ncurves_)-(w+1))*sizeof(Whisker_Seg));
-    memset(curves_+ncurves_-1,0,sizeof(Whisker_Seg)); // setting to zero here is useful for catching bugs 
+    frame_remove_curve(f,i);             // Do the whiskers first
     --ncurves_;
-    buildCurveIndex_();
+    markDirty_(iframe,true,false);
     emit curvesDirtied();
 
-    SILENTTRY(m=get_meas_by_wid_(iframe,wid));
-    { Measurements t = *m;
-      memmove(m,m+1, ((measurements_+nmeasurements_)-(m+1))*sizeof(Measurements));      
-      measurements_[nmeasurements_-1] = t;
-      measurements_[nmeasurements_-1].fid=-1;
-      measurements_[nmeasurements_-1].wid=-1;
-      measurements_[nmeasurements_-1].state=-1;
-    }
+    SILENTTRY((i=frame_find_measurement(f,wid))>=0);
+    frame_remove_measurement(f,i);
     --nmeasurements_;
-    buildMeasurementsIndex_();
+    markDirty_(iframe,false,true);
     emit measurementsDirtied();
   }
   emit success();
@@ -502,21 +853,22 @@ Error:
 
 void Data::setIdentity(int iframe, int wid, int ident)
 { Measurements *mm;
-  measIdMap_t ms;
-  if(ident==-1 && !measurements_)
+  Frame *f;
+  if(ident==-1 && !hasMeasurements_)
     return;
   maybePopulateMeasurements();
   SILENTTRY(mm=get_meas_by_wid_(iframe,wid));
-  ms = measIndex_.value(iframe);
+  f = frames_.value(iframe);
   saving_.waitForFinished();
   { LOCK;
-    foreach(Measurements* m,ms)
-      if(m->state==ident)
-        m->state=-1;
+    for(int i=0;i<f->nmeas;++i)
+      if(f->meas[i].state==ident)
+        f->meas[i].state=-1;
     mm->state=ident;
 
     minIdent_ = qMin(minIdent_,ident);
     maxIdent_ = qMax(maxIdent_,ident);
+    markDirty_(iframe,false,true);
   }
 
   emit measurementsDirtied();
@@ -526,31 +878,61 @@ Error:
   return;
 }
 
-void Data::buildCurveIndex_()
-{ LOCK;
-  curveIndex_.clear();
-  if(curves_)
-    for(Whisker_Seg *c=curves_;c<curves_+ncurves_;++c)
-    { curveIdMap_t cs = curveIndex_[c->time];
-      cs.insert(c->id,c);
-      curveIndex_.insert(c->time,cs);
-    }
+Data::Frame* Data::frame_(int iframe)
+{ Frame *&f = frames_[iframe];
+  if(!f)
+    f = new Frame;
+  return f;
+}
+
+void Data::markDirty_(int iframe, bool curves, bool measurements)
+{ dirty_.insert(iframe);
+  curvesDirty_       |= curves;
+  measurementsDirty_ |= measurements;
 }
 
-void Data::buildMeasurementsIndex_()
+bool Data::isDirty()
+{ return curvesDirty_ || measurementsDirty_;
+}
+
+void Data::clearFrames_()
 { LOCK;
-  minIdent_=maxIdent_=-1;
-  measIndex_.clear();
-  if(measurements_)
-  { maxIdent_=measurements_->state;
-    for(Measurements *m=measurements_;m<measurements_+nmeasurements_;++m)
-    { measIdMap_t ms = measIndex_[m->fid];                // ... maybe make a new map for frame
-      ms.insert(m->wid,m);
-      measIndex_.insert(m->fid,ms);
-      minIdent_ = qMin(minIdent_,(int)m->state);
-      maxIdent_ = qMax(maxIdent_,(int)m->state);
-    }
-  }
+  foreach(Frame *f,frames_)
+    frame_free(f);
+  frames_.clear();
+  ncurves_=0;
+  nmeasurements_=0;
+}
+
+/**
+ * Measures \a w against the current face anchor and appends the row to
+ * the frame that holds \a w.  The caller holds the lock.
+ */
+int Data::appendMeasurement_(Whisker_Seg *w)
+{ Frame *f = frame_(w->time);
+  Measurements *row;
+  TRY(frame_resize_measurements(f,f->nmeas+1,measProto_.n));
+  row = f->meas+f->nmeas-1;
+  row->fid            = w->time;
+  row->wid            = w->id;
+  row->state          = -1;
+  row->face_x         = measProto_.face_x;
+  row->face_y         = measProto_.face_y;
+  row->face_axis      = measProto_.face_axis;
+  row->col_follicle_x = measProto_.col_follicle_x;
+  row->col_follicle_y = measProto_.col_follicle_y;
+  row->valid_velocity = 0;
+  locked::Whisker_Seg_Measure(
+      w,
+      row->data,
+      row->face_x,
+      row->face_y,
+      row->face_axis);
+  ++nmeasurements_;
+  markDirty_(w->time,false,true);
+  return 1;
+Error:
+  return 0;
 }
 
 // Bugfix, 05.11.2014, Author: Viktor Bahr (viktor@bccn-berlin.de)
@@ -558,21 +940,19 @@ void Data::buildMeasurementsIndex_()
 void Data::updateIdentity_()
 {
 	LOCK;
-	if(measurements_)
+	if(!hasMeasurements_ && ncurves_)
+		maybePopulateMeasurements();
+	if(hasMeasurements_)
 	{
 		TRY(maybeShowFaceAnchorRequiredDialog());
-		for(Measurements *m=measurements_;m<measurements_+nmeasurements_;++m)
-		{
-			setIdentity(m->fid, m->wid, m->wid);
-		}
-	}
-	else if(curves_)
-	{
-		TRY(maybeShowFaceAnchorRequiredDialog());
-		for(Whisker_Seg *c=curves_;c<curves_+ncurves_;++c)
-		{
-			setIdentity(c->time, c->id, c->id);
-		}
+		minIdent_=maxIdent_=-1;
+		foreach(Frame *f,frames_)
+			for(int i=0;i<f->nmeas;++i)
+			{ f->meas[i].state = f->meas[i].wid;
+				minIdent_ = qMin(minIdent_,f->meas[i].wid);
+				maxIdent_ = qMax(maxIdent_,f->meas[i].wid);
+			}
+		emit measurementsDirtied();
 	}
 
 Error:
@@ -596,10 +976,10 @@ bool Data::areFaceDefaultsSet()
 }
 QPointF Data::facePosition(int *is_unknown)
 { if(is_unknown) *is_unknown=1;
-  if(!measurements_)
+  if(!hasMeasurements_)
     return QPointF();
   if(is_unknown) *is_unknown=0;
-  return QPointF(measurements_[0].face_x,measurements_[0].face_y);
+  return QPointF(measProto_.face_x,measProto_.face_y);
 }
 
 void Data::setFacePosition(QPointF r)
@@ -610,28 +990,27 @@ void Data::setFacePosition(QPointF r)
   //emit facePositionChanged(r);  
 }
 
+/** New rows get measured against the committed anchor.  Existing rows are
+ *  brought up to date when they're saved.
+ */
 void Data::maybeCommitFacePosition_()
-{ if(!measurements_ && face_param_dirty_) return;
+{ if(!face_param_dirty_) return;
   TRY(areFaceDefaultsSet());
-  { int  x = faceDefaultAnchor_.x(),
-         y = faceDefaultAnchor_.y();
-    char o = (faceDefaultOrient_==HORIZONTAL)?'x':'y';
-    for(int i=0;i<nmeasurements_;++i)
-    { measurements_[i].face_x = x;
-      measurements_[i].face_y = y;
-      measurements_[i].face_axis = o;
-    }    
-  }
+  measProto_.face_x    = faceDefaultAnchor_.x();
+  measProto_.face_y    = faceDefaultAnchor_.y();
+  measProto_.face_axis = (faceDefaultOrient_==HORIZONTAL)?'x':'y';
+  measurementsDirty_   = true;
   face_param_dirty_=0;
 Error:
   return;
 }
 
 int Data::get_next_wid_(int iframe)
-{ curveIdMap_t ws = curveIndex_.value(iframe);
+{ Frame *f = frames_.value(iframe,NULL);
   int max=-1;
-  foreach(Whisker_Seg* w,ws)
-    max=(max>w->id)?max:w->id;
+  if(f)
+    for(int i=0;i<f->ncurves;++i)
+      max=(max>f->curves[i].id)?max:f->curves[i].id;
   return max+1; // if nothing found returns 0
 }
 
@@ -641,93 +1020,62 @@ void Data::traceAt(int iframe, QPointF r, bool autocorrect)
   Whisker_Seg *w=0;
   int offset,wid;
   Image *im=0;
-  
-  LOCK;
+
+  // trace without holding the data lock
   TRY(im=locked::video_get(video_,iframe,autocorrect));
   offset=im->width*(int)r.y() + (int)r.x();
   TRY(sd=locked::compute_seed_from_point(im,offset,8));
   TRY( w=locked::trace_whisker(sd,im));
   locked::Free_Image(im);
-  w->time = iframe;
-  w->id   = wid = get_next_wid_(iframe);
-
-  // append whisker
-  if(!curves_)
-  { curves_  = w;
-    ncurves_ = 1;
-    ncurves_capacity_ = ncurves_;
-    lastWhiskerFile_=whiskersFile(lastVideoFile_).absoluteFilePath();
-  } else
-  { if(measurements_)
+  im=0;
+  saving_.waitForFinished();             // make sure the saving thread is done before changing anything
+  { LOCK;
+    Frame *f;
+    w->time = iframe;
+    w->id   = wid = get_next_wid_(iframe);
+
+    // append whisker
+    if(!ncurves_)
+      lastWhiskerFile_=whiskersFile(lastVideoFile_).absoluteFilePath();
+    else if(hasMeasurements_)
       TRY(maybeShowFaceAnchorRequiredDialog()); // before we go any further
-    if( (++ncurves_)>ncurves_capacity_) // resize
-    { ncurves_capacity_ = ncurves_capacity_*1.2 + 50;
-      TRY(curves_=(Whisker_Seg*)realloc(curves_,sizeof(Whisker_Seg)*ncurves_capacity_));
-      memset(curves_+ncurves_-1,0,sizeof(Whisker_Seg)*(ncurves_capacity_-ncurves_));
-    }
-    curves_[ncurves_-1] = *w;
-    free(w);
-    buildCurveIndex_();
-  }
-  { curveIdMap_t ws = curveIndex_.value(iframe);
-    ws.insert(wid,curves_+ncurves_-1);
-    curveIndex_.insert(iframe,ws);
-  }
-  emit curvesDirtied();
+    f = frame_(iframe);
+    TRY(frame_append_curve(f,w));
+    free(w);                             // the frame owns the point arrays now
+    w = NULL;
+    ++ncurves_;
+    markDirty_(iframe,true,false);
+    emit curvesDirtied();
 
-  // maybe append measurement
-  if(measurements_)
-  { int was_resized=0;
-    maybeCommitFacePosition_();
-    if((++nmeasurements_)>nmeasurements_capacity_) // resize
-    { nmeasurements_capacity_ = nmeasurements_capacity_*1.2+50;
-      TRY(measurements_=locked::Realloc_Measurements_Table(
-            measurements_,
-            nmeasurements_-1,
-            nmeasurements_capacity_));
-      was_resized=1;
-    }
-    TRY(nmeasurements_<=nmeasurements_capacity_);
-    locked::Whisker_Seg_Measure(
-        curves_+ncurves_-1,
-        measurements_[nmeasurements_-1].data,
-        measurements_->face_x,
-        measurements_->face_y,
-        measurements_->face_axis);
-    measurements_[nmeasurements_-1].fid = iframe;
-    measurements_[nmeasurements_-1].wid = wid;
-    if(was_resized)
-      buildMeasurementsIndex_();
-    else
-    { measIdMap_t ms = measIndex_.value(iframe);
-      ms.insert(wid,measurements_+nmeasurements_-1);
-      measIndex_.insert(iframe,ms);
+    // maybe append measurement
+    if(hasMeasurements_)
+    { maybeCommitFacePosition_();
+      TRY(appendMeasurement_(f->curves+f->ncurves-1));
+      emit measurementsDirtied();
     }
-    emit measurementsDirtied();
+    emit success();
+    emit lastCurve(curveByWid(iframe,wid));
   }
-  emit success();
-  emit lastCurve(curveByWid(iframe,wid));
   return;
 Error:  
   if(im) locked::Free_Image(im);
-  if(w && curves_==NULL)  locked::Free_Whisker_Seg(w); // curves_ realloc failed
-  else if(w)              free(w);                     // something after curves_ realloc failed
-
+  if(w)  locked::Free_Whisker_Seg(w);
   return;
 }
 
 void Data::traceAtAndIdentify(int iframe,QPointF target,bool autocorrect_video,int ident)
-{ if(ident!=-1 && !measurements_)    
+{ if(ident!=-1 && !hasMeasurements_)
     TRY(maybePopulateMeasurements());
   { int oldcount = nmeasurements_;
     traceAt(iframe,target,autocorrect_video);     //don't return success failure because it's a slot
     { LOCK;
-      if(oldcount!=nmeasurements_)                    //check to see if something got traced 
-      { foreach(Measurements* m,measIndex_.value(iframe).values())  // make sure identity is unique in the frame
-          if(m->state==ident)
-            m->state=-1;
+      Frame *f = frames_.value(iframe,NULL);
+      if(f && oldcount!=nmeasurements_)               //check to see if something got traced 
+      { for(int i=0;i<f->nmeas;++i)                  // make sure identity is unique in the frame
+          if(f->meas[i].state==ident)
+            f->meas[i].state=-1;
         
-        measurements_[nmeasurements_-1].state = ident;//last traced is last row of measurements table
+        f->meas[f->nmeas-1].state = ident;            //last traced is last row of the frame
         minIdent_ = qMin(minIdent_,ident);
         maxIdent_ = qMax(maxIdent_,ident);
       }
@@ -737,105 +1085,141 @@ Error:
   return;
 }
 
-static void ws_vec_free_rest(Whisker_Seg **wv, int nkeep, int ntotal)
-{ if(!wv) return;
-  if(!*wv) return;
-  for(int i=nkeep;i<ntotal;++i)
-    locked::Free_Whisker_Seg_Data(*wv+i);
-  free(*wv);
-  *wv=NULL;
+/**
+ * Traces all whiskers in \a iframe on a worker thread.
+ *
+ * Previously traced curves in the frame are replaced once the result is
+ * merged.  success() and then frameTraced() are emitted at that point.
+ */
+void Data::traceFrame(int iframe, bool autocorrect)
+{ QList<int> frames;
+  frames.append(iframe);
+  startTracing_(frames,autocorrect,true);
 }
 
-void Data::traceFrame(int iframe, bool autocorrect)
-{ Whisker_Seg *ws=0;
-  Image *im=0;
-  int n,k=0;
+/**
+ * Traces frames \a first through \a last (inclusive) on worker threads.
+ *
+ * Results are merged on the main thread as they arrive, so the frames fill
+ * in while the user keeps working.  Emits frameTraced() and traceProgress()
+ * for each merged frame.  Use cancelTracing() to stop early.
+ */
+void Data::traceRange(int first, int last, bool autocorrect)
+{ QList<int> frames;
+  first = qMax(first,0);
+  last  = qMin(last,frameCount()-1);
+  for(int i=first;i<=last;++i)
+    frames.append(i);
+  if(!frames.isEmpty())
+    startTracing_(frames,autocorrect,false);
+}
+
+void Data::cancelTracing()
+{ foreach(QFutureWatcher<traced_frame_ptr_t> *t,tracers_)
+    t->cancel();
+}
+
+bool Data::isTracing()
+{ return !tracers_.isEmpty();
+}
+
+void Data::startTracing_(QList<int> frames, bool autocorrect, bool notify)
+{ QFutureWatcher<traced_frame_ptr_t> *t;
+  TRY(video_);
+  t = new QFutureWatcher<traced_frame_ptr_t>(this);
+  TRY(connect(t,SIGNAL(resultReadyAt(int)),this,SLOT(commitTrace_(int))));
+  TRY(connect(t,SIGNAL(finished()),this,SLOT(traceJobDone_())));
+  tracers_.append(t);
+  t->setFuture(QtConcurrent::mapped(frames,traceOne(video_,autocorrect,notify)));
+  return;
+Error:
+  return;
+}
+
+/** Used before the video gets swapped out from under the workers. */
+void Data::stopTracing_()
+{ foreach(QFutureWatcher<traced_frame_ptr_t> *t,tracers_)
+  { t->disconnect(this);
+    t->cancel();
+    t->waitForFinished();
+    t->deleteLater();
+  }
+  if(!tracers_.isEmpty())
+  { tracers_.clear();
+    emit tracingFinished();
+  }
+}
+
+void Data::commitTrace_(int index)
+{ QFutureWatcher<traced_frame_ptr_t> *t = static_cast<QFutureWatcher<traced_frame_ptr_t>*>(sender());
+  traced_frame_ptr_t r = t->resultAt(index);
+  SILENTTRY(r->ws);                      // the trace failed
+  mergeTracedFrame_(r->iframe,&r->ws,r->n,r->k);
+  if(r->notify)
+    emit success();
+  else
+    emit traceProgress(t->progressValue()-t->progressMinimum(),
+                       t->progressMaximum()-t->progressMinimum());
+  emit frameTraced(r->iframe);
+Error:
+  return;
+}
+
+void Data::traceJobDone_()
+{ QFutureWatcher<traced_frame_ptr_t> *t = static_cast<QFutureWatcher<traced_frame_ptr_t>*>(sender());
+  tracers_.removeAll(t);
+  t->deleteLater();
+  if(tracers_.isEmpty())
+    emit tracingFinished();
+}
+
+/** Removes all curves and measurements in \a iframe. */
+void Data::removeFrame_(int iframe)
+{ Frame *f = frames_.value(iframe,NULL);
+  if(!f) return;
+  ncurves_       -= f->ncurves;
+  nmeasurements_ -= f->nmeas;
+  frame_clear(f);
+  markDirty_(iframe,true,hasMeasurements_);
+}
 
+/**
+ * Replaces the curves in \a iframe with the first \a n of the \a k segments
+ * in \a *ws.  Takes ownership of \a *ws and sets it to NULL on success.
+ * Must be called from the main thread.
+ */
+void Data::mergeTracedFrame_(int iframe, Whisker_Seg **ws, int n, int k)
+{ Frame *f;
+  saving_.waitForFinished();             // make sure the saving thread is done before changing anything
   LOCK;
-  TRY(im=locked::video_get(video_,iframe,autocorrect));  
-  TRY(ws=locked::find_segments(iframe,im,NULL,&k));
-  n = locked::Remove_Overlapping_Whiskers_One_Frame( ws, k, 
-                                            im->width, im->height, 
-                                            2.0,    // scale down by this
-                                            2.0,    // distance threshold
-                                            0.5 );  // significant overlap fraction
-  locked::Free_Image(im);
+  if(!ncurves_)
+    lastWhiskerFile_=whiskersFile(lastVideoFile_).absoluteFilePath();
+  removeFrame_(iframe);
 
   // append whiskers
-  if(!curves_)
-  { curves_  = ws;
-    ncurves_ = n;
-    ncurves_capacity_ = ncurves_;
-    lastWhiskerFile_=whiskersFile(lastVideoFile_).absoluteFilePath();
-    { curveIdMap_t wmap = curveIndex_.value(iframe);
-      for(int i=0;i<n;++i)
-        wmap.insert(ws[i].id,curves_+i);
-      curveIndex_.insert(iframe,wmap);
-    }
-  } else
-  { int o;
-    //first need to remove curves from current frame
-    QList<int> wids;
-    foreach(Whisker_Seg *wc,curveIndex_.value(iframe).values())  /// \todo FIXME this is retardedly slow - should write something to remove them all at onces
-      wids.append(wc->id);
-    foreach(int wid,wids)
-      remove(iframe,wid);
-    //realloc and insert
-    o = ncurves_;
-    ncurves_+=n;
-    if( ncurves_>ncurves_capacity_) // resize
-    { ncurves_capacity_ = ncurves_*1.2 + 50;
-      TRY(curves_=(Whisker_Seg*)realloc(curves_,sizeof(Whisker_Seg)*ncurves_capacity_));
-      memset(curves_+o,0,sizeof(Whisker_Seg)*(ncurves_capacity_-o));
-    }
-    memcpy(curves_+o,ws,n*sizeof(Whisker_Seg));    
-    ws_vec_free_rest(&ws,n,k);  
-    buildCurveIndex_();
-  }
+  f = frame_(iframe);
+  TRY(f->curves=(Whisker_Seg*)malloc(sizeof(Whisker_Seg)*qMax(n,1)));
+  memcpy(f->curves,*ws,n*sizeof(Whisker_Seg));
+  f->ncurves = n;
+  ws_vec_free_rest(ws,n,k);
+  locked::Whisker_Seg_Sort_By_Id(f->curves,f->ncurves);
+  ncurves_ += n;
+  markDirty_(iframe,true,false);
   emit curvesDirtied();
 
   // update measurements
-  if(measurements_)
-  { int was_resized=0;
-    int o = nmeasurements_;
-    nmeasurements_ += n;
-    if(nmeasurements_>nmeasurements_capacity_) // resize
-    { nmeasurements_capacity_ = nmeasurements_*1.2+50;
-      TRY(measurements_=locked::Realloc_Measurements_Table(
-            measurements_,
-            o,
-            nmeasurements_capacity_));
-      was_resized=1;
-    }
-    TRY(nmeasurements_<=nmeasurements_capacity_); // double checking in case of weird stuff
-    for(int i=0;i<n;++i)
-    {
-      locked::Whisker_Seg_Measure(
-          curves_+o+i,
-          measurements_[o+i].data,
-          measurements_->face_x,
-          measurements_->face_y,
-          measurements_->face_axis);
-      measurements_[o+i].fid = curves_[o+i].time;
-      measurements_[o+i].wid = curves_[o+i].id;      
-    }
-    buildMeasurementsIndex_();
+  if(hasMeasurements_)
+  { for(int i=0;i<n;++i)
+      TRY(appendMeasurement_(f->curves+i));
     emit measurementsDirtied();
   }
-  emit success();
-  //emit lastCurve(curveByWid(iframe,wid));
-
-  return;
-Error: 
-  if(im) locked::Free_Image(im);
-  if(ws && curves_==NULL) locked::Free_Whisker_Seg(ws); // curves_ realloc failed
-  else if(ws)             ws_vec_free_rest(&ws,n,k);    // something after curves_ realloc failed
+Error:
   return;
 }
 
 Data::Orientation Data::faceOrientation()
-{ if(measurements_)
-    switch(measurements_[0].face_axis)
+{ if(hasMeasurements_)
+    switch(measProto_.face_axis)
     { case 'x':
       case 'h':
         return HORIZONTAL;
@@ -866,8 +1250,9 @@ int Data::nextMissingFrame(int iframe, int ident)
     return iframe;
   for(int i=iframe+1;i<frameCount();++i)
   { int any=0;
-    foreach(Measurements *m,measIndex_.value(i).values())
-    { if(m->state==ident)
+    Frame *f = frames_.value(i,NULL);
+    for(int j=0;f && j<f->nmeas;++j)
+    { if(f->meas[j].state==ident)
       { any=1;
         break;
       }
@@ -884,8 +1269,9 @@ int Data::prevMissingFrame(int iframe, int ident)
     return iframe;
   for(int i=iframe-1;i>=0;--i)
   { int any=0;
-    foreach(Measurements *m,measIndex_.value(i).values())
-    { if(m->state==ident)
+    Frame *f = frames_.value(i,NULL);
+    for(int j=0;f && j<f->nmeas;++j)
+    { if(f->meas[j].state==ident)
       { any=1;
         break;
       }
@@ -896,30 +1282,96 @@ int Data::prevMissingFrame(int iframe, int ident)
   return 0;
 }
 
+/**
+ * \returns the frame at \a iframe, or a null pixmap if it can't be read.
+ *
+ * Frames come from frameCache_ when they can.  Each call also queues the
+ * next few frames in the direction of travel for the read-ahead worker, so
+ * holding down next-frame or jumping repeatedly seldom waits on a decode.
+ */
 const QPixmap Data::frame(int iframe, bool autocorrect)
 { Image *im;
+  QImage qim;
   TRY(video_);
-  SILENTTRY(im=locked::video_get(video_,iframe,autocorrect));
-  { //QImage qim(im->array,im->width,im->height,im->width,QImage::Format_Indexed8);
-    QImage qim(im->width,im->height,QImage::Format_Indexed8);
-    QVector<QRgb> grayscale;
-    for(int i=0;i<256;++i)
-      grayscale.append(qRgb(i,i,i));
-    qim.setColorTable(grayscale);
-
-    // copy in the data
-    qim.fill(0);
-    for(int i=0;i<im->height;++i)
-      memcpy(qim.scanLine(i),im->array+im->width*i,im->width);
-
-    QPixmap out = QPixmap::fromImage(qim);
+  { QMutexLocker lock(&frameCacheLock_);
+    if(autocorrect!=frameCacheAutocorrect_)           // cached frames are stale
+    { frameCache_.clear();
+      frameCacheAutocorrect_ = autocorrect;
+    }
+    if(QImage *c=frameCache_.object(iframe))
+      qim = *c;
+  }
+  if(qim.isNull())
+  { SILENTTRY(im=locked::video_get(video_,iframe,autocorrect));
+    qim = to_qimage(im);
     locked::Free_Image(im);
-    return out;
+    { QMutexLocker lock(&frameCacheLock_);
+      frameCache_.insert(iframe,new QImage(qim),qim.byteCount());
+    }
   }
+  maybeReadAhead_(iframe,qim.byteCount());
+  return QPixmap::fromImage(qim);
 Error:
   return QPixmap();
 }
 
+/**
+ * Queues frames for the read-ahead worker.
+ *
+ * The step from the last request sets the direction and stride.  Single
+ * steps queue a longer run than jumps.  The run never takes more than half
+ * the cache budget so it can't evict itself.  Backward single steps are
+ * queued in ascending order so the decoder runs forward from one seek
+ * instead of seeking for every frame.
+ */
+void Data::maybeReadAhead_(int iframe, int nbytes)
+{ int step = iframe-lastFrameRequest_,
+      n    = frameCount(),
+      depth;
+  QList<int> frames;
+  lastFrameRequest_ = iframe;
+  if(step==0)
+    return;
+  depth = (step==1 || step==-1)?READ_AHEAD_STEP:READ_AHEAD_JUMP;
+  { QMutexLocker lock(&frameCacheLock_);
+    depth = qMin(depth,frameCache_.maxCost()/(2*qMax(nbytes,1)));
+    for(int k=1;k<=depth;++k)
+    { int i = iframe+k*step;
+      if(i<0 || i>=n)
+        break;
+      if(step==-1)
+        frames.prepend(i);
+      else
+        frames.append(i);
+    }
+    readAhead_ = frames;                               // replaces the old plan
+    if(readAhead_.isEmpty() || readAheadRunning_)
+      return;
+    readAheadRunning_ = true;
+  }
+  readingAhead_ = QtConcurrent::run(readaheadfunc,this);
+}
+
+/** Used before the video gets swapped out from under the worker. */
+void Data::stopReadAhead_()
+{ { QMutexLocker lock(&frameCacheLock_);
+    readAhead_.clear();
+  }
+  readingAhead_.waitForFinished();
+}
+
+void Data::clearFrameCache_()
+{ stopReadAhead_();
+  QMutexLocker lock(&frameCacheLock_);
+  frameCache_.clear();
+  lastFrameRequest_ = -1;
+}
+
+void Data::setFrameCacheBudget(int megabytes)
+{ QMutexLocker lock(&frameCacheLock_);
+  frameCache_.setMaxCost(qBound(0,megabytes,2047)<<20); // cost is an int
+}
+
 int Data::frameCount()
 { if(video_)
     return locked::video_frame_count(video_);
@@ -933,44 +1385,41 @@ int Data::wid(int iframe, int icurve)
 }
 
 Whisker_Seg* Data::get_curve_(int iframe, int icurve)
-{ QList<Whisker_Seg*> cs;
-  cs = curveIndex_.value(iframe,curveIdMap_t())
-                  .values();
-  TRY(0<=icurve && icurve<cs.size());
-  return cs.at(icurve);
+{ Frame *f;
+  TRY(f=frames_.value(iframe,NULL));
+  TRY(0<=icurve && icurve<f->ncurves);
+  return f->curves+icurve;
 Error:
   return NULL;
 }
 
 Whisker_Seg* Data::get_curve_by_wid_(int iframe, int wid)
-{ Whisker_Seg *w = 0;
-  QList<Whisker_Seg*> cs = curveIndex_.value(iframe,curveIdMap_t()).values();
-  foreach(Whisker_Seg *c,cs)
-    if(c->id==wid)
-      w=c;
-  return w;
+{ Frame *f = frames_.value(iframe,NULL);
+  int i;
+  if(!f || (i=frame_find_curve(f,wid))<0)
+    return NULL;
+  return f->curves+i;
 }
 
 Measurements* Data::get_meas_(int iframe, int icurve)
-{ QList<Measurements*> ms;
-  ms = measIndex_.value(iframe,measIdMap_t())
-                 .values();
-  TRY(0<icurve && icurve<ms.size());
-  return ms.at(icurve);
+{ Whisker_Seg *w;
+  TRY(w=get_curve_(iframe,icurve));
+  return get_meas_by_wid_(iframe,w->id);
 Error:
   return NULL;
 }
 
 Measurements* Data::get_meas_by_wid_(int iframe, int wid)
-{ measIdMap_t ms = measIndex_.value(iframe);
-  return  ms.value(wid,NULL);
+{ Frame *f = frames_.value(iframe,NULL);
+  int i;
+  if(!f || (i=frame_find_measurement(f,wid))<0)
+    return NULL;
+  return f->meas+i;
 }
 
 bool Data::is_ident_same_(int iframe, int wid, int ident)
-{ measIdMap_t ms = measIndex_.value(iframe);
-  Measurements *row; 
-  if(row=ms.value(wid,NULL))
-    return row->state == ident;
+{ Measurements *row = get_meas_by_wid_(iframe,wid);
+  return row && row->state == ident;
 }
 
 int Data::maybeShowFaceAnchorRequiredDialog()
@@ -988,20 +1437,36 @@ int Data::maybeShowFaceAnchorRequiredDialog()
 }
 
 int Data::maybePopulateMeasurements()
-{ if(!curves_)      return 0;
-  if(measurements_) return 1;
+{ if(!ncurves_)        return 0;
+  if(hasMeasurements_) return 1;
   TRY(maybeShowFaceAnchorRequiredDialog());
   { LOCK;
-    TRY(measurements_=locked::Whisker_Segments_Measure(
-          curves_,ncurves_,
-          faceDefaultAnchor_.x(),
-          faceDefaultAnchor_.y(),
-          faceDefaultOrient_?'y':'x'));
-    nmeasurements_=ncurves_;
-    for(int i=0;i<nmeasurements_;++i)// set initial identities to unknown
-      measurements_[i].state=-1;
+    foreach(Frame *f,frames_)
+    { Measurements *table;
+      if(!f->ncurves) continue;
+      TRY(table=locked::Whisker_Segments_Measure(
+            f->curves,f->ncurves,
+            faceDefaultAnchor_.x(),
+            faceDefaultAnchor_.y(),
+            faceDefaultOrient_?'y':'x'));
+      if(!hasMeasurements_)
+      { measProto_ = table[0];
+        measProto_.data = measProto_.velocity = NULL;
+        hasMeasurements_ = true;
+      }
+      if(!frame_resize_measurements(f,f->ncurves,table[0].n))
+      { locked::Free_Measurements_Table(table);
+        goto Error;
+      }
+      for(int i=0;i<f->ncurves;++i)
+      { frame_copy_row(f,i,table+i);
+        f->meas[i].state=-1;                   // set initial identities to unknown
+      }
+      locked::Free_Measurements_Table(table);
+      nmeasurements_ += f->ncurves;
+      markDirty_(f->curves[0].time,false,true);
+    }
   }
-  buildMeasurementsIndex_();
   lastMeasurementsFile_ = measurementsFile(lastWhiskerFile_).absoluteFilePath();
   return 1;
 Error:
@@ -1029,15 +1494,15 @@ Error:
 }
 
 int Data::curveCount(int iframe)
-{ return curveIndex_.value(iframe,curveIdMap_t()).size();
+{ Frame *f = frames_.value(iframe,NULL);
+  return f?f->ncurves:0;
 }
 
 int Data::identity(int iframe, int icurve)
 { Measurements *row;
   Whisker_Seg  *w;
   TRY(  w=get_curve_(iframe,icurve))  // icurve is not necessarily the whisker id, so look up the whisker first
-  SILENTTRY(row= measIndex_.value(iframe,measIdMap_t())
-                     .value(w->id,NULL));
+  SILENTTRY(row=get_meas_by_wid_(iframe,w->id));
   return row->state;
 Error:
   return -1; //unknown
@@ -6,8 +6,12 @@
  *
  * \notes
  * - negative one (-1) is a special curve identity.  It represents an unknown identity.
- * - If the whiskers or measurements arrays get reordered or changed, their
- *   respective indexes need to be rebuilt.
+ * - Curves and measurements are stored in per-frame chunks (Data::Frame).
+ *   Edits only touch the chunk for the edited frame.
+ * - Edited frames are tracked so save() can skip unchanged files and only
+ *   re-measure stale rows.
+ * - Decoded frames are kept in an LRU cache bounded by a memory budget.
+ *   frame() reads ahead on a worker thread in the direction of travel.
  */
 #pragma once
 
@@ -16,6 +20,8 @@
 #include "LockedCalls.h"
 
 struct result_t;
+struct traced_frame_t;
+typedef QSharedPointer<traced_frame_t> traced_frame_ptr_t;
 
 class Data : public QObject
 { Q_OBJECT
@@ -45,6 +51,9 @@ class Data : public QObject
       Orientation  faceOrientation();
               int  nextMissingFrame(int iframe, int ident); ///< \returns the next frame number lacking a curve with the given identity
               int  prevMissingFrame(int iframe, int ident); ///< \returns the prev frame number lacking a curve with the given identity
+             bool  isTracing();                          ///< \returns true while any background trace job is running
+             bool  isDirty();                            ///< \returns true if there are edits that haven't been saved
+             void  setFrameCacheBudget(int megabytes);   ///< bounds the memory used by cached frames.  0 disables the cache.
 
     static bool isValidPath(const QString& path);        ///< \returns true if, at first glance, the path seems to point to something relevant.
 
@@ -54,10 +63,20 @@ class Data : public QObject
     Measurements  *get_meas_(int iframe,int icurve);     ///< icurve is NOT the "whisker id"
     Measurements  *get_meas_by_wid_(int iframe,int wid); ///< \returns NULL if not found
     bool           is_ident_same_(int iframe, int wid, int ident);
+    int            appendMeasurement_(Whisker_Seg *w);   ///< measures w and appends a row to its frame.  \returns 0 on failure.
+    void           markDirty_(int iframe, bool curves, bool measurements);
+    void           clearFrames_();                       ///< releases all curves and measurements
     int            maybePopulateMeasurements();          ///< \returns 1 if measurements table is populated, 0 otherwise
     int            maybeShowFaceAnchorRequiredDialog();  ///< \returns 0 if face anchor defaults are not set, 0 otherwise
     void           maybeCommitFacePosition_();           ///< fills in the measurements_ table with the current face position and orientation
     int            get_next_wid_(int iframe);            ///> \returns a good wid for iframe.  Used for appending new curves.
+    void           startTracing_(QList<int> frames, bool autocorrect, bool notify);
+    void           stopTracing_();                       ///< cancels background tracing and blocks till the workers are done
+    void           removeFrame_(int iframe);             ///< removes every curve and measurement in iframe.  Caller holds the lock.
+    void           mergeTracedFrame_(int iframe, Whisker_Seg **ws, int n, int k);
+    void           maybeReadAhead_(int iframe, int nbytes); ///< queues frames past iframe in the direction of travel
+    void           stopReadAhead_();                     ///< cancels read-ahead and blocks till the worker is done
+    void           clearFrameCache_();
 
   public slots:
     void open(const QString& path);
@@ -74,7 +93,9 @@ class Data : public QObject
 
     void traceAt(int iframe, QPointF r, bool autocorrect=true);
     void traceAtAndIdentify(int iframe,QPointF target,bool autocorrect_video,int ident);
-    void traceFrame(int iframe, bool autocorrect);
+    void traceFrame(int iframe, bool autocorrect);       ///< traces in the background.  Emits success() then frameTraced() when merged.
+    void traceRange(int first, int last, bool autocorrect); ///< traces frames [first,last] in the background
+    void cancelTracing();                                ///< stops background tracing.  Frames already traced are kept.
 
   signals:
     void loaded();                                        ///< emited when commit of new data is finished
@@ -86,29 +107,44 @@ class Data : public QObject
     void facePositionChanged(QPointF r);                  ///< only emitted after load
     void faceOrientationChanged(Data::Orientation o);     ///< only emitted after load
     void lastCurve(QPolygonF);                            ///< emits shape of the last edited curve
+    void frameTraced(int iframe);                         ///< emitted after background trace results for iframe are merged
+    void traceProgress(int done, int total);              ///< emitted as frames from traceRange() are merged
+    void tracingFinished();                               ///< emitted once no more background trace jobs are running
 
   protected slots:
     void commit();                                        ///< called once a load succesfully completes to merge loaded data
-    void saveDone();                                      ///< called after save.  Save may update data before writing to disk. This commits changes.
+    void commitTrace_(int index);                         ///< merges one traced frame on the main thread
+    void traceJobDone_();                                 ///< called when a background trace job finishes or is cancelled
 
   public: //pseudo-private
-    typedef QMap<int,Whisker_Seg*>           curveIdMap_t;///<        id->Whisker_Seg*
-    typedef QMap<int,curveIdMap_t>           curveMap_t;  ///< frame->id->Whisker_Seg*
-    typedef QMap<int,Measurements*>          measIdMap_t; ///<        id->Measurements*
-    typedef QMap<int,measIdMap_t>            measMap_t;   ///< frame->id->Measurements*
+    /** One frame's curves and measurements.
+     *  Owns the curve point arrays and the storage behind each row's data and
+     *  velocity.  Curves are kept sorted by id.  Rows are matched to curves by
+     *  wid, not by position.
+     */
+    struct Frame
+    { Whisker_Seg      *curves;
+      int               ncurves;
+      Measurements     *meas;
+      int               nmeas;
+      double           *values;                   ///< 2*meas[i].n doubles per row
+      Frame() : curves(0), ncurves(0), meas(0), nmeas(0), values(0) {}
+    };
+    typedef QMap<int,Frame*>                 frameMap_t;  ///< frame->Frame (owned)
+
+    Frame            *frame_(int iframe);                 ///< \returns the chunk for iframe, adding an empty one if needed
 
     video_t          *video_;
     Image            *lastImage_;
 
-    Whisker_Seg      *curves_;
-    int               ncurves_;
-    int               ncurves_capacity_;
-    curveMap_t        curveIndex_;
-
-    Measurements     *measurements_;
-    int               nmeasurements_;
-    int               nmeasurements_capacity_;
-    measMap_t         measIndex_;
+    frameMap_t        frames_;
+    int               ncurves_;               ///< total over all frames
+    int               nmeasurements_;         ///< total over all frames
+    bool              hasMeasurements_;
+    Measurements      measProto_;             ///< face and column layout for new rows.  data is NULL.
+    QSet<int>         dirty_;                 ///< frames edited since the last save
+    bool              curvesDirty_;
+    bool              measurementsDirty_;
     int               minIdent_;
     int               maxIdent_;
     QPointF           faceDefaultAnchor_;
@@ -118,11 +154,17 @@ class Data : public QObject
     QFutureWatcher<result_t> *watcher_;
     QFutureWatcher<void>     *save_watcher_;
     QFuture<void>     saving_;
+    QList<QFutureWatcher<traced_frame_ptr_t>*> tracers_;  ///< running background trace jobs
+    QCache<int,QImage> frameCache_;          ///< decoded frames.  Cost is in bytes.
+    QMutex            frameCacheLock_;        ///< guards the cache and the read-ahead queue
+    bool              frameCacheAutocorrect_; ///< cached frames were decoded with this setting
+    int               lastFrameRequest_;
+    QList<int>        readAhead_;             ///< frames queued for the read-ahead worker
+    bool              readAheadRunning_;
+    QFuture<void>     readingAhead_;
     QString           lastVideoFile_;         ///< gets set whether or not video loads
     QString           lastWhiskerFile_;
     QString           lastMeasurementsFile_;
 
-    void buildCurveIndex_();
-    void buildMeasurementsIndex_();
 	void updateIdentity_();
 };
@@ -2,6 +2,7 @@
 #include <QGLWidget>
 #include <QGraphicsView>
 #include <QGraphicsSvgItem>
+#include <QInputDialog>
 #include <QDebug>
 
 #include "Editor.h"
@@ -204,6 +205,7 @@ Editor::Editor(QWidget *parent,Qt::WindowFlags f)
   , autocorrect_video_(true)
   , advance_on_successful_left_click_(false)
   , is_auto_mode_on_(false)
+  , tracing_frame_(-1)
   , iframe_(0)
 {
   //setContextMenuPolicy(Qt::ActionsContextMenu);
@@ -261,6 +263,7 @@ Editor::Editor(QWidget *parent,Qt::WindowFlags f)
   ///// responses to data signals
   { TRY(connect(&data_,SIGNAL(success()),this,SLOT(maybeNextFrame())),ErrorConnect);
     TRY(connect(&data_,SIGNAL(lastCurve(QPolygonF)),this,SLOT(maybeShowLastCurve(QPolygonF))),ErrorConnect);
+    TRY(connect(&data_,SIGNAL(frameTraced(int)),this,SLOT(frameTraced(int))),ErrorConnect);
   }
 
 
@@ -434,18 +437,45 @@ void Editor::traceAtCursor()
   showFrame(iframe_);
 }
 
+/** Tracing a frame runs in the background.  Propigation happens in
+ *  frameTraced() once the result has been merged.
+ */
 void Editor::traceFrame()
-{ int oframe=iframe_;
+{ tracing_frame_=iframe_;
   data_.traceFrame(iframe_,autocorrect_video_);
-  showFrame(iframe_);
-  if(iframe_!=oframe && is_auto_mode_on_)
-    emit propigateTraceFrame();
 }
 
 void Editor::propigateTraceFrameHandler()
 { traceFrame();
 }
 
+void Editor::traceRange()
+{ bool ok;
+  int last = QInputDialog::getInt(this,tr("Trace range"),
+                                  tr("Trace from frame %1 through frame:").arg(iframe_),
+                                  data_.frameCount()-1,   // default
+                                  iframe_,                // min
+                                  data_.frameCount()-1,   // max
+                                  1,&ok);
+  if(ok)
+    data_.traceRange(iframe_,last,autocorrect_video_);
+}
+
+/** Called whenever background trace results get merged.
+ *  success() has already been handled, so iframe_ may have advanced.
+ */
+void Editor::frameTraced(int iframe)
+{ if(iframe==tracing_frame_)
+  { tracing_frame_=-1;
+    if(iframe_!=iframe && is_auto_mode_on_)
+    { emit propigateTraceFrame();
+      return;
+    }
+  }
+  if(iframe==iframe_)
+    showFrame(iframe_);
+}
+
 void Editor::setFaceAnchor()
 { QPointF target;
   if(last_context_menu_point_.isNull()) // keyboard accelerator activated.  Use current mouse pos.
@@ -613,6 +643,8 @@ void Editor::makeActions_()
   actions_["setFaceAnchor"]=new QAction(QIcon(QPixmap(":/icons/faceindicator")),tr("Place &face anchor")  ,this);
   actions_["traceAt"     ]= new QAction(QIcon(":/icons/traceAt"),tr("&Trace a new curve"),this);
   actions_["traceFrame"  ]= new QAction(QIcon(":/icons/traceFrame"),tr("Trace all curves"),this);
+  actions_["traceRange"  ]= new QAction(tr("Trace a range of frames..."),this);
+  actions_["cancelTrace" ]= new QAction(tr("Stop background tracing"),this);
   actions_["autocorrect" ] = new QAction(tr("&Stripe correction"),this);
   actions_["advance"     ] = new QAction(tr("&Advance after edit"),this);
   actions_["automode"    ] = new QAction(tr("&Automatically propigate clicks"),this);
@@ -620,6 +652,8 @@ void Editor::makeActions_()
   actions_["prevMissing" ]= new QAction(tr("Previous Missing"),this);
 
   actions_["traceFrame" ]->setStatusTip(tr("Trace all whiskers in the current frame.  Previously traced curves will be removed."));
+  actions_["traceRange" ]->setStatusTip(tr("Trace all whiskers in frames starting from the current one.  Runs in the background."));
+  actions_["cancelTrace"]->setStatusTip(tr("Stop background tracing.  Frames that are already done are kept."));
   actions_["advance"    ]->setStatusTip(tr("If set, the next frame will be shown after successfully tracing or identifying a curve."));
   actions_["automode"   ]->setStatusTip(tr("If set, attempts to trace or identify curves are automaticaly repeated."));
   actions_["nextMissing"]->setStatusTip(tr("Jump forward to a frame lacking a curve with the currently selected identity."));
@@ -655,6 +689,7 @@ void Editor::makeActions_()
   actions_["setFaceAnchor"   ]->setShortcut( QKeySequence( "f"));
   actions_["traceAt"         ]->setShortcut( QKeySequence( "t"));
   actions_["traceFrame"      ]->setShortcut( QKeySequence( "Ctrl+t"));
+  actions_["traceRange"      ]->setShortcut( QKeySequence( "Ctrl+Shift+t"));
   actions_["autocorrect"     ]->setShortcut( QKeySequence( "s"));
   actions_["advance"         ]->setShortcut( QKeySequence( "a"));
   actions_["automode"        ]->setShortcut( QKeySequence( "Space"));
@@ -683,6 +718,8 @@ void Editor::makeActions_()
   TRY(connect(actions_["setFaceAnchor"],SIGNAL(triggered()),this,SLOT(setFaceAnchor()) ),Error);
   TRY(connect(actions_["traceAt"      ],SIGNAL(triggered()),this,SLOT(traceAtCursor()) ),Error);
   TRY(connect(actions_["traceFrame"   ],SIGNAL(triggered()),this,SLOT(traceFrame()) ),Error);
+  TRY(connect(actions_["traceRange"   ],SIGNAL(triggered()),this,SLOT(traceRange()) ),Error);
+  TRY(connect(actions_["cancelTrace"  ],SIGNAL(triggered()),&data_,SLOT(cancelTracing()) ),Error);
   TRY(connect(actions_["nextMissing"  ],SIGNAL(triggered()),this,SLOT(nextMissing()) ),Error);
   TRY(connect(actions_["prevMissing"  ],SIGNAL(triggered()),this,SLOT(prevMissing()) ),Error);
   actions_["autocorrect" ]->setCheckable(true);
@@ -708,6 +745,8 @@ Error:
 
 QList<QAction*> Editor::tracingActions()
 { static const char* names[] = {"traceFrame",
+                                "traceRange",
+                                "cancelTrace",
                                 "delete",
                                 "autocorrect",
                                 "advance",
@@ -803,6 +842,7 @@ void Editor::contextMenuEvent(QContextMenuEvent *event)
   const char* as[] = {"setFaceAnchor"
                      ,"traceAt"
                      ,"traceFrame"
+                     ,"traceRange"
                      ,NULL
   };
   const char **a = as;
@@ -101,6 +101,7 @@ class Editor : public QWidget
     void traceAtAndIdentify(QPointF target);
     void traceAtCursor();
     void traceFrame();
+    void traceRange();           ///< Asks for a last frame and traces from the current frame through it in the background.
     void setFaceAnchor();        ///< Response from editor action.  Updates FaceIndicator and Data.
     void updateFromFaceAnchor(); ///< Commit state of FaceIndicator item to Data.
     void setAutocorrect(bool);
@@ -126,6 +127,7 @@ class Editor : public QWidget
     void propigateTraceHandler(QPointF);
     void propigateIdentityHandler(int query_frame,int query_wid);
     void propigateTraceFrameHandler();
+    void frameTraced(int iframe);
 
   protected:
     QMap<QString,QAction*>  actions_;
@@ -143,5 +145,6 @@ class Editor : public QWidget
     bool                    autocorrect_video_;
     bool                    advance_on_successful_left_click_;
     bool                    is_auto_mode_on_;
+    int                     tracing_frame_;      ///< frame waiting on a traceFrame() request, or -1
     int     iframe_;
 };
@@ -16,13 +16,51 @@ extern "C"{
 namespace locked {
 QMutex GlobalWhiskLock; // = NULL; //& GlobalWhiskLock_;
 
+// The tracing calls keep their scratch per thread and may run on several
+// threads at once once the detector banks are loaded (see thread.h).  They
+// only hold this for reading, so workers and the GUI thread don't wait on
+// each other.  Loading parameters, which the tracer reads, holds it for
+// writing.
+QReadWriteLock GlobalTraceLock;
+static bool    DetectorBanksLoaded = false;  // guarded by GlobalTraceLock
+
+// Measurement keeps its scratch in statics, so it's serialized, but on its
+// own lock rather than behind tracing.
+QMutex GlobalMeasureLock;
+
 #define LOCK QMutexLocker locker(&GlobalWhiskLock)
 #define WRAP(expr) {LOCK; return (whisk::expr);}
 #define WRAPNR(expr) {LOCK; (whisk::expr);}
 
+class TraceLocker
+{ public:
+    TraceLocker()
+    { GlobalTraceLock.lockForRead();
+      if(!DetectorBanksLoaded)
+      { GlobalTraceLock.unlock();
+        { QWriteLocker w(&GlobalTraceLock);
+          if(!DetectorBanksLoaded)
+            DetectorBanksLoaded = whisk::load_detector_banks()!=0;
+        }
+        GlobalTraceLock.lockForRead();
+      }
+    }
+    ~TraceLocker() {GlobalTraceLock.unlock();}
+};
+#define TLOCK TraceLocker locker
+#define TWRAP(expr) {TLOCK; return (whisk::expr);}
+#define TWRAPNR(expr) {TLOCK; (whisk::expr);}
+
+#define MLOCK QMutexLocker locker(&GlobalMeasureLock)
+#define MWRAP(expr) {MLOCK; return (whisk::expr);}
+#define MWRAPNR(expr) {MLOCK; (whisk::expr);}
+
 //  PARAMS  ////////////////////////////////////////////////////////////////////
 t_params* Params()                     WRAP(Params())
-int Load_Params_File(char *filename)   WRAP(Load_Params_File(filename))
+int Load_Params_File(char *filename)   { QMutexLocker   a(&GlobalWhiskLock);
+                                         QWriteLocker   b(&GlobalTraceLock);
+                                         QMutexLocker   c(&GlobalMeasureLock);
+                                         return whisk::Load_Params_File(filename); }
 int Print_Params_File(char *filename)  WRAP(Print_Params_File(filename))
 
 //  WHISKER IO  ////////////////////////////////////////////////////////////////
@@ -71,13 +109,13 @@ WRAPNR(Free_Image(image))
 
 //  TRACE  /////////////////////////////////////////////////////////////////////
 Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
-WRAP(find_segments(iFrame,image,bg,pnseg))
+TWRAP(find_segments(iFrame,image,bg,pnseg))
 
 Seed* compute_seed_from_point  ( Image *image, int p, int maxr )
-WRAP(compute_seed_from_point(image,p,maxr))
+TWRAP(compute_seed_from_point(image,p,maxr))
 
 Whisker_Seg* trace_whisker(Seed *s,Image *image)
-WRAP(trace_whisker(s,image))
+TWRAP(trace_whisker(s,image))
 
 void Whisker_Seg_Sort_By_Id( Whisker_Seg *wv, int n )
 WRAP(Whisker_Seg_Sort_By_Id(wv,n))
@@ -92,7 +130,7 @@ int Remove_Overlapping_Whiskers_One_Frame( Whisker_Seg *wv,
                                            float scale,
                                            float dist_thresh,
                                            float overlap_thresh )
-WRAP(Remove_Overlapping_Whiskers_One_Frame(wv,wv_n,w,h,scale,dist_thresh,overlap_thresh))
+TWRAP(Remove_Overlapping_Whiskers_One_Frame(wv,wv_n,w,h,scale,dist_thresh,overlap_thresh))
 
 // TRAJ  ///////////////////////////////////////////////////////////////////////
 
@@ -100,17 +138,17 @@ void Sort_Measurements_Table_Segment_UID( Measurements *table, int nrows )
 WRAP(Sort_Measurements_Table_Segment_UID(table,nrows))
 
 void Whisker_Seg_Measure(Whisker_Seg *w,double *dest,int facex,int facey,char face_axis )
-WRAPNR(Whisker_Seg_Measure(w,dest,facex,facey,face_axis))
+MWRAPNR(Whisker_Seg_Measure(w,dest,facex,facey,face_axis))
 
 Measurements *Whisker_Segments_Measure( 
     Whisker_Seg *wv, int wvn, 
     int facex, int facey, char face_axis )
-WRAP(Whisker_Segments_Measure(wv,wvn,facex,facey,face_axis))
+MWRAP(Whisker_Segments_Measure(wv,wvn,facex,facey,face_axis))
 
 Measurements *Whisker_Segments_Update_Measurements(
     Measurements* table,Whisker_Seg *wv, int wvn,
     int facex, int facey, char face_axis )
-WRAP(Whisker_Segments_Update_Measurements(table,wv,wvn,facex,facey,face_axis))
+MWRAP(Whisker_Segments_Update_Measurements(table,wv,wvn,facex,facey,face_axis))
 
 Measurements* Realloc_Measurements_Table( Measurements *old, int n_rows_old, int n_rows_new )
 WRAP(Realloc_Measurements_Table(old,n_rows_old,n_rows_new))
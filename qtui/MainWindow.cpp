@@ -66,6 +66,14 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
   TRY(connect(this,SIGNAL(saveRequest(const QString&)),d->data(),SLOT(saveAs(const QString&))));
 
   statusBar()->setSizeGripEnabled(true);
+  { traceProgress_ = new QProgressBar;
+    traceProgress_->setMaximumWidth(200);
+    traceProgress_->setFormat(tr("Tracing %v/%m"));
+    traceProgress_->hide();
+    statusBar()->addPermanentWidget(traceProgress_);
+    TRY(connect(d->data(),SIGNAL(traceProgress(int,int)),this,SLOT(showTraceProgress(int,int))));
+    TRY(connect(d->data(),SIGNAL(tracingFinished()),traceProgress_,SLOT(hide())));
+  }
   /*
   { FileNameDisplay *w = new FileNameDisplay("Nothing loaded");
     statusBar()->addPermanentWidget(w);
@@ -83,6 +91,12 @@ Error:
   DIE;
 }
 
+void MainWindow::showTraceProgress(int done, int total)
+{ traceProgress_->setMaximum(total);
+  traceProgress_->setValue(done);
+  traceProgress_->show();
+}
+
 void MainWindow::openFileDialog()
 { QSettings settings;
   QString filename = QFileDialog::getOpenFileName(this,
@@ -4,6 +4,7 @@
   */
 #include<QMainWindow>
 #include<QLabel>
+#include<QProgressBar>
 #include<QMap>
 #include<QString>
 
@@ -24,6 +25,7 @@ class MainWindow : public QMainWindow
     void openFileDialog();
     void saveToLastLocation();
     void saveFileDialog();
+    void showTraceProgress(int done, int total);
 
   signals:
     void loadRequest(const QString& filename);
@@ -34,6 +36,7 @@ class MainWindow : public QMainWindow
     void createMenus();
 
     Editor* view_;
+    QProgressBar *traceProgress_;
     QMap<QString,QAction*> actions_;
 };
 
@@ -10,6 +10,9 @@
 #include "image_lib.h"
 #include "level_set.h"
 #include "contour_lib.h"
+#include "utilities.h"
+#include "common.h"
+#include "bar.h"
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -78,7 +81,8 @@ int  Compute_Circumscribed_Circle(  double x0, double y0,
  */
 
 typedef struct _bar_param
-{ int width;
+{ Component_Tree *tree;   // the level sets belong to this tree
+  int width;
   int height;
   int gap;
   int minlen;
@@ -86,6 +90,8 @@ typedef struct _bar_param
   int lvl_high;
   double rsq_low;
   double rsq_high;
+  double minarea;         // level sets outside this range of areas are skipped
+  double maxarea;
 } bar_param;
 
 int  bar_on_lvlset( Level_Set *self, 
@@ -105,11 +111,11 @@ int  bar_on_lvlset( Level_Set *self,
   rsq_low = parm->rsq_low;
   rsq_high = parm->rsq_high;
 
-  maxarea = rsq_high*3.14159*2.0;
-  minarea = rsq_low *3.14159/2.0;
+  maxarea = parm->maxarea;
+  minarea = parm->minarea;
 
-  lvl = Level_Set_Level(self);
-  size = Level_Set_Size(self);
+  lvl = Level_Set_Level_In(parm->tree, self);
+  size = Level_Set_Size_In(parm->tree, self);
 //printf("level: %5d [%3d, %3d](%p) - size:%5d (%5g,%5g)\n",
 //    lvl,
 //    parm->lvl_low,
@@ -128,7 +134,7 @@ int  bar_on_lvlset( Level_Set *self,
   w = parm->width;
   h = parm->height;
   
-  c = Trace_Level_Set( self );
+  c = Trace_Level_Set_In( parm->tree, self );
   len = c->length;
 
   if( len > parm->minlen ) {
@@ -165,42 +171,39 @@ int  bar_on_lvlset( Level_Set *self,
   return res;
 }
 
+/* Visits `self`, its siblings and their descendants.
+ *
+ * A child is part of its parent at a higher level, so it has a higher level
+ * and no more pixels.  Nothing below a level set at or above lvl_high, or
+ * smaller than minarea, can pass the tests in bar_on_lvlset, and those
+ * subtrees are skipped.
+ */
 void bar_lvlset_traverse( Level_Set *self, 
                           unsigned int *result,
                           bar_param *parm )
-{ Level_Set *next; 
-  
-  bar_on_lvlset( self, result, parm ); 
-
-  next = Level_Set_Sibling( self );
-  if( next && (next != self) )
-    bar_lvlset_traverse( next, result, parm );
-
-  if( next == self )
-    printf("*** Next == Self, sib\n");
-
-  next = Level_Set_Child( self );
-  if( next && (next != self) )
-    bar_lvlset_traverse( next, result, parm );
-  
-  if( next == self )
-    printf("*** Next == Self, chd\n");
-  return;
+{ for( ; self; self = Level_Set_Sibling_In( parm->tree, self ) )
+  { bar_on_lvlset( self, result, parm ); 
+    if(  Level_Set_Level_In( parm->tree, self ) <  parm->lvl_high
+      && Level_Set_Size_In ( parm->tree, self ) >= parm->minarea )
+      bar_lvlset_traverse( Level_Set_Child_In( parm->tree, self ), result, parm );
+  }
 }
 
-SHARED_EXPORT
-void Compute_Bar_Histogram( Image *im, 
-                            unsigned int *result,
-                            int gap,
-                            int minlen,
-                            int lvl_low,
-                            int lvl_high,
-                            double r_low,
-                            double r_high )
-{ Component_Tree *ctree;
-  Level_Set *node;
-  bar_param parm;
-
+// Builds the component tree of `im` in *tree, reusing its space if *tree is
+// not NULL.  See Compute_Bar_Histogram.
+static void bar_histogram( Component_Tree **tree,
+                           Image *im,
+                           unsigned int *result,
+                           int gap,
+                           int minlen,
+                           int lvl_low,
+                           int lvl_high,
+                           double r_low,
+                           double r_high )
+{ bar_param parm;
+
+  *tree = Rebuild_2D_Component_Tree( *tree, im, 0 );
+  parm.tree     = *tree;
   parm.width    = im->width;
   parm.height   = im->height;
   parm.gap      = gap;
@@ -209,13 +212,10 @@ void Compute_Bar_Histogram( Image *im,
   parm.lvl_high = lvl_high;
   parm.rsq_low  = r_low*r_low;
   parm.rsq_high = r_high*r_high;
+  parm.maxarea  = parm.rsq_high*3.14159*2.0;
+  parm.minarea  = parm.rsq_low *3.14159/2.0;
 
-  ctree = Build_2D_Component_Tree( im, 0 );
-  Set_Current_Component_Tree( ctree );
-  node = Level_Set_Root();
-
-  bar_lvlset_traverse( node, result, &parm );
-  Free_Component_Tree( ctree );
+  bar_lvlset_traverse( Level_Set_Root_In(*tree), result, &parm );
   
   /* Eliminate hits where no neighbors were hit.
    * Use 4-connected neighbors.
@@ -247,6 +247,50 @@ void Compute_Bar_Histogram( Image *im,
   return;
 }
 
+SHARED_EXPORT
+void Compute_Bar_Histogram( Image *im, 
+                            unsigned int *result,
+                            int gap,
+                            int minlen,
+                            int lvl_low,
+                            int lvl_high,
+                            double r_low,
+                            double r_high )
+{ Component_Tree *tree = NULL;
+  bar_histogram( &tree, im, result, gap, minlen, lvl_low, lvl_high, r_low, r_high );
+  Free_Component_Tree( tree );
+}
+
+struct _Bar_Locator
+{ unsigned int   *histogram;
+  size_t          maxlen;     // bytes
+  Component_Tree *tree;       // node space is reused from frame to frame
+  int             scale;      // coarse pass downsampling factor (1: off)
+};
+
+SHARED_EXPORT
+Bar_Locator *Make_Bar_Locator( void )
+{ Bar_Locator *self = (Bar_Locator*) Guarded_Malloc( sizeof(Bar_Locator), "Make_Bar_Locator" );
+  self->histogram = NULL;
+  self->maxlen    = 0;
+  self->tree      = NULL;
+  self->scale     = 1;
+  return self;
+}
+
+SHARED_EXPORT
+void Free_Bar_Locator( Bar_Locator *self )
+{ if(!self) return;
+  if(self->histogram) free(self->histogram);
+  if(self->tree) Kill_Component_Tree(self->tree);
+  free(self);
+}
+
+SHARED_EXPORT
+void Bar_Locator_Set_Scale( Bar_Locator *self, int scale )
+{ self->scale = MAX( 1, scale );
+}
+
 SHARED_EXPORT
 void Compute_Bar_Location(  Image *im, 
                             double *x,
@@ -257,22 +301,35 @@ void Compute_Bar_Location(  Image *im,
                             int lvl_high,
                             double r_low,
                             double r_high )  
-{ static unsigned int *histogram, max;
-  static int maxlen = 0;
+{ static Bar_Locator locator = {NULL,0,NULL,1};
+  Compute_Bar_Location_r( &locator, im, x, y, gap, minlen, lvl_low, lvl_high, r_low, r_high );
+}
+
+// Single pass over all of `im`.  Returns the histogram count at the peak;
+// 0 means nothing was found.
+static unsigned int bar_peak( Bar_Locator *self,
+                              Image *im, 
+                              double *x,
+                              double *y,
+                              int gap,
+                              int minlen,
+                              int lvl_low,
+                              int lvl_high,
+                              double r_low,
+                              double r_high )  
+{ unsigned int *histogram, max;
   int i, best, npx = (im->width)*(im->height)*4;
   int carea = sizeof(unsigned int)*npx;
   int stride = im->width * 2;
 
-  if( maxlen < carea )
-  { histogram = (unsigned int*) Guarded_Malloc( carea, "Compute Bar Location" );
-    maxlen = carea;
-  }
+  histogram = self->histogram = (unsigned int*) 
+    request_storage( self->histogram, &self->maxlen, sizeof(unsigned int), npx, "Compute Bar Location" );
 
   memset( histogram, 0, carea );
-  Compute_Bar_Histogram( im, histogram, 
-                         gap, minlen, 
-                         lvl_low, lvl_high, 
-                         r_low, r_high);
+  bar_histogram( &self->tree, im, histogram, 
+                 gap, minlen, 
+                 lvl_low, lvl_high, 
+                 r_low, r_high);
 
 
   /* compute max */
@@ -317,7 +374,109 @@ void Compute_Bar_Location(  Image *im,
     (*y) = yc / sum / 2.0;
   }
 
-  return;
+  return max;
+}
+
+// Box filter `im` down by `s`.  Partial blocks at the right and bottom edges
+// are dropped.
+static Image *bar_downsample( Image *im, int s )
+{ int w = im->width / s,
+      h = im->height / s,
+      i,j,u,v;
+  Image *out = Make_Image( GREY8, w, h );
+  for( j=0; j<h; j++ )
+    for( i=0; i<w; i++ )
+    { int acc = 0;
+      for( v=0; v<s; v++ )
+      { uint8 *row = im->array + (j*s+v)*im->width + i*s;
+        for( u=0; u<s; u++ )
+          acc += row[u];
+      }
+      out->array[j*w+i] = (uint8) ( (acc + s*s/2) / (s*s) );
+    }
+  return out;
+}
+
+// Copies the w by h window at (ox,oy) out of `im`.
+static Image *bar_crop( Image *im, int ox, int oy, int w, int h )
+{ Image *out = Make_Image( GREY8, w, h );
+  int j;
+  for( j=0; j<h; j++ )
+    memcpy( out->array + j*w, im->array + (oy+j)*im->width + ox, w );
+  return out;
+}
+
+// Locates the bar in a downsampled copy of `im`, then refines it at full
+// resolution in a window around the coarse estimate.  Returns 0 if either
+// pass comes up empty.
+static int bar_coarse_to_fine( Bar_Locator *self,
+                               Image *im, 
+                               double *x,
+                               double *y,
+                               int gap,
+                               int minlen,
+                               int lvl_low,
+                               int lvl_high,
+                               double r_low,
+                               double r_high )  
+{ int s = self->scale;
+  double cx,cy;
+  unsigned int found;
+  Image *small;
+
+  if( im->kind != GREY8 || im->width < 4*s || im->height < 4*s )
+    return 0;
+
+  small = bar_downsample( im, s );
+  found = bar_peak( self, small, &cx, &cy, 
+                    MAX( 2, (gap + s/2)/s ), minlen/s, 
+                    lvl_low, lvl_high, 
+                    r_low/s, r_high/s );
+  Free_Image( small );
+  if( !found )
+    return 0;
+
+  cx = cx*s + (s-1)/2.0;
+  cy = cy*s + (s-1)/2.0;
+
+  { int half = (int)(2*r_high) + gap,
+        x0 = MAX( 0, (int)cx - half ),
+        y0 = MAX( 0, (int)cy - half ),
+        x1 = MIN( im->width,  (int)cx + half + 1 ),
+        y1 = MIN( im->height, (int)cy + half + 1 );
+    Image *win;
+
+    if( x1 - x0 < 4 || y1 - y0 < 4 )
+      return 0;
+    win = bar_crop( im, x0, y0, x1-x0, y1-y0 );
+    found = bar_peak( self, win, &cx, &cy, 
+                      gap, minlen, 
+                      lvl_low, lvl_high, 
+                      r_low, r_high );
+    Free_Image( win );
+    if( !found )
+      return 0;
+    (*x) = cx + x0;
+    (*y) = cy + y0;
+  }
+  return 1;
+}
+
+SHARED_EXPORT
+void Compute_Bar_Location_r( Bar_Locator *self,
+                             Image *im, 
+                             double *x,
+                             double *y,
+                             int gap,
+                             int minlen,
+                             int lvl_low,
+                             int lvl_high,
+                             double r_low,
+                             double r_high )  
+{ if( self->scale > 1 
+    && bar_coarse_to_fine( self, im, x, y, gap, minlen, lvl_low, lvl_high, r_low, r_high ) )
+    return;
+  bar_peak( self, im, x, y, gap, minlen, lvl_low, lvl_high, r_low, r_high );
 }
 
 /*
@@ -0,0 +1,571 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+/*
+ * Batch tracing
+ * -------------
+ * Traces the whiskers in many movies in one process.  Each movie gets the
+ * same <prefix>.whiskers that `trace <movie> <prefix>` would write.
+ *
+ * Movies are cut into blocks of consecutive frames.  Worker threads take
+ * blocks from one shared queue, always from the oldest movie that has frames
+ * left.  A long movie at the end of a batch is spread over every worker
+ * rather than keeping one busy while the rest sit idle.  Blocks can finish
+ * out of order.  A movie holds on to blocks that are ahead of its file and
+ * appends them once the blocks before them are written.
+ *
+ * The detector banks are loaded once and shared.  The tracing code keeps its
+ * scratch buffers per thread (see THREAD_LOCAL in compat.h).  The decoders
+ * are not reentrant, so movies are opened, read and closed under a lock, a
+ * block of frames at a time.
+ *
+ * The next movie is opened while the last blocks of the current ones are
+ * traced.  With a memory budget, a movie is only opened, and a block is only
+ * decoded, if the estimate of the memory in use stays within the budget.  A
+ * tiff stack is read whole, so it counts at its full size, or at the whole
+ * budget if its size can't be found.  Something is always allowed to run
+ * when nothing else is, so one large movie can exceed the budget on its own.
+ */
+#include "compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities.h"
+#include "image_lib.h"
+#include "video.h"
+#include "trace.h"
+#include "merge.h"
+#include "whisker_io.h"
+#include "common.h"
+#include "error.h"
+#include "thread.h"
+
+#include "parameters/param.h"
+
+#define DEFAULT_BLOCK 16 // frames
+
+typedef struct _batch_block_t
+{ struct _batch_block_t *next;
+  int           first,            // frames first through first+n-1
+                n;
+  Whisker_Seg **wv;               // segments kept in each frame
+  int          *nseg;
+} batch_block_t;
+
+typedef enum _movie_state_t
+{ MOVIE_WAITING = 0,
+  MOVIE_OPENING,
+  MOVIE_OPEN,
+  MOVIE_DONE,
+  MOVIE_FAILED
+} movie_state_t;
+
+typedef struct _batch_movie_t
+{ char          *path,
+                *dest;            // <prefix>.whiskers
+  movie_state_t  state;
+  video_t       *video;
+  WhiskerFile    file;
+  int            start,           // first frame traced (after --resume)
+                 stop,            // number of frames
+                 next,            // first frame not handed out yet
+                 written,         // frames before this are in the file
+                 busy,            // blocks handed out and not yet written
+                 writing,         // a worker is appending to the file
+                 closed,
+                 tenths;          // progress last reported
+  size_t         frame_bytes,
+                 footprint;       // estimated memory held while open
+  Local_Area_Thresholds thresholds; // from frame 0, as trace uses them
+  batch_block_t *ready;           // traced blocks waiting on earlier ones.  Sorted by first.
+  double         t0,
+                 seconds;
+  char          *why;             // reason for failure
+} batch_movie_t;
+
+typedef struct _batch_t
+{ batch_movie_t *movies;
+  int            nmovies,
+                 nopened,         // movies before this have left MOVIE_WAITING
+                 nfinished,
+                 nworkers,
+                 nblocks,         // blocks being decoded or traced
+                 block,           // frames per block
+                 resume;
+  size_t         budget,          // bytes.  0 for no limit
+                 used;            // estimate
+  mutex_t       *lock;            // guards everything here and in movies
+  mutex_t       *decode;          // held while opening, reading or closing a movie
+  condition_t   *changed;
+} batch_t;
+
+typedef enum _work_t
+{ WORK_NONE = 0,
+  WORK_OPEN,
+  WORK_BLOCK
+} work_t;
+
+/*
+ * Files
+ */
+
+static int is_tiff( char *path )
+{ char *ext = strrchr( path, '.' );
+  return ext && ( !strcmp(ext,".tif") || !strcmp(ext,".tiff") );
+}
+
+// Size in bytes, or -1 if the file can't be opened or measured.
+static int64_t file_size( char *filename )
+{ FILE *fp = fopen( filename, "rb" );
+  int64_t size = -1;
+  if( !fp )
+    return -1;
+  if( FSEEK64( fp, 0, SEEK_END )==0 )
+    size = FTELL64( fp );
+  fclose( fp );
+  return size;
+}
+
+// The movie's memory estimate before it has been opened.  A tiff stack of
+// unknown size is assumed to be too big for any budget.
+static size_t guess_footprint( char *path )
+{ int64_t size;
+  if( !is_tiff(path) )
+    return 0;
+  size = file_size(path);
+  return ( size<0 || (uint64_t)size>SIZE_MAX ) ? SIZE_MAX : (size_t)size;
+}
+
+// <outdir>/<name>[<label>].whiskers where <name> is the movie's file name
+// without its extension.  <outdir> defaults to the movie's directory.
+static char *make_dest( char *movie, char *outdir, char *label )
+{ char *name = movie, *c, *dest;
+  size_t n;
+  for( c=movie; *c; c++ )
+    if( *c=='/' || *c=='\\' )
+      name = c+1;
+  n = (c = strrchr(name,'.')) ? (size_t)(c-name) : strlen(name);
+  dest = (char*) Guarded_Malloc( (outdir ? strlen(outdir) : (size_t)(name-movie)) + n
+                                 + (label ? strlen(label)+2 : 0) + 32, "whisk-batch" );
+  if( outdir )
+    sprintf( dest, "%s/", outdir );
+  else
+  { memcpy( dest, movie, name-movie );
+    dest[name-movie] = 0;
+  }
+  strncat( dest, name, n );
+  if( label )
+    sprintf( dest+strlen(dest), "[%s]", label );
+  strcat( dest, ".whiskers" );
+  return dest;
+}
+
+static int file_has_data( char *filename )
+{ return file_size(filename) > 0;
+}
+
+/*
+ * Movies
+ */
+
+// Called without b->lock.  Only the opening worker touches m until its
+// state changes.
+static int open_movie( batch_t *b, batch_movie_t *m, size_t *footprint )
+{ Image *im;
+  int start = 0;
+  if( !file_has_data(m->path) )  // some readers exit or crash on a missing file
+  { m->why = "could not read the movie";
+    return 0;
+  }
+  mutex_lock( b->decode );
+  if( !(m->video = video_open(m->path)) )
+  { mutex_unlock( b->decode );
+    m->why = "could not open the movie";
+    return 0;
+  }
+  m->stop = video_frame_count( m->video );
+  if( !(im = video_get(m->video,0,1)) )  // also estimates the scan bias
+  { video_close( &m->video );
+    mutex_unlock( b->decode );
+    m->why = "could not read the first frame";
+    return 0;
+  }
+  m->frame_bytes = (size_t) im->width * im->height * im->kind;
+  compute_local_area_thresholds( im, &m->thresholds );
+  Free_Image( im );
+  mutex_unlock( b->decode );
+  *footprint = is_tiff(m->path) ? m->frame_bytes*m->stop : m->frame_bytes;
+
+  if( b->resume && file_has_data(m->dest) )
+  { if( !(m->file = Whisker_File_Resume( m->dest, &start )) )
+      m->why = "could not resume the whiskers file";
+  } else
+  { if( !(m->file = Whisker_File_Open( m->dest, "whiskbin1", "w" )) )
+      m->why = "could not open the whiskers file for writing";
+  }
+  if( m->file )
+    Whisker_File_Async( m->file, 0 );
+  else
+  { mutex_lock( b->decode );
+    video_close( &m->video );
+    mutex_unlock( b->decode );
+    return 0;
+  }
+  m->start = m->next = m->written = MIN( start, m->stop );
+  m->tenths = (m->stop>0) ? 10*m->written/m->stop : 10;
+  m->t0 = wall_clock();
+  return 1;
+}
+
+// Called with b->lock held.  Closes the movie once nothing else uses it.
+static void retire_movie( batch_t *b, batch_movie_t *m )
+{ int wrote = 1;
+  if( m->closed || m->busy || m->writing )
+    return;
+  if( m->state==MOVIE_OPEN && m->written<m->stop )
+    return;
+  m->closed = 1;
+  mutex_unlock( b->lock );
+  if( m->file )
+    wrote = Whisker_File_Close( m->file );
+  m->file = NULL;
+  mutex_lock( b->decode );
+  video_close( &m->video );
+  mutex_unlock( b->decode );
+  mutex_lock( b->lock );
+  b->used -= m->footprint;
+  b->nfinished++;
+  m->seconds = wall_clock() - m->t0;
+  if( m->state==MOVIE_OPEN && !wrote )
+  { m->state = MOVIE_FAILED;
+    m->why   = "could not write the whiskers file";
+  }
+  if( m->state==MOVIE_OPEN )
+  { m->state = MOVIE_DONE;
+    progress( "Done %s: %d frames in %.1f s.  [%d/%d]\n",
+              m->path, m->stop-m->start, m->seconds, b->nfinished, b->nmovies );
+  } else
+  { warning( "Failed %s: %s.  [%d/%d]\n", m->path, m->why, b->nfinished, b->nmovies );
+  }
+  condition_broadcast( b->changed );
+}
+
+// Called with b->lock held.
+static void fail_movie( batch_movie_t *m, char *why )
+{ if( m->state!=MOVIE_OPEN )
+    return;
+  m->state = MOVIE_FAILED;
+  m->why   = why;
+  while( m->ready )
+  { batch_block_t *blk = m->ready;
+    int i;
+    m->ready = blk->next;
+    for( i=0; i<blk->n; i++ )
+      Free_Whisker_Seg_Vec( blk->wv[i], blk->nseg[i] );
+    free( blk );
+    m->busy--;
+  }
+}
+
+/*
+ * Blocks
+ */
+
+static batch_block_t *make_block( int first, int n )
+{ batch_block_t *blk;
+  blk = (batch_block_t*) Guarded_Malloc( sizeof(batch_block_t) + n*(sizeof(Whisker_Seg*)+sizeof(int)), "whisk-batch" );
+  blk->next  = NULL;
+  blk->first = first;
+  blk->n     = n;
+  blk->wv    = (Whisker_Seg**) (blk+1);
+  blk->nseg  = (int*) (blk->wv+n);
+  memset( blk->wv,   0, n*sizeof(Whisker_Seg*) );
+  memset( blk->nseg, 0, n*sizeof(int) );
+  return blk;
+}
+
+// Called without b->lock.  Decodes the block's frames, then traces them.
+static int trace_block( batch_t *b, batch_movie_t *m, batch_block_t *blk )
+{ Image **frames = (Image**) Guarded_Malloc( sizeof(Image*)*blk->n, "whisk-batch" );
+  int i,j;
+  mutex_lock( b->decode );
+  for( j=0; j<blk->n; j++ )
+    if( !(frames[j] = video_get( m->video, blk->first+j, 1 )) )
+      break;
+  mutex_unlock( b->decode );
+  pin_local_area_thresholds( &m->thresholds );
+  for( i=0; i<j; i++ )
+  { if( j==blk->n )
+    { Whisker_Seg *wv;
+      int n,k;
+      wv = find_segments( blk->first+i, frames[i], NULL, &n );
+      k  = Remove_Overlapping_Whiskers_One_Frame( wv, n,
+                                                  frames[i]->width, frames[i]->height,
+                                                  2.0,    // scale down by this
+                                                  2.0,    // distance threshold
+                                                  0.5 );  // significant overlap fraction
+      while( n-- > k )
+        Free_Whisker_Seg_Data( wv+n );
+      blk->wv[i]   = wv;
+      blk->nseg[i] = k;
+    }
+    Free_Image( frames[i] );
+  }
+  free( frames );
+  return j==blk->n;
+}
+
+// Called with b->lock held.  Appends the blocks that are next in line.
+// The lock is released while writing.
+static void write_ready( batch_t *b, batch_movie_t *m )
+{ if( m->writing )   // that worker will get to the new blocks
+    return;
+  m->writing = 1;
+  while( m->state==MOVIE_OPEN && m->ready && m->ready->first==m->written )
+  { batch_block_t *blk = m->ready;
+    int i, t;
+    m->ready = blk->next;
+    mutex_unlock( b->lock );
+    for( i=0; i<blk->n; i++ )
+    { Whisker_File_Append_Segments( m->file, blk->wv[i], blk->nseg[i] );
+      Free_Whisker_Seg_Vec( blk->wv[i], blk->nseg[i] );
+    }
+    mutex_lock( b->lock );
+    m->written += blk->n;
+    m->busy--;
+    free( blk );
+    if( (t = 10*m->written/m->stop) > m->tenths && m->written<m->stop )
+      progress( "%s: %3d%% (%d/%d frames)\n", m->path, 10*t, m->written, m->stop );
+    m->tenths = t;
+  }
+  m->writing = 0;
+}
+
+// Called with b->lock held.  Keeps m->ready sorted by first frame.
+static void add_ready( batch_movie_t *m, batch_block_t *blk )
+{ batch_block_t **p = &m->ready;
+  while( *p && (*p)->first < blk->first )
+    p = &(*p)->next;
+  blk->next = *p;
+  *p = blk;
+}
+
+/*
+ * Scheduling
+ */
+
+// Whether `bytes` more stays within the budget.  Called with b->lock held.
+static int fits( batch_t *b, size_t bytes )
+{ return b->used <= b->budget && bytes <= b->budget - b->used;
+}
+
+// Called with b->lock held.  Waits until there is something to do.
+static work_t next_work( batch_t *b, batch_movie_t **pm, batch_block_t **pblk )
+{ for(;;)
+  { batch_movie_t *m = NULL;
+    int i, opening = 0, left = 0;
+    for( i=0; i<b->nopened; i++ )
+    { batch_movie_t *t = b->movies+i;
+      opening |= t->state==MOVIE_OPENING;
+      if( t->state==MOVIE_OPEN && t->next<t->stop )
+      { if( !m ) m = t;
+        left += t->stop - t->next;
+      }
+    }
+    // Open the next movie before the open ones run out of frames, so
+    // workers don't wait on it.
+    if( !opening && b->nopened<b->nmovies && left < b->nworkers*b->block )
+    { batch_movie_t *t = b->movies + b->nopened;
+      size_t bytes = guess_footprint( t->path );
+      if( !b->budget || !b->used || fits(b,bytes) )
+      { t->state     = MOVIE_OPENING;
+        t->footprint = b->budget ? MIN( bytes, b->budget ) : bytes;
+        b->used     += t->footprint;
+        b->nopened++;
+        *pm = t;
+        return WORK_OPEN;
+      }
+    }
+    if( m )
+    { int    n     = MIN( b->block, m->stop - m->next );
+      size_t bytes = n*m->frame_bytes;
+      if( !b->budget || !b->nblocks || fits(b,bytes) )
+      { *pblk    = make_block( m->next, n );
+        m->next += n;
+        m->busy++;
+        b->nblocks++;
+        b->used += bytes;
+        *pm = m;
+        return WORK_BLOCK;
+      }
+    }
+    if( b->nfinished == b->nmovies )
+      return WORK_NONE;
+    condition_wait( b->changed, b->lock );
+  }
+}
+
+static void batch_worker( void *ctx, int iworker )
+{ batch_t *b = (batch_t*) ctx;
+  batch_movie_t *m;
+  batch_block_t *blk;
+  work_t work;
+
+  mutex_lock( b->lock );
+  while( (work = next_work( b, &m, &blk )) != WORK_NONE )
+  { mutex_unlock( b->lock );
+    if( work==WORK_OPEN )
+    { size_t footprint = 0;
+      int ok = open_movie( b, m, &footprint );
+      mutex_lock( b->lock );
+      if( ok )
+      { b->used     += footprint - m->footprint;
+        m->footprint = footprint;
+        m->state     = MOVIE_OPEN;
+        progress( "Tracing %s: %d frames%s.\n", m->path, m->stop - m->start,
+                  m->start ? " (resumed)" : "" );
+      } else
+      { m->state  = MOVIE_FAILED;
+        m->t0     = wall_clock();
+      }
+      retire_movie( b, m );   // in case there is nothing to trace
+    } else
+    { int ok = trace_block( b, m, blk );
+      mutex_lock( b->lock );
+      b->nblocks--;
+      b->used -= blk->n*m->frame_bytes;
+      if( ok && m->state==MOVIE_OPEN )
+      { add_ready( m, blk );
+        write_ready( b, m );
+      } else
+      { int i;
+        if( !ok )
+          fail_movie( m, "could not read a frame" );
+        for( i=0; i<blk->n; i++ )
+          Free_Whisker_Seg_Vec( blk->wv[i], blk->nseg[i] );
+        free( blk );
+        m->busy--;
+      }
+      retire_movie( b, m );
+    }
+    condition_broadcast( b->changed );
+  }
+  mutex_unlock( b->lock );
+}
+
+/*
+ * MAIN
+ */
+static char *Spec[] = { "[-h|--help] | <movie:string> ... [--out <string>] [--label <string>]",
+                        "             [--memory <int>] [--block <int>] [--resume]", NULL };
+int main(int argc, char *argv[])
+{ batch_t b;
+  char *outdir, *label;
+  int i, nfailed = 0, nframes = 0;
+  double t0;
+
+  Process_Arguments(argc,argv,Spec,0);
+
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+      "----------------------\n"
+      "Batch whisker tracing\n"
+      "----------------------\n"
+      "\n"
+      "Traces whisker segments in each <movie> and writes them to\n"
+      "<outdir>/<name>.whiskers, where <name> is the movie's file name without\n"
+      "its extension.  The result for each movie is the same as from trace.\n"
+      "\n"
+      "All movies are traced in one process that shares the detector banks and\n"
+      "one set of worker threads (see WHISK_THREADS).  Movies are split into\n"
+      "blocks of frames and idle workers take the next block from the oldest\n"
+      "unfinished movie, so the last movies in a batch are still traced on\n"
+      "every thread.\n"
+      "\n"
+      "\t--out       Directory for the whiskers files.  Defaults to the\n"
+      "\t            directory of each movie.\n"
+      "\t--label     Append [<label>] to each output name.\n"
+      "\t--memory    Memory budget in MB.  Movies are opened and frames decoded\n"
+      "\t            only while the estimated memory in use stays within it.\n"
+      "\t            A tiff stack is read whole and counts at its full size.\n"
+      "\t            Default: no limit.\n"
+      "\t--block     Frames per block (default 16).\n"
+      "\t--resume    Continue whiskers files that were partly written, like\n"
+      "\t            trace --resume.\n"
+      "\n" );
+
+  { char* paramfile = "default.parameters";
+    if(Load_Params_File(paramfile))
+    { warning(
+        "Could not load parameters from file: %s\n"
+        "Writing %s\n"
+        "\tTrying again\n",paramfile,paramfile);
+      Print_Params_File(paramfile);
+      if(Load_Params_File(paramfile))
+        error("\tStill could not load parameters.\n");
+    }
+  }
+  if( !load_detector_banks() )
+    error("Could not load the detector banks.\n");
+
+  memset( &b, 0, sizeof(b) );
+  outdir     = Is_Arg_Matched("--out")    ? Get_String_Arg("--out")   : NULL;
+  label      = Is_Arg_Matched("--label")  ? Get_String_Arg("--label") : NULL;
+  if( label && !*label )
+    label = NULL;
+  b.block    = Is_Arg_Matched("--block")  ? Get_Int_Arg("--block")    : DEFAULT_BLOCK;
+  b.budget   = Is_Arg_Matched("--memory") ? ((size_t)Get_Int_Arg("--memory"))<<20 : 0;
+  b.resume   = Is_Arg_Matched("--resume");
+  b.nworkers = thread_count();
+  if( b.block < 1 )
+    error("--block must be at least 1.\n");
+  if( Is_Arg_Matched("--memory") && Get_Int_Arg("--memory") < 1 )
+    error("--memory must be at least 1 MB.\n");
+
+  b.nmovies = Get_Repeat_Count("movie");
+  b.movies  = (batch_movie_t*) Guarded_Malloc( sizeof(batch_movie_t)*b.nmovies, "whisk-batch" );
+  memset( b.movies, 0, sizeof(batch_movie_t)*b.nmovies );
+  for( i=0; i<b.nmovies; i++ )
+  { b.movies[i].path = Get_String_Arg("movie",i+1);
+    b.movies[i].dest = make_dest( b.movies[i].path, outdir, label );
+  }
+
+  b.lock    = mutex_create();
+  b.decode  = mutex_create();
+  b.changed = condition_create();
+  progress( "Tracing %d movies on %d threads.\n", b.nmovies, b.nworkers );
+  t0 = wall_clock();
+  parallel_for( b.nworkers, b.nworkers, batch_worker, &b );
+
+  //
+  // Report
+  //
+  { int width = 0;
+    for( i=0; i<b.nmovies; i++ )
+      width = MAX( width, (int) strlen(b.movies[i].path) );
+    for( i=0; i<b.nmovies; i++ )
+    { batch_movie_t *m = b.movies+i;
+      if( m->state==MOVIE_DONE )
+      { printf( "%*s [ ] Success %6d frames %8.1f s\n", width+1, m->path, m->stop-m->start, m->seconds );
+        nframes += m->stop-m->start;
+      } else
+      { printf( "%*s [X] FAILED  %s\n", width+1, m->path, m->why );
+        nfailed++;
+      }
+      free( m->dest );
+    }
+  }
+  printf( "Traced %d frames from %d movies in %.1f seconds.", nframes, b.nmovies-nfailed, wall_clock()-t0 );
+  if( nfailed )
+    printf( "  %d failed.", nfailed );
+  printf( "\n" );
+
+  condition_destroy( &b.changed );
+  mutex_destroy( &b.decode );
+  mutex_destroy( &b.lock );
+  free( b.movies );
+  return nfailed ? 1 : 0;
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+/*
+ * Tracing benchmark
+ * -----------------
+ * Renders a synthetic movie of curved, dark, whisker-like lines sweeping back
+ * and forth in front of a face, writes it to a tiff stack, and runs it
+ * through the pipeline while timing each stage separately:
+ *
+ *   decode     video_open and video_get
+ *   seed       find_segment_seeds, once for each SEED_METHOD
+ *   trace      trace_segment_seeds (trace_whisker from each seed)
+ *   overlap    Remove_Overlapping_Whiskers_One_Frame
+ *   write      Whisker_File_Append_Segments
+ *   measure    Whisker_Segments_Measure
+ *   classify   length threshold and Measurements_Table_Label_By_Order
+ *   reclassify HMM_Reclassify_Watershed
+ *
+ * Results are written to <prefix>.json as frames per second and nanoseconds
+ * per pixel for each stage.  The movie is generated from a fixed random seed
+ * so runs with the same options see the same frames.
+ */
+#include "compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utilities.h"
+#include "image_lib.h"
+#include "video.h"
+#include "trace.h"
+#include "merge.h"
+#include "whisker_io.h"
+#include "measure.h"
+#include "traj.h"
+#include "hmm-reclassify.h"
+#include "common.h"
+#include "thread.h"
+#include "error.h"
+
+#include "parameters/param.h"
+
+#define ENDL "\n"
+#define REPORT(expr) debug("%s(%d):"ENDL "\t%s"ENDL "\tExpression evaluated as false."ENDL,__FILE__,__LINE__,#expr)
+#define TRY(expr,lbl) if(!(expr)) {REPORT(expr); goto lbl;}
+
+#define countof(e) (sizeof(e)/sizeof(*e))
+
+/*
+ * Synthetic movie
+ */
+
+typedef struct _movie_spec_t
+{ int    width,
+         height,
+         nframes,
+         nwhiskers,
+         nhairs;
+  double noise,    // standard deviation of additive noise (intensity units)
+         fps,      // frame rate
+         hz;       // whisking frequency
+  unsigned seed;
+} movie_spec_t;
+
+static unsigned long long g_rng;
+
+static double uniform(void)
+{ g_rng = g_rng*6364136223846793005ULL + 1442695040888963407ULL;
+  return (double)(g_rng>>11)*(1.0/9007199254740992.0);
+}
+
+static double gaussian(void)
+{ double u = uniform(),
+         v = uniform();
+  return sqrt(-2.0*log(u+1e-300))*cos(2.0*M_PI*v);
+}
+
+static double face_edge( movie_spec_t *spec, double y )
+{ double t = y/spec->height - 0.5;
+  return spec->width*( 0.12 - 0.1*t*t );
+}
+
+// Darkens `dark` along a curve starting on the face edge at height `y0`.
+// The curve starts at angle `angle` and bends by `curvature` radians per
+// pixel.  Thickness and contrast taper toward the tip.
+static void draw_curve( movie_spec_t *spec, float *dark,
+                        double y0, double angle, double curvature, double length, double contrast )
+{ const double step = 0.5;
+  double x = face_edge(spec,y0),
+         y = y0,
+         s;
+  int w = spec->width,
+      h = spec->height;
+  for( s=0.0; s<length; s+=step )
+  { double u     = s/length,
+           sigma = 1.4 - 0.9*u,
+           c     = contrast*( 1.0 - 0.6*u ),
+           k     = -0.5/(sigma*sigma);
+    int ix = (int)x, iy = (int)y, i, j;
+    for( j=MAX(0,iy-3); j<=MIN(h-1,iy+3); j++ )
+      for( i=MAX(0,ix-3); i<=MIN(w-1,ix+3); i++ )
+      { double dx = i - x,
+               dy = j - y,
+               d  = c*exp( k*(dx*dx+dy*dy) );
+        float *p = dark + j*w + i;
+        if( d > *p ) *p = (float)d;
+      }
+    x += step*cos(angle);
+    y += step*sin(angle);
+    angle += step*curvature;
+  }
+}
+
+static void render_frame( movie_spec_t *spec, int iframe, float *dark, Image *out )
+{ int w = spec->width,
+      h = spec->height,
+      i, j;
+  double phase = 2.0*M_PI*spec->hz*iframe/spec->fps;
+  uint8 *a = out->array;
+
+  memset( dark, 0, sizeof(float)*w*h );
+  for( i=0; i<spec->nwhiskers; i++ )
+  { double f  = (spec->nwhiskers>1) ? i/(double)(spec->nwhiskers-1) : 0.5,
+           y0 = h*( 0.25 + 0.5*f ),
+           th = ( -0.6 + 1.2*f ) + 0.35*sin( phase - 0.3*f );
+    draw_curve( spec, dark, y0, th, -0.0015*( 1.0 + f ), 0.75*w*( 1.0 - 0.3*f ), 110.0 );
+  }
+  for( i=0; i<spec->nhairs; i++ )
+  { double f  = (i+0.5)/spec->nhairs,
+           y0 = h*( 0.2 + 0.6*f ),
+           th = ( -0.8 + 1.6*f ) + 0.1*sin( phase + 2.0*f );
+    draw_curve( spec, dark, y0, th, 0.004, 0.08*w, 60.0 );
+  }
+
+  for( j=0; j<h; j++ )
+  { double edge = face_edge(spec,j);
+    for( i=0; i<w; i++ )
+    { double v = ( i < edge ) ? 40.0 : 190.0 + 30.0*j/h - dark[j*w+i];
+      v += spec->noise*gaussian();
+      a[j*w+i] = (uint8) MAX( 0.0, MIN( 255.0, v + 0.5 ) );
+    }
+  }
+}
+
+static int write_movie( movie_spec_t *spec, char *path )
+{ TIFF  *t;
+  Image *im;
+  float *dark;
+  int i;
+  TRY( t=Open_Tiff(path,"w"), Error );
+  im   = Make_Image( GREY8, spec->width, spec->height );
+  dark = (float*) Guarded_Malloc( sizeof(float)*spec->width*spec->height, "write_movie" );
+  g_rng = spec->seed;
+  for( i=0; i<spec->nframes; i++ )
+  { render_frame( spec, i, dark, im );
+    Write_Tiff( t, im );
+    progress_meter( i, 0, spec->nframes-1, 79, "Rendering: [%5d/%5d]", i, spec->nframes );
+  }
+  printf("\n");
+  Close_Tiff( t );
+  Free_Image( im );
+  free( dark );
+  return 1;
+Error:
+  return 0;
+}
+
+/*
+ * Stage timers
+ */
+
+typedef struct _stage_t
+{ char   name[32];
+  double seconds;
+  long   items;     // what the stage produced (seeds, segments, rows...)
+} stage_t;
+
+enum
+{ STAGE_DECODE = 0,
+  STAGE_SEED_EVERYWHERE,
+  STAGE_SEED_ON_MHAT_CONTOURS,
+  STAGE_SEED_ON_GRID,
+  STAGE_TRACE,
+  STAGE_OVERLAP,
+  STAGE_WRITE,
+  STAGE_MEASURE,
+  STAGE_CLASSIFY,
+  STAGE_RECLASSIFY,
+  NSTAGES
+};
+
+static stage_t g_stages[NSTAGES] =
+{ { "decode",                       0.0, 0 },
+  { "seed:SEED_EVERYWHERE",         0.0, 0 },
+  { "seed:SEED_ON_MHAT_CONTOURS",   0.0, 0 },
+  { "seed:SEED_ON_GRID",            0.0, 0 },
+  { "trace",                        0.0, 0 },
+  { "overlap",                      0.0, 0 },
+  { "write",                        0.0, 0 },
+  { "measure",                      0.0, 0 },
+  { "classify",                     0.0, 0 },
+  { "reclassify",                   0.0, 0 },
+};
+
+static const int g_seed_stage[] = { STAGE_SEED_EVERYWHERE, STAGE_SEED_ON_MHAT_CONTOURS, STAGE_SEED_ON_GRID }; // by enumSEED_METHOD
+
+static double g_t0;
+static void tic(void)                      { g_t0 = wall_clock(); }
+static void toc(int istage, long items)    { g_stages[istage].seconds += wall_clock()-g_t0;
+                                             g_stages[istage].items   += items; }
+
+static int write_report( char *path, movie_spec_t *spec, char *movie, enumSEED_METHOD method, int run_all_methods )
+{ FILE *fp;
+  double npx = (double)spec->width*spec->height*spec->nframes;
+  int i, first = 1;
+  TRY( fp=fopen(path,"w"), Error );
+  fprintf( fp, "{\n"
+               "  \"movie\": { \"path\": \"%s\", \"width\": %d, \"height\": %d, \"frames\": %d,\n"
+               "             \"whiskers\": %d, \"hairs\": %d, \"noise\": %g, \"fps\": %g, \"hz\": %g, \"seed\": %u },\n"
+               "  \"seed_method\": \"%s\",\n"
+               "  \"stages\": [\n",
+               movie, spec->width, spec->height, spec->nframes,
+               spec->nwhiskers, spec->nhairs, spec->noise, spec->fps, spec->hz, spec->seed,
+               g_stages[g_seed_stage[method]].name+5 );
+  for( i=0; i<NSTAGES; i++ )
+  { stage_t *s = g_stages+i;
+    if( !run_all_methods
+        && ( i==STAGE_SEED_EVERYWHERE || i==STAGE_SEED_ON_MHAT_CONTOURS || i==STAGE_SEED_ON_GRID )
+        && i!=g_seed_stage[method] )
+      continue;
+    fprintf( fp, "%s    { \"name\": \"%s\", \"seconds\": %.6f, \"items\": %ld, "
+                 "\"frames_per_second\": %.3f, \"ns_per_pixel\": %.4f }",
+             first?"":",\n", s->name, s->seconds, s->items,
+             (s->seconds>0.0) ? spec->nframes/s->seconds : 0.0,
+             1e9*s->seconds/npx );
+    first = 0;
+  }
+  fprintf( fp, "\n  ]\n}\n" );
+  fclose(fp);
+  return 1;
+Error:
+  return 0;
+}
+
+/*
+ * MAIN
+ */
+static char *Spec[] = { "[-h|--help] | <prefix:string>",
+                        "[--width <int>] [--height <int>] [--frames <int>]",
+                        "[--whiskers <int>] [--hairs <int>] [--noise <double>]",
+                        "[--fps <double>] [--hz <double>] [--seed <int>]",
+                        "[--movie <string>] [--all-seed-methods] [--keep]",
+                        NULL };
+int main(int argc, char *argv[])
+{ movie_spec_t spec = { 640, 480, 100, 5, 5, 8.0, 500.0, 10.0, 1 };
+  char *prefix, *movie, *whisker_file_name, *report_file_name;
+  enumSEED_METHOD method;
+  video_t      *v = NULL;
+  WhiskerFile   wfile = NULL;
+  Whisker_Seg  *all = NULL;
+  size_t        max_all = 0;
+  int           nall = 0;
+  Measurements *table = NULL;
+  int i, generated = 0;
+
+  Process_Arguments(argc,argv,Spec,0);
+
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+      "------------------\n"
+      "Tracing benchmark\n"
+      "------------------\n"
+      "\n"
+      "Renders a synthetic movie of whisker-like curves and times each stage of\n"
+      "tracing, measurement and classification.  Results are written as JSON to\n"
+      "<prefix>.json.  The movie and traced segments go to <prefix>.tif and\n"
+      "<prefix>.whiskers and are removed afterward unless --keep is given.\n"
+      "\n"
+      "\t--width, --height  Frame size in pixels (640 x 480).\n"
+      "\t--frames           Number of frames (100).\n"
+      "\t--whiskers         Number of whiskers (5).\n"
+      "\t--hairs            Number of short, faint hairs near the face (5).\n"
+      "\t--noise            Standard deviation of pixel noise (8).\n"
+      "\t--fps, --hz        Frame rate and whisking frequency (500, 10).\n"
+      "\t--seed             Random seed for the noise (1).\n"
+      "\t--movie            Benchmark an existing movie instead.  Measure and\n"
+      "\t                   classify assume the face is on the left.\n"
+      "\t--all-seed-methods Also time the seeding methods that aren't selected\n"
+      "\t                   by SEED_METHOD in default.parameters.\n"
+      "\n" );
+
+  { char* paramfile = "default.parameters";
+    if(Load_Params_File(paramfile))
+    { warning(
+        "Could not load parameters from file: %s\n"
+        "Writing %s\n"
+        "\tTrying again\n",paramfile,paramfile);
+      Print_Params_File(paramfile);
+      if(Load_Params_File(paramfile))
+        error("\tStill could not load parameters.\n");
+    }
+  }
+  method = SEED_METHOD;
+
+  if( Is_Arg_Matched("--width")    ) spec.width     = Get_Int_Arg("--width");
+  if( Is_Arg_Matched("--height")   ) spec.height    = Get_Int_Arg("--height");
+  if( Is_Arg_Matched("--frames")   ) spec.nframes   = Get_Int_Arg("--frames");
+  if( Is_Arg_Matched("--whiskers") ) spec.nwhiskers = Get_Int_Arg("--whiskers");
+  if( Is_Arg_Matched("--hairs")    ) spec.nhairs    = Get_Int_Arg("--hairs");
+  if( Is_Arg_Matched("--noise")    ) spec.noise     = Get_Double_Arg("--noise");
+  if( Is_Arg_Matched("--fps")      ) spec.fps       = Get_Double_Arg("--fps");
+  if( Is_Arg_Matched("--hz")       ) spec.hz        = Get_Double_Arg("--hz");
+  if( Is_Arg_Matched("--seed")     ) spec.seed      = (unsigned) Get_Int_Arg("--seed");
+  if( spec.width<64 || spec.height<64 || spec.nframes<2 || spec.nwhiskers<1 || spec.fps<=0.0 )
+    error("Movie must be at least 64x64 with at least 2 frames and 1 whisker.\n");
+
+  prefix = Get_String_Arg("prefix");
+  movie             = (char*) Guarded_Malloc( strlen(prefix)+32, "benchmark" );
+  whisker_file_name = (char*) Guarded_Malloc( strlen(prefix)+32, "benchmark" );
+  report_file_name  = (char*) Guarded_Malloc( strlen(prefix)+32, "benchmark" );
+  sprintf( movie,             "%s.tif",      prefix );
+  sprintf( whisker_file_name, "%s.whiskers", prefix );
+  sprintf( report_file_name,  "%s.json",     prefix );
+
+  if( Is_Arg_Matched("--movie") )
+  { free(movie);
+    movie = Guarded_Strdup( Get_String_Arg("--movie"), "benchmark" );
+  } else
+  { TRY( write_movie(&spec,movie), ErrorWrite );
+    generated = 1;
+  }
+
+  // Decode once up front so video_open's cost is counted under decode
+  tic();
+  TRY( v=video_open(movie), ErrorOpen );
+  toc( STAGE_DECODE, 0 );
+  if( !generated )
+  { Image *im;
+    TRY( im=video_get(v,0,1), ErrorOpen );
+    spec.width   = im->width;
+    spec.height  = im->height;
+    spec.nframes = video_frame_count(v);
+    Free_Image(im);
+  }
+  TRY( wfile=Whisker_File_Open(whisker_file_name,"whiskbin1","w"), ErrorOpen );
+
+  //
+  // Per-frame stages
+  //
+  for( i=0; i<spec.nframes; i++ )
+  { Image *image;
+    Seed_Candidate *seeds;
+    Whisker_Seg *wv;
+    int m, nseeds, wv_n, k;
+
+    tic();
+    TRY( image=video_get(v,i,1), ErrorRead );
+    toc( STAGE_DECODE, 1 );
+
+    // The seeds buffer is reused, so the selected method goes last
+    for( m=0; m<(int)countof(g_seed_stage); m++ )
+    { if( m==method || !Is_Arg_Matched("--all-seed-methods") ) continue;
+      Params()->paramSEED_METHOD = (enumSEED_METHOD) m;
+      tic();
+      find_segment_seeds( image, NULL, &nseeds );
+      toc( g_seed_stage[m], nseeds );
+    }
+    Params()->paramSEED_METHOD = method;
+    tic();
+    seeds = find_segment_seeds( image, NULL, &nseeds );
+    toc( g_seed_stage[method], nseeds );
+
+    tic();
+    wv = trace_segment_seeds( i, image, NULL, seeds, nseeds, &wv_n );
+    toc( STAGE_TRACE, wv_n );
+
+    tic();
+    k = Remove_Overlapping_Whiskers_One_Frame( wv, wv_n,
+                                               image->width, image->height,
+                                               2.0,    // scale down by this
+                                               2.0,    // distance threshold
+                                               0.5 );  // significant overlap fraction
+    toc( STAGE_OVERLAP, k );
+
+    tic();
+    Whisker_File_Append_Segments( wfile, wv, k );
+    toc( STAGE_WRITE, k );
+
+    // Keep the survivors for measurement
+    all = (Whisker_Seg*) request_storage( all, &max_all, sizeof(Whisker_Seg), nall+k, "benchmark" );
+    memcpy( all+nall, wv, sizeof(Whisker_Seg)*k );
+    nall += k;
+    for( m=k; m<wv_n; m++ )
+      Free_Whisker_Seg_Data( wv+m );
+    if(wv) free(wv);
+    Free_Image(image);
+    progress_meter( i, 0, spec.nframes-1, 79, "Tracing: [%5d/%5d]", i, spec.nframes );
+  }
+  printf("\n");
+  tic();
+  Whisker_File_Close( wfile );
+  toc( STAGE_WRITE, 0 );
+  wfile = NULL;
+  video_close( &v );
+
+  //
+  // Whole-movie stages
+  //
+  if( nall>0 )
+  { int count = spec.nwhiskers;
+    double thresh;
+
+    tic();
+    table = Whisker_Segments_Measure( all, nall, -spec.width/2, spec.height/2, 'y' );
+    toc( STAGE_MEASURE, nall );
+
+    tic();
+    Sort_Measurements_Table_Time( table, nall );
+    thresh = Measurements_Table_Estimate_Best_Threshold_For_Known_Count( table, nall,
+               0,                        // length column
+               1.0, spec.width/2.0,      // search range (px)
+               1,                        // use >
+               count );
+    Measurements_Table_Label_By_Threshold( table, nall, 0, thresh, 1 );
+    Measurements_Table_Label_By_Order( table, nall, count );
+    toc( STAGE_CLASSIFY, nall );
+
+    tic();
+    HMM_Reclassify_Watershed( table, nall, count );
+    toc( STAGE_RECLASSIFY, nall );
+  }
+
+  TRY( write_report( report_file_name, &spec, movie, method, Is_Arg_Matched("--all-seed-methods") ), ErrorReport );
+  progress( "Wrote %s\n", report_file_name );
+
+  if( !Is_Arg_Matched("--keep") )
+  { remove( whisker_file_name );
+    if( generated )
+      remove( movie );
+  }
+  if( table ) Free_Measurements_Table( table );
+  Free_Whisker_Seg_Vec( all, nall );
+  free( movie );
+  free( whisker_file_name );
+  free( report_file_name );
+  return 0;
+ErrorWrite:
+  error("Could not write %s"ENDL,movie);
+  return 1;
+ErrorOpen:
+  error("Could not open %s"ENDL,movie);
+  return 2;
+ErrorRead:
+  if( wfile ) Whisker_File_Close( wfile );
+  video_close( &v );
+  error("Could not read frame %d from %s"ENDL,i,movie);
+  return 3;
+ErrorReport:
+  error("Could not write %s"ENDL,report_file_name);
+  return 4;
+}
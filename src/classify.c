@@ -15,6 +15,7 @@
 #include "traj.h"
 #include "measurements_io.h"
 #include "error.h"
+#include "profile.h"
 
 #define DEBUG_CLASSIFY_1
 #define DEBUG_CLASSIFY_3
@@ -261,86 +262,41 @@ void Measurements_Table_Label_By_Order( Measurements *table, int n_rows, int tar
   }
 }
 
-#ifdef TEST_CLASSIFY_1
-char *Spec[] = {"[-h|--help] |",
-                "<source:string> <dest:string>",
-                "(<face:string> | <x:int> <y:int> <axis:string>)",
-                "--px2mm <double>",
-                "-n <int>", 
-                "[--limit<double(1.0)>:<double(50.0)>]",
-                "[--follicle <int>]",
-                NULL};
-int main(int argc, char* argv[])
-{ int n_rows, count;
-  Measurements *table,*cursor;
-  double thresh,
-         px2mm,
-         low_px,
-         high_px;
-  int face_x, face_y;
+/* Length threshold classification (the `classify` step)
+ *
+ * Separates hairs and microvibrissae from main whiskers with a length
+ * threshold, then labels whiskers by their order along the face in frames
+ * where the expected number is found.  Other rows get state -1.
+ *
+ * The face is given either by a hint ("top", "left", "bottom" or "right") in
+ * `face`, or, when `face` is NULL, by the point (face_x,face_y) and `axis`
+ * ('x' or 'h' for a horizontal face, 'y' or 'v' for a vertical one).
+ * If `follicle` > 0, only segments with a follicle on one side of that
+ * coordinate are counted.  The length threshold is searched for in
+ * [low_px,high_px).  If count < 1 the number of whiskers is estimated.
+ *
+ * The table is resorted.  Returns the number of whiskers used for labelling.
+ */
+SHARED_EXPORT
+int Measurements_Table_Classify( Measurements *table, int n_rows,
+                                 char *face, int face_x, int face_y, char axis,
+                                 int follicle, double low_px, double high_px, int count )
+{ Measurements *cursor;
+  double thresh;
   int follicle_thresh = 0,
       follicle_col = 4,
       follicle_high,
       is_gt = 1;
   int n_cursor;
 
-  Process_Arguments( argc, argv, Spec, 0);
-
-  if( Is_Arg_Matched("-h") | Is_Arg_Matched("--help") )
-  { Print_Argument_Usage(stdout,0);
-    printf("--------------------------                                                   \n"
-          " Classify test 1 (autotraj)                                                   \n"
-          "---------------------------                                                   \n"
-          "                                                                              \n"
-          "  Uses a length threshold to seperate hair/microvibrissae from main whiskers. \n"
-          "  Then, for frames where the expected number of whiskers are found,           \n"
-          "  label the whiskers according to their order on the face.                    \n"
-          "\n"
-          "  <source> Filename with Measurements table.\n"
-          "  <dest>   Filename to which labelled Measurements will be saved.\n"
-          "           This can be the same as <source>.\n"
-          "  <face>\n"
-          "  <x> <y> <axis>\n"
-          "           These are used for determining the order of whisker segments along \n"
-          "           the face.  This requires an approximate position for the center of \n"
-          "           the face and can be specified in pixel coordinates with <x> and <y>.\n"
-          "           <axis> indicates the orientaiton of the face.  Values for <axis> may\n"
-          "           be 'x' or 'h' for horizontal. 'y' or 'v' indicate a vertical face. \n"
-          "           If the face is located along the edge of the frame then specify    \n"
-          "           that edge with 'left', 'right', 'top' or 'bottom'.                 \n"
-          "  --px2mm <double>\n"
-          "           The length of a pixel in millimeters.  This is used to determine   \n"
-          "           appropriate thresholds for discriminating hairs from whiskers.     \n"
-          "  -n <int> (Optional) Optimize the threshold to find this number of whiskers. \n"
-          "           If this isn't specified, or if this is set to a number less than 1 \n"
-          "           then the number of whiskers is automatically determined.           \n"
-          "  --follicle <int>\n"
-          "           Only count follicles that lie on one side of the line specified by \n"
-          "           this threshold (in pixels).  The direction of the line points      \n"
-          "           along the x or y axis depending which is closer to the orientation \n"
-          "           of the mouse's face.\n"
-          "--                                                                            \n");
-    return 0;
-  }
-
-  px2mm   = Get_Double_Arg("--px2mm");
-  low_px  = Get_Double_Arg("--limit",1) / px2mm;
-  high_px = Get_Double_Arg("--limit",2) / px2mm;
-#ifdef DEBUG_CLASSIFY_1
-  debug("mm/px %f\n"
-        "  low %f\n"
-        " high %f\n", px2mm, low_px, high_px );
-#endif
-
-  table  = Measurements_Table_From_Filename ( Get_String_Arg("source"), NULL, &n_rows );
-  if(!table) error("Couldn't read %s\n",Get_String_Arg("source"));
+  PROFILE_BEGIN(PROFILE_CLASSIFY);
   Sort_Measurements_Table_Time(table,n_rows);
 
-  if( Is_Arg_Matched("face") )
+  if( face )
   { int maxx,maxy;
     Measurements_Table_Pixel_Support( table, n_rows, &maxx, &maxy );
-    Helper_Get_Face_Point( Get_String_Arg("face"), maxx, maxy, &face_x, &face_y);
-    Helper_Get_Follicle_Const_Axis( Get_String_Arg("face"), maxx, maxy, 
+    Helper_Get_Face_Point( face, maxx, maxy, &face_x, &face_y);
+    Helper_Get_Follicle_Const_Axis( face, maxx, maxy, 
                                     &follicle_col, &is_gt, &follicle_high);
     follicle_thresh = (is_gt) ? 0 : follicle_high;
 #ifdef DEBUG_CLASSIFY_1
@@ -348,18 +304,13 @@ int main(int argc, char* argv[])
 		  "maxy: %d\n", maxx, maxy );
 #endif
   } else 
-  { int maxx,maxy;
-    const char *axis = Get_String_Arg("axis");
-    static const int x = 4,
+  { static const int x = 4,
                      y = 5;
-    Measurements_Table_Pixel_Support( table, n_rows, &maxx, &maxy );
-    face_x = Get_Int_Arg("x");
-    face_y = Get_Int_Arg("y");
     follicle_thresh = 0;       // set defaults
     is_gt = 1;
-    if( Is_Arg_Matched("--follicle") && Get_Int_Arg("--follicle")>0 )
-    { follicle_thresh = Get_Int_Arg("--follicle");
-      switch( axis[0] )        // respond to <follicle> option
+    if( follicle>0 )
+    { follicle_thresh = follicle;
+      switch( axis )           // respond to <follicle> option
       { case 'x':              // follicle must be between threshold and face
         case 'h':
           is_gt = follicle_thresh < face_y;
@@ -371,13 +322,13 @@ int main(int argc, char* argv[])
           follicle_col = x;
           break;
         default:
-          error("Could not recognize <axis>.  Must be 'x','h','y', or 'v'.  Got %s\n",axis);
+          error("Could not recognize <axis>.  Must be 'x','h','y', or 'v'.  Got %c\n",axis);
       }
     }
   }
   // Follicle location threshold
-  if( Is_Arg_Matched("--follicle") && Get_Int_Arg("--follicle")>0 )
-    follicle_thresh = Get_Int_Arg("--follicle");
+  if( follicle>0 )
+    follicle_thresh = follicle;
   Measurements_Table_Label_By_Threshold    ( table, 
                                              n_rows, 
                                              follicle_col,
@@ -405,7 +356,7 @@ int main(int argc, char* argv[])
   //
   // Estimate best length threshold and apply
   //
-  if( Is_Arg_Matched("-n") && ( (count = Get_Int_Arg("-n"))>=1 ) )
+  if( count>=1 )
   { thresh = Measurements_Table_Estimate_Best_Threshold_For_Known_Count( cursor, //table, 
                                                                          n_cursor, //n_rows, 
                                                                          0 /*length column*/, 
@@ -450,6 +401,94 @@ int main(int argc, char* argv[])
   Measurements_Table_Set_Follicle_Position_Indices  ( table, n_rows, 4, 5 );
 
   Measurements_Table_Label_By_Order(table, n_rows, count ); //resorts
+  PROFILE_END(PROFILE_CLASSIFY);
+  return count;
+}
+
+#ifdef TEST_CLASSIFY_1
+char *Spec[] = {"[-h|--help] |",
+                "<source:string> <dest:string>",
+                "(<face:string> | <x:int> <y:int> <axis:string>)",
+                "--px2mm <double>",
+                "-n <int>", 
+                "[--limit<double(1.0)>:<double(50.0)>]",
+                "[--follicle <int>]",
+                "[--profile <string>] [--timeline <string>]",
+                NULL};
+int main(int argc, char* argv[])
+{ int n_rows, count, follicle;
+  Measurements *table;
+  double px2mm,
+         low_px,
+         high_px;
+
+  Process_Arguments( argc, argv, Spec, 0);
+
+  if( Is_Arg_Matched("-h") | Is_Arg_Matched("--help") )
+  { Print_Argument_Usage(stdout,0);
+    printf("--------------------------                                                   \n"
+          " Classify test 1 (autotraj)                                                   \n"
+          "---------------------------                                                   \n"
+          "                                                                              \n"
+          "  Uses a length threshold to seperate hair/microvibrissae from main whiskers. \n"
+          "  Then, for frames where the expected number of whiskers are found,           \n"
+          "  label the whiskers according to their order on the face.                    \n"
+          "\n"
+          "  <source> Filename with Measurements table.\n"
+          "  <dest>   Filename to which labelled Measurements will be saved.\n"
+          "           This can be the same as <source>.\n"
+          "  <face>\n"
+          "  <x> <y> <axis>\n"
+          "           These are used for determining the order of whisker segments along \n"
+          "           the face.  This requires an approximate position for the center of \n"
+          "           the face and can be specified in pixel coordinates with <x> and <y>.\n"
+          "           <axis> indicates the orientaiton of the face.  Values for <axis> may\n"
+          "           be 'x' or 'h' for horizontal. 'y' or 'v' indicate a vertical face. \n"
+          "           If the face is located along the edge of the frame then specify    \n"
+          "           that edge with 'left', 'right', 'top' or 'bottom'.                 \n"
+          "  --px2mm <double>\n"
+          "           The length of a pixel in millimeters.  This is used to determine   \n"
+          "           appropriate thresholds for discriminating hairs from whiskers.     \n"
+          "  -n <int> (Optional) Optimize the threshold to find this number of whiskers. \n"
+          "           If this isn't specified, or if this is set to a number less than 1 \n"
+          "           then the number of whiskers is automatically determined.           \n"
+          "  --follicle <int>\n"
+          "           Only count follicles that lie on one side of the line specified by \n"
+          "           this threshold (in pixels).  The direction of the line points      \n"
+          "           along the x or y axis depending which is closer to the orientation \n"
+          "           of the mouse's face.\n"
+          "  --profile <string>\n"
+          "           Write per-stage timings and counters as JSON to this file.         \n"
+          "  --timeline <string>\n"
+          "           With --profile, also write a Chrome trace event timeline.          \n"
+          "--                                                                            \n");
+    return 0;
+  }
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
+
+  px2mm   = Get_Double_Arg("--px2mm");
+  low_px  = Get_Double_Arg("--limit",1) / px2mm;
+  high_px = Get_Double_Arg("--limit",2) / px2mm;
+#ifdef DEBUG_CLASSIFY_1
+  debug("mm/px %f\n"
+        "  low %f\n"
+        " high %f\n", px2mm, low_px, high_px );
+#endif
+  count    = Is_Arg_Matched("-n")         ? Get_Int_Arg("-n")         : -1;
+  follicle = Is_Arg_Matched("--follicle") ? Get_Int_Arg("--follicle") :  0;
+
+  table  = Measurements_Table_From_Filename ( Get_String_Arg("source"), NULL, &n_rows );
+  if(!table) error("Couldn't read %s\n",Get_String_Arg("source"));
+  if( Is_Arg_Matched("face") )
+  { Measurements_Table_Classify( table, n_rows, Get_String_Arg("face"), 0, 0, 0,
+                                 follicle, low_px, high_px, count );
+  } else
+  { Measurements_Table_Classify( table, n_rows, NULL, Get_Int_Arg("x"), Get_Int_Arg("y"), Get_String_Arg("axis")[0],
+                                 follicle, low_px, high_px, count );
+  }
 
   Measurements_Table_To_Filename( Get_String_Arg("dest"), NULL, table, n_rows );
   Free_Measurements_Table(table);
@@ -593,6 +632,7 @@ char *Spec[] = {"[-h|--help] |",
                 "-n <int>", 
                 "[--limit<double(1.0)>:<double(50.0)>]",
                 "[--follicle <int>]",
+                "[--profile <string>] [--timeline <string>]",
                 NULL};
 int main(int argc, char* argv[])
 { int n_rows, count;
@@ -643,9 +683,17 @@ int main(int argc, char* argv[])
           "  --follicle <int>\n"
           "           Only count follicles that lie inside a circle with this radius in  \n"
           "           (in pixels) and centered at the face position as whiskers.         \n"
+          "  --profile <string>\n"
+          "           Write per-stage timings and counters as JSON to this file.         \n"
+          "  --timeline <string>\n"
+          "           With --profile, also write a Chrome trace event timeline.          \n"
           "--                                                                            \n");
     return 0;
   }
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
 
   px2mm   = Get_Double_Arg("--px2mm");
   low_px  = Get_Double_Arg("--limit",1) / px2mm;
@@ -658,6 +706,7 @@ int main(int argc, char* argv[])
 
   table  = Measurements_Table_From_Filename ( Get_String_Arg("source"), NULL, &n_rows );
   if(!table) error("Couldn't read %s\n",Get_String_Arg("source"));
+  PROFILE_BEGIN(PROFILE_CLASSIFY);
   Sort_Measurements_Table_Time(table,n_rows);
 
   { int maxx,maxy;
@@ -767,6 +816,7 @@ int main(int argc, char* argv[])
   Measurements_Table_Set_Follicle_Position_Indices  ( table, n_rows, 4, 5 );
 
   Measurements_Table_Label_By_Order(table, n_rows, count ); //re-sorts
+  PROFILE_END(PROFILE_CLASSIFY);
 
   Measurements_Table_To_Filename( Get_String_Arg("dest"), NULL, table, n_rows );
   Free_Measurements_Table(table);
@@ -41,6 +41,7 @@
 #include <libavutil/imgutils.h>
 #include <libavdevice/avdevice.h>
 #include <libavutil/pixfmt.h>
+#include <libavutil/pixdesc.h>
 //#include <avcodec.h>
 //#include <avformat.h>
 //#include <swscale.h>
@@ -83,11 +84,13 @@ typedef struct _ffmpeg_video
    uint8_t *data[AV_NUM_DATA_POINTERS];
    int linesize[AV_NUM_DATA_POINTERS];
    struct SwsContext *Sctx;
-   int videoStream, width, height;
+   int videoStream, width, height;   // width and height of the output (crop) frame
+   int crop_x, crop_y;                // origin of the output frame in the decoded frame
    int numBytes;
    int numFrames;
    Image currentImage;
    int last;
+   int needs_seek;                    // decoder position is unknown; the next fetch must seek
    int pix_fmt;
 } ffmpeg_video;
 
@@ -194,6 +197,7 @@ ffmpeg_video *ffmpeg_video_init(const char *fname, int format )
   ret->currentImage.array  = ret->data[0];
 
   ret->last = -1;
+  ret->needs_seek = 0;               // the decoder is at the start of the stream
   return ret;
 Error:
   ffmpeg_video_quit(ret);
@@ -205,6 +209,102 @@ int ffmpeg_video_bytes_per_frame( ffmpeg_video* v )
   return v->numBytes;
 }
 
+/* Convert the last decoded frame (pRaw) to the output format.
+ * Only the crop rectangle is converted.  The source planes are offset to
+ * the crop origin (in units of each plane's subsampling) so sws_scale
+ * sees just the rectangle.
+ * Returns 0 on success, -1 otherwise
+ */
+int ffmpeg_video_convert( ffmpeg_video *cur )
+{ const uint8_t *src[AV_NUM_DATA_POINTERS] = {0};
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(cur->pRaw->format);
+  int max_step[4],i;
+
+  TRY(desc);
+  av_image_fill_max_pixsteps(max_step,NULL,desc);
+  for(i=0;i<4 && cur->pRaw->data[i];++i)
+  { int chroma = (i==1 || i==2),
+        sx     = chroma ? (cur->crop_x >> desc->log2_chroma_w) : cur->crop_x,
+        sy     = chroma ? (cur->crop_y >> desc->log2_chroma_h) : cur->crop_y;
+    src[i] = cur->pRaw->data[i];
+    if( i==1 && (desc->flags & AV_PIX_FMT_FLAG_PAL) )  // palette, not pixels
+      continue;
+    src[i] += sy*cur->pRaw->linesize[i] + sx*max_step[i];
+  }
+
+  AVTRY(av_frame_make_writable(cur->pDat), NULL);
+
+  sws_scale(cur->Sctx,              // sws context
+            src,                    // src slice
+            cur->pRaw->linesize,    // src stride
+            0,                      // src slice origin y
+            cur->height,            // src slice height
+            cur->pDat->data,        // dst
+            cur->pDat->linesize );  // dst stride
+
+  /* copy out raw data */
+  av_image_copy(cur->data, cur->linesize, (const uint8_t **)(cur->pDat->data), cur->pDat->linesize, cur->pix_fmt, cur->width, cur->height);
+  return 0;
+Error:
+  return -1;
+}
+
+/* Set the rectangle of the decoded frame that is converted and returned.
+ * Pass width or height <= 0 for the full frame.  Reallocates the output
+ * buffers and scaler, and reconverts the current frame if there is one.
+ * Fails for pixel formats that can't be offset to an arbitrary origin
+ * (bitstream and hardware formats) or for an origin that doesn't fall on
+ * the chroma grid.
+ * Returns 0 on success, -1 otherwise
+ */
+int ffmpeg_video_set_crop( ffmpeg_video *cur, int x, int y, int width, int height )
+{ const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(cur->pCtx->pix_fmt);
+  if( width<=0 || height<=0 )
+  { x = y = 0;
+    width  = cur->pCtx->width;
+    height = cur->pCtx->height;
+  }
+  if( x==cur->crop_x && y==cur->crop_y && width==cur->width && height==cur->height )
+    return 0;
+  TRY(desc && !(desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM|AV_PIX_FMT_FLAG_HWACCEL)));
+  TRY(x>=0 && y>=0 && x+width<=cur->pCtx->width && y+height<=cur->pCtx->height);
+  TRY((x & ((1<<desc->log2_chroma_w)-1))==0 && (y & ((1<<desc->log2_chroma_h)-1))==0);
+
+  if( cur->Sctx ) sws_freeContext( cur->Sctx );
+  if( cur->pDat ) av_frame_free( &cur->pDat );
+  av_freep(&cur->data[0]);
+  cur->Sctx = NULL;
+
+  cur->crop_x = x;
+  cur->crop_y = y;
+  cur->width  = width;
+  cur->height = height;
+  cur->numBytes = av_image_alloc(cur->data, cur->linesize, cur->width, cur->height, cur->pix_fmt, 1);
+  TRY(cur->numBytes>=0);
+  TRY(cur->pDat = av_frame_alloc());
+  cur->pDat->format = cur->pix_fmt;
+  cur->pDat->width  = cur->width;
+  cur->pDat->height = cur->height;
+  AVTRY(av_frame_get_buffer(cur->pDat, 0), NULL);
+  TRY(cur->Sctx=sws_getContext(
+        cur->width,
+        cur->height,
+        cur->pCtx->pix_fmt,
+        cur->width,
+        cur->height,
+        cur->pix_fmt,
+        SWS_BICUBIC,NULL,NULL,NULL));
+
+  cur->currentImage.width  = cur->width;
+  cur->currentImage.height = cur->height;
+  cur->currentImage.array  = cur->data[0];
+  if( cur->last>=0 )
+    TRY(ffmpeg_video_convert(cur)==0);
+  return 0;
+Error:
+  return -1;
+}
+
 /* Parse next packet from cur video
  * Returns 0 on success, -1 otherwise
  */
@@ -259,18 +359,7 @@ int ffmpeg_video_next( ffmpeg_video *cur, int target )
     av_packet_unref(packet);
   } while (cur->pRaw->best_effort_timestamp < target);
 
-  AVTRY(av_frame_make_writable(cur->pDat), NULL);
-
-  sws_scale(cur->Sctx,              // sws context
-            cur->pRaw->data,        // src slice
-            cur->pRaw->linesize,    // src stride
-            0,                      // src slice origin y
-            cur->height,            // src slice height
-            cur->pDat->data,        // dst
-            cur->pDat->linesize );  // dst stride
-
-  /* copy out raw data */
-  av_image_copy(cur->data, cur->linesize, (const uint8_t **)(cur->pDat->data), cur->pDat->linesize, cur->pix_fmt, cur->width, cur->height);
+  TRY(ffmpeg_video_convert(cur)==0);
   return 0;
 Error:
   return -1;
@@ -356,24 +445,40 @@ SHARED_EXPORT void FFMPEG_Close(void *context)
 { if(context) ffmpeg_video_quit(context);
 }
 
+/* Decoding forward from the current position beats a seek for gaps up to
+ * about a keyframe interval.  A seek lands on a keyframe and decodes forward
+ * from there anyway.
+ */
+#define FFMPEG_MAX_DECODE_AHEAD 32
+
 SHARED_EXPORT Image *FFMPEG_Fetch(void *context, int iframe)
 { 
   ffmpeg_video *v = (ffmpeg_video*)context;
   TRY(iframe>=0 && iframe<v->numFrames);     // ensure iframe is in bounds
-  if(iframe==v->last+1)
+  if(iframe==v->last)                        // already decoded
+    goto Finalize;
+  if(!v->needs_seek && v->last<iframe && iframe-v->last<=FFMPEG_MAX_DECODE_AHEAD)
     TRY(ffmpeg_video_next(v,iframe)>=0);
   else
     TRY(ffmpeg_video_seek(v,iframe)>=0);
   v->last = iframe;
+  v->needs_seek = 0;
+Finalize:
   v->currentImage.array  = v->data[0];      // just in case the pointer changed...which it didn't
   return &v->currentImage;
 Error:
+  v->last = -1;                              // nothing valid is decoded
+  v->needs_seek = 1;                         // decoder position is unknown, force a seek next time
   return NULL;
 }
 
 SHARED_EXPORT unsigned int  FFMPEG_Frame_Count(void* ctx)
 { return ((ffmpeg_video*)ctx)->numFrames; }
 
+SHARED_EXPORT int FFMPEG_Set_Crop(void *context, int x, int y, int width, int height)
+{ return ffmpeg_video_set_crop((ffmpeg_video*)context,x,y,width,height)==0;
+}
+
 //--- UI2.PY interface
 
 int FFMPEG_Get_Stack_Dimensions(char *filename, int *width, int *height, int *depth, int *kind)
@@ -417,6 +522,7 @@ SHARED_EXPORT void         *FFMPEG_Open       (const char* filename)     {_handl
 SHARED_EXPORT void          FFMPEG_Close      (void *context)            {_handle_ffmpeg_not_installed();}             
 SHARED_EXPORT Image        *FFMPEG_Fetch      (void *context, int iframe){_handle_ffmpeg_not_installed(); return 0;}   
 SHARED_EXPORT unsigned int  FFMPEG_Frame_Count(void *context)            {_handle_ffmpeg_not_installed(); return 0;}   
+SHARED_EXPORT int           FFMPEG_Set_Crop   (void *context, int x, int y, int width, int height) {_handle_ffmpeg_not_installed(); return 0;}
 
 //--- UI2.PY interface
 SHARED_EXPORT int FFMPEG_Get_Stack_Dimensions(char *filename, int *width, int *height, int *depth, int *kind)
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
 
+#include "compat.h"
 #include "utilities.h"
 #include "image_lib.h"
 #include "level_set.h"
@@ -16,12 +18,13 @@
  ****************************************************************************************/
 
 //  Awk-generated (manager.awk) Contour space management
+//  The tracing state below is per thread so contours may be traced on several at once.
 
-static int     Contour_Length_Max = -1;
-static int     Cwidth;
-static int     Carea;
-static uint8  *Value8;
-static uint16 *Value16;
+static THREAD_LOCAL int     Contour_Length_Max = -1;
+static THREAD_LOCAL int     Cwidth;
+static THREAD_LOCAL int     Carea;
+static THREAD_LOCAL uint8  *Value8;
+static THREAD_LOCAL uint16 *Value16;
 
 static  int contour_tsize(Contour *contour)
 { return (sizeof(int) * contour->length); }
@@ -33,8 +36,9 @@ typedef struct __Contour
     Contour           contour;
   } _Contour;
 
-static _Contour *Free_Contour_List = NULL;
-static int    Contour_Offset, Contour_Inuse;
+static THREAD_LOCAL _Contour *Free_Contour_List = NULL;
+static THREAD_LOCAL int    Contour_Inuse;
+static const int    Contour_Offset = offsetof(_Contour,contour);
 
 static  void allocate_contour_tour(Contour *contour, int tsize, char *routine)
 { _Contour *object  = (_Contour *) (((char *) contour) - Contour_Offset);
@@ -49,7 +53,6 @@ static  Contour *new_contour(int tsize, char *routine)
 
   if (Free_Contour_List == NULL)
     { object = (_Contour *) Guarded_Malloc(sizeof(_Contour),routine);
-      Contour_Offset = ((char *) &(object->contour)) - ((char *) object);
       object->tsize = 0;
       object->contour.tour = NULL;
     }
@@ -177,8 +180,8 @@ static  int is_eq(int p, int level)
 }
 
 Contour *Trace_Region(Image *image, int pixel, Comparator cmprsn, int level, int iscon4)
-{ static int       offset[4];
-  static int       firstime = 0;
+{ static THREAD_LOCAL int offset[4];
+  static THREAD_LOCAL int firstime = 0;
   static char     *direction[] = { "S", "E", "N", "W" };
 
   Contour *my_cont;
@@ -373,6 +376,14 @@ Contour *Trace_Level_Set(Level_Set *rgn)
   return (Trace_Region(image,Level_Set_Leftmost(rgn),GE,Level_Set_Level(rgn),iscon4));
 }
 
+Contour *Trace_Level_Set_In(Component_Tree *tree, Level_Set *rgn)
+
+{ Image *image  = Get_Component_Tree_Image(tree);
+  int    iscon4 = Get_Component_Tree_Connectivity(tree);
+
+  return (Trace_Region(image,Level_Set_Leftmost_In(tree,rgn),GE,Level_Set_Level_In(tree,rgn),iscon4));
+}
+
 Contour *Trace_Watershed(Watershed_2D *w, int cb)
 
 { Image          *image  = w->labels;
@@ -390,7 +401,7 @@ Contour *Trace_Watershed(Watershed_2D *w, int cb)
  ****************************************************************************************/
 
 Contour_Extent *Contour_Get_Extent(Contour *cont)
-{ static Contour_Extent my_ext;
+{ static THREAD_LOCAL Contour_Extent my_ext;
 
   int  len, wide;
   int *tour;
@@ -443,10 +454,10 @@ static int RSORT(const void *l, const void *r)
 }
 
 int *Raster_Scan(Contour *trace, int *pren)
-{ static int   offset[4];
-  static int   firstime = 0;
-  static int   max_raster = 0;
-  static int  *raster = NULL;
+{ static THREAD_LOCAL int   offset[4];
+  static THREAD_LOCAL int   firstime = 0;
+  static THREAD_LOCAL int   max_raster = 0;
+  static THREAD_LOCAL int  *raster = NULL;
 
   int  len, wide, ren;
   int *tour;
@@ -543,10 +554,10 @@ int *Raster_Scan(Contour *trace, int *pren)
 }
 
 int *Yaster_Scan(Contour *trace, int *pren, int height)
-{ static int   offset[4];
-  static int   firstime = 0;
-  static int   max_raster = 0;
-  static int  *raster = NULL;
+{ static THREAD_LOCAL int   offset[4];
+  static THREAD_LOCAL int   firstime = 0;
+  static THREAD_LOCAL int   max_raster = 0;
+  static THREAD_LOCAL int  *raster = NULL;
 
   int  len, wide, ren;
   int *tour;
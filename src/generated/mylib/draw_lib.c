@@ -14,7 +14,7 @@ typedef struct
   } Brush;
 
 Brush *new_brush(Paint_Brush *floater, Image *canvas)
-{ static Brush My_Brush;
+{ static THREAD_LOCAL Brush My_Brush;
 
   if (canvas->kind == GREY16)
     { My_Brush.red   = 0xFFFF * floater->red;
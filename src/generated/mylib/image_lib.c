@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
+#include "compat.h"
 #include "utilities.h"
 #include "image_lib.h"
 #include "tiff_io.h"
@@ -90,8 +92,9 @@ typedef struct __Image
     Image           image;
   } _Image;
 
-static _Image *Free_Image_List = NULL;
-static int    Image_Offset, Image_Inuse;
+static THREAD_LOCAL _Image *Free_Image_List = NULL;
+static THREAD_LOCAL int    Image_Inuse;
+static const int    Image_Offset = offsetof(_Image,image);
 
 static  void allocate_image_array(Image *image, int asize, char *routine)
 { _Image *object  = (_Image *) (((char *) image) - Image_Offset);
@@ -114,7 +117,6 @@ static  Image *new_image(int asize, int tsize, char *routine)
 
   if (Free_Image_List == NULL)
     { object = (_Image *) Guarded_Malloc(sizeof(_Image),routine);
-      Image_Offset = ((char *) &(object->image)) - ((char *) object);
       object->asize = 0;
       object->image.array = NULL;
       object->tsize = 0;
@@ -227,8 +229,9 @@ typedef struct __Stack
     Stack           stack;
   } _Stack;
 
-static _Stack *Free_Stack_List = NULL;
-static int    Stack_Offset, Stack_Inuse;
+static THREAD_LOCAL _Stack *Free_Stack_List = NULL;
+static THREAD_LOCAL int    Stack_Inuse;
+static const int    Stack_Offset = offsetof(_Stack,stack);
 
 static  void allocate_stack_array(Stack *stack, int vsize, char *routine)
 { _Stack *object  = (_Stack *) (((char *) stack) - Stack_Offset);
@@ -251,7 +254,6 @@ static  Stack *new_stack(int vsize, int tsize, char *routine)
 
   if (Free_Stack_List == NULL)
     { object = (_Stack *) Guarded_Malloc(sizeof(_Stack),routine);
-      Stack_Offset = ((char *) &(object->stack)) - ((char *) object);
       object->vsize = 0;
       object->stack.array = NULL;
       object->tsize = 0;
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
 
+#include "compat.h"
 #include "utilities.h"
 #include "image_lib.h"
 #include "level_set.h"
@@ -52,6 +54,8 @@ typedef struct
     Stack   *stack_ref;
     regtree *array;
     int      iscon4;
+    pixel   *pixels;   /* Build workspace: union-find of pixels, and chords of  */
+    int     *chord;    /*   equal-valued pixels.  Kept to rebuild in place.     */
   } Comtree;
 
 
@@ -62,17 +66,17 @@ typedef struct
  ****************************************************************************************/
 
 
-/* Current Component Tree globals */
+/* Current Component Tree globals.  Each thread has its own current tree. */
 
-static regtree *regtrees;  /* Binary tree of region tree islands */
-static uint8   *value8;    /* Pixel values of image          */
-static uint16  *value16;   /* Pixel values of image          */
-static int      cwidth;    /* Width of current image         */
-static int      cheight;   /* Height of current image        */
-static int      cdepth;    /* Depth of current stack         */
-static int      carea;     /* Area of current image          */
-static int      cvolume;   /* Area of current image          */
-static Comtree *ctree = NULL;
+static THREAD_LOCAL regtree *regtrees;  /* Binary tree of region tree islands */
+static THREAD_LOCAL uint8   *value8;    /* Pixel values of image          */
+static THREAD_LOCAL uint16  *value16;   /* Pixel values of image          */
+static THREAD_LOCAL int      cwidth;    /* Width of current image         */
+static THREAD_LOCAL int      cheight;   /* Height of current image        */
+static THREAD_LOCAL int      cdepth;    /* Depth of current stack         */
+static THREAD_LOCAL int      carea;     /* Area of current image          */
+static THREAD_LOCAL int      cvolume;   /* Area of current image          */
+static THREAD_LOCAL Comtree *ctree = NULL;
 
 void Set_Current_Component_Tree(Component_Tree *atree)
 { Comtree *t = (Comtree *) atree;
@@ -81,20 +85,30 @@ void Set_Current_Component_Tree(Component_Tree *atree)
   if (atree != NULL)
     if (t->image_ref != NULL)
       { if (t->image_ref->kind == GREY16)
-          value16 = (uint16 *) (t->image_ref->array);
+          { value16 = (uint16 *) (t->image_ref->array);
+            value8  = NULL;
+          }
         else
-          value8  = t->image_ref->array;
+          { value8  = t->image_ref->array;
+            value16 = NULL;
+          }
         cwidth   = t->image_ref->width;
+        cheight  = t->image_ref->height;
         carea    = cwidth * cheight;
         regtrees = t->array - 1;
       }
     else
       { if (t->stack_ref->kind == GREY16)
-          value16 = (uint16 *) (t->stack_ref->array);
+          { value16 = (uint16 *) (t->stack_ref->array);
+            value8  = NULL;
+          }
         else
-          value8  = t->stack_ref->array;
+          { value8  = t->stack_ref->array;
+            value16 = NULL;
+          }
         cwidth   = t->stack_ref->width;
         cheight  = t->stack_ref->height;
+        cdepth   = t->stack_ref->depth;
         carea    = cwidth * cheight;
         cvolume  = cwidth * cheight * cdepth;
         regtrees = t->array - 1;
@@ -240,44 +254,118 @@ void List_Level_Set(Level_Set *r, void (*handler)(int))
 
 /****************************************************************************************
  *                                                                                      *
- *  COMPONENT TREE SPACE MANAGEMENT ROUTINES                                            *
+ *  TREE-PASSING TRAVERSAL ROUTINES                                                     *
  *                                                                                      *
  ****************************************************************************************/
 
-//  Workspace routines for building a component tree
+/* Same as the routines above, but everything is read from the tree that is passed in
+   rather than from the current tree.  Different trees may be traversed at the same
+   time, on the same thread or on different ones.                                      */
 
-static int *get_chord(int area, char *routine)
-{ static int  Max_Area = 0;
-  static int *Array = NULL;
+static  int tree_value(Comtree *t, int p)
+{ int   kind  = (t->image_ref != NULL) ? t->image_ref->kind  : t->stack_ref->kind;
+  void *array = (t->image_ref != NULL) ? t->image_ref->array : t->stack_ref->array;
+  if (kind == GREY16)
+    return (((uint16 *) array)[p]);
+  else
+    return (((uint8 *) array)[p]);
+}
 
-  if (area < 0)
-    { free(Array);
-      Max_Area = 0;
-      Array    = NULL;
-    }
-  else if (area > Max_Area)
-    { Max_Area = area;
-      Array    = (int *) Guarded_Realloc(Array,sizeof(int)*Max_Area,routine);
-    }
-  return (Array);
+static  int tree_size(Comtree *t, int cont)
+{ if (cont > 0)
+    return (t->array[cont-1].size);
+  else
+    return (1);
 }
 
-static pixel *get_pixels(int area, char *routine)
-{ static int    Max_Area = 0;
-  static pixel *Array = NULL;
+static  int tree_level(Comtree *t, int cont)
+{ if (cont > 0)
+    return (t->array[cont-1].level);
+  else
+    return (tree_value(t,-cont));
+}
 
-  if (area < 0)
-    { free(Array);
-      Max_Area = 0;
-      Array    = NULL;
-    }
-  else if (area > Max_Area)
-    { Max_Area = area;
-      Array    = (pixel *) Guarded_Realloc(Array,sizeof(pixel)*Max_Area,routine);
+static  int tree_peak(Comtree *t, int cont)
+{ if (cont > 0)
+    return (t->array[cont-1].peak);
+  else
+    return (tree_value(t,-cont));
+}
+
+static  int tree_start(Comtree *t, int cont)
+{ if (cont > 0)
+    return (t->array[cont-1].start);
+  else
+    return (-cont);
+}
+
+  /* The level set for node x, or NULL if it is a pixel on the level of its parent */
+
+static  Level_Set *tree_level_set(Comtree *t, int x)
+{ regtree *p;
+
+  if (x <= 0)
+    return (NULL);
+  p = t->array + (x-1);
+  if (p->right <= 0 && tree_value(t,-p->right) == p->level)
+    return (NULL);
+  return ((Level_Set *) p);
+}
+
+Level_Set *Level_Set_Root_In(Component_Tree *tree)
+{ Comtree *t = (Comtree *) tree;
+  int      n;
+
+  if (t->image_ref != NULL)
+    n = t->image_ref->width * t->image_ref->height;
+  else
+    n = t->stack_ref->width * t->stack_ref->height * t->stack_ref->depth;
+  return ((Level_Set *) (t->array + (n-1)));
+}
+
+Level_Set *Level_Set_Child_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_level_set((Comtree *) tree,((regtree *) r)->right)); }
+
+Level_Set *Level_Set_Sibling_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_level_set((Comtree *) tree,((regtree *) r)->left)); }
+
+int Level_Set_Size_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_size((Comtree *) tree,((regtree *) r)->right)); }
+
+int Level_Set_Level_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_level((Comtree *) tree,((regtree *) r)->right)); }
+
+int Level_Set_Peak_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_peak((Comtree *) tree,((regtree *) r)->right)); }
+
+int Level_Set_Leftmost_In(Component_Tree *tree, Level_Set *r)
+{ return (tree_start((Comtree *) tree,((regtree *) r)->right)); }
+
+int Level_Set_Id_In(Component_Tree *tree, Level_Set *r)
+{ return (((regtree *) r) - (((Comtree *) tree)->array - 1)); }
+
+static void list_level_set_in(regtree *nodes, int p, void (*handler)(int,void *), void *arg)
+{ if (p <= 0)
+    handler(-p,arg);
+  else
+    { while (p > 0)
+        { list_level_set_in(nodes,nodes[p].right,handler,arg);
+          p = nodes[p].left;
+        }
+      list_level_set_in(nodes,p,handler,arg);
     }
-  return (Array);
 }
 
+void List_Level_Set_In(Component_Tree *tree, Level_Set *r, void (*handler)(int,void *), void *arg)
+{ list_level_set_in(((Comtree *) tree)->array - 1,((regtree *) r)->right,handler,arg); }
+
+
+/****************************************************************************************
+ *                                                                                      *
+ *  COMPONENT TREE SPACE MANAGEMENT ROUTINES                                            *
+ *                                                                                      *
+ ****************************************************************************************/
+
 //  Awk-generated (manager.awk) Component_Tree space management
 
 static  int comtree_asize(Comtree *tree)
@@ -288,15 +376,26 @@ static  int comtree_asize(Comtree *tree)
             tree->stack_ref->depth * sizeof(regtree));
 }
 
+  /* The build workspace isn't part of the tree, so copies and packs drop it */
+
+static  int comtree_psize(Comtree *tree)
+{ return (0); }
+
+static  int comtree_csize(Comtree *tree)
+{ return (0); }
+
 
 typedef struct __Comtree
   { struct __Comtree *next;
     int               asize;
+    int               psize;
+    int               csize;
     Comtree           comtree;
   } _Comtree;
 
-static _Comtree *Free_Comtree_List = NULL;
-static int    Comtree_Offset, Comtree_Inuse;
+static THREAD_LOCAL _Comtree *Free_Comtree_List = NULL;
+static THREAD_LOCAL int    Comtree_Inuse;
+static const int    Comtree_Offset = offsetof(_Comtree,comtree);
 
 static  void allocate_comtree_array(Comtree *comtree, int asize, char *routine)
 { _Comtree *object  = (_Comtree *) (((char *) comtree) - Comtree_Offset);
@@ -306,14 +405,33 @@ static  void allocate_comtree_array(Comtree *comtree, int asize, char *routine)
     }
 }
 
-static  Comtree *new_comtree(int asize, char *routine)
+static  void allocate_comtree_pixels(Comtree *comtree, int psize, char *routine)
+{ _Comtree *object  = (_Comtree *) (((char *) comtree) - Comtree_Offset);
+  if (object->psize < psize)
+    { object->comtree.pixels  = Guarded_Realloc(object->comtree.pixels,psize,routine);
+      object->psize = psize;
+    }
+}
+
+static  void allocate_comtree_chord(Comtree *comtree, int csize, char *routine)
+{ _Comtree *object  = (_Comtree *) (((char *) comtree) - Comtree_Offset);
+  if (object->csize < csize)
+    { object->comtree.chord  = Guarded_Realloc(object->comtree.chord,csize,routine);
+      object->csize = csize;
+    }
+}
+
+static  Comtree *new_comtree(int asize, int psize, int csize, char *routine)
 { _Comtree *object;
 
   if (Free_Comtree_List == NULL)
     { object = (_Comtree *) Guarded_Malloc(sizeof(_Comtree),routine);
-      Comtree_Offset = ((char *) &(object->comtree)) - ((char *) object);
       object->asize = 0;
       object->comtree.array = NULL;
+      object->psize = 0;
+      object->comtree.pixels = NULL;
+      object->csize = 0;
+      object->comtree.chord = NULL;
     }
   else
     { object = Free_Comtree_List;
@@ -321,17 +439,25 @@ static  Comtree *new_comtree(int asize, char *routine)
     }
   Comtree_Inuse += 1;
   allocate_comtree_array(&(object->comtree),asize,routine);
+  allocate_comtree_pixels(&(object->comtree),psize,routine);
+  allocate_comtree_chord(&(object->comtree),csize,routine);
   return (&(object->comtree));
 }
 
 static  Comtree *copy_comtree(Comtree *comtree)
 { _Comtree *object  = (_Comtree *) (((char *) comtree) - Comtree_Offset);
-  Comtree *copy = new_comtree(comtree_asize(comtree),"Copy_Component_Tree");
+  Comtree *copy = new_comtree(comtree_asize(comtree),comtree_psize(comtree),comtree_csize(comtree),"Copy_Component_Tree");
   Comtree  temp = *copy;
   *copy = *comtree;
   copy->array = temp.array;
   if (comtree_asize(comtree) != 0)
     memcpy(copy->array,comtree->array,comtree_asize(comtree));
+  copy->pixels = temp.pixels;
+  if (comtree_psize(comtree) != 0)
+    memcpy(copy->pixels,comtree->pixels,comtree_psize(comtree));
+  copy->chord = temp.chord;
+  if (comtree_csize(comtree) != 0)
+    memcpy(copy->chord,comtree->chord,comtree_csize(comtree));
   return (copy);
 }
 
@@ -348,6 +474,22 @@ static  void pack_comtree(Comtree *comtree)
       else
         object->comtree.array = NULL;
     }
+  if (object->psize > comtree_psize(comtree))
+    { object->psize = comtree_psize(comtree);
+      if (object->psize != 0)
+        object->comtree.pixels = Guarded_Realloc(object->comtree.pixels,
+                                                 object->psize,"Pack_Comtree");
+      else
+        object->comtree.pixels = NULL;
+    }
+  if (object->csize > comtree_csize(comtree))
+    { object->csize = comtree_csize(comtree);
+      if (object->csize != 0)
+        object->comtree.chord = Guarded_Realloc(object->comtree.chord,
+                                                object->csize,"Pack_Comtree");
+      else
+        object->comtree.chord = NULL;
+    }
 }
 
 void Pack_Component_Tree(Component_Tree *component_tree)
@@ -365,6 +507,10 @@ void Free_Component_Tree(Component_Tree *component_tree)
 
 static  void kill_comtree(Comtree *comtree)
 { _Comtree *object  = (_Comtree *) (((char *) comtree) - Comtree_Offset);
+  if (comtree->chord != NULL)
+    free(comtree->chord);
+  if (comtree->pixels != NULL)
+    free(comtree->pixels);
   if (comtree->array != NULL)
     free(comtree->array);
   free(((char *) comtree) - Comtree_Offset);
@@ -388,10 +534,7 @@ int Component_Tree_Usage()
 { return (Comtree_Inuse); }
 
 void Reset_Component_Tree()
-{ reset_comtree();
-  get_chord(-1,NULL);
-  get_pixels(-1,NULL);
-}
+{ reset_comtree(); }
 
 
 /****************************************************************************************
@@ -400,7 +543,7 @@ void Reset_Component_Tree()
  *                                                                                      *
  ****************************************************************************************/
 
-static pixel *pixels;         /* Union-find of image pixels  */
+static THREAD_LOCAL pixel *pixels;         /* Union-find of image pixels (ctree->pixels)  */
 
 /* Find root of pixel x in union/find tree and compress path */
 
@@ -591,13 +734,13 @@ static int flatten_tree(int p)
   return (final);
 }
 
-static int chk_width;
-static int chk_height;
-static int chk_depth;
-static int chk_iscon4;
+static THREAD_LOCAL int chk_width;
+static THREAD_LOCAL int chk_height;
+static THREAD_LOCAL int chk_depth;
+static THREAD_LOCAL int chk_iscon4;
 
 static  int *boundary_pixels_2d(int p)
-{ static int bound[8];
+{ static THREAD_LOCAL int bound[8];
   int x, xn, xp;
   int y, yn, yp;
 
@@ -629,7 +772,7 @@ static  int *boundary_pixels_2d(int p)
 }
 
 static  int *boundary_pixels_3d(int p)
-{ static int bound[26];
+{ static THREAD_LOCAL int bound[26];
   int x, xn, xp;
   int y, yn, yp;
   int z, zn, zp;
@@ -690,6 +833,9 @@ static  int *boundary_pixels_3d(int p)
 }
 
 Component_Tree *Build_2D_Component_Tree(Image *frame, int iscon4)
+{ return (Rebuild_2D_Component_Tree(NULL,frame,iscon4)); }
+
+Component_Tree *Rebuild_2D_Component_Tree(Component_Tree *tree, Image *frame, int iscon4)
 { int index[0x10001];
   int maxval;
 
@@ -710,7 +856,15 @@ Component_Tree *Build_2D_Component_Tree(Image *frame, int iscon4)
   cwidth   = frame->width;
   cheight  = frame->height;
   carea    = cwidth*cheight;
-  ctree    = new_comtree(carea*sizeof(regtree),"Build_Component_Tree");
+  if (tree == NULL)
+    ctree = new_comtree(carea*sizeof(regtree),carea*sizeof(pixel),carea*sizeof(int),
+                        "Build_Component_Tree");
+  else
+    { ctree = (Comtree *) tree;             //  Reuse the node array and workspace.  Only grows.
+      allocate_comtree_array(ctree,carea*sizeof(regtree),"Build_Component_Tree");
+      allocate_comtree_pixels(ctree,carea*sizeof(pixel),"Build_Component_Tree");
+      allocate_comtree_chord(ctree,carea*sizeof(int),"Build_Component_Tree");
+    }
   ctree->image_ref = frame;
   ctree->stack_ref = NULL;
   ctree->iscon4    = iscon4;
@@ -737,8 +891,8 @@ Component_Tree *Build_2D_Component_Tree(Image *frame, int iscon4)
   chk_height = cheight-1;
   chk_iscon4 = iscon4;
 
-  chord  = get_chord(carea,"Build_Component_Tree");
-  pixels = get_pixels(carea,"Build_Component_Tree");
+  chord  = ctree->chord;
+  pixels = ctree->pixels;
 
   if (frame->kind == GREY16)
     { maxval  = 0x10000;
@@ -836,7 +990,7 @@ Component_Tree *Build_2D_Component_Tree(Image *frame, int iscon4)
 }
 
 Component_Tree *Build_3D_Component_Tree(Stack *frame, int iscon6)
-{ static int index[0x10001];
+{ static THREAD_LOCAL int index[0x10001];
 
   int neighbor[26];
   int n_nbrs;
@@ -858,7 +1012,8 @@ Component_Tree *Build_3D_Component_Tree(Stack *frame, int iscon6)
   cdepth   = frame->depth;
   carea    = cwidth*cheight;
   cvolume  = cwidth*cheight*cdepth;
-  ctree    = new_comtree(cvolume*sizeof(regtree),"Build_Component_Tree");
+  ctree    = new_comtree(cvolume*sizeof(regtree),cvolume*sizeof(pixel),cvolume*sizeof(int),
+                         "Build_Component_Tree");
   ctree->stack_ref = frame;
   ctree->image_ref = NULL;
   ctree->iscon4    = iscon6;
@@ -888,8 +1043,8 @@ Component_Tree *Build_3D_Component_Tree(Stack *frame, int iscon6)
   chk_height = cheight-1;
   chk_iscon4 = iscon6;
 
-  chord  = get_chord(cvolume,"Build_Component_Tree");
-  pixels = get_pixels(cvolume,"Build_Component_Tree");
+  chord  = ctree->chord;
+  pixels = ctree->pixels;
 
   if (frame->kind == GREY16)
     { maxval  = 0x10000;
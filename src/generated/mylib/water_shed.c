@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
 
+#include "compat.h"
 #include "utilities.h"
 #include "image_lib.h"
 #include "water_shed.h"
@@ -53,8 +55,9 @@ typedef struct __Watershed_2D
     Watershed_2D           watershed_2d;
   } _Watershed_2D;
 
-static _Watershed_2D *Free_Watershed_2D_List = NULL;
-static int    Watershed_2D_Offset, Watershed_2D_Inuse;
+static THREAD_LOCAL _Watershed_2D *Free_Watershed_2D_List = NULL;
+static THREAD_LOCAL int    Watershed_2D_Inuse;
+static const int    Watershed_2D_Offset = offsetof(_Watershed_2D,watershed_2d);
 
 static  void allocate_watershed_2d_seeds(Watershed_2D *watershed_2d, int ssize, char *routine)
 { _Watershed_2D *object  = (_Watershed_2D *) (((char *) watershed_2d) - Watershed_2D_Offset);
@@ -69,7 +72,6 @@ static  Watershed_2D *new_watershed_2d(int ssize, char *routine)
 
   if (Free_Watershed_2D_List == NULL)
     { object = (_Watershed_2D *) Guarded_Malloc(sizeof(_Watershed_2D),routine);
-      Watershed_2D_Offset = ((char *) &(object->watershed_2d)) - ((char *) object);
       object->ssize = 0;
       object->watershed_2d.seeds = NULL;
       object->watershed_2d.labels = NULL;
@@ -654,8 +656,9 @@ typedef struct __Watershed_3D
     Watershed_3D           watershed_3d;
   } _Watershed_3D;
 
-static _Watershed_3D *Free_Watershed_3D_List = NULL;
-static int    Watershed_3D_Offset, Watershed_3D_Inuse;
+static THREAD_LOCAL _Watershed_3D *Free_Watershed_3D_List = NULL;
+static THREAD_LOCAL int    Watershed_3D_Inuse;
+static const int    Watershed_3D_Offset = offsetof(_Watershed_3D,watershed_3d);
 
 static  void allocate_watershed_3d_seeds(Watershed_3D *watershed_3d, int ssize, char *routine)
 { _Watershed_3D *object  = (_Watershed_3D *) (((char *) watershed_3d) - Watershed_3D_Offset);
@@ -670,7 +673,6 @@ static  Watershed_3D *new_watershed_3d(int ssize, char *routine)
 
   if (Free_Watershed_3D_List == NULL)
     { object = (_Watershed_3D *) Guarded_Malloc(sizeof(_Watershed_3D),routine);
-      Watershed_3D_Offset = ((char *) &(object->watershed_3d)) - ((char *) object);
       object->ssize = 0;
       object->watershed_3d.seeds = NULL;
       object->watershed_3d.labels = NULL;
@@ -301,21 +301,28 @@ void LRDelModel_Compute_Starts_For_Two_Classes_Log2( real *S, real *T, int nwhis
     S[N] = v[ N%3 ] + t[ N%3 ] - (N/3)*log2p_missing;
 }
 
+// Shape likelihoods of each observation for every state in shp_dists:
+// nobs x shp_dists->n_states.  The storage is reused by the next call.
+static real *shape_log2p( Measurements *obs, int nobs, Distributions *shp_dists )
+{ static size_t maxsize = 0;
+  static real *L = NULL;
+  L = request_storage(L, &maxsize, sizeof(real), nobs*shp_dists->n_states, "LRDelModel - shape likelihoods");
+  Eval_Table_Likelihood_Log2_All_States( shp_dists, obs, nobs, L );
+  return L;
+}
+
 void LRDelModel_Compute_Starts_For_Distinct_Whiskers_Log2( real *S, real *T, int nwhisk, Measurements *first, Distributions *shp_dists )
 { int N = 3 * nwhisk + 1;
   int i,iwhisk;
-  double *shp = first->data;
+  real *L = shape_log2p( first, 1, shp_dists );
   // Assumes the following encoding of conditionals for the distributions:
   //   Junk                    -> translates to state 0
   //   Whiskers                -> translates to state 1..nwhisk (inclusive)
-  { real log2p = Eval_Likelihood_Log2( shp_dists, shp, 0 );
-    for(i=0;i<N;i+=3)
-      S[i] = log2p;
-    for(i=1,iwhisk=1;i<N;i+=3,iwhisk++)
-    { log2p  = Eval_Likelihood_Log2( shp_dists, shp, iwhisk ); 
-      S[i]   = log2p;
-      S[i+1] = log2p;
-    }
+  for(i=0;i<N;i+=3)
+    S[i] = L[0];
+  for(i=1,iwhisk=1;i<N;i+=3,iwhisk++)
+  { S[i]   = L[iwhisk];
+    S[i+1] = L[iwhisk];
   }
 }
 
@@ -334,12 +341,13 @@ real *LRDelModel_Request_Static_Resizable_Emissions( int nwhisk, int nobs )
 
 void LRDelModel_Compute_Emissions_For_Two_Classes_Log2( real *E, int nwhisk, Measurements *obs, int nobs, Distributions *shp_dists )
 { int N = 3 * nwhisk + 1;
-  int i,j;
+  int i,j,ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
   for(i=0;i<N;i++)
   { real *row = E + i*nobs;
     int state = (i%3)!=0;
     for(j=0;j<nobs;j++)
-      row[j] = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+      row[j] = L[j*ns + state];
   }
 }
 
@@ -356,6 +364,8 @@ void  LRDelModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
   int i,j;
   real max_logp_delta = -FLT_MAX;
   Measurements *prev;
+  int ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
 
   // over all observables and all states
   // compute max delta probability.
@@ -391,7 +401,7 @@ void  LRDelModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
     int st = LRDelModel_State_Decode(i); 
     if( st > -1 && (prev = history[ st ]) ) 
     { for(j=0;j<nobs;j++)
-      { shp = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+      { shp = L[j*ns + state];
         vel = Eval_Velocity_Likelihood_Log2( vel_dists,
                                               prev->data,
                                               obs[j].data,
@@ -403,7 +413,7 @@ void  LRDelModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
       }
     } else // missing a previous
     { for(j=0;j<nobs;j++)
-      { shp = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+      { shp = L[j*ns + state];
         vel = max_logp_delta;
         row[j] = shp + vel;
 #ifdef DEBUG_LRDELMODEL_COMPUTE_EMISSIONS_FOR_TWO_CLASSES_W_HISTORY_LOG2
@@ -417,24 +427,26 @@ void  LRDelModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
 void LRDelModel_Compute_Emissions_For_Distinct_Whiskers_Log2( real *E, int nwhisk, Measurements *obs, int nobs, Distributions *shp_dists ) 
 { int N = 3 * nwhisk + 1;
   int i,j, iwhisk;
+  int ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
   // Assumes the following encoding of conditionals for the distributions:
   //   Junk     N%3==0         -> translates to state 0
   //   Whiskers N%3!=0         -> translates to state 1..nwhisk (inclusive)
   
   // first do junk
   for(j=0;j<nobs;j++)
-  { real logp = Eval_Likelihood_Log2( shp_dists, obs[j].data, 0 );  
+  { real logp = L[j*ns];
     for(i=0;i<N;i+=3)  
       E[i*nobs+j] = logp;
   }
 
-  // now whiskers
+  // now whiskers (and their deletion states)
   for(i=1,iwhisk=1;i<N;i+=3,iwhisk++)
   { real *row = E + i*nobs;
     for(j=0;j<nobs;j++)
-    { double log2p = Eval_Likelihood_Log2( shp_dists, obs[j].data, iwhisk );
-      row[j] = log2p;
-      row[j+1] = log2p;
+    { real log2p = L[j*ns + iwhisk];
+      row[j]      = log2p;
+      row[j+nobs] = log2p;
     }
   }
 }
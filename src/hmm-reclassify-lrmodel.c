@@ -191,19 +191,27 @@ void LRModel_Compute_Starts_For_Two_Classes_Log2( real *S, real *T, int nwhisk,
     S[N] = v[ N%2 ] + t[ N%2 ] + (N/2)*log2p_missing;
 }
 
+// Shape likelihoods of each observation for every state in shp_dists:
+// nobs x shp_dists->n_states.  The storage is reused by the next call.
+static real *shape_log2p( Measurements *obs, int nobs, Distributions *shp_dists )
+{ static size_t maxsize = 0;
+  static real *L = NULL;
+  L = request_storage(L, &maxsize, sizeof(real), nobs*shp_dists->n_states, "LRModel - shape likelihoods");
+  Eval_Table_Likelihood_Log2_All_States( shp_dists, obs, nobs, L );
+  return L;
+}
+
 void LRModel_Compute_Starts_For_Distinct_Whiskers_Log2( real *S, real *T, int nwhisk, Measurements *first, Distributions *shp_dists )
 { int N = 2 * nwhisk + 1;
   int i,iwhisk;
-  double *shp = first->data;
+  real *L = shape_log2p( first, 1, shp_dists );
   // Assumes the following encoding of conditionals for the distributions:
   //   Junk is when N even     -> translates to state 0
   //   Whiskers are when N odd -> translates to state 1..nwhisk (inclusive)
-  { real log2p = Eval_Likelihood_Log2( shp_dists, shp, 0 );
-    for(i=0;i<N;i+=2)
-      S[i] = log2p;
-    for(i=1,iwhisk=1;i<N;i+=2,iwhisk++)
-      S[i] = Eval_Likelihood_Log2( shp_dists, shp, iwhisk ); 
-  }
+  for(i=0;i<N;i+=2)
+    S[i] = L[0];
+  for(i=1,iwhisk=1;i<N;i+=2,iwhisk++)
+    S[i] = L[iwhisk];
 }
 
 real *LRModel_Alloc_Emissions( int nwhisk, int nobs )
@@ -221,12 +229,13 @@ real *LRModel_Request_Static_Resizable_Emissions( int nwhisk, int nobs )
 
 void LRModel_Compute_Emissions_For_Two_Classes_Log2( real *E, int nwhisk, Measurements *obs, int nobs, Distributions *shp_dists )
 { int N = 2 * nwhisk + 1;
-  int i,j;
+  int i,j,ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
   for(i=0;i<N;i++)
   { real *row = E + i*nobs;
     int state = i&1;
     for(j=0;j<nobs;j++)
-      row[j] = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+      row[j] = L[j*ns + state];
   }
 }
 
@@ -283,6 +292,8 @@ void  LRModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
   real max_logp_delta = -FLT_MAX;
   Measurements *p,
                **history = prev->whiskers;
+  int ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
 
 #ifdef DEBUG_LRMODEL_COMPUTE_EMISSIONS_FOR_TWO_CLASSES_W_HISTORY_LOG2
   debug("  j st   shp      vel\n"
@@ -295,7 +306,7 @@ void  LRModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
     int st = LRModel_State_Decode(i); 
     if( st > -1 && (p = history[ st ]) ) 
     { for(j=0;j<nobs;j++)
-      { shp = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+      { shp = L[j*ns + state];
         vel = Eval_Velocity_Likelihood_Log2( vel_dists,
                                               p->data,
                                               obs[j].data,
@@ -308,7 +319,7 @@ void  LRModel_Compute_Emissions_For_Two_Classes_W_History_Log2(
     } else // missing a previous
     { for(j=0;j<nobs;j++)
       { vel = velocity_likelihood_infer_match(prev,vel_dists,obs,j,st);        
-        shp = Eval_Likelihood_Log2( shp_dists, obs[j].data, state );
+        shp = L[j*ns + state];
 
         row[j] = shp + vel;
 #ifdef DEBUG_LRMODEL_COMPUTE_EMISSIONS_FOR_TWO_CLASSES_W_HISTORY_LOG2
@@ -399,13 +410,15 @@ void  LRModel_Compute_Emissions_For_Two_Classes_W_Prev_And_Next_Log2(
 void LRModel_Compute_Emissions_For_Distinct_Whiskers_Log2( real *E, int nwhisk, Measurements *obs, int nobs, Distributions *shp_dists ) 
 { int N = 2 * nwhisk + 1;
   int i,j, iwhisk;
+  int ns = shp_dists->n_states;
+  real *L = shape_log2p( obs, nobs, shp_dists );
   // Assumes the following encoding of conditionals for the distributions:
   //   Junk is when N even     -> translates to state 0
   //   Whiskers are when N odd -> translates to state 1..nwhisk (inclusive)
   
   // first do junk
   for(j=0;j<nobs;j++)
-  { real logp = Eval_Likelihood_Log2( shp_dists, obs[j].data, 0 );  
+  { real logp = L[j*ns];
     for(i=0;i<N;i+=2)  
       E[i*nobs+j] = logp;
   }
@@ -414,7 +427,7 @@ void LRModel_Compute_Emissions_For_Distinct_Whiskers_Log2( real *E, int nwhisk,
   for(i=1,iwhisk=1;i<N;i+=2,iwhisk++)
   { real *row = E + i*nobs;
     for(j=0;j<nobs;j++)
-      row[j] = Eval_Likelihood_Log2( shp_dists, obs[j].data, iwhisk );
+      row[j] = L[j*ns + iwhisk];
   }
 }
 
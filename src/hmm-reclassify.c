@@ -21,6 +21,7 @@
 #include "common.h"
 #include "hmm-reclassify.h"
 #include "measurements_io.h"
+#include "profile.h"
 
 #include "parameters/param.h"
 
@@ -293,7 +294,7 @@ void HMM_Reclassify_No_Deltas_W_Likelihood(
   { Measurements *bookmark = row;
     int fid = row->fid;
     int nobs;
-    while( row->fid == fid && row < table+nrows )
+    while( row < table+nrows && row->fid == fid )
     {
 #ifdef DEBUG_HMM_RECLASSIFY_EXTRA
       debug("Frame: %5d  Whisker: %3d  State: %3d \n", row->fid, row->wid, row->state);
@@ -463,6 +464,7 @@ int main(int argc, char*argv[])
   Distributions_Dilate( shp_dists );
   Distributions_Normalize( shp_dists );
   Distributions_Apply_Log2( shp_dists );
+  Distributions_Index_States( shp_dists );
 
   //
   // Process frames
@@ -590,6 +592,7 @@ int main(int argc, char*argv[])
   Distributions_Normalize( vel_dists );
   Distributions_Apply_Log2( shp_dists );
   Distributions_Apply_Log2( vel_dists );
+  Distributions_Index_States( shp_dists );
 
   //
   // Process frames
@@ -698,9 +701,6 @@ int main(int argc, char*argv[])
 }
 #endif
 
-#ifdef TEST_HMM_RECLASSIFY_WATERSHED
-
-
 typedef struct _heap
 { real **data;
   size_t size;
@@ -807,7 +807,7 @@ heap *Priority_Queue_Init( real *likelihood, int nframes)
   heap *q;          // priority queue
   static const real tol = 0.0;
 
-  p = likelihood + nframes;
+  p = likelihood + nframes - 1; // interior frames only; first and last are added below
   while(p-- > likelihood+1)
     if(    (p[ 0] - p[-1]) >= tol
         && (p[ 0] - p[ 1]) >= tol )
@@ -823,7 +823,7 @@ heap *Priority_Queue_Init( real *likelihood, int nframes)
   //    b.  use heap_build, O(count)
   //    Repeated heap_insert would be O( count x log(count) )
   { real **minima = q->data;
-    p = likelihood + nframes;
+    p = likelihood + nframes - 1;
     while(p-- > likelihood+1)
       if(    (p[ 0] - p[-1]) >= tol
           && (p[ 0] - p[ 1]) >= tol )
@@ -1193,49 +1193,28 @@ int _count_labelled_as_whiskers(frame_index *index, int fid)
   return count;
 }
 
-char *Spec[] = {"[-h|--help] | ( [-n <int>] <source:string> <dest:string> )",NULL};
-int main(int argc, char*argv[])
-{
-  int nrows;
-  int nwhisk;
-  Measurements *table, *row;
+/* Watershed reclassification
+ *
+ * `table` should hold an initial guess at the identity of many of the
+ * segments (see classify).  Frames whose guess is most likely under the model
+ * are trusted first.  Labels are extended from those frames to their
+ * neighbors, then across the remaining gaps.
+ *
+ * The table is relabelled in place.  Velocities are recomputed and rows are
+ * reordered.
+ *
+ * If nwhisk < 1, the number of whiskers is taken from the initial guess.
+ * Returns 0, and does nothing, if every segment was already labelled as a
+ * whisker.  Otherwise returns 1.
+ */
+SHARED_EXPORT
+int HMM_Reclassify_Watershed( Measurements *table, int nrows, int nwhisk )
+{ Measurements *row;
   Distributions *shp_dists, *vel_dists;
   real *T;
   int nstate,minstate,maxstate;
-  
-  Process_Arguments( argc, argv, Spec, 0 );
-  { char* paramfile = "default.parameters";
-    if(Load_Params_File("default.parameters"))
-    { warning(
-        "Could not load parameters from file: %s\n"
-        "Writing %s\n"
-        "\tTrying again\n",paramfile,paramfile);
-      Print_Params_File(paramfile);
-      if(Load_Params_File("default.parameters"))
-        error("\tStill could not load parameters.\n");
-    }
-  }
-
-  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
-    "----------------------------\n"
-    "HMM-Reclassify ( Watershed )\n"
-    "----------------------------\n"
-    " <source> should be the filename of a `measurements` file where an initial guess has been made as\n"
-    "          to the identity of many of the whiskers.  These initial assignments are used to build a \n"
-    "          probabalistic model of the process by which whiskers are identified as one travels along\n"
-    "          the face\n"
-    "\n"
-    " <dest>   should be the destination filename.  After applying the probibalistic model to identify\n"
-    "          whiskers in each frame, the results are saved to this file.\n"
-    "\n"
-    " -n <int> Optionally specify the number of whiskers to identify.  The default behavior is to use\n"
-    "          the initial guess provided by <source>.  Specifying a number less than one results in\n"
-    "          the default behavior.\n"
-    "\n");
-
-  table = Measurements_Table_From_Filename( Get_String_Arg("source"), NULL, &nrows );
-  if(!table) error("Couldn't read %s\n",Get_String_Arg("source"));
 
+  PROFILE_BEGIN(PROFILE_RECLASSIFY);
   //
   // Compute velocities using approximate/incomplete labelling
   //
@@ -1243,7 +1222,8 @@ int main(int argc, char*argv[])
   Measurements_Table_Compute_Velocities(table,nrows);
   nstate = _count_n_states(table,nrows,1,&minstate,&maxstate);
   if( minstate > -1 )
-  { warning("Doing nothing\n"
+  { PROFILE_END(PROFILE_RECLASSIFY);
+    warning("Doing nothing\n"
             "\tIt looks like all segments were labelled in the previous step.\n"
             "\tThis step (hmm-reclassify) helps when there are some segments\n"
             "\t  that do not correspond to whiskers (e.g. hairs).  Since every\n"
@@ -1252,9 +1232,6 @@ int main(int argc, char*argv[])
     return 0;
   }
 
-  nwhisk = -1;
-  if( Is_Arg_Matched("-n") )
-    nwhisk = Get_Int_Arg("-n");
   if( nwhisk < 1 )
   { nwhisk = nstate - 1; //subtract the dummy state, which is minstate
 #ifdef DEBUG_HMM_RECLASSIFY
@@ -1302,6 +1279,7 @@ int main(int argc, char*argv[])
   Distributions_Normalize( vel_dists );
   Distributions_Apply_Log2( shp_dists );
   Distributions_Apply_Log2( vel_dists );
+  Distributions_Index_States( shp_dists );
 
   //
   // Process frames
@@ -1437,7 +1415,7 @@ int main(int argc, char*argv[])
       { fid=0;
         while( fid < nframes )
         { left_ok = right_ok = 0;
-          while( visited[fid] && fid<nframes ) fid++; // find the left side of the next gap
+          while( fid<nframes && visited[fid] ) fid++; // find the left side of the next gap
           if( fid == nframes )
           { break;  // no gaps...so all done
           } else if( left_ok = (fid != 0) )
@@ -1447,7 +1425,7 @@ int main(int argc, char*argv[])
                                                 left, fid, 1 );
             left_ok &= left_jump < nframes;
           }
-          while( !visited[fid] && fid<nframes ) fid++; // find the right side of this gap
+          while( fid<nframes && !visited[fid] ) fid++; // find the right side of this gap
           if( right_ok = (fid != nframes) )
           { Measurements_Reference_Build( right, index[fid].first, index[fid].n );
             right_start = fid;
@@ -1513,7 +1491,7 @@ int main(int argc, char*argv[])
 #if 1
     { int fid=0;
       while( fid < nframes )
-      { while( visited[fid] && fid<nframes ) fid++; // find the left side of the next gap
+      { while( fid<nframes && visited[fid] ) fid++; // find the left side of the next gap
         if( fid==nframes ) break;
         fid = HMM_Reclassify_Fill_Gap( index, nframes, shp_dists, vel_dists, nwhisk, S,T,E, visited, likelihood, fid);
 #ifdef DEBUG_HMM_RECLASSIFY
@@ -1539,6 +1517,71 @@ int main(int argc, char*argv[])
     //free(E); //FIXME: Heap violation when free'd 
   } // end re-classification
 
+  //
+  // Cleanup
+  //
+  //free(T);
+  Free_Distributions(vel_dists);
+  Free_Distributions(shp_dists);
+  PROFILE_END(PROFILE_RECLASSIFY);
+  return 1;
+}
+
+#ifdef TEST_HMM_RECLASSIFY_WATERSHED
+char *Spec[] = {"[-h|--help] | ( [-n <int>] <source:string> <dest:string>",
+                "                [--profile <string>] [--timeline <string>] )",NULL};
+int main(int argc, char*argv[])
+{
+  int nrows;
+  int nwhisk;
+  Measurements *table;
+  
+  Process_Arguments( argc, argv, Spec, 0 );
+  { char* paramfile = "default.parameters";
+    if(Load_Params_File("default.parameters"))
+    { warning(
+        "Could not load parameters from file: %s\n"
+        "Writing %s\n"
+        "\tTrying again\n",paramfile,paramfile);
+      Print_Params_File(paramfile);
+      if(Load_Params_File("default.parameters"))
+        error("\tStill could not load parameters.\n");
+    }
+  }
+
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+    "----------------------------\n"
+    "HMM-Reclassify ( Watershed )\n"
+    "----------------------------\n"
+    " <source> should be the filename of a `measurements` file where an initial guess has been made as\n"
+    "          to the identity of many of the whiskers.  These initial assignments are used to build a \n"
+    "          probabalistic model of the process by which whiskers are identified as one travels along\n"
+    "          the face\n"
+    "\n"
+    " <dest>   should be the destination filename.  After applying the probibalistic model to identify\n"
+    "          whiskers in each frame, the results are saved to this file.\n"
+    "\n"
+    " -n <int> Optionally specify the number of whiskers to identify.  The default behavior is to use\n"
+    "          the initial guess provided by <source>.  Specifying a number less than one results in\n"
+    "          the default behavior.\n"
+    "\n"
+    " --profile  Write per-stage timings and counters as JSON to this file.\n"
+    " --timeline With --profile, also write a Chrome trace event timeline.\n"
+    "\n");
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
+
+  table = Measurements_Table_From_Filename( Get_String_Arg("source"), NULL, &nrows );
+  if(!table) error("Couldn't read %s\n",Get_String_Arg("source"));
+
+  nwhisk = -1;
+  if( Is_Arg_Matched("-n") )
+    nwhisk = Get_Int_Arg("-n");
+  if( !HMM_Reclassify_Watershed( table, nrows, nwhisk ) )
+    return 0;
+
   //
   // Save results
   //
@@ -1548,9 +1591,6 @@ int main(int argc, char*argv[])
   //
   // Cleanup
   //
-  //free(T);
-  Free_Distributions(vel_dists);
-  Free_Distributions(shp_dists);
   Free_Measurements_Table(table);
 
   return 0;
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 
+#include "compat.h"
 #include "utilities.h"
 #include "image_lib.h"
 #include "tiff_io.h"
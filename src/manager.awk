@@ -73,7 +73,10 @@ BEGIN { FS = " +"; }
         }
     }
 
-# generate container and free list declarations
+# generate container and free list declarations.  Free lists and usage counts
+# are kept per thread so objects may be made and freed on worker threads.  A
+# thread's free list is lost when it exits, so only long lived threads, such as
+# parallel_for's workers, should free objects.
 
   print "";
   print "typedef struct __" X;
@@ -84,8 +87,9 @@ BEGIN { FS = " +"; }
   print "    " X "           " x ";";
   print "  } _" X ";";
   print "";
-  print "static _" X " *Free_" X "_List = NULL;";
-  print "static int    " X "_Offset, " X "_Inuse;";
+  print "static THREAD_LOCAL _" X " *Free_" X "_List = NULL;";
+  print "static THREAD_LOCAL int    " X "_Inuse;";
+  print "static const int    " X "_Offset = offsetof(_" X "," x ");";
 
 # generate allocate_<field[i]>
 
@@ -115,7 +119,6 @@ BEGIN { FS = " +"; }
   print "";
   print "  if (Free_" X "_List == NULL)";
   print "    { object = (_" X " *) Guarded_Malloc(sizeof(_" X "),routine);";
-  print "      " X "_Offset = ((char *) &(object->" x ")) - ((char *) object);";
   for (i = base+1; i <= NF; i++)
     { if (type[i] == 0)
         print "      object->" value[i] " = 0;";
@@ -468,6 +468,180 @@ void step5(double *assignment, double *distMatrix, char *starMatrix, char *newSt
 }
 
 
+ /****************************************
+ **
+ ** SPARSE
+ **
+ ****************************************/
+
+/* Nodes are numbered rows first, then columns.  Each row i gets a private
+ * dummy column nOfColumns+i that stands for "unassigned".
+ */
+typedef struct _sparse_heap_t
+{ double *key;
+  int    *node;
+  int     n, cap;
+} sparse_heap_t;
+
+static void heap_push( sparse_heap_t *h, double key, int node )
+{ int i;
+  if( h->n == h->cap )
+  { h->cap  = 2*h->cap + 16;
+    h->key  = (double*) realloc( h->key,  h->cap*sizeof(double) );
+    h->node = (int*)    realloc( h->node, h->cap*sizeof(int) );
+  }
+  for( i = h->n++; i>0 && h->key[(i-1)/2] > key; i = (i-1)/2 )
+  { h->key [i] = h->key [(i-1)/2];
+    h->node[i] = h->node[(i-1)/2];
+  }
+  h->key [i] = key;
+  h->node[i] = node;
+}
+
+static int heap_pop( sparse_heap_t *h, double *key )
+{ int node = h->node[0], i = 0, c;
+  double k = h->key[--h->n];
+  int    v = h->node[h->n];
+  *key = h->key[0];
+  while( (c = 2*i+1) < h->n )
+  { if( c+1 < h->n && h->key[c+1] < h->key[c] )
+      c++;
+    if( k <= h->key[c] )
+      break;
+    h->key [i] = h->key [c];
+    h->node[i] = h->node[c];
+    i = c;
+  }
+  h->key [i] = k;
+  h->node[i] = v;
+  return node;
+}
+
+SHARED_EXPORT int assignmentsparse(int *assignment, double *cost, const int *rowptr, const int *col, const float *costs, int nOfRows, int nOfColumns, double unassignedCost)
+{ int nCols  = nOfColumns + nOfRows,   // real and dummy columns
+      nNodes = nOfRows + nCols;
+  double *pi, *dist,                   /* potentials and path lengths, by node */
+         *matchCost, *pathCost;        /* by column: cost of the current match and of the edge in prev */
+  int *colMatch, *prev, *done, *touched;
+  int row, k, ntouched, nassigned = 0;
+  sparse_heap_t heap = {0};
+
+  *cost = 0.0;
+  for( k=rowptr[0]; k<rowptr[nOfRows]; k++ )
+    if( costs[k] < 0 )
+      return -1;
+  if( unassignedCost < 0 )
+    return -1;
+
+  pi       = (double*) calloc( nNodes, sizeof(double) );
+  dist     = (double*) malloc( nNodes*sizeof(double) );
+  matchCost= (double*) malloc( nCols *sizeof(double) );
+  pathCost = (double*) malloc( nCols *sizeof(double) );
+  colMatch = (int*)    malloc( nCols *sizeof(int) );
+  prev     = (int*)    malloc( nCols *sizeof(int) );
+  done     = (int*)    calloc( nNodes, sizeof(int) );
+  touched  = (int*)    malloc( nNodes*sizeof(int) );
+  for( row=0; row<nNodes; row++ ) dist[row] = INFINITY;
+  for( row=0; row<nCols;  row++ ) colMatch[row] = -1;
+  for( row=0; row<nOfRows; row++ ) assignment[row] = -1;
+
+  for( row=0; row<nOfRows; row++ )
+  { double D = 0.0, d;
+    int sink = -1, i;
+    ntouched = 0;
+    heap.n = 0;
+    dist[row] = 0.0;
+    touched[ntouched++] = row;
+    heap_push( &heap, 0.0, row );
+
+    while( heap.n )
+    { int u = heap_pop( &heap, &d );
+      if( done[u] || d > dist[u] )
+        continue;
+      done[u] = 1;
+      if( u < nOfRows )                              /* row: relax its candidates */
+      { int kend = rowptr[u+1];
+        for( k=rowptr[u]; k<=kend; k++ )
+        { int j = (k<kend) ? col[k] : nOfColumns+u;  /* last one is the dummy */
+          double c = (k<kend) ? costs[k] : unassignedCost,
+                 nd = d + c + pi[u] - pi[nOfRows+j];
+          if( colMatch[j] == u )                     /* matched edges only run backwards */
+            continue;
+          if( nd < dist[nOfRows+j] )
+          { if( dist[nOfRows+j] == INFINITY )
+              touched[ntouched++] = nOfRows+j;
+            dist[nOfRows+j] = nd;
+            prev[j] = u;
+            pathCost[j] = c;
+            heap_push( &heap, nd, nOfRows+j );
+          }
+        }
+      } else                                         /* column: free ends the search */
+      { int j = u - nOfRows,
+            r = colMatch[j];
+        double nd;
+        if( r < 0 )
+        { sink = j;
+          D = d;
+          break;
+        }
+        nd = d - matchCost[j] + pi[u] - pi[r];       /* back along the matched edge */
+        if( nd < dist[r] )
+        { if( dist[r] == INFINITY )
+            touched[ntouched++] = r;
+          dist[r] = nd;
+          heap_push( &heap, nd, r );
+        }
+      }
+    }
+
+    /* update potentials so reduced costs stay non-negative */
+    for( i=0; i<ntouched; i++ )
+    { int u = touched[i];
+      if( done[u] && dist[u] < D )
+        pi[u] -= D - dist[u];
+    }
+
+    /* augment */
+    { int j = sink;
+      while( j >= 0 )
+      { int r = prev[j],
+            old = assignment[r];
+        assignment[r] = j;
+        colMatch[j] = r;
+        matchCost[j] = pathCost[j];
+        j = (r == row) ? -1 : old;
+      }
+    }
+
+    for( i=0; i<ntouched; i++ )
+    { dist[touched[i]] = INFINITY;
+      done[touched[i]] = 0;
+    }
+  }
+
+  for( row=0; row<nOfRows; row++ )
+  { int j = assignment[row];
+    *cost += matchCost[j];
+    if( j >= nOfColumns )
+      assignment[row] = -1;
+    else
+      nassigned++;
+  }
+
+  free(heap.key);
+  free(heap.node);
+  free(pi);
+  free(dist);
+  free(matchCost);
+  free(pathCost);
+  free(colMatch);
+  free(prev);
+  free(done);
+  free(touched);
+  return nassigned;
+}
+
  /****************************************
  **
  ** TEST CASE
@@ -541,3 +715,161 @@ int main(int argc, char* argv[] )
   return 0;
 }
 #endif
+
+#ifdef TEST_MATCH_SPARSE
+/*
+ * assignmentsparse() against assignmentoptimal() on random sparse problems.
+ *
+ * The sparse problem is written out as a dense one with a private
+ * "unassigned" column per row and INFINITY for pairs that aren't listed.
+ * Both must reach the same total cost and, since random costs don't tie,
+ * the same assignment.
+ */
+#include "utilities.h"
+
+static double urand( void ) { return rand()/(RAND_MAX+1.0); }
+
+// Checks one problem.  Returns 1 if the solvers agree.
+static int check_problem( int nrows, int ncols, const int *rowptr, const int *col, const float *costs, double unassigned )
+{ int     ndense = ncols + nrows,
+          *asg   = (int*)    malloc( nrows*sizeof(int) ),
+          *used  = (int*)    calloc( ncols, sizeof(int) );
+  double  *D     = (double*) malloc( (size_t)nrows*ndense*sizeof(double) ),
+          *dasg  = (double*) malloc( nrows*sizeof(double) ),
+          cost, dcost, total = 0.0;
+  int i, k, nassigned, ncount = 0, ok = 1;
+
+  for( i=0; i<nrows*ndense; i++ )
+    D[i] = INFINITY;
+  for( i=0; i<nrows; i++ )
+  { for( k=rowptr[i]; k<rowptr[i+1]; k++ )
+      D[i + nrows*col[k]] = costs[k];               // column-major
+    D[i + nrows*(ncols+i)] = unassigned;
+  }
+  nassigned = assignmentsparse( asg, &cost, rowptr, col, costs, nrows, ncols, unassigned );
+  assignmentoptimal( dasg, &dcost, D, nrows, ndense );
+
+  if( fabs(cost-dcost) > 1e-6*(1.0+dcost) )
+  { printf("\t*** Sparse cost %g.  Dense cost %g.\n",cost,dcost);
+    ok = 0;
+  }
+  for( i=0; i<nrows && ok; i++ )
+  { int j = asg[i],
+        dj = (dasg[i]>=ncols) ? -1 : (int)dasg[i];
+    if( j != dj )
+    { printf("\t*** Row %d: sparse column %d.  Dense column %d.\n",i,j,dj);
+      ok = 0;
+    }
+    if( j<0 )
+    { total += unassigned;
+      continue;
+    }
+    if( used[j]++ )
+    { printf("\t*** Column %d is assigned twice.\n",j);
+      ok = 0;
+    }
+    for( k=rowptr[i]; k<rowptr[i+1] && col[k]!=j; k++ ) {}
+    if( k==rowptr[i+1] )
+    { printf("\t*** Row %d is assigned to column %d, which isn't listed.\n",i,j);
+      ok = 0;
+    } else
+      total += costs[k];
+    ncount++;
+  }
+  if( ok && (ncount!=nassigned || fabs(total-cost) > 1e-6*(1.0+cost)) )
+  { printf("\t*** Returned %d assigned rows costing %g.  Counted %d costing %g.\n",nassigned,cost,ncount,total);
+    ok = 0;
+  }
+
+  free(asg);
+  free(used);
+  free(D);
+  free(dasg);
+  return ok;
+}
+
+// Each pair is listed with probability `density`.  Every `empty`th row lists
+// nothing (0 for none).  Costs are in [0,1).
+static int check_random( int ntrials, int nrows, int ncols, double density, int empty, double unassigned )
+{ int    *rowptr = (int*)   malloc( (nrows+1)*sizeof(int) ),
+         *col    = (int*)   malloc( (size_t)nrows*ncols*sizeof(int) );
+  float  *costs  = (float*) malloc( (size_t)nrows*ncols*sizeof(float) );
+  int t, i, j, ok = 1;
+  for( t=0; t<ntrials && ok; t++ )
+  { rowptr[0] = 0;
+    for( i=0; i<nrows; i++ )
+    { rowptr[i+1] = rowptr[i];
+      if( empty && i%empty==0 )
+        continue;
+      for( j=0; j<ncols; j++ )
+        if( urand() < density )
+        { col  [rowptr[i+1]]   = j;
+          costs[rowptr[i+1]++] = (float) urand();
+        }
+    }
+    ok = check_problem( nrows, ncols, rowptr, col, costs, unassigned );
+  }
+  free(rowptr);
+  free(col);
+  free(costs);
+  return ok;
+}
+
+// Row 0's only candidate costs more than leaving it unassigned.
+static int test_unassigned_wins( void )
+{ int   rowptr[] = { 0, 1, 3, 4 },
+        col   [] = { 0,   0, 1,   1 };
+  float costs [] = { 5.0f, 0.2f, 0.3f, 0.1f };
+  int   asg[3];
+  double cost;
+  if( assignmentsparse( asg, &cost, rowptr, col, costs, 3, 2, 1.0 ) != 2
+   || asg[0]!=-1 || asg[1]!=0 || asg[2]!=1 || fabs(cost-1.3)>1e-6 )
+  { printf("\t*** Expected rows 1,2 -> columns 0,1 and row 0 unassigned for 1.3.\n");
+    return 0;
+  }
+  return check_problem( 3, 2, rowptr, col, costs, 1.0 );
+}
+
+static int test_square          ( void ) { return check_random( 20, 20, 20, 0.2, 0, 0.5  ); }
+static int test_more_rows       ( void ) { return check_random( 20, 30, 10, 0.3, 0, 0.8  ); }
+static int test_more_columns    ( void ) { return check_random( 20, 15, 40, 0.1, 0, 0.3  ); }
+static int test_empty_rows      ( void ) { return check_random( 20, 25, 25, 0.2, 4, 0.6  ); }
+static int test_unassigned_rare ( void ) { return check_random( 20, 25, 25, 0.2, 0, 50.0 ); }
+static int test_unassigned_often( void ) { return check_random( 20, 25, 25, 0.4, 0, 0.05 ); }
+
+static int (*tests[])( void ) = { test_unassigned_wins,
+                                  test_square,
+                                  test_more_rows,
+                                  test_more_columns,
+                                  test_empty_rows,
+                                  test_unassigned_rare,
+                                  test_unassigned_often,
+                                  NULL };
+
+char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ int i, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Sparse Assignment Test                                       \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Solves random sparse assignment problems with                \n"
+      "| assignmentsparse() and, written out as dense matrices, with  \n"
+      "| assignmentoptimal().  Costs and assignments must agree,      \n"
+      "| including rows that are cheaper to leave unassigned.         \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+  srand(1);
+
+  for( i=0; tests[i]; i++ )
+  { int ok = tests[i]();
+    printf("--- TEST %d --- %s\n", i+1, ok?"PASSED":"FAILED");
+    nfailed += !ok;
+  }
+  return nfailed;
+}
+#endif // TEST_MATCH_SPARSE
@@ -20,6 +20,7 @@
 #include "mat.h"
 #include "measurements_io.h"
 #include "error.h"
+#include "profile.h"
 
 #if 0  // Tests
 #define TEST_MEASURE_1
@@ -337,6 +338,7 @@ Measurements *Whisker_Segments_Measure( Whisker_Seg *wv, int wvn, int facex, int
 { Measurements *table = Alloc_Measurements_Table( 
                           wvn /* #rows */, 
                           MEASURE__NUM_FIELDS_FROM_MEASURE_SEGMENTS/* #measurments */ ); 
+  PROFILE_BEGIN(PROFILE_MEASURE);
   while(wvn--)
   { Measurements *row = table + wvn; 
     row->row   = wvn;
@@ -352,12 +354,14 @@ Measurements *Whisker_Segments_Measure( Whisker_Seg *wv, int wvn, int facex, int
     row->n = MEASURE__NUM_FIELDS_FROM_MEASURE_SEGMENTS;
     Whisker_Seg_Measure( wv+wvn, row->data, facex, facey, face_axis );
   }
+  PROFILE_END(PROFILE_MEASURE);
   return table;
 }
 
 SHARED_EXPORT
 Measurements *Whisker_Segments_Update_Measurements(Measurements* table, Whisker_Seg *wv, int wvn, int facex, int facey, char face_axis )
 { 
+  PROFILE_BEGIN(PROFILE_MEASURE);
   while(wvn--)
   { Measurements *row = table + wvn; 
 //  row->row   = wvn;
@@ -373,6 +377,7 @@ Measurements *Whisker_Segments_Update_Measurements(Measurements* table, Whisker_
 //  row->n = MEASURE__NUM_FIELDS_FROM_MEASURE_SEGMENTS;
     Whisker_Seg_Measure( wv+wvn, row->data, facex, facey, face_axis );
   }
+  PROFILE_END(PROFILE_MEASURE);
   return table;
 }
 
@@ -400,6 +405,7 @@ Measurements *Whisker_Segments_Measure_With_Bar( Whisker_Seg *wv, int wvn, Bar *
   
   { Bar **bindex = bar_build_index( bars, nbars, maxfid );
     Measurements *table = Alloc_Measurements_Table( wvn, ncol );
+    PROFILE_BEGIN(PROFILE_MEASURE);
     while(wvn--)
     { Measurements *row = table + wvn; 
       row->row   = wvn;
@@ -415,6 +421,7 @@ Measurements *Whisker_Segments_Measure_With_Bar( Whisker_Seg *wv, int wvn, Bar *
       Whisker_Seg_Measure( wv+wvn, row->data, facex, facey, face_axis );
       row->data[ncol-1] = Whisker_Seg_Compute_Distance_To_Bar( wv+wvn, bindex[row->fid] );
     }
+    PROFILE_END(PROFILE_MEASURE);
     free(bindex);
     return table;
   }
@@ -489,6 +496,7 @@ char *Spec[] = {"[-h|--help]",
                 "          | <hint:string>",
                 "          )",
                 "   <whiskers:string> [<bar:string>] <dest:string>",
+                "   [--profile <string>] [--timeline <string>]",
                 " )",
                 NULL};
 int main( int argc, char* argv[] )
@@ -521,7 +529,14 @@ int main( int argc, char* argv[] )
       "\n\tand optionally (with a provided .bar file)\n"
       "\t12. distance to center of bar\n"
       "\nTo access this data via python/numpy see `traj.py` and traj.MeasurementTable\n"
+      "\n"
+      "\t--profile   Write per-stage timings and counters as JSON to this file.\n"
+      "\t--timeline  With --profile, also write a Chrome trace event timeline.\n"
       "\n" );
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
 
   wv = Load_Whiskers( Get_String_Arg("whiskers"), NULL, &wvn);
   if(!wv)
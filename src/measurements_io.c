@@ -17,6 +17,7 @@
 
 #include "error.h"
 #include "traj.h"
+#include "profile.h"
 
 #define MF_CALL(a,name)  (*(((_MeasurementsFile*)a)->name))
 #define MF_DEREF(a,name)   (((_MeasurementsFile*)a)->name)
@@ -33,6 +34,7 @@ typedef FILE*          (*pf_mf_open  ) (const char* filename, const char* mode )
 typedef void           (*pf_mf_close ) (FILE* file);                                // Writes footer, closes and frees resources
 typedef void           (*pf_mf_write)  (FILE* file, Measurements *table, int n);
 typedef Measurements*  (*pf_mf_read)   (FILE* file, int *n);                        // Gets the table
+typedef Measurements*  (*pf_mf_read_range) (FILE* file, int fid_begin, int fid_end, int *n); // Gets rows for a range of frames. Optional (NULL).
 
 typedef struct __MeasurementsFile
 { FILE*          fp;
@@ -42,6 +44,7 @@ typedef struct __MeasurementsFile
   pf_mf_close    close;
   pf_mf_write    write_segments;
   pf_mf_read     read_segments;
+  pf_mf_read_range read_range;
 } _MeasurementsFile;
 
 /***********************************************************************
@@ -99,6 +102,13 @@ pf_mf_read Measurements_File_Read_Table[] = {
   read_measurements_v3
 };
 
+pf_mf_read_range Measurements_File_Read_Range_Table[] = {
+  NULL,
+  NULL,
+  NULL,
+  read_measurements_range_v3
+};
+
 
 /*********************************************************************** 
  * General interface
@@ -164,6 +174,7 @@ MeasurementsFile Measurements_File_Open(const char* filename, char* format, cons
     mf->close           = Measurements_File_Closers_Table         [ifmt];
     mf->write_segments  = Measurements_File_Write_Table           [ifmt];
     mf->read_segments   = Measurements_File_Read_Table            [ifmt];
+    mf->read_range      = Measurements_File_Read_Range_Table      [ifmt];
     mf->fp = MF_CALL( mf, open )(filename, mode);
     if( mf->fp == NULL )
     { warning("Could not open file %s with mode %s.\n",filename,mode);
@@ -187,12 +198,69 @@ void Measurements_File_Close(MeasurementsFile mf)
 
 SHARED_EXPORT
 void Measurements_File_Write(MeasurementsFile mf, Measurements *table, int n)
-{ MF_CALL( mf, write_segments )( MF_DEREF(mf,fp),table,n);
+{ FILE *fp = MF_DEREF(mf,fp);
+  int64_t pos = profile_on ? FTELL64(fp) : 0;
+  PROFILE_BEGIN(PROFILE_WRITE);
+  MF_CALL( mf, write_segments )( fp,table,n);
+  PROFILE_END(PROFILE_WRITE);
+  PROFILE_COUNT(PROFILE_BYTES_WRITTEN, FTELL64(fp)-pos);
 }
 
 SHARED_EXPORT
 Measurements* Measurements_File_Read(MeasurementsFile mf, int *n)
-{ return MF_CALL(mf, read_segments)( MF_DEREF(mf,fp),n);
+{ FILE *fp = MF_DEREF(mf,fp);
+  int64_t pos = profile_on ? FTELL64(fp) : 0;
+  Measurements *table;
+  PROFILE_BEGIN(PROFILE_READ);
+  table = MF_CALL(mf, read_segments)( fp,n);
+  PROFILE_END(PROFILE_READ);
+  PROFILE_COUNT(PROFILE_BYTES_READ, FTELL64(fp)-pos);
+  return table;
+}
+
+/* Returns the rows with fid in [fid_begin,fid_end).  Formats without a range
+ * reader load the whole table and then copy out the selected rows.
+ */
+SHARED_EXPORT
+Measurements* Measurements_File_Read_Range(MeasurementsFile mf, int fid_begin, int fid_end, int *n)
+{ Measurements *all,*table;
+  int i,nall,*index;
+  if( MF_DEREF(mf,read_range) )
+  { FILE *fp = MF_DEREF(mf,fp);
+    int64_t pos = profile_on ? FTELL64(fp) : 0;
+    PROFILE_BEGIN(PROFILE_READ);
+    table = MF_CALL(mf, read_range)( fp,fid_begin,fid_end,n);
+    PROFILE_END(PROFILE_READ);
+    PROFILE_COUNT(PROFILE_BYTES_READ, FTELL64(fp)-pos);
+    return table;
+  }
+
+  if( !(all = Measurements_File_Read(mf,&nall)) )
+    return NULL;
+  index = (int*) malloc( sizeof(int)*(nall+1) );
+  if(!index)
+  { warning("Out of memory in Measurements_File_Read_Range\n");
+    Free_Measurements_Table(all);
+    return NULL;
+  }
+  *n = Measurements_Table_Select(all,nall,MEASUREMENTS_ANY_STATE,fid_begin,fid_end,index);
+  table = Alloc_Measurements_Table( (*n) ? (*n) : 1, all[0].n );
+  for(i=0;i<*n;++i)
+  { Measurements *dst = table+i,
+                 *src = all+index[i];
+    double *data = dst->data,
+           *vel  = dst->velocity;
+    int     row  = dst->row;
+    *dst = *src;
+    dst->data     = data;
+    dst->velocity = vel;
+    dst->row      = row;
+    memcpy( data, src->data,     sizeof(double)*src->n );
+    memcpy( vel,  src->velocity, sizeof(double)*src->n );
+  }
+  free(index);
+  Free_Measurements_Table(all);
+  return table;
 }
 
 SHARED_EXPORT
@@ -205,6 +273,19 @@ Measurements *Measurements_Table_From_Filename(const char *filename, char* forma
   return table;
 }
 
+/* Loads the rows with fid in [fid_begin,fid_end).  Returns NULL on failure.
+ * See Measurements_File_Read_Range.
+ */
+SHARED_EXPORT
+Measurements *Measurements_Table_From_Filename_Range(const char *filename, char* format, int fid_begin, int fid_end, int *n )
+{ Measurements *table;
+  MeasurementsFile mf = Measurements_File_Open(filename, format, "r");
+  if(!mf) return NULL;
+  table = Measurements_File_Read_Range( mf, fid_begin, fid_end, n);
+  Measurements_File_Close(mf);
+  return table;
+}
+
 SHARED_EXPORT
 int  Measurements_Table_To_Filename(const char *filename, char* format, Measurements *table, int n )
 { MeasurementsFile mf;
@@ -308,3 +389,156 @@ int main(int argc, char *argv[]) {
   return 0;
 };
 #endif
+
+#ifdef MEASUREMENTS_IO_TEST_RANGE
+#include "test_fixtures.h"
+/*
+ * Writes a synthetic table, reads frame ranges back with
+ * Measurements_Table_From_Filename_Range and checks them against the rows
+ * Measurements_Table_Select picks out of the whole file.
+ */
+#define TEST_NMEASURES 8
+
+// Frame ranges to read.  Frame 5 has no rows.
+static int ranges[][2] = { {0,TEST_NFRAMES}, {3,9}, {7,8}, {5,6}, {15,100},
+                           {-5,2}, {9,3}, {TEST_NFRAMES,TEST_NFRAMES+5} };
+
+static Measurements *_test_make_table( int *n )
+{ Measurements *table;
+  int f, k, j, i = 0;
+  *n = 0;
+  for( f=0; f<TEST_NFRAMES; f++ )
+    *n += TEST_ROWS_IN_FRAME(f);
+  table = Alloc_Measurements_Table( *n, TEST_NMEASURES );
+  for( f=0; f<TEST_NFRAMES; f++ )
+    for( k=0; k<TEST_ROWS_IN_FRAME(f); k++, i++ )
+    { Measurements *row = table+i;
+      row->fid            = f;
+      row->wid            = k;
+      row->state          = k%2;
+      row->face_x         = -100;
+      row->face_y         = 50;
+      row->col_follicle_x = 4;
+      row->col_follicle_y = 5;
+      row->valid_velocity = 1;
+      row->face_axis      = 'y';
+      for( j=0; j<TEST_NMEASURES; j++ )
+      { row->data[j]     = 10.0*f + k + 0.5*j;
+        row->velocity[j] = -row->data[j];
+      }
+    }
+  return table;
+}
+
+static int _test_same_row( Measurements *a, Measurements *b )
+{ return a->fid==b->fid && a->wid==b->wid && a->state==b->state
+      && a->face_x==b->face_x && a->face_y==b->face_y
+      && a->col_follicle_x==b->col_follicle_x && a->col_follicle_y==b->col_follicle_y
+      && a->valid_velocity==b->valid_velocity && a->face_axis==b->face_axis
+      && a->n==b->n
+      && !memcmp( a->data,     b->data,     sizeof(double)*a->n )
+      && !memcmp( a->velocity, b->velocity, sizeof(double)*a->n );
+}
+
+// Each range read of a file in `format` matches the same frames selected
+// from the whole file.
+static int _check_ranges( Measurements *table, int n, char *format )
+{ Measurements *all, *sel;
+  int i, j, nall, nsel, nexpect, *index, ok = 1;
+  printf("\t%s\n",format);
+  if( !Measurements_Table_To_Filename( "test_range.measurements", format, table, n ) )
+    return 0;
+  if( !(all = Measurements_Table_From_Filename( "test_range.measurements", NULL, &nall )) )
+    return 0;
+  index = (int*) Guarded_Malloc( sizeof(int)*(nall+1), "test" );
+  for( i=0; ok && i<(int)(sizeof(ranges)/sizeof(*ranges)); i++ )
+  { int beg = ranges[i][0],
+        end = ranges[i][1];
+    nexpect = Measurements_Table_Select( all, nall, MEASUREMENTS_ANY_STATE, beg, end, index );
+    if( !(sel = Measurements_Table_From_Filename_Range( "test_range.measurements", NULL, beg, end, &nsel )) )
+    { printf("\t*** Could not read frames [%d,%d).\n",beg,end);
+      ok = 0;
+      break;
+    }
+    if( nsel!=nexpect )
+    { printf("\t*** Frames [%d,%d): expected %d rows.  Got %d.\n",beg,end,nexpect,nsel);
+      ok = 0;
+    }
+    for( j=0; ok && j<nsel; j++ )
+      if( !_test_same_row( all+index[j], sel+j ) )
+      { printf("\t*** Frames [%d,%d): row %d differs.\n",beg,end,j);
+        ok = 0;
+      }
+    Free_Measurements_Table( sel );
+  }
+  free( index );
+  Free_Measurements_Table( all );
+  remove( "test_range.measurements" );
+  return ok;
+}
+
+// The v3 format has a range reader.
+static int test_range_v3( Measurements *table, int n )
+{ return _check_ranges( table, n, "v3" );
+}
+
+// Other formats load the whole table and copy out the selected rows.
+static int test_range_fallback( Measurements *table, int n )
+{ return _check_ranges( table, n, "v2" );
+}
+
+// A v3 file that was cut short inside its last row fails to read.
+static int test_range_truncated( Measurements *table, int n )
+{ Measurements *sel;
+  int nsel;
+  if( !Measurements_Table_To_Filename( "test_range.measurements", "v3", table, n ) )
+    return 0;
+  if( !_test_truncate_file( "test_range.measurements", _test_file_size("test_range.measurements")-5 ) )
+    return 0;
+  sel = Measurements_Table_From_Filename_Range( "test_range.measurements", NULL, 0, TEST_NFRAMES, &nsel );
+  remove( "test_range.measurements" );
+  if( sel )
+  { printf("\t*** Read %d rows from a truncated file.\n",nsel);
+    Free_Measurements_Table( sel );
+    return 0;
+  }
+  return 1;
+}
+
+static int (*tests[])( Measurements*, int ) = { test_range_v3,
+                                                test_range_fallback,
+                                                test_range_truncated,
+                                                NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Measurements *table;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Measurements frame range test                                \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Reads frame ranges of a synthetic measurements table and     \n"
+      "| checks them against the whole file.  Files are written to    \n"
+      "| the working directory.                                       \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  table = _test_make_table( &n );
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](table,n) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  Free_Measurements_Table( table );
+  return nfailed;
+}
+#endif
@@ -118,7 +118,7 @@ Measurements *read_measurements_v1( FILE *fp, int *n_rows)
 
   while( row-- > table )
   { fread( row, rowsize, 1, fp );
-    row->row = (row->data - head)/sizeof(double);
+    row->row = (int)(row->data - head)/n_measures;
     row->face_axis = 'u'; // mark as unknown
     fread( row->data, sizeof(double), n_measures, fp);
     fread( row->velocity, sizeof(double), n_measures, fp);
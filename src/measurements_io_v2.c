@@ -143,7 +143,7 @@ Measurements *read_measurements_v2( FILE *fp, int *n_rows)
 
   while( row-- > table )
   { fread( row, rowsize, 1, fp );
-    row->row = (row->data - head)/sizeof(double);
+    row->row = (int)(row->data - head)/n_measures;
     fread( row->data, sizeof(double), n_measures, fp);
     fread( row->velocity, sizeof(double), n_measures, fp);
   }
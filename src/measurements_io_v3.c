@@ -6,7 +6,9 @@
  * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
  * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
  */
+#include "compat.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "traj.h"
 #include "error.h"
@@ -153,9 +155,58 @@ Measurements *read_measurements_v3( FILE *fp, int *n_rows)
 
   while( row-- > table )
   { fread( row, ROWSIZE, 1, fp );
-    row->row = (row->data - head)/sizeof(double);
+    row->row = (int)(row->data - head)/n_measures;
     fread( row->data, sizeof(double), n_measures, fp);
     fread( row->velocity, sizeof(double), n_measures, fp);
   }
   return table;
 }
+
+// Reads only the rows with fid in [fid_begin,fid_end).
+// Rows have a fixed size, so a first pass reads just the fid of each row and
+// a second pass seeks to and reads the selected rows.  Rows keep the order
+// read_measurements_v3 would give them.
+Measurements *read_measurements_range_v3( FILE *fp, int fid_begin, int fid_end, int *n_rows)
+{ Measurements *table = NULL;
+  int total,n_measures,i,count=0,*hits=NULL;
+  long long head,stride;
+
+  *n_rows = 0;
+  if( fread( &total, sizeof(int), 1, fp)!=1 )      goto Error;
+  if( fread( &n_measures, sizeof(int), 1, fp)!=1 ) goto Error;
+  if( total<0 || n_measures<0 )                    goto Error;
+  if( (head = FTELL64(fp))<0 )                     goto Error;
+  stride = ROWSIZE + 2*sizeof(double)*n_measures;
+
+  hits = (int*) malloc( sizeof(int)*((size_t)total+1) );
+  if(!hits) goto Error;
+  for(i=0;i<total;++i)
+  { int ids[2]; // row, fid
+    if( FSEEK64( fp, head + (long long)i*stride, SEEK_SET ) ) goto Error;
+    if( fread( ids, sizeof(int), 2, fp )!=2 )                 goto Error;
+    if( ids[1]>=fid_begin && ids[1]<fid_end )
+      hits[count++] = i;
+  }
+
+  table = Alloc_Measurements_Table( count ? count : 1, n_measures );
+  if(!table) goto Error;
+  for(i=0;i<count;++i)
+  { Measurements *row = table + count - 1 - i; // rows are stored back to front
+    char buf[ROWSIZE];
+    int r = row->row;
+    if( FSEEK64( fp, head + (long long)hits[i]*stride, SEEK_SET ) )                goto Error;
+    if( fread( buf, ROWSIZE, 1, fp )!=1 )                                           goto Error;
+    if( fread( row->data,     sizeof(double), n_measures, fp )!=(size_t)n_measures ) goto Error;
+    if( fread( row->velocity, sizeof(double), n_measures, fp )!=(size_t)n_measures ) goto Error;
+    memcpy( row, buf, ROWSIZE );
+    row->row = r;
+  }
+  free(hits);
+  *n_rows = count;
+  return table;
+Error:
+  warning("Could not read measurements (v3) rows for frames [%d,%d).\n",fid_begin,fid_end);
+  if(hits)  free(hits);
+  if(table) Free_Measurements_Table(table);
+  return NULL;
+}
@@ -23,10 +23,11 @@
 #include "common.h"
 #include "error.h"
 #include "trace.h"
+#include "profile.h"
 
 #if 0
+#define DEBUG_REMOVE_OVERLAPPING_WHISKERS
 #define DEBUG_REMOVE_OVERLAPPING_WHISKERS_ONE_FRAME
-#define DEBUG_COLLISIONTABLE_REQUEST_DEPTH
 #define DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
 #define DEBUG_COLLISIONTABLE_REMOVE
 #define DEBUG_TRACE_OVERLAP_ONE_SIDE
@@ -37,152 +38,204 @@
  * CollisionTable
  * --------------
  *
- * This is a scalar (integer) volume.
+ * A sparse map from grid cells to the whisker segments passing over them.
  *
- * The `width` and `height` correspond to an image's width and height divided by
- * the `scale`. So these first two dimensions correspond with an image.
+ * Segment points are binned onto a grid with cells `scale` pixels on a side.
+ * Only cells that get hit are stored.  They live in an open-addressing hash
+ * keyed on the cell's (x,y) position, so a push or a lookup is O(1) on
+ * average and the table does not need to know the image size.
  *
- * The third dimension, the 'depth', is for holding the id's of whisker
- * segments passing over a particular x,y position. Actually, the first 
- * plane (depth=0) holds the hit count.  The rest holds the id's.
+ * Each cell owns a contiguous run of hit records in a shared slab.  A hit
+ * record is an (id,index) pair: the segment id and the index of the point on
+ * that segment.  Searching and modifying a cell's hits only touches that run.
+ * When a cell outgrows its run, the run is moved to the end of the slab with
+ * twice the capacity.  The abandoned space is reclaimed on the next reset.
+ * Most cells get one or two hits, so little space is wasted.
  *
- * In terms of memory usage, worst case is that all segments overlap at the
- * same point.  Then the depth will be the number of whisker segments + 1.  In
- * practice, the number of overlapping segments is ~5.  
+ * Tables are cheap to make and are sized from a hint (the number of points
+ * that will be pushed).  They grow on demand if the hint was too small.  A
+ * table may be reset and reused for every frame in a movie.  Tables share no
+ * state, so separate tables may be used from separate threads.
  *
- * Most of the image is never hit, so much of the allocated space goes unused;
- * a sparse representation would be much more memory efficient.  However, this
- * table never gets that big and can be reused for every frame in the movie
- * without reallocating, so memory management isn't so much of an issue.
- *
- * The other problem with this approach is inserts/removals of id's at points
- * are O(d).
- *
- * Using linked lists would be more memory efficient, something necessary if 
- * hundreds or thousands of overlaps happen on any pixel.  There's a bit of
- * a speed tradeoff since it requires dereferencing each iteration and 
- * there's no way to optimize cache hits.  For now, I'm sticking with the table 
- * since I expect to d to be low.
- *
- * TODO: possible optimization: arrange table so hit records are contiguous.
- *       This means that on realloc a single pass has to be made to rearrange
- *       the data.  The upside is searching and modifying the hit records 
- *       makes better use of the cache.  Should give ~2X speed boost.
+ * Cells must not be added while a cursor is iterating over the table (see
+ * CollisionTableCursor).  Removing hits is fine.
  */
 
+typedef struct _CollisionCell
+{ int x,y;
+  int n;        // number of hits
+  int cap;      // capacity of the run of hit records starting at `off`
+  int off;      // offset of the first hit record in the slab (in records)
+} CollisionCell;
+
 typedef struct CollisionTable
-{ unsigned int *table;
-  int stride;
-  int area;
-  int depth;
-  float scale;
+{ int           *slots;    // hash buckets: index into `cells` or -1
+  int            nslots;   // always a power of two
+  CollisionCell *cells;
+  int            ncells;
+  size_t         cells_size;
+  unsigned int  *hits;     // slab of (id,index) hit records
+  int            nhits;    // records used in the slab
+  size_t         hits_size;
+  int            sorted;   // cells are in raster order (see CollisionTable_Next)
+  float          scale;
 } CollisionTable;
 
+static unsigned int _collisiontable_hash( int x, int y )
+{ return ((unsigned int)x)*73856093u ^ ((unsigned int)y)*19349663u;
+}
+
+static void _collisiontable_rehash( CollisionTable *this, int nslots )
+{ int i, mask = nslots-1;
+  this->slots  = Guarded_Realloc( this->slots, sizeof(int)*nslots, "CollisionTable rehash" );
+  this->nslots = nslots;
+  memset( this->slots, 0xff, sizeof(int)*nslots );
+  for( i=0; i<this->ncells; i++ )
+  { int s = _collisiontable_hash( this->cells[i].x, this->cells[i].y ) & mask;
+    while( this->slots[s] >= 0 )
+      s = (s+1) & mask;
+    this->slots[s] = i;
+  }
+}
+
 void CollisionTable_Reset( CollisionTable *this )
-{ memset(this->table, 0, sizeof(unsigned int)*(this->area) );
+{ memset( this->slots, 0xff, sizeof(int)*this->nslots );
+  this->ncells = 0;
+  this->nhits  = 0;
+  this->sorted = 0;
 }
 
-CollisionTable *Alloc_CollisionTable(int width, int height, float scale, int depth_hint)
-{ CollisionTable *this = Guarded_Malloc( sizeof(CollisionTable), "Create_CollisionTable");
-  this->stride = (int) width/scale + 1;
-  this->area   = ((int) (height/scale)+1) * this->stride;
-  this->depth  = depth_hint;
-  this->scale  = scale;
+CollisionTable *Alloc_CollisionTable( float scale, int npoints_hint )
+{ CollisionTable *this = Guarded_Malloc( sizeof(CollisionTable), "Alloc_CollisionTable");
+  int nslots = 64;
+  memset( this, 0, sizeof(CollisionTable) );
+  while( nslots < 2*npoints_hint )
+    nslots *= 2;
+  this->scale = scale;
+  this->cells = request_storage( this->cells, &this->cells_size, sizeof(CollisionCell), npoints_hint, "Alloc_CollisionTable" );
+  this->hits  = request_storage( this->hits , &this->hits_size , 2*sizeof(unsigned int), 2*npoints_hint, "Alloc_CollisionTable" );
+  _collisiontable_rehash( this, nslots );
 
 #ifdef DEBUG_ALLOC_COLLISIONTABLE
-  debug("this->stride: %d\n", this->stride);
-  debug("this->area  : %d\n", this->area  );
-  debug("this->depth : %d\n", this->depth );
+  debug("this->nslots: %d\n", this->nslots);
   debug("this->scale : %f\n", this->scale );
 #endif
-
-  this->table  = Guarded_Malloc( sizeof(unsigned int)*(this->area)*(this->depth+1)*2, 
-                                 "Create_CollisionTable");
-  CollisionTable_Reset(this);
   return this; 
 }
 
 void Free_CollisionTable( CollisionTable* this )
 { if(this)
-  { if( this->table ) 
-      free( this->table );
+  { if( this->slots ) free( this->slots );
+    if( this->cells ) free( this->cells );
+    if( this->hits  ) free( this->hits  );
     free(this);
   }
 }
 
-void CollisionTable_Request_Depth( CollisionTable* this, int depth )
-{ 
-#ifdef DEBUG_COLLISIONTABLE_REQUEST_DEPTH
-  //debug("depth: %3d\trequested: %3d\n",this->depth, depth);
-#endif
-  if( depth >= this->depth )
-  { depth = 1.2 * depth + 10;
-#ifdef DEBUG_COLLISIONTABLE_REQUEST_DEPTH
-    debug("Reallocating collision table for depth of %d.\n",depth);
-#endif
-    this->table = Guarded_Realloc( this->table,
-                                   sizeof(unsigned int)*(this->area)*(depth+1)*2, 
-                                   "CollisionTable_Request_Depth" );
-    this->depth = depth;
+// Returns the cell at (x,y) or NULL if it has never been hit.
+static CollisionCell *_collisiontable_find( CollisionTable *this, int x, int y )
+{ int mask = this->nslots-1,
+      s    = _collisiontable_hash(x,y) & mask,
+      i;
+  while( (i=this->slots[s]) >= 0 )
+  { CollisionCell *c = this->cells + i;
+    if( c->x == x && c->y == y )
+      return c;
+    s = (s+1) & mask;
   }
+  return NULL;
+}
+
+// Returns the cell at (x,y), adding it if necessary.
+static CollisionCell *_collisiontable_get( CollisionTable *this, int x, int y )
+{ CollisionCell *c;
+  int mask, s;
+  if( (c = _collisiontable_find(this,x,y)) )
+    return c;
+
+  if( 2*(this->ncells+1) > this->nslots )                   // keep load below 1/2
+    _collisiontable_rehash( this, 2*this->nslots );
+  mask = this->nslots-1;
+  s = _collisiontable_hash(x,y) & mask;
+  while( this->slots[s] >= 0 )
+    s = (s+1) & mask;
+
+  this->cells = request_storage( this->cells, &this->cells_size, sizeof(CollisionCell), this->ncells+1, "CollisionTable_Push" );
+  this->hits  = request_storage( this->hits , &this->hits_size , 2*sizeof(unsigned int), this->nhits+2, "CollisionTable_Push" );
+  this->slots[s] = this->ncells;
+  c = this->cells + this->ncells++;
+  c->x   = x;
+  c->y   = y;
+  c->n   = 0;
+  c->cap = 2;
+  c->off = this->nhits;
+  this->nhits += 2;
+  this->sorted = 0;
+  return c;
 }
 
 void CollisionTable_Push( CollisionTable *this, int x, int y, int id, int index )
-{ int p = x + y * this->stride;
-  unsigned int *cnt = this->table + p;
-  int area = this->area;
-  int d = *cnt;
+{ CollisionCell *c = _collisiontable_get(this,x,y);
+  unsigned int *h = this->hits + 2*c->off;
+  int d = c->n;
 
   // Check to see if id already counted ~O(d)
   while( d-- )
-    if( cnt[ (2*d+1)*area ] == id )
+    if( h[2*d] == id )
       return;
-  
-  // Append
-  CollisionTable_Request_Depth( this, *cnt+1 ); // possible realloc
-  cnt = this->table + p;     // old *cnt might be invalid 
-  (*cnt)++;
-  p += (*cnt * 2 - 1) * area; // (*cnt-1)*2+1 = *cnt*2 - 1
-  this->table[p       ] = id;
-  this->table[p + area] = index;
-}
-
-void print_hits( CollisionTable *this, int p )
-{ int area = this->area;
-  unsigned int *c = this->table + p;
-  int d = *c;
-  printf("At %5d:  %4d items\n",p,d);
+
+  if( c->n == c->cap )                                      // move run to the end of the slab
+  { int cap = 2*c->cap;
+    this->hits = request_storage( this->hits, &this->hits_size, 2*sizeof(unsigned int), this->nhits+cap, "CollisionTable_Push" );
+    memcpy( this->hits + 2*this->nhits, this->hits + 2*c->off, 2*sizeof(unsigned int)*c->n );
+    c->off = this->nhits;
+    c->cap = cap;
+    this->nhits += cap;
+  }
+  h = this->hits + 2*(c->off + c->n++);
+  h[0] = id;
+  h[1] = index;
+}
+
+void print_hits( CollisionTable *this, int x, int y )
+{ CollisionCell *c = _collisiontable_find(this,x,y);
+  unsigned int *h;
+  int d;
+  if(!c)
+  { printf("At (%3d,%3d):     0 items\n",x,y);
+    return;
+  }
+  h = this->hits + 2*c->off;
+  d = c->n;
+  printf("At (%3d,%3d):  %4d items\n",x,y,d);
   while(d--)
-    printf("\t%4d:id:%5d\tindex:%5d\n",d,c[(2*d+1)*area], c[(2*d+2)*area] );
+    printf("\t%4d:id:%5d\tindex:%5d\n",d,h[2*d],h[2*d+1]);
 }
 
 void CollisionTable_Remove( CollisionTable *this, int x, int y, int id )
-{ int p = x + y * this->stride;
-  unsigned int *cnt = this->table + p;
-  int area = this->area;
-  int d = *cnt;
+{ CollisionCell *c = _collisiontable_find(this,x,y);
+  unsigned int *h;
+  int d;
+  if(!c)
+    return;
+  h = this->hits + 2*c->off;
+  d = c->n;
 
 #ifdef DEBUG_COLLISIONTABLE_REMOVE
-  debug("\tRemoving id:%5d from point (%3d,%3d)=%5d. %3d left.\n",id,x,y,p,d-1);
-  print_hits(this,p);
+  debug("\tRemoving id:%5d from point (%3d,%3d). %3d left.\n",id,x,y,d-1);
+  print_hits(this,x,y);
 #endif
 
   // remove id and shrink list ~O(d)
   while( d-- )
-  { unsigned int *cur = cnt + (2*d+1)*area;
-    if( *cur == id )
-    { int i,n = *cnt - d - 1;                               // remove and copy down the rest
-      for(i=0;i<n;i++)
-      { cur[2*area*i]     = cur[2*(i+1)*area];
-        cur[(2*i+1)*area] = cur[(2*i+3)*area]; 
-      }
-      (*cnt)--;                                             // decriment count
+    if( h[2*d] == id )
+    { memmove( h+2*d, h+2*(d+1), 2*sizeof(unsigned int)*(c->n-d-1) ); // copy down the rest
+      c->n--;
 #ifdef DEBUG_COLLISIONTABLE_REMOVE
-      print_hits(this,p);
+      print_hits(this,x,y);
 #endif
       return;
     }
-  }
 }
 
 void CollisionTable_Add_Segment( CollisionTable *table, Whisker_Seg *w, int id )
@@ -210,11 +263,36 @@ void CollisionTable_Add_Segments( CollisionTable *table, Whisker_Seg *wv, int n
     CollisionTable_Add_Segment( table, wv+n, n );
 }
 
-void CollisionTable_Counts_To_File( CollisionTable *this, char *filename )
+// Returns the largest hit count over all cells.
+int CollisionTable_Max_Count( CollisionTable *this )
+{ int i, m = 0;
+  for( i=0; i<this->ncells; i++ )
+    if( this->cells[i].n > m )
+      m = this->cells[i].n;
+  return m;
+}
+
+// Writes hit counts into a `width` x `height` raster.  Cells outside the
+// raster are ignored.
+void CollisionTable_Rasterize_Counts( CollisionTable *this, unsigned int *dest, int width, int height )
+{ int i;
+  memset( dest, 0, sizeof(unsigned int)*width*height );
+  for( i=0; i<this->ncells; i++ )
+  { CollisionCell *c = this->cells + i;
+    if( c->x >= 0 && c->x < width && c->y >= 0 && c->y < height )
+      dest[ c->x + c->y*width ] = c->n;
+  }
+}
+
+void CollisionTable_Counts_To_File( CollisionTable *this, char *filename, int width, int height )
 { FILE *fp = fopen(filename,"wb");
+  unsigned int *counts;
   if(fp == NULL)
     goto Err;
-  fwrite(this->table, sizeof(unsigned int), this->area, fp);
+  counts = Guarded_Malloc( sizeof(unsigned int)*width*height, "CollisionTable_Counts_To_File" );
+  CollisionTable_Rasterize_Counts( this, counts, width, height );
+  fwrite(counts, sizeof(unsigned int), width*height, fp);
+  free(counts);
   fclose(fp);
   return;
 Err:
@@ -232,17 +310,20 @@ Err:
  *     ... operate on cursor results ...
  *   Free_CollisionTableCursor(cur);
  * }
+ *
+ * Cells are visited in raster order (by y, then x).  Only occupied cells are
+ * visited.
  */
 
 typedef struct _CollisionTableCursor
-{ int p;
-  unsigned int *hit;   // a 4-element array with id0, index0, id1, index1.
-  int stride; // the stride between succesive elements of the hit array
+{ int i;             // index of the cell in the table
+  int x,y;           // the cell
+  unsigned int *hit; // a 4-element array with id0, index0, id1, index1.
 } CollisionTableCursor;
 
 CollisionTableCursor *Alloc_CollisionTableCursor(void)
 { CollisionTableCursor *this = Guarded_Malloc( sizeof(CollisionTableCursor), "Alloc_CollisionTableCursor" );
-  this->p = 0;
+  memset( this, 0, sizeof(CollisionTableCursor) );
   return this;
 }
 
@@ -250,24 +331,43 @@ void Free_CollisionTableCursor(CollisionTableCursor* this)
 { if( this ) free( this );
 }
 
-// Returns cursor for table corresponding to the next pixel with 2 or more
+static int _cmp_cell_raster_order( const void *a, const void *b )
+{ const CollisionCell *ca = (const CollisionCell*)a,
+                      *cb = (const CollisionCell*)b;
+  if( ca->y != cb->y )
+    return (ca->y < cb->y) ? -1 : 1;
+  return (ca->x < cb->x) ? -1 : (ca->x > cb->x);
+}
+
+// Orders cells by (y,x) and rebuilds the hash over the new positions.
+static void _collisiontable_sort( CollisionTable *this )
+{ qsort( this->cells, this->ncells, sizeof(CollisionCell), _cmp_cell_raster_order );
+  _collisiontable_rehash( this, this->nslots );
+  this->sorted = 1;
+}
+
+// Returns cursor for table corresponding to the next cell with 2 or more
 // hits.
 //
 // Reentrant with same cursor.  Search will start at position indicated by
 // cursor, so if hits aren't removed between calls it will always return the
 // same hit.
 int CollisionTable_Next( CollisionTable *this, CollisionTableCursor *cursor )
-{ int p;
-  int area = this->area;
-  unsigned int *table = this->table;
-
-  for( p = cursor->p; p<area; p++ )
-    if( table[p] >= 2 )
-    { cursor->p      = p;
-      cursor->hit    = table + p + area;
-      cursor->stride = area;
-      return table[p];
+{ int i;
+  if( !this->sorted )
+    _collisiontable_sort(this);
+
+  for( i = cursor->i; i<this->ncells; i++ )
+  { CollisionCell *c = this->cells + i;
+    if( c->n >= 2 )
+    { cursor->i   = i;
+      cursor->x   = c->x;
+      cursor->y   = c->y;
+      cursor->hit = this->hits + 2*c->off;
+      return c->n;
     }
+  }
+  cursor->i = i;
   return 0;
 }
 
@@ -278,8 +378,8 @@ int CollisionTable_Next( CollisionTable *this, CollisionTableCursor *cursor )
  * After an approximate intersection between two whiskers is found, the indices
  * bounding the total overlapping region must be computed.
  *
- * Returns a four element array of indices two (beg, end) pairs.
- * The returned array is a static result so it's only valid for one call.
+ * Fills `res`, a four element array, with two (beg, end) pairs of indices and
+ * returns it.
  */
 
  float _trace_overlap_dist( Whisker_Seg *wa, Whisker_Seg *wb, int ia, int ib )
@@ -360,12 +460,12 @@ void _trace_overlap_one_side( Whisker_Seg *wa, Whisker_Seg *wb, int *ia, int *ib
   *ib = tb; 
 }
 
-int *Trace_Overlap( CollisionTableCursor *cursor, Whisker_Seg* wv, float thresh )
-{ static int res[4] = {-1,-1,-1,-1};
-  Whisker_Seg *wa = wv + cursor->hit[ 0                ],
-              *wb = wv + cursor->hit[ 2*cursor->stride ];
-  int ia = cursor->hit[   cursor->stride ], 
-      ib = cursor->hit[ 3*cursor->stride ];
+int *Trace_Overlap( CollisionTableCursor *cursor, Whisker_Seg* wv, float thresh, int res[4] )
+{ 
+  Whisker_Seg *wa = wv + cursor->hit[0],
+              *wb = wv + cursor->hit[2];
+  int ia = cursor->hit[1], 
+      ib = cursor->hit[3];
   int dax, day, dbx, dby;
   int sign;
 
@@ -463,9 +563,9 @@ int _cmp_whisker_seg_frame( const void *a, const void *b )
  *
  * scale : float
  *
- *  The ratio between the units (pixels) in segments and the pixels in the
+ *  The ratio between the units (pixels) in segments and the cells in the
  *  CollisionTable.  For example, if the scale is 2.0, whiskers traced from a
- *  400x300 px image will end up creating a 200x150 px CollisionTable.
+ *  400x300 px image will be binned onto a 200x150 grid of cells.
  *
  * dist_thresh : float
  *
@@ -478,144 +578,33 @@ int _cmp_whisker_seg_frame( const void *a, const void *b )
  *  to be considered a duplicate.
  *
  */
-int Remove_Overlapping_Whiskers_Multi_Frame( Whisker_Seg *wv, int wv_n, float scale, float dist_thresh, float overlap_thresh )
-{ int i,j, w, h;
-  static uint8_t *keepers = NULL;
-  static size_t keepers_size = 0;
-  CollisionTable *table;
-  
-  qsort( wv, wv_n, sizeof(Whisker_Seg), &_cmp_whisker_seg_frame ); // dunno if this is strictly necessary
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-  assert( wv[0].time < wv[wv_n-1].time );
-#endif
-  
-  keepers = request_storage( keepers, &keepers_size, sizeof(uint8_t), wv_n, "Expand keepers" );
-  memset(keepers,1, sizeof(uint8_t)*wv_n);
-
-  Estimate_Image_Shape_From_Segments(wv, wv_n, &w, &h );
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-  debug("Computing table for width: %3d and height: %3d\n",w,h);
-#endif
-  table = Alloc_CollisionTable( w, h, scale, 5 );
-  
-  for( i=0; i<wv_n; i++ )
-  { int iframe = wv[i].time;
-    Whisker_Seg *wvf = wv      + i;
-    uint8_t *mask        = keepers + i;
-
-    j = i;                         // find index of next frame
-    while( j++ < wv_n )
-      if( wv[j].time != iframe )    
-        break;
-
-    CollisionTable_Reset( table );
-    CollisionTable_Add_Segments( table, wvf , j-i ); 
+// Marks duplicates among the segments of a single frame.
+// `keepers[i]` is cleared for each removed segment.
+// `table` is reset and refilled; it holds the survivors afterward.
+static void _mark_overlapping_whiskers( CollisionTable *table,
+                                        Whisker_Seg *wv,
+                                        int wv_n,
+                                        uint8_t *keepers,
+                                        float dist_thresh,
+                                        float overlap_thresh )
+{ int n, res[4];
+  CollisionTableCursor cursor = {0};
 
-    { int n;
-      int area = table->area;
-      CollisionTableCursor cursor = {0,0};
-      
-      while( (n = CollisionTable_Next(table, &cursor)) )
-      { int id2   = cursor.hit[2*area],
-            id    = cursor.hit[0],
-            index = cursor.hit[area],
-            *ovlp;
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-        assert(id    <  j-i);
-        assert(index <  wvf[id].len);
-#endif
-
-        ovlp = Trace_Overlap( &cursor, wvf, dist_thresh );
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-        assert( ovlp[0] <= ovlp[1] );
-        assert( ovlp[2] <= ovlp[3] );
-#endif
-
-        if( _is_whisker_interval_significant( wvf+id , ovlp[0], ovlp[1], overlap_thresh ) ||
-            _is_whisker_interval_significant( wvf+id2, ovlp[2], ovlp[3], overlap_thresh )  )
-        { if( _whisker_seg_score_sum( wvf+id ) > _whisker_seg_score_sum( wvf+id2 ) )
-          { // Keep id, remove id2
-            mask[id2] = 0;
-            CollisionTable_Remove_Segment( table, wvf+id2, id2 );
-          } else 
-          { // Keep id2, remove id
-            mask[id ] = 0;
-            CollisionTable_Remove_Segment( table, wvf+id, id );
-          }
-        } else
-        { int x = cursor.p % table->stride,
-              y = cursor.p / table->stride;
-          CollisionTable_Remove( table, x, y, id );
-        }
-      }
-      i = j-1;
-    }
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-    { int n = table->area;
-      while(n--)
-        assert( table->table[n] <= 1 );
-    }
-#endif
-  }
-
-  // Move keepers to beginning and others to end
-  // stable resorting
-  for(i=0, j=0; j<wv_n; ) // i is the destination, j is the source
-    if( keepers[j] )
-    { Whisker_Seg *a = wv + i++,
-                  *b = wv + j++,
-                  c  = *a;
-      *a = *b;
-      *b = c;
-    }
-    else
-      j++;
-
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
-  debug("Found %d keepers.  Originally %d whiskers (removed %d).\n", i, wv_n, wv_n-i);
-#endif
-
-  Free_CollisionTable(table);
-  return i;
-}
-
-int Remove_Overlapping_Whiskers_One_Frame( Whisker_Seg *wv, 
-                                           int wv_n, 
-                                           int w, 
-                                           int h, 
-                                           float scale, 
-                                           float dist_thresh, 
-                                           float overlap_thresh )
-{ int i,j;
-  static uint8_t *keepers = NULL;
-  static size_t keepers_size = 0;
-  static CollisionTable *table = NULL;
-  static int area;
-  int n;
-  CollisionTableCursor cursor = {0,0};
-
-  keepers = request_storage( keepers, &keepers_size, sizeof(uint8_t), wv_n, "Expand keepers" );
-  memset(keepers,1, sizeof(uint8_t)*wv_n);
-
-  if( !table )
-  { table = Alloc_CollisionTable( w, h, scale, 5 );
-    area= table->area;
-  }
   CollisionTable_Reset( table );
-  CollisionTable_Add_Segments( table, wv , wv_n ); 
+  CollisionTable_Add_Segments( table, wv, wv_n ); 
     
   while( (n = CollisionTable_Next(table, &cursor)) )
-  { int id2   = cursor.hit[2*area],
-        id    = cursor.hit[0],
-        index = cursor.hit[area],
+  { int id    = cursor.hit[0],
+        index = cursor.hit[1],
+        id2   = cursor.hit[2],
         *ovlp;
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_ONE_FRAME
+#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS
     assert(id    <  wv_n);
     assert(index <  wv[id].len);
 #endif
 
-    ovlp = Trace_Overlap( &cursor, wv, dist_thresh );
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_ONE_FRAME
+    ovlp = Trace_Overlap( &cursor, wv, dist_thresh, res );
+#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS
     assert( ovlp[0] <= ovlp[1] );
     assert( ovlp[2] <= ovlp[3] );
 #endif
@@ -632,19 +621,17 @@ int Remove_Overlapping_Whiskers_One_Frame( Whisker_Seg *wv,
         CollisionTable_Remove_Segment( table, wv+id, id );
       }
     } else
-    { int x = cursor.p % table->stride,
-          y = cursor.p / table->stride;
-      CollisionTable_Remove( table, x, y, id );
-    }
-  }
-#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_ONE_FRAME
-  { int n = table->area;
-    while(n--)
-      assert( table->table[n] <= 1 );
+      CollisionTable_Remove( table, cursor.x, cursor.y, id );
   }
+#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS
+  assert( CollisionTable_Max_Count(table) <= 1 );
 #endif
-  // Move keepers to beginning and others to end
-  // stable resorting
+}
+
+// Move keepers to beginning and others to end.
+// Stable.  Returns the number of keepers.
+static int _partition_keepers( Whisker_Seg *wv, int wv_n, uint8_t *keepers )
+{ int i,j;
   for(i=0, j=0; j<wv_n; ) // i is the destination, j is the source
     if( keepers[j] )
     { Whisker_Seg *a = wv + i++,
@@ -655,11 +642,75 @@ int Remove_Overlapping_Whiskers_One_Frame( Whisker_Seg *wv,
     }
     else
       j++;
+  return i;
+}
+
+static int _count_points( Whisker_Seg *wv, int wv_n )
+{ int n = 0;
+  while(wv_n--)
+    n += wv[wv_n].len;
+  return n;
+}
+
+int Remove_Overlapping_Whiskers_Multi_Frame( Whisker_Seg *wv, int wv_n, float scale, float dist_thresh, float overlap_thresh )
+{ int i,j;
+  uint8_t *keepers;
+  CollisionTable *table;
+  
+  qsort( wv, wv_n, sizeof(Whisker_Seg), &_cmp_whisker_seg_frame ); // dunno if this is strictly necessary
+#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
+  assert( wv[0].time < wv[wv_n-1].time );
+#endif
+  
+  keepers = Guarded_Malloc( sizeof(uint8_t)*wv_n + 1, "Remove_Overlapping_Whiskers_Multi_Frame" );
+  memset(keepers,1, sizeof(uint8_t)*wv_n);
+  table = Alloc_CollisionTable( scale, 0 );                 // grows to fit the busiest frame
+  
+  for( i=0; i<wv_n; i=j )
+  { j = i+1;                                 // find index of next frame
+    while( j<wv_n && wv[j].time==wv[i].time )
+      j++;
+    _mark_overlapping_whiskers( table, wv+i, j-i, keepers+i, dist_thresh, overlap_thresh );
+  }
+  i = _partition_keepers( wv, wv_n, keepers );
+
+#ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_MULTI_FRAME
+  debug("Found %d keepers.  Originally %d whiskers (removed %d).\n", i, wv_n, wv_n-i);
+#endif
+
+  free(keepers);
+  Free_CollisionTable(table);
+  return i;
+}
+
+// `w` and `h` are no longer needed.  The table is sparse and sized from the
+// segments passed in.  They're kept so existing callers don't change.
+int Remove_Overlapping_Whiskers_One_Frame( Whisker_Seg *wv, 
+                                           int wv_n, 
+                                           int w, 
+                                           int h, 
+                                           float scale, 
+                                           float dist_thresh, 
+                                           float overlap_thresh )
+{ int i;
+  uint8_t *keepers;
+  CollisionTable *table;
+
+  PROFILE_BEGIN(PROFILE_MERGE);
+  keepers = Guarded_Malloc( sizeof(uint8_t)*wv_n + 1, "Remove_Overlapping_Whiskers_One_Frame" );
+  memset(keepers,1, sizeof(uint8_t)*wv_n);
+  table = Alloc_CollisionTable( scale, _count_points(wv,wv_n) );
+
+  _mark_overlapping_whiskers( table, wv, wv_n, keepers, dist_thresh, overlap_thresh );
+  i = _partition_keepers( wv, wv_n, keepers );
 
 #ifdef DEBUG_REMOVE_OVERLAPPING_WHISKERS_ONE_FRAME
   debug("Found %d keepers.  Originally %d whiskers (removed %d).\n", i, wv_n, wv_n-i);
 #endif
 
+  free(keepers);
+  Free_CollisionTable(table);
+  PROFILE_END(PROFILE_MERGE);
   return i;
 }
 
@@ -695,26 +746,25 @@ int main(int argc, char *argv[])
   
   Estimate_Image_Shape_From_Segments( wv, wv_n, &w, &h );
   debug("Computing table for width: %3d and height: %3d\n",w,h);
-  table = Alloc_CollisionTable( w, h, 2, 5 );
+  table = Alloc_CollisionTable( 2, 0 );
   CollisionTable_Add_Segments( table, wv, wv_n ); 
-  CollisionTable_Counts_To_File( table, Get_String_Arg("dest") );
+  CollisionTable_Counts_To_File( table, Get_String_Arg("dest"), w/2+1, h/2+1 );
 
-  { int n, count=0;
-    int area = table->area;
-    CollisionTableCursor cursor = {0,0};
+  { int n, count=0, res[4];
+    CollisionTableCursor cursor = {0};
     while( n = CollisionTable_Next(table, &cursor) )
-    { int id2, id = cursor.hit[2*n*area];
-      int index = cursor.hit[(2*n+1)*area];
+    { int id2, id = cursor.hit[0];
+      int index = cursor.hit[1];
       int *ovlp;
       assert(id    <  wv_n);
       assert(index <  wv[id].len);
-    //printf("(%3d,%3d) id: %5d\tindex: %5d\n", cursor.p % table->stride,
-    //                                          cursor.p / table->stride,
+    //printf("(%3d,%3d) id: %5d\tindex: %5d\n", cursor.x,
+    //                                          cursor.y,
     //                                          id,
-    //                                          cursor.hit[(2*n+1)*area] );
-      ovlp = Trace_Overlap( &cursor, wv, 2.0 );
+    //                                          cursor.hit[1] );
+      ovlp = Trace_Overlap( &cursor, wv, 2.0, res );
       id  = cursor.hit[0];
-      id2 = cursor.hit[2*area];
+      id2 = cursor.hit[2];
     //printf("Result Overlap: id: %5d\t%3d to %3d\n"
     //       "                id: %5d\t%3d to %3d\n", id , ovlp[0], ovlp[1], 
     //                                                id2, ovlp[2], ovlp[3] );
@@ -726,10 +776,7 @@ int main(int argc, char *argv[])
     }
     printf("Called Next/Remove %d times.\n",count);
   }
-  { int n = table->area;
-    while(n--)
-      assert( table->table[n] <= 1 );
-  }
+  assert( CollisionTable_Max_Count(table) <= 1 );
 
   Free_Whisker_Seg_Vec(wv,wv_n);
   Free_CollisionTable(table);
@@ -748,7 +795,7 @@ int main(int argc, char *argv[])
 { int i, wv_n, w, h, count;
   Whisker_Seg *wv;
   CollisionTable *table;
-  unsigned int *stack;
+  unsigned int *counts;
   FILE *fp;
 
   printf(
@@ -774,7 +821,8 @@ int main(int argc, char *argv[])
 
   Estimate_Image_Shape_From_Segments( wv, wv_n, &w, &h );
   debug("Computing table for width: %3d and height: %3d\n",w,h);
-  table = Alloc_CollisionTable( w, h, 2, 5 );
+  table  = Alloc_CollisionTable( 2, 0 );
+  counts = Guarded_Malloc( sizeof(unsigned int)*(w/2+1)*(h/2+1), "TEST_COLLISIONTABLE_2" );
 
   qsort( wv, wv_n, sizeof(Whisker_Seg), &_cmp_whisker_seg_frame ); // dunno if this is strictly necessary
   assert( wv[0].time < wv[wv_n-1].time );
@@ -791,19 +839,18 @@ int main(int argc, char *argv[])
     CollisionTable_Reset( table );
     CollisionTable_Add_Segments( table, wvf , j-i ); 
 
-    { int n;
-      int area = table->area;
-      CollisionTableCursor cursor = {0,0};
+    { int n, res[4];
+      CollisionTableCursor cursor = {0};
       
       while( (n = CollisionTable_Next(table, &cursor)) )
-      { int id2 = cursor.hit[2*area],
+      { int id2 = cursor.hit[2],
             id  = cursor.hit[0];
-        int index = cursor.hit[area];
+        int index = cursor.hit[1];
         int *ovlp;
         assert(id    <  j-i);
         assert(index <  wvf[id].len);
 
-        ovlp = Trace_Overlap( &cursor, wvf, 2.0 );
+        ovlp = Trace_Overlap( &cursor, wvf, 2.0, res );
         assert( ovlp[0] <= ovlp[1] );
         assert( ovlp[2] <= ovlp[3] );
 
@@ -815,30 +862,25 @@ int main(int argc, char *argv[])
           { CollisionTable_Remove_Segment( table, wvf+id, id );   // Keep id2, remove id
           }
         } else
-        { int x = cursor.p % table->stride,
-              y = cursor.p / table->stride;
-          CollisionTable_Remove( table, x, y, id );
-        }
+          CollisionTable_Remove( table, cursor.x, cursor.y, id );
       count++;
-      assert( count < table->area );
       }
       i = j-1;
-      fwrite( table->table, 
-              table->area , 
+      CollisionTable_Rasterize_Counts( table, counts, w/2+1, h/2+1 );
+      fwrite( counts, 
+              (w/2+1)*(h/2+1), 
               sizeof(unsigned int), 
               fp );
     }
-    { int n = table->area;
-      while(n--)
-        assert( table->table[n] <= 1 );
-    }
+    assert( CollisionTable_Max_Count(table) <= 1 );
   }
   debug("Called Next %d times.\n",count);
 
   fclose(fp);
-  printf("Stack dimensions: %3d x %3d x %3d\n", wv[wv_n-1].time+1, table->area/table->stride, table->stride);
+  printf("Stack dimensions: %3d x %3d x %3d\n", wv[wv_n-1].time+1, h/2+1, w/2+1);
   Free_Whisker_Seg_Vec(wv,wv_n);
   Free_CollisionTable(table);
+  free(counts);
 
   return 0;
 }
@@ -876,3 +918,442 @@ int main(int argc, char *argv[])
   return 0;
 }
 #endif
+
+#ifdef TEST_COLLISIONTABLE_4
+#include <math.h>
+#include <limits.h>
+#include "utilities.h"
+/*
+ * Checks the sparse table against a dense reference.  The reference keeps a
+ * bit per segment for every cell in a window around the points, so segment
+ * ids must be less than 64.
+ */
+#define REF_X0  (-16)   // first cell column in the reference
+#define REF_Y0  (-16)
+#define REF_W   128
+#define REF_H   96
+#define NWALKS  40      // segments that wander over the window
+#define NSTARS  20      // segments that all cross one cell
+#define NSEGS   (NWALKS+NSTARS)
+
+static unsigned long long ref[REF_H][REF_W];
+static unsigned int g_seed = 1;
+
+static float _rand_uniform( float lo, float hi )
+{ g_seed = g_seed*1103515245u + 12345u;
+  return lo + (hi-lo)*((g_seed>>8)&0xffff)/65536.0f;
+}
+
+// Random walks, then segments radiating from (100,40).  Coordinates go
+// negative so cells on both sides of zero are used.
+static Whisker_Seg *_make_segments( int first, int n )
+{ Whisker_Seg *wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*n, "TEST_COLLISIONTABLE_4" );
+  int i, j;
+  for( i=0; i<n; i++ )
+  { Whisker_Seg *w = wv+i;
+    int len = 20 + (first+i)%17;
+    float x, y, a = _rand_uniform(0.0f,6.28f);
+    w->id     = i;
+    w->time   = 0;
+    w->len    = len;
+    w->x      = (float*) Guarded_Malloc( sizeof(float)*len, "TEST_COLLISIONTABLE_4" );
+    w->y      = (float*) Guarded_Malloc( sizeof(float)*len, "TEST_COLLISIONTABLE_4" );
+    w->thick  = (float*) Guarded_Malloc( sizeof(float)*len, "TEST_COLLISIONTABLE_4" );
+    w->scores = (float*) Guarded_Malloc( sizeof(float)*len, "TEST_COLLISIONTABLE_4" );
+    if( first+i<NWALKS )
+    { x = _rand_uniform(-20.0f,180.0f);
+      y = _rand_uniform(-20.0f,120.0f);
+    } else
+    { x = 100.0f;
+      y = 40.0f;
+    }
+    for( j=0; j<len; j++ )
+    { w->x[j]      = x;
+      w->y[j]      = y;
+      w->thick[j]  = 1.0f;
+      w->scores[j] = 1.0f;
+      x += 1.5f*cos(a);
+      y += 1.5f*sin(a);
+      if( first+i<NWALKS )
+        a += _rand_uniform(-0.5f,0.5f);
+      x = MAX( -30.0f, MIN( 200.0f, x ) );
+      y = MAX( -30.0f, MIN( 150.0f, y ) );
+    }
+  }
+  return wv;
+}
+
+static int _ref_cell( float x, float y, float scale, int *cx, int *cy )
+{ *cx = (int)(x/scale) - REF_X0;
+  *cy = (int)(y/scale) - REF_Y0;
+  return *cx>=0 && *cx<REF_W && *cy>=0 && *cy<REF_H;
+}
+
+static void _ref_build( Whisker_Seg *wv, int n, float scale )
+{ int i, j, cx, cy;
+  memset( ref, 0, sizeof(ref) );
+  for( i=0; i<n; i++ )
+    for( j=0; j<wv[i].len; j++ )
+      if( _ref_cell( wv[i].x[j], wv[i].y[j], scale, &cx, &cy ) )
+        ref[cy][cx] |= 1ull<<i;
+      else
+        error("TEST_COLLISIONTABLE_4: point outside the reference window\n");
+}
+
+static int _popcount( unsigned long long m )
+{ int c = 0;
+  while( m ) { m &= m-1; c++; }
+  return c;
+}
+
+static int _ref_max_count( void )
+{ int x, y, m = 0;
+  for( y=0; y<REF_H; y++ )
+    for( x=0; x<REF_W; x++ )
+      m = MAX( m, _popcount(ref[y][x]) );
+  return m;
+}
+
+// Every reference cell has the same hits in the table, each hit names a
+// point in that cell, and the table has no other occupied cells.
+static int _same_as_ref( CollisionTable *table, Whisker_Seg *wv )
+{ int x, y, i, occupied = 0, nonempty = 0;
+  for( y=0; y<REF_H; y++ )
+    for( x=0; x<REF_W; x++ )
+    { CollisionCell *c = _collisiontable_find( table, x+REF_X0, y+REF_Y0 );
+      unsigned long long seen = 0;
+      int n = c ? c->n : 0;
+      if( n!=_popcount(ref[y][x]) )
+      { printf("\t*** Cell (%d,%d) has %d hits.  Expected %d.\n",x+REF_X0,y+REF_Y0,n,_popcount(ref[y][x]));
+        return 0;
+      }
+      for( i=0; i<n; i++ )
+      { unsigned int *h = table->hits + 2*(c->off+i);
+        int cx, cy;
+        if( !(ref[y][x]&(1ull<<h[0])) || (seen&(1ull<<h[0]))
+            || h[1]>=(unsigned)wv[h[0]].len
+            || !_ref_cell( wv[h[0]].x[h[1]], wv[h[0]].y[h[1]], table->scale, &cx, &cy )
+            || cx!=x || cy!=y )
+        { printf("\t*** Cell (%d,%d) has a bad hit (id %u, index %u).\n",x+REF_X0,y+REF_Y0,h[0],h[1]);
+          return 0;
+        }
+        seen |= 1ull<<h[0];
+      }
+      nonempty += (ref[y][x]!=0);
+    }
+  for( i=0; i<table->ncells; i++ )
+    occupied += (table->cells[i].n>0);
+  if( occupied!=nonempty )
+  { printf("\t*** %d cells are occupied.  Expected %d.\n",occupied,nonempty);
+    return 0;
+  }
+  return 1;
+}
+
+// Starting from no size hint, so the hash and the slab grow.
+static int test_push( CollisionTable *table, Whisker_Seg *wv, int n )
+{ CollisionTable_Reset( table );
+  CollisionTable_Add_Segments( table, wv, n );
+  _ref_build( wv, n, table->scale );
+  return _same_as_ref( table, wv )
+      && CollisionTable_Max_Count(table)==_ref_max_count()
+      && CollisionTable_Max_Count(table)>=NSTARS;
+}
+
+// The cursor visits each cell with two or more hits once, in raster order.
+static int test_next( CollisionTable *table, Whisker_Seg *wv, int n )
+{ CollisionTableCursor cursor = {0};
+  int x, y, k, expect = 0, count = 0, lastx = INT_MIN, lasty = INT_MIN;
+  for( y=0; y<REF_H; y++ )
+    for( x=0; x<REF_W; x++ )
+      expect += _popcount(ref[y][x])>=2;
+  while( (k = CollisionTable_Next( table, &cursor )) )
+  { if( k!=_popcount( ref[cursor.y-REF_Y0][cursor.x-REF_X0] ) )
+      return 0;
+    if( cursor.y<lasty || (cursor.y==lasty && cursor.x<=lastx) )
+    { printf("\t*** (%d,%d) was visited after (%d,%d).\n",cursor.x,cursor.y,lastx,lasty);
+      return 0;
+    }
+    lastx = cursor.x;
+    lasty = cursor.y;
+    cursor.i++;
+    count++;
+  }
+  if( count!=expect )
+  { printf("\t*** Visited %d cells.  Expected %d.\n",count,expect);
+    return 0;
+  }
+  return _same_as_ref( table, wv ); // sorting rebuilt the hash
+}
+
+// Removing segments.  Removing ids or cells that aren't there does nothing.
+static int test_remove( CollisionTable *table, Whisker_Seg *wv, int n )
+{ int i, x, y;
+  for( i=0; i<n; i+=3 )
+  { CollisionTable_Remove_Segment( table, wv+i, i );
+    for( y=0; y<REF_H; y++ )
+      for( x=0; x<REF_W; x++ )
+        ref[y][x] &= ~(1ull<<i);
+  }
+  CollisionTable_Remove( table, 1000, 1000, 1 );
+  CollisionTable_Remove( table, 50, 20, n+1 ); // the cell the stars cross
+  return _same_as_ref( table, wv )
+      && CollisionTable_Max_Count(table)==_ref_max_count();
+}
+
+// Reusing the table for a different frame leaves nothing behind.
+static int test_reset( CollisionTable *table, Whisker_Seg *wv, int n )
+{ Whisker_Seg *other = _make_segments( NWALKS/2, NSEGS-NWALKS/2 );
+  int ok;
+  CollisionTable_Reset( table );
+  if( table->ncells!=0 || CollisionTable_Max_Count(table)!=0 )
+    ok = 0;
+  else
+  { CollisionTable_Add_Segments( table, other, NSEGS-NWALKS/2 );
+    _ref_build( other, NSEGS-NWALKS/2, table->scale );
+    ok = _same_as_ref( table, other );
+  }
+  Free_Whisker_Seg_Vec( other, NSEGS-NWALKS/2 );
+  return ok;
+}
+
+// Rasterized counts agree with the reference inside the raster.
+static int test_rasterize( CollisionTable *table, Whisker_Seg *wv, int n )
+{ int w = REF_W+REF_X0, h = REF_H+REF_Y0, x, y, ok = 1;
+  unsigned int *counts = (unsigned int*) Guarded_Malloc( sizeof(unsigned int)*w*h, "TEST_COLLISIONTABLE_4" );
+  CollisionTable_Rasterize_Counts( table, counts, w, h );
+  for( y=0; y<h && ok; y++ )
+    for( x=0; x<w && ok; x++ )
+      ok = counts[x+y*w]==(unsigned)_popcount( ref[y-REF_Y0][x-REF_X0] );
+  free( counts );
+  return ok;
+}
+
+static int (*tests[])( CollisionTable*, Whisker_Seg*, int ) = { test_push,
+                                                                test_next,
+                                                                test_remove,
+                                                                test_reset,
+                                                                test_rasterize,
+                                                                NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ CollisionTable *table;
+  Whisker_Seg *wv;
+  int i, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| CollisionTable Test #4                                       \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Pushes synthetic segments into a table with no size hint and \n"
+      "| checks every cell against a dense reference.  Then iterates, \n"
+      "| removes hits, resets and rasterizes, checking each result.   \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  wv    = _make_segments( 0, NSEGS );
+  table = Alloc_CollisionTable( 2.0, 0 );
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](table,wv,NSEGS) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  Free_CollisionTable( table );
+  Free_Whisker_Seg_Vec( wv, NSEGS );
+  return nfailed;
+}
+#endif
+
+#ifdef WHISKER_REMOVE_OVERLAPS
+#include "whisker_io.h"
+#include "utilities.h"
+#include "thread.h"
+
+/*
+ * Streams a whiskers file through the overlap removal, a window of frames at
+ * a time.  Memory use depends on the window size, not on the movie length.
+ *
+ * Segments are read in file order.  Each run of segments with the same frame
+ * id is treated as one frame.  Files written by `trace` list a frame's
+ * segments together.
+ *
+ * Frames in a window are processed in parallel.  Each worker has its own
+ * CollisionTable.
+ */
+
+typedef struct _overlap_window_t
+{ Whisker_Seg     *wv;       // segments for all frames in the window
+  int             *beg;      // frame f is wv[beg[f]] to wv[beg[f+1]-1]
+  int             *nkeep;    // kept segments in each frame
+  int              nframes;
+  int              nworkers;
+  CollisionTable **tables;   // one per worker
+  uint8_t        **keepers;  // one per worker
+  size_t          *keepers_size;
+  float            dist_thresh,
+                   overlap_thresh;
+} overlap_window_t;
+
+// Worker i handles frames i, i+nworkers, ...
+static void overlap_window_worker( void *ctx, int iworker )
+{ overlap_window_t *job = (overlap_window_t*) ctx;
+  int f;
+  for( f=iworker; f<job->nframes; f+=job->nworkers )
+  { Whisker_Seg *wv = job->wv + job->beg[f];
+    int n = job->beg[f+1] - job->beg[f];
+    uint8_t *keepers;
+    keepers = job->keepers[iworker] = request_storage( job->keepers[iworker], job->keepers_size+iworker, 
+                                                       sizeof(uint8_t), n, "remove overlaps - keepers" );
+    memset( keepers, 1, sizeof(uint8_t)*n );
+    _mark_overlapping_whiskers( job->tables[iworker], wv, n, keepers, job->dist_thresh, job->overlap_thresh );
+    job->nkeep[f] = _partition_keepers( wv, n, keepers );
+  }
+}
+
+static char *Spec[] = {"[-h|--help] | <source:string> <dest:string> [--overlap <double>] [--window <int>]", NULL};
+int main(int argc, char *argv[])
+{ WhiskerFile in, out;
+  overlap_window_t job;
+  Whisker_Seg pending;
+  int i, f, window, nthreads,
+      has_pending = 0,
+      eof         = 0,
+      last_time   = -1,
+      warned      = 0,
+      count_in    = 0,
+      count_out   = 0;
+  size_t wv_size = 0;
+
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+  { Print_Argument_Usage(stdout,0);
+    printf(
+      "--------------------------                                                   \n"
+      " Remove overlapping whiskers                                                  \n"
+      "--------------------------                                                   \n"
+      "                                                                              \n"
+      "  Finds duplicate segments within each frame and keeps the higher scoring     \n"
+      "  one.  This is the same cleanup `trace` does as it goes.                     \n"
+      "                                                                              \n"
+      "  The source is read a window of frames at a time, so whole movies can be     \n"
+      "  processed in constant memory.  Frames in a window are processed in          \n"
+      "  parallel.  Set WHISK_THREADS to limit the number of threads.                \n"
+      "                                                                              \n"
+      "  <source>    Whiskers file to read.  Segments from the same frame should be  \n"
+      "              adjacent in the file.                                           \n"
+      "  <dest>      Whiskers file to write.                                         \n"
+      "  --overlap   Fraction of a segment that must overlap another for the two to  \n"
+      "              be considered duplicates.  Default: 0.5                         \n"
+      "  --window    Number of frames to hold in memory.  Default: 16 per thread.    \n"
+      "\n");
+    return 0;
+  }
+
+  memset( &job, 0, sizeof(job) );
+  nthreads           = thread_count();
+  window             = Is_Arg_Matched("--window")  ? Get_Int_Arg("--window")     : 16*nthreads;
+  job.overlap_thresh = Is_Arg_Matched("--overlap") ? Get_Double_Arg("--overlap") : 0.5;
+  job.dist_thresh    = 2.0;
+  if( window < 1 )
+    error("--window must be at least 1.\n");
+
+  in  = Whisker_File_Open( Get_String_Arg("source"), NULL, "r" );
+  if( !in )
+    error("Could not open %s for reading.\n",Get_String_Arg("source"));
+  out = Whisker_File_Open( Get_String_Arg("dest"), NULL, "w" );
+  if( !out )
+    error("Could not open %s for writing.\n",Get_String_Arg("dest"));
+
+  job.beg          = Guarded_Malloc( sizeof(int)*(window+1), "remove overlaps" );
+  job.nkeep        = Guarded_Malloc( sizeof(int)*window,     "remove overlaps" );
+  job.tables       = Guarded_Malloc( sizeof(CollisionTable*)*nthreads, "remove overlaps" );
+  job.keepers      = Guarded_Malloc( sizeof(uint8_t*)*nthreads,        "remove overlaps" );
+  job.keepers_size = Guarded_Malloc( sizeof(size_t)*nthreads,          "remove overlaps" );
+  for( i=0; i<nthreads; i++ )
+  { job.tables[i]       = Alloc_CollisionTable( 2.0, 0 );
+    job.keepers[i]      = NULL;
+    job.keepers_size[i] = 0;
+  }
+
+  for(;;)
+  { int nseg = 0;
+
+    // Fill the window
+    job.nframes = 0;
+    for(;;)
+    { if( !has_pending )
+      { if( !eof && (has_pending = Whisker_File_Read_Segment( in, &pending )) < 0 )
+          error("Could not read %s.  It may be truncated.\n",Get_String_Arg("source"));
+        if( eof || !has_pending )
+        { eof = 1;
+          break;
+        }
+        count_in++;
+      }
+      if( nseg==0 || pending.time != job.wv[nseg-1].time )
+      { if( job.nframes == window )
+          break;
+        if( pending.time <= last_time && !warned )
+        { warning("Frames in %s are not in order.\n"
+                  "\tSegments from the same frame that are not adjacent in the file will\n"
+                  "\tnot be compared to each other.\n",Get_String_Arg("source"));
+          warned = 1;
+        }
+        last_time = pending.time;
+        job.beg[job.nframes++] = nseg;
+      }
+      job.wv = request_storage( job.wv, &wv_size, sizeof(Whisker_Seg), nseg+1, "remove overlaps - window" );
+      job.wv[nseg++] = pending;
+      has_pending = 0;
+    }
+    if( job.nframes == 0 )
+      break;
+    job.beg[job.nframes] = nseg;
+
+    // Process
+    job.nworkers = (nthreads<job.nframes) ? nthreads : job.nframes;
+    parallel_for( job.nworkers, job.nworkers, overlap_window_worker, &job );
+
+    // Write: compact the keepers and release the rest
+    { int k = 0;
+      for( f=0; f<job.nframes; f++ )
+      { Whisker_Seg *wv = job.wv + job.beg[f];
+        int n = job.beg[f+1] - job.beg[f];
+        for( i=job.nkeep[f]; i<n; i++ )
+          Free_Whisker_Seg_Data( wv+i );
+        for( i=0; i<job.nkeep[f]; i++ )
+          job.wv[k++] = wv[i];
+      }
+      Whisker_File_Append_Segments( out, job.wv, k );
+      for( i=0; i<k; i++ )
+        Free_Whisker_Seg_Data( job.wv+i );
+      count_out += k;
+    }
+    progress("Frame %5d.  Kept %d of %d segments.\r",last_time,count_out,count_in);
+  }
+  progress("\n");
+
+  if( !Whisker_File_Close( out ) )
+    error("Could not write %s.\n",Get_String_Arg("dest"));
+  Whisker_File_Close( in );
+  for( i=0; i<nthreads; i++ )
+  { Free_CollisionTable( job.tables[i] );
+    if( job.keepers[i] ) free( job.keepers[i] );
+  }
+  free( job.tables );
+  free( job.keepers );
+  free( job.keepers_size );
+  free( job.beg );
+  free( job.nkeep );
+  if( job.wv ) free( job.wv );
+  return 0;
+}
+#endif
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+/*
+ * Fused pipeline
+ * --------------
+ * Runs the steps of a tracing session in one process:
+ *
+ *   trace      find_segments and Remove_Overlapping_Whiskers_One_Frame
+ *   measure    Whisker_Segments_Measure
+ *   classify   Measurements_Table_Classify
+ *   reclassify HMM_Reclassify_Watershed
+ *
+ * Segments and measurements stay in memory between steps, so nothing is
+ * written and parsed again.  When the face is given as a point, each frame is
+ * measured as soon as it has been traced and its segments are released.  A
+ * face hint depends on the extent of all the segments in the movie, so with a
+ * hint the segments are kept and measured after the last frame.
+ *
+ * The result is the same as running trace, measure, classify and reclassify
+ * one after another with the same options.  The files those steps would have
+ * written can still be requested.
+ */
+#include "compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities.h"
+#include "image_lib.h"
+#include "video.h"
+#include "trace.h"
+#include "merge.h"
+#include "whisker_io.h"
+#include "measure.h"
+#include "traj.h"
+#include "measurements_io.h"
+#include "hmm-reclassify.h"
+#include "common.h"
+#include "error.h"
+#include "profile.h"
+
+#include "parameters/param.h"
+
+#define ENDL "\n"
+#define REPORT(expr) debug("%s(%d):"ENDL "\t%s"ENDL "\tExpression evaluated as false."ENDL,__FILE__,__LINE__,#expr)
+#define TRY(expr,lbl) if(!(expr)) {REPORT(expr); goto lbl;}
+
+// Measures one frame's segments and appends the rows to `table`.
+// The table grows geometrically; *maxrows is the number of rows allocated.
+static Measurements *append_measurements( Measurements *table, int *nrows, int *maxrows,
+                                          Whisker_Seg *wv, int n, int facex, int facey, char face_axis )
+{ Measurements *row;
+  if( n<=0 )
+    return table;
+  if( !table )
+  { *nrows = *maxrows = n;
+    return Whisker_Segments_Measure( wv, n, facex, facey, face_axis );
+  }
+  if( *nrows + n > *maxrows )
+  { int m = MAX( 2*(*maxrows), *nrows + n );
+    table = Realloc_Measurements_Table( table, *maxrows, m );
+    *maxrows = m;
+  }
+  Whisker_Segments_Update_Measurements( table + *nrows, wv, n, facex, facey, face_axis );
+  for( row = table + *nrows; row < table + *nrows + n; row++ )
+  { row->state = 0;
+    row->valid_velocity = 0;
+  }
+  *nrows += n;
+  return table;
+}
+
+static void save( char *filename, Measurements *table, int nrows )
+{ if( !Measurements_Table_To_Filename( filename, NULL, table, nrows ) )
+    error("Could not write %s"ENDL,filename);
+  progress("Wrote %s\n",filename);
+}
+
+/*
+ * MAIN
+ */
+static char *Spec[] = { "[-h|--help] | ( <movie:string> <prefix:string>",
+                        "                --face ( <x:int> <y:int> <axis:string> | <hint:string> )",
+                        "                --px2mm <double> -n <int>",
+                        "                [--limit<double(1.0)>:<double(50.0)>] [--follicle <int>]",
+                        "                [--whiskers <string>] [--measured <string>] [--classified <string>]",
+                        "                [--profile <string>] [--timeline <string>] )", NULL };
+int main(int argc, char *argv[])
+{ char *movie, *prefix, *dest, *hint = NULL;
+  video_t *v = NULL;
+  WhiskerFile wfile = NULL;
+  Whisker_Seg *all = NULL;          // kept for a face hint
+  size_t max_all = 0;
+  int nall = 0;
+  Measurements *table = NULL;
+  int nrows = 0, maxrows = 0;
+  int facex = 0, facey = 0;
+  char face_axis = 0;
+  int i, depth, count, follicle;
+  double px2mm, low_px, high_px;
+
+  Process_Arguments(argc,argv,Spec,0);
+
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+      "-------------------------\n"
+      "Whisker tracing pipeline\n"
+      "-------------------------\n"
+      "\n"
+      "Traces, measures, classifies and reclassifies the whiskers in <movie> and\n"
+      "writes the labelled measurements to <prefix>.measurements.  This gives the\n"
+      "same result as running trace, measure, classify and reclassify in turn,\n"
+      "but intermediate results are kept in memory.\n"
+      "\n"
+      "\t--face        Center of the face as <x> <y> <axis>, or the side of the\n"
+      "\t              frame it is nearest: 'left', 'right', 'top' or 'bottom'.\n"
+      "\t              With <x> <y> <axis>, frames are measured as they are\n"
+      "\t              traced.  See measure and classify.\n"
+      "\t--px2mm       The length of a pixel in millimeters.\n"
+      "\t-n            The number of whiskers.  Use -1 to have it estimated.\n"
+      "\t--limit       Range of whisker lengths (mm) searched for the length\n"
+      "\t              threshold (default 1.0:50.0).\n"
+      "\t--follicle    Follicle position threshold (px).  See classify.\n"
+      "\t--whiskers    Also write the traced segments to this file.\n"
+      "\t--measured    Also write the measurements before classification.\n"
+      "\t--classified  Also write the measurements after classification.\n"
+      "\t--profile     Write per-stage timings and counters as JSON to this file.\n"
+      "\t--timeline    With --profile, also write a Chrome trace event timeline.\n"
+      "\n"
+      "If every segment is identified by classification, reclassification has\n"
+      "nothing to do and <prefix>.measurements holds the classified result.\n"
+      "\n" );
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
+
+  { char* paramfile = "default.parameters";
+    if(Load_Params_File(paramfile))
+    { warning(
+        "Could not load parameters from file: %s\n"
+        "Writing %s\n"
+        "\tTrying again\n",paramfile,paramfile);
+      Print_Params_File(paramfile);
+      if(Load_Params_File(paramfile))
+        error("\tStill could not load parameters.\n");
+    }
+  }
+
+  prefix = Get_String_Arg("prefix");
+  { char *dot = strrchr(prefix,'.');  // Remove any file extension from the prefix
+    if(dot) *dot = 0;
+  }
+  dest = (char*) Guarded_Malloc( strlen(prefix)+32, "pipeline" );
+  sprintf( dest, "%s.measurements", prefix );
+
+  px2mm    = Get_Double_Arg("--px2mm");
+  low_px   = Get_Double_Arg("--limit",1) / px2mm;
+  high_px  = Get_Double_Arg("--limit",2) / px2mm;
+  count    = Get_Int_Arg("-n");
+  follicle = Is_Arg_Matched("--follicle") ? Get_Int_Arg("--follicle") : 0;
+  if( Is_Arg_Matched("hint") )
+  { hint = Get_String_Arg("hint");
+  } else
+  { facex     = Get_Int_Arg("x");
+    facey     = Get_Int_Arg("y");
+    face_axis = Get_String_Arg("axis")[0];
+  }
+
+  movie = Get_String_Arg("movie");
+  TRY( v=video_open(movie), ErrorOpen );
+  depth = video_frame_count(v);
+  if( Is_Arg_Matched("--whiskers") )
+    if( !(wfile = Whisker_File_Open( Get_String_Arg("--whiskers"), "whiskbin1", "w" )) )
+      error("Could not open %s for writing."ENDL,Get_String_Arg("--whiskers"));
+  if( wfile )
+    Whisker_File_Async( wfile, 0 );
+
+  //
+  // Trace and measure
+  //
+  for( i=0; i<depth; i++ )
+  { Image *image;
+    Whisker_Seg *wv;
+    int wv_n, k;
+    TRY( image=video_get(v,i,1), ErrorRead );
+    progress_meter(i, 0, depth, 79, "Finding segments: [%5d/%5d]",i,depth-1);
+    wv = find_segments( i, image, NULL, &wv_n );
+    k = Remove_Overlapping_Whiskers_One_Frame( wv, wv_n,
+                                               image->width, image->height,
+                                               2.0,    // scale down by this
+                                               2.0,    // distance threshold
+                                               0.5 );  // significant overlap fraction
+    if( wfile )
+      Whisker_File_Append_Segments( wfile, wv, k );
+    if( hint )
+    { int j;
+      all = (Whisker_Seg*) request_storage( all, &max_all, sizeof(Whisker_Seg), nall+k, "pipeline" );
+      memcpy( all+nall, wv, sizeof(Whisker_Seg)*k );
+      nall += k;
+      for( j=k; j<wv_n; j++ )
+        Free_Whisker_Seg_Data( wv+j );
+      if(wv) free(wv);
+    } else
+    { table = append_measurements( table, &nrows, &maxrows, wv, k, facex, facey, face_axis );
+      Free_Whisker_Seg_Vec( wv, wv_n );
+    }
+    Free_Image( image );
+  }
+  printf("\n");
+  if( wfile && !Whisker_File_Close( wfile ) )
+    error("Could not write %s.\n", Get_String_Arg("--whiskers"));
+  video_close( &v );
+
+  if( hint && nall>0 )
+  { face_point_from_hint( all, nall, hint, &facex, &facey, &face_axis );
+    table = Whisker_Segments_Measure( all, nall, facex, facey, face_axis );
+    nrows = nall;
+  }
+  Free_Whisker_Seg_Vec( all, nall );
+  if( nrows<=0 )
+    error("No whiskers found\n"
+          "\tin %s\n", movie);
+  if( Is_Arg_Matched("--measured") )
+    save( Get_String_Arg("--measured"), table, nrows );
+
+  //
+  // Classify and reclassify
+  //
+  Measurements_Table_Classify( table, nrows, hint, facex, facey, face_axis,
+                               follicle, low_px, high_px, count );
+  if( Is_Arg_Matched("--classified") )
+    save( Get_String_Arg("--classified"), table, nrows );
+  HMM_Reclassify_Watershed( table, nrows, count );
+  save( dest, table, nrows );
+
+  Free_Measurements_Table( table );
+  free( dest );
+  return 0;
+ErrorRead:
+  if( wfile ) Whisker_File_Close( wfile );
+  video_close( &v );
+  error("Could not read frame %d from %s"ENDL,i,movie);
+  return 1;
+ErrorOpen:
+  error("Could not open %s"ENDL,movie);
+  return 2;
+}
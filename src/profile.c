@@ -0,0 +1,230 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "error.h"
+#include "utilities.h"
+
+#define PROFILE_MAX_DEPTH 32
+
+SHARED_EXPORT int profile_on = 0;
+
+static const char *g_stage_names[PROFILE_NSTAGES] =
+{ "decode",
+  "seed",
+  "trace",
+  "merge",
+  "read",
+  "write",
+  "measure",
+  "classify",
+  "reclassify",
+};
+
+static const char *g_counter_names[PROFILE_NCOUNTERS] =
+{ "frames_decoded",
+  "frames_traced",
+  "seeds",
+  "segments",
+  "eval_line",
+  "eval_half_space",
+  "line_adjust_iterations",
+  "bytes_read",
+  "bytes_written",
+};
+
+// Each thread that records a span or count gets its own record, so probes
+// never touch shared state.  Records are kept on a list for the life of the
+// process (the thread may exit first) and summed by profile_stop().
+typedef struct _profile_thread_t
+{ int      session;  // records from an earlier profile_start() are stale
+  int      tid;      // timeline row
+  double   seconds[PROFILE_NSTAGES];
+  int64_t  calls  [PROFILE_NSTAGES];
+  int64_t  counts [PROFILE_NCOUNTERS];
+  struct { profile_stage_t stage; double t; } stack[PROFILE_MAX_DEPTH];
+  int      depth;
+  struct _profile_thread_t *next;
+} profile_thread_t;
+
+static struct
+{ char    *summary_path;
+  FILE    *timeline;
+  int      nevents;
+  int      session;
+  int      nthreads;
+  double   t0;
+  profile_thread_t *threads;
+  mutex_t *lock;     // guards threads, nthreads and timeline
+} g_profile;
+
+static THREAD_LOCAL profile_thread_t *t_profile = NULL;
+
+static profile_thread_t *this_thread(void)
+{ profile_thread_t *self = t_profile;
+  if( !self )
+  { self = (profile_thread_t*) Guarded_Malloc( sizeof(profile_thread_t), "profile" );
+    memset( self, 0, sizeof(profile_thread_t) );
+    mutex_lock( mutex_lazy_create(&g_profile.lock) );
+    self->session = g_profile.session;
+    self->tid     = ++g_profile.nthreads;
+    self->next    = g_profile.threads;
+    g_profile.threads = self;
+    mutex_unlock( g_profile.lock );
+    t_profile = self;
+  } else if( self->session != g_profile.session )
+  { memset( self->seconds, 0, sizeof(self->seconds) );
+    memset( self->calls,   0, sizeof(self->calls)   );
+    memset( self->counts,  0, sizeof(self->counts)  );
+    self->depth   = 0;
+    self->session = g_profile.session;
+  }
+  return self;
+}
+
+SHARED_EXPORT
+const char *profile_stage_name(profile_stage_t stage)
+{ return (stage>=0 && stage<PROFILE_NSTAGES) ? g_stage_names[stage] : "unknown";
+}
+
+SHARED_EXPORT
+const char *profile_counter_name(profile_counter_t counter)
+{ return (counter>=0 && counter<PROFILE_NCOUNTERS) ? g_counter_names[counter] : "unknown";
+}
+
+SHARED_EXPORT
+int profile_start(const char *summary_path, const char *timeline_path)
+{ static int registered = 0;
+  profile_stop();
+  g_profile.nevents = 0;
+  g_profile.session++;
+  if( summary_path )
+  { g_profile.summary_path = (char*) malloc( strlen(summary_path)+1 );
+    strcpy( g_profile.summary_path, summary_path );
+  }
+  if( timeline_path )
+  { if( !(g_profile.timeline = fopen(timeline_path,"w")) )
+    { warning("Could not open %s for writing the profile timeline.\n",timeline_path);
+      free( g_profile.summary_path );
+      g_profile.summary_path = NULL;
+      return 0;
+    }
+    fprintf( g_profile.timeline, "{\"traceEvents\":[\n" );
+  }
+  if( !registered )
+  { atexit( profile_stop );
+    registered = 1;
+  }
+  g_profile.t0 = wall_clock();
+  profile_on = 1;
+  return 1;
+}
+
+SHARED_EXPORT
+void profile_begin(profile_stage_t stage)
+{ profile_thread_t *self = this_thread();
+  if( self->depth < PROFILE_MAX_DEPTH )
+  { self->stack[self->depth].stage = stage;
+    self->stack[self->depth].t     = wall_clock();
+  }
+  self->depth++;
+}
+
+SHARED_EXPORT
+void profile_end(profile_stage_t stage)
+{ profile_thread_t *self = this_thread();
+  double t = wall_clock(),
+         t0;
+  if( self->depth<=0 )
+    return;
+  if( --self->depth >= PROFILE_MAX_DEPTH )
+    return;
+  if( self->stack[self->depth].stage != stage )
+  { debug("profile: unbalanced end of stage %s inside %s.\n",
+        profile_stage_name(stage), profile_stage_name(self->stack[self->depth].stage) );
+    return;
+  }
+  t0 = self->stack[self->depth].t;
+  self->seconds[stage] += t-t0;
+  self->calls[stage]++;
+  if( g_profile.timeline )
+  { mutex_lock( g_profile.lock );
+    if( g_profile.timeline )
+      fprintf( g_profile.timeline, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+               g_profile.nevents++ ? ",\n" : "",
+               g_stage_names[stage], self->tid, 1e6*(t0-g_profile.t0), 1e6*(t-t0) );
+    mutex_unlock( g_profile.lock );
+  }
+}
+
+SHARED_EXPORT
+void profile_count(profile_counter_t counter, int64_t n)
+{ this_thread()->counts[counter] += n;
+}
+
+// Sums the records of every thread that ran during this session.
+static void write_summary( const char *path, double elapsed )
+{ FILE *fp;
+  int i;
+  double  seconds[PROFILE_NSTAGES]   = {0};
+  int64_t calls  [PROFILE_NSTAGES]   = {0},
+          counts [PROFILE_NCOUNTERS] = {0};
+  double  frames;
+  profile_thread_t *t;
+
+  mutex_lock( mutex_lazy_create(&g_profile.lock) );
+  for( t=g_profile.threads; t; t=t->next )
+  { if( t->session != g_profile.session )
+      continue;
+    for( i=0; i<PROFILE_NSTAGES; i++ )
+    { seconds[i] += t->seconds[i];
+      calls[i]   += t->calls[i];
+    }
+    for( i=0; i<PROFILE_NCOUNTERS; i++ )
+      counts[i] += t->counts[i];
+  }
+  mutex_unlock( g_profile.lock );
+  frames = (double) counts[PROFILE_FRAMES_TRACED];
+
+  if( !(fp=fopen(path,"w")) )
+  { warning("Could not open %s for writing the profile summary.\n",path);
+    return;
+  }
+  fprintf( fp, "{\n  \"seconds\": %.6f,\n  \"stages\": {\n", elapsed );
+  for( i=0; i<PROFILE_NSTAGES; i++ )
+    fprintf( fp, "    \"%s\": { \"seconds\": %.6f, \"calls\": %lld }%s\n",
+             g_stage_names[i], seconds[i], (long long) calls[i],
+             (i<PROFILE_NSTAGES-1) ? "," : "" );
+  fprintf( fp, "  },\n  \"counters\": {\n" );
+  for( i=0; i<PROFILE_NCOUNTERS; i++ )
+    fprintf( fp, "    \"%s\": %lld,\n", g_counter_names[i], (long long) counts[i] );
+  fprintf( fp, "    \"segments_per_frame\": %.3f\n  }\n}\n",
+           (frames>0) ? counts[PROFILE_SEGMENTS]/frames : 0.0 );
+  fclose(fp);
+}
+
+SHARED_EXPORT
+void profile_stop(void)
+{ if( !profile_on )
+    return;
+  profile_on = 0;
+  if( g_profile.summary_path )
+  { write_summary( g_profile.summary_path, wall_clock()-g_profile.t0 );
+    free( g_profile.summary_path );
+    g_profile.summary_path = NULL;
+  }
+  if( g_profile.timeline )
+  { mutex_lock( g_profile.lock );
+    fprintf( g_profile.timeline, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+    fclose( g_profile.timeline );
+    g_profile.timeline = NULL;
+    mutex_unlock( g_profile.lock );
+  }
+}
@@ -16,6 +16,7 @@
 
 #include "parameters/param.h"
 #include "error.h"
+#include "thread.h"
 
 #if 1
 #define DEBUG_REPORT_1
@@ -102,17 +103,202 @@ void print_hist( int *hist, int n)
   printf("Total: %8d\n",ttl);
 }
 
+//
+// Frame index
+// -----------
+//
+// Both tables are sorted by time.  Each frame in A is paired with the rows
+// of B from the same frame.  Frames only in B are never visited, just as
+// junk rows in A are never matched.
+//
+
+typedef struct _diff_frame_t
+{ int           fid;
+  Measurements *a, *b;      // first row of the frame in each table
+  int           na, nb;
+  int           same;       // rows are identical in A and B
+} diff_frame_t;
+
+static int rows_are_same( Measurements *a, Measurements *b )
+{ return a->wid   == b->wid
+      && a->state == b->state
+      && a->n     == b->n
+      && 0==memcmp( a->data, b->data, a->n*sizeof(double) );
+}
+
+static diff_frame_t *index_frames( Measurements *A, int nA, Measurements *B, int nB, int *nframes )
+{ diff_frame_t *frames, *f;
+  Measurements *rowA = A, *rowB = B;
+  int n = 0;
+
+  while( rowA < A+nA )                            // count frames in A
+  { int cur = rowA->fid;
+    while( (rowA < A+nA) && (rowA->fid == cur) )
+      rowA++;
+    n++;
+  }
+  f = frames = Guarded_Malloc( sizeof(diff_frame_t)*MAX(n,1), "index frames" );
+
+  rowA = A;
+  while( rowA < A+nA )
+  { int i;
+    f->fid = rowA->fid;
+    f->a   = rowA;
+    while( (rowA < A+nA) && (rowA->fid == f->fid) )
+      rowA++;
+    f->na  = rowA - f->a;
+
+    while( (rowB < B+nB) && (rowB->fid < f->fid) )
+      rowB++;
+    f->b   = rowB;
+    while( (rowB < B+nB) && (rowB->fid == f->fid) )
+      rowB++;
+    f->nb  = rowB - f->b;
+
+    f->same = (f->na == f->nb);
+    for( i=0; f->same && i<f->na; i++ )
+      f->same = rows_are_same( f->a+i, f->b+i );
+    f++;
+  }
+  *nframes = n;
+  return frames;
+}
+
+//
+// Parallel passes
+// ---------------
+//
+// Frames are handed out to workers in chunks of DIFF_CHUNK consecutive
+// frames.  Mismatched frames are collected per chunk and flushed to the
+// caller in chunk order.
+//
+
+#define DIFF_CHUNK 256
+
+typedef struct _diff_chunk_t
+{ int    *fids;
+  size_t  size;
+  int     n;
+  int     done;
+} diff_chunk_t;
+
+typedef struct _diff_t
+{ Distributions *distA, *distB;
+  int            minstateA, minstateB,
+                 nAst, nBst;
+  diff_frame_t  *frames;
+  int            nframes;
+  int           *counts,       // nAst x nBst identity correspondence
+                *map;          // A identity -> B identity
+  diff_chunk_t  *chunks;
+  int            nchunks,
+                 next_flush,   // first chunk not yet passed to emit
+                 mismatch;
+  pf_diff_frame  emit;
+  void          *ctx;
+  mutex_t       *lock;
+} diff_t;
+
+static Measurements *match_row( diff_t *d, diff_frame_t *f, Measurements *rowA )
+{ if( f->same )              // identical rows match themselves
+    return f->b + (rowA - f->a);
+  return find_match( d->distA, rowA, d->minstateA, d->distB, f->b, f->nb, d->minstateB, -5000.0 );
+}
+
+// First pass
+// solve correspondence between trajectories
+static void count_chunk( void *ctx, int ichunk )
+{ diff_t *d = (diff_t*) ctx;
+  int i,
+      beg = ichunk*DIFF_CHUNK,
+      end = MIN( beg+DIFF_CHUNK, d->nframes ),
+      ncounts = d->nAst*d->nBst;
+  int *counts = Guarded_Malloc( ncounts*sizeof(int), "alloc counts");
+  memset( counts, 0, ncounts*sizeof(int) );
+
+  for( i=beg; i<end; i++ )
+  { diff_frame_t *f = d->frames + i;
+    Measurements *rowA;
+    for( rowA = f->a; rowA < f->a + f->na; rowA++ )
+    { Measurements *match;
+
+      if( rowA->state == -1 ) // skip these
+        continue;
+
+      match = match_row( d, f, rowA );
+      if(match)
+      { counts[ d->nAst*(match->state-d->minstateB) + (rowA->state-d->minstateA) ]++;
+      } else {
+        counts[ (rowA->state-d->minstateA) ]++;
+      }
+    }
+  }
+
+  mutex_lock( d->lock );
+  for( i=0; i<ncounts; i++ )
+    d->counts[i] += counts[i];
+  mutex_unlock( d->lock );
+  free(counts);
+}
+
+static void flush_chunks( diff_t *d ) // caller holds the lock
+{ while( d->next_flush < d->nchunks && d->chunks[d->next_flush].done )
+  { diff_chunk_t *c = d->chunks + d->next_flush++;
+    int i;
+    for( i=0; i<c->n; i++ )
+      d->emit( d->ctx, c->fids[i] );
+    d->mismatch += c->n;
+    free( c->fids );
+    c->fids = NULL;
+  }
+}
+
+// Second pass
+// Collect frames where there is a mismatch
+static void diff_chunk( void *ctx, int ichunk )
+{ diff_t *d = (diff_t*) ctx;
+  diff_chunk_t *c = d->chunks + ichunk;
+  int i,
+      beg = ichunk*DIFF_CHUNK,
+      end = MIN( beg+DIFF_CHUNK, d->nframes );
+
+  for( i=beg; i<end; i++ )
+  { diff_frame_t *f = d->frames + i;
+    Measurements *rowA;
+    for( rowA = f->a; rowA < f->a + f->na; rowA++ )
+    { Measurements *match;
+
+      if( rowA->state == d->minstateA ) // skip these
+        continue;
+
+      match = match_row( d, f, rowA );
+      if( match && ( d->map[ rowA->state-d->minstateA ] != match->state-d->minstateB ) )
+      { c->fids = request_storage( c->fids, &c->size, sizeof(int), c->n+1, "measurements diff" );
+        c->fids[ c->n++ ] = f->fid;
+#ifdef DEBUG_MEASUREMENTS_TABLE_GET_DIFF_FRAMES
+        debug("Frame %5d. Mismatch\tident:(%3d, %-3d) wid:(%3d, %-3d)\n", f->fid,
+            d->map[rowA->state-d->minstateA]+d->minstateB,
+            match->state,
+            rowA->wid,
+            match->wid);
+#endif
+        break;                // one mistake is enough for this frame
+      } //end aggregate difference
+    } //end iterate over rows with const frame
+  }
+
+  mutex_lock( d->lock );
+  c->done = 1;
+  flush_chunks( d );
+  mutex_unlock( d->lock );
+}
+
 SHARED_EXPORT
-int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements *B, int nB, int *nframes )
-{ int nAst, nBst;
-  Measurements *rowA, *rowB, *markA, *markB;
-  Distributions *distA, *distB;
-  int *counts, 
-      *map,
-      mismatch=0;
-  static int *frames = NULL;
-  size_t frames_size = 0;
-  int minstateA, minstateB;
+int Measurements_Tables_Stream_Diff_Frames( Measurements *A, int nA, Measurements *B, int nB, pf_diff_frame emit, void *ctx )
+{ diff_t d;
+  memset( &d, 0, sizeof(d) );
+  d.emit = emit;
+  d.ctx  = ctx;
 
   //
   // Now build distributions. (Conditioned on whisker or not)
@@ -120,23 +306,23 @@ int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements
   
   Sort_Measurements_Table_State_Time(A, nA);
   Measurements_Table_Compute_Velocities(A, nA);
-  distA = Build_Velocity_Distributions( A, nA, COMPARE_IDENTITIES_DISTS_NBINS );
-  Distributions_Normalize( distA );
-  Distributions_Apply_Log2( distA );
-  nAst = _count_n_states( A, nA, 0, &minstateA, NULL);
+  d.distA = Build_Velocity_Distributions( A, nA, COMPARE_IDENTITIES_DISTS_NBINS );
+  Distributions_Normalize( d.distA );
+  Distributions_Apply_Log2( d.distA );
+  d.nAst = _count_n_states( A, nA, 0, &d.minstateA, NULL);
   
   Sort_Measurements_Table_State_Time(B, nB);
   Measurements_Table_Compute_Velocities(B, nB);
-  distB = Build_Velocity_Distributions( B, nB, COMPARE_IDENTITIES_DISTS_NBINS );
-  Distributions_Normalize( distB );
-  Distributions_Apply_Log2( distB );
-  nBst = _count_n_states( B, nB, 0, &minstateB, NULL);
+  d.distB = Build_Velocity_Distributions( B, nB, COMPARE_IDENTITIES_DISTS_NBINS );
+  Distributions_Normalize( d.distB );
+  Distributions_Apply_Log2( d.distB );
+  d.nBst = _count_n_states( B, nB, 0, &d.minstateB, NULL);
 
 #ifdef  DEBUG_MEASUREMENTS_TABLE_GET_DIFF_FRAMES
   debug("nAst: %d\n"
-        "nBst: %d\n", nAst, nBst );
+        "nBst: %d\n", d.nAst, d.nBst );
   debug("minA: %d\n"
-        "minB: %d\n", minstateA, minstateB);
+        "minB: %d\n", d.minstateA, d.minstateB);
 #endif
   //
   // Check for differences in identification
@@ -144,57 +330,25 @@ int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements
   
   Sort_Measurements_Table_Time_State_Face( A, nA );
   Sort_Measurements_Table_Time_State_Face( B, nB );
+  d.frames  = index_frames( A, nA, B, nB, &d.nframes );
+  d.nchunks = (d.nframes + DIFF_CHUNK - 1)/DIFF_CHUNK;
+  d.chunks  = Guarded_Malloc( sizeof(diff_chunk_t)*MAX(d.nchunks,1), "alloc chunks");
+  memset( d.chunks, 0, sizeof(diff_chunk_t)*MAX(d.nchunks,1) );
+  d.lock    = mutex_create();
   
-  counts = Guarded_Malloc( nAst*nBst*sizeof(int), "alloc counts");
-  memset( counts, 0, nAst*nBst*sizeof(int) );
-  map = Guarded_Malloc( nAst*sizeof(int), "alloc counts");
+  d.counts = Guarded_Malloc( d.nAst*d.nBst*sizeof(int), "alloc counts");
+  memset( d.counts, 0, d.nAst*d.nBst*sizeof(int) );
+  d.map = Guarded_Malloc( d.nAst*sizeof(int), "alloc counts");
 
-  //
-  // First pass
-  // solve correspondence between trajectories
-  //
-  rowA = A;
-  rowB = B;
-  while( rowA < A + nA )
-  { 
-    int cur = rowA->fid;
-    int nframeB;
-    
-    mismatch = 0;
-  
-    markA = rowA;
-    markB = rowB;
-  
-    // count number in current frame in B
-    while( (rowB < B+nB) && (rowB->fid == cur ) )
-      rowB++;
-    nframeB = rowB - markB;
-  
-    // iterate over current frame in A
-    // Compute # of mismatches
-    for(;  ( rowA < A + nA ) && (rowA->fid == cur); rowA++ )
-    { Measurements *match;
-  
-      if( rowA->state == -1 ) // skip these
-        continue;
-  
-      match = find_match( distA, rowA, minstateA, distB, markB, nframeB, minstateB, -5000.0 );
-      if(match)                                    
-      { counts[ nAst*(match->state-minstateB) + (rowA->state-minstateA) ]++;
-      } else {
-        counts[ (rowA->state-minstateA) ]++;
-      }
-    }
-  
-  }
+  parallel_for( d.nchunks, 0, count_chunk, &d );
 
 #ifdef  DEBUG_MEASUREMENTS_TABLE_GET_DIFF_FRAMES
   { //print the counts matrix
     int i,j;
-    int *c = counts;
+    int *c = d.counts;
     debug("Identity correspondance matrix:\n");
-    for(j=0; j<nBst; j++)
-    { for(i=0; i<nAst; i++)
+    for(j=0; j<d.nBst; j++)
+    { for(i=0; i<d.nAst; i++)
         debug("%5d ",*c++);
       debug("\n");
     }
@@ -206,13 +360,13 @@ int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements
   // Greedily
   //
   { int i,j,max;
-    for(i=0;i<nAst;i++)
+    for(i=0;i<d.nAst;i++)
     { max = -1;
-      for(j=0;j<nBst;j++)
-      { int v = counts[nAst*j + i];
+      for(j=0;j<d.nBst;j++)
+      { int v = d.counts[d.nAst*j + i];
         if( v > max )
         { max = v;
-          map[i] = j;
+          d.map[i] = j;
         }
       }
     }
@@ -225,70 +379,46 @@ int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements
           "Identity correspondance\n"
           "  A      B\n"
           " ---    ---\n");
-    for( i=0; i<nAst; i++ )
-      debug("%3d  ->%3d\n", i+minstateA, map[i]+minstateB);
+    for( i=0; i<d.nAst; i++ )
+      debug("%3d  ->%3d\n", i+d.minstateA, d.map[i]+d.minstateB);
   }
 #endif
 
-  //
-  // Second pass
-  // Collect frames where there is a mismatch
-  //
-  rowA = A;
-  rowB = B;
-  mismatch = 0;
-  while( rowA < A + nA )
-  { 
-    int cur = rowA->fid,
-        nframeB,
-        last = -1;
-  
-    markA = rowA;
-    markB = rowB;
-  
-    // count number in current frame in B
-    while( (rowB < B+nB) && (rowB->fid == cur ) )
-      rowB++;
-    nframeB = rowB - markB;
-  
-    // iterate over current frame in A
-    // Compute # of mismatches
-    for(;  ( rowA < A + nA ) && (rowA->fid == cur); rowA++ )
-    { Measurements *match;
-    
-      if( rowA->state == minstateA ) // skip these
-        continue;
+  parallel_for( d.nchunks, 0, diff_chunk, &d );
 
-      if( cur == last )       // skip ahead if a mistake has been found on
-        continue;             //      this frame
-    
-      match = find_match( distA, rowA, minstateA, distB, markB, nframeB, minstateB, -5000.0 );
-      if( match && ( map[ rowA->state-minstateA ] != match->state-minstateB ) ) 
-      { frames = request_storage( frames,
-                                 &frames_size,
-                                  sizeof(int),
-                                  mismatch+1,
-                                  "measurements diff" );
-        frames[ mismatch++ ] = cur;
-        last = cur;
-                                  
-#ifdef DEBUG_MEASUREMENTS_TABLE_GET_DIFF_FRAMES
-          debug("Frame %5d. Mismatch\tident:(%3d, %-3d) wid:(%3d, %-3d)\n", cur, 
-              map[rowA->state-minstateA]+minstateB, 
-              match->state,
-              rowA->wid,
-              match->wid);
-#endif
-      } //end aggregate difference
-    } //end iterate over rows with const frame
-  } // end iterate over rows
-  free(counts);
-  free(map);
-  Free_Distributions( distA );
-  Free_Distributions( distB );
+  mutex_destroy( &d.lock );
+  free(d.chunks);
+  free(d.frames);
+  free(d.counts);
+  free(d.map);
+  Free_Distributions( d.distA );
+  Free_Distributions( d.distB );
+  return d.mismatch;
+}
 
-  *nframes = mismatch;
-  return frames;
+typedef struct _diff_frames_t
+{ int    *frames;
+  size_t  size;
+  int     n;
+} diff_frames_t;
+
+static void append_frame( void *ctx, int fid )
+{ diff_frames_t *out = (diff_frames_t*) ctx;
+  out->frames = request_storage( out->frames, &out->size, sizeof(int), out->n+1, "measurements diff" );
+  out->frames[ out->n++ ] = fid;
+}
+
+SHARED_EXPORT
+int *Measurements_Tables_Get_Diff_Frames( Measurements *A, int nA, Measurements *B, int nB, int *nframes )
+{ diff_frames_t out = {NULL,0,0};
+  Measurements_Tables_Stream_Diff_Frames( A, nA, B, nB, append_frame, &out );
+  *nframes = out.n;
+  return out.frames;
+}
+
+SHARED_EXPORT
+void Measurements_Tables_Free_Diff_Frames( int *frames )
+{ free(frames);
 }
 
 #ifdef TEST_REPORT_1
@@ -492,23 +622,24 @@ int report_histogram_mismatched_frames(void)
   return 0;
 }
 
+static void print_frame( void *ctx, int fid )
+{ printf("%5d\n",fid);
+  fflush(stdout);
+}
+
 //produces a list of mismatched frames
+//frames are printed in ascending order as soon as they are known
 int report_mismatched_frames(void)
 { Measurements *A, *B;
-  int nA, nB, nframes, *frames;
+  int nA, nB, nframes;
 
   A = Measurements_Table_From_Filename( Get_String_Arg("measurements1"), NULL, &nA );
   if(!A) error("Couldn't read %s\n",Get_String_Arg("measurements1"));
   B = Measurements_Table_From_Filename( Get_String_Arg("measurements2"), NULL, &nB );
   if(!B) error("Couldn't read %s\n",Get_String_Arg("measurements2"));
   
-  frames = Measurements_Tables_Get_Diff_Frames( A, nA, B, nB, &nframes );
-
-  { debug("frames vec at   0x%p\n"
-          "           size %d\n",frames, nframes);
-    while(nframes--)
-      debug("%5d\n",frames[nframes]);
-  }
+  nframes = Measurements_Tables_Stream_Diff_Frames( A, nA, B, nB, print_frame, NULL );
+  debug("Mismatched frames: %d\n", nframes);
 
   Free_Measurements_Table(A);
   Free_Measurements_Table(B);
@@ -540,3 +671,185 @@ int main(int argc, char* argv[])
 }
 
 #endif
+
+#ifdef TEST_REPORT_DIFF
+/*
+ * Diffs small measurements files with the frames split across threads and
+ * checks the mismatched frames against a single-threaded run.
+ *
+ * One pair is a file and itself.  The other swaps the labels of two
+ * whiskers in a few frames.  There are enough frames for several chunks.
+ */
+#include <math.h>
+#define TEST_NFRAMES   1000
+#define TEST_NWHISKERS 3
+#define TEST_NCLUTTER  1
+#define TEST_SWAPPED(fid) ((fid)%97==13)
+
+static unsigned int test_seed = 1;
+static double test_rand(void) // uniform on [0,1)
+{ test_seed = test_seed*1664525u + 1013904223u;
+  return (test_seed>>8) / 16777216.0;
+}
+
+// `swap` exchanges the labels of whiskers 0 and 1 in TEST_SWAPPED frames.
+static Measurements *_test_make_table( int swap, int *n )
+{ int nper = TEST_NWHISKERS + TEST_NCLUTTER,
+      fid, k;
+  Measurements *table = Alloc_Measurements_Table( TEST_NFRAMES*nper, 8 );
+  test_seed = 1;
+  for( fid=0; fid<TEST_NFRAMES; fid++ )
+    for( k=0; k<nper; k++ )
+    { Measurements *row = table + fid*nper + k;
+      double *d = row->data;
+      row->fid = fid;
+      row->wid = k;
+      if( k < TEST_NWHISKERS )
+      { double th = 2.0*M_PI*fid/50.0 + k;
+        row->state = k;
+        if( swap && TEST_SWAPPED(fid) && k<2 )
+          row->state = 1-k;
+        d[0] = 150.0 + 40.0*k + 2.0*test_rand();                       // length
+        d[1] = 500.0 + 50.0*test_rand();                               // score
+        d[2] = -60.0 + 30.0*k + 15.0*sin(th) + test_rand();            // angle
+        d[3] = 0.002*k + 0.001*cos(th) + 0.0002*test_rand();           // curvature
+        d[4] = 100.0 + 25.0*k + 2.0*test_rand();                       // follicle x
+        d[5] =  50.0 + 2.0*test_rand();                                // follicle y
+        d[6] = d[4] + d[0]*cos(d[2]*M_PI/180.0);                       // tip x
+        d[7] = d[5] + d[0]*sin(d[2]*M_PI/180.0);                       // tip y
+      } else
+      { int j;
+        row->state = -1;
+        for( j=0; j<8; j++ )
+          d[j] = 100.0*test_rand();
+      }
+    }
+  *n = TEST_NFRAMES*nper;
+  return table;
+}
+
+static void _test_set_threads( int n )
+{ char buf[32];
+  sprintf( buf, "%d", n );
+#ifdef _WIN32
+  _putenv_s( "WHISK_THREADS", buf );
+#else
+  setenv( "WHISK_THREADS", buf, 1 );
+#endif
+}
+
+// Diffing sorts the tables, so each run reads the files again.
+static int *_test_diff( const char *a, const char *b, int nthreads, int *nframes )
+{ Measurements *A, *B;
+  int nA, nB, *frames;
+  *nframes = -1;
+  if( !(A = Measurements_Table_From_Filename( a, NULL, &nA )) )
+    return NULL;
+  if( !(B = Measurements_Table_From_Filename( b, NULL, &nB )) )
+  { Free_Measurements_Table( A );
+    return NULL;
+  }
+  _test_set_threads( nthreads );
+  frames = Measurements_Tables_Get_Diff_Frames( A, nA, B, nB, nframes );
+  Free_Measurements_Table( A );
+  Free_Measurements_Table( B );
+  return frames;
+}
+
+// The threaded and serial runs report the same frames in the same order.
+// Returns the number of frames, or -1 on failure.
+static int _check_diff( const char *a, const char *b, int **frames )
+{ int *serial, nserial, nparallel, i;
+  serial  = _test_diff( a, b, 1, &nserial );
+  *frames = _test_diff( a, b, 4, &nparallel );
+  if( nserial<0 || nparallel<0 )
+  { printf("\t*** Could not read %s or %s.\n",a,b);
+    nparallel = -1;
+  } else if( nserial!=nparallel )
+  { printf("\t*** Serial diff found %d frames.  Threaded diff found %d.\n",nserial,nparallel);
+    nparallel = -1;
+  }
+  for( i=0; nparallel>0 && i<nparallel; i++ )
+    if( serial[i]!=(*frames)[i] )
+    { printf("\t*** Mismatch %d: serial frame %d.  Threaded frame %d.\n",i,serial[i],(*frames)[i]);
+      nparallel = -1;
+    }
+  Measurements_Tables_Free_Diff_Frames( serial );
+  return nparallel;
+}
+
+static int test_identical( void )
+{ int *frames, n;
+  n = _check_diff( "test_diff_a.measurements", "test_diff_a.measurements", &frames );
+  Measurements_Tables_Free_Diff_Frames( frames );
+  if( n>0 )
+    printf("\t*** Found %d mismatched frames in identical files.\n",n);
+  return n==0;
+}
+
+static int test_swapped( void )
+{ int *frames, n, fid, i = 0, ok;
+  n  = _check_diff( "test_diff_a.measurements", "test_diff_b.measurements", &frames );
+  ok = n>0;
+  for( fid=0; ok && fid<TEST_NFRAMES; fid++ )
+  { int found = (i<n && frames[i]==fid);
+    if( found!=TEST_SWAPPED(fid) )
+    { printf("\t*** Frame %d: %s.\n",fid,found?"reported but labels agree":"labels swapped but not reported");
+      ok = 0;
+    }
+    i += found;
+  }
+  Measurements_Tables_Free_Diff_Frames( frames );
+  return ok;
+}
+
+static int (*tests[])( void ) = { test_identical,
+                                  test_swapped,
+                                  NULL };
+
+char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Measurements *table;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Measurements diff test                                       \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Diffs a measurements file against itself and against a copy  \n"
+      "| with whisker labels swapped in a few frames.  The threaded   \n"
+      "| diff must report the same frames as a single-threaded one.   \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+  { char* paramfile = "default.parameters";
+    if(Load_Params_File(paramfile))
+    { warning(
+              "Could not load parameters from file: %s\n"
+              "Writing %s\n"
+              "\tTrying again\n",paramfile,paramfile);
+      Print_Params_File(paramfile);
+      if(Load_Params_File(paramfile))
+        error("\tStill could not load parameters.\n");
+    }
+  }
+
+  table = _test_make_table( 0, &n );
+  Measurements_Table_To_Filename( "test_diff_a.measurements", "v3", table, n );
+  Free_Measurements_Table( table );
+  table = _test_make_table( 1, &n );
+  Measurements_Table_To_Filename( "test_diff_b.measurements", "v3", table, n );
+  Free_Measurements_Table( table );
+
+  for( i=0; tests[i]; i++ )
+  { int ok = tests[i]();
+    printf("--- TEST %d --- %s\n", i+1, ok?"PASSED":"FAILED");
+    nfailed += !ok;
+  }
+  remove( "test_diff_a.measurements" );
+  remove( "test_diff_b.measurements" );
+  return nfailed;
+}
+#endif // TEST_REPORT_DIFF
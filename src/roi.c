@@ -0,0 +1,276 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#include "roi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "error.h"
+#include "utilities.h"
+
+#define ENDL "\n"
+#if 1
+#define REPORT(expr) debug("%s(%d):"ENDL "\t%s"ENDL "\tExpression evaluated as false."ENDL,__FILE__,__LINE__,#expr)
+#else
+#define REPORT(expr)
+#endif
+#define TRY(expr) if(!(expr)) {REPORT(expr); goto Error;}
+
+static Roi *make_roi( int x, int y, int width, int height )
+{ Roi *self = (Roi*) Guarded_Malloc( sizeof(Roi), "make_roi" );
+  self->x      = x;
+  self->y      = y;
+  self->width  = width;
+  self->height = height;
+  self->mask   = Make_Image( GREY8, width, height );
+  memset( self->mask->array, 0, width*height );
+  return self;
+}
+
+SHARED_EXPORT
+void Free_Roi( Roi *self )
+{ if( !self ) return;
+  if( self->mask ) Free_Image( self->mask );
+  free( self );
+}
+
+SHARED_EXPORT
+Roi *Make_Roi_Rect( int x, int y, int width, int height )
+{ Roi *self;
+  if( width<=0 || height<=0 )
+    return NULL;
+  self = make_roi( x, y, width, height );
+  memset( self->mask->array, 1, width*height );
+  return self;
+}
+
+/* Pixel (x,y) is in the polygon if the point (x,y) is inside by the even-odd
+ * rule.  Rows are filled between successive crossings of the scan line with
+ * the polygon's edges.
+ */
+SHARED_EXPORT
+Roi *Make_Roi_Polygon( float *xy, int npoints )
+{ Roi   *self;
+  float  xmin, xmax, ymin, ymax;
+  float *crossings;
+  int    i,x,y;
+
+  if( npoints < 3 )
+    return NULL;
+  xmin = xmax = xy[0];
+  ymin = ymax = xy[1];
+  for( i=1; i<npoints; i++ )
+  { xmin = MIN( xmin, xy[2*i] );   xmax = MAX( xmax, xy[2*i] );
+    ymin = MIN( ymin, xy[2*i+1] ); ymax = MAX( ymax, xy[2*i+1] );
+  }
+  { int x0 = (int) ceilf(xmin),
+        y0 = (int) ceilf(ymin),
+        x1 = (int) floorf(xmax),
+        y1 = (int) floorf(ymax);
+    if( x1<x0 || y1<y0 )
+      return NULL;
+    self = make_roi( x0, y0, x1-x0+1, y1-y0+1 );
+  }
+
+  crossings = (float*) Guarded_Malloc( sizeof(float)*npoints, "Make_Roi_Polygon" );
+  for( y=0; y<self->height; y++ )
+  { float fy = (float)( y + self->y );
+    int    n = 0;
+    uint8 *row = self->mask->array + y*self->width;
+    for( i=0; i<npoints; i++ )
+    { float *a = xy + 2*i,
+            *b = xy + 2*((i+1)%npoints);
+      if( (a[1] <= fy) != (b[1] <= fy) )   // edge straddles the scan line
+      { float t = (fy - a[1])/(b[1] - a[1]);
+        float c = a[0] + t*(b[0] - a[0]);
+        int j = n++;
+        while( j>0 && crossings[j-1] > c ) // insertion sort
+        { crossings[j] = crossings[j-1];
+          j--;
+        }
+        crossings[j] = c;
+      }
+    }
+    for( i=0; i+1<n; i+=2 )
+    { int x0 = MAX( 0,             (int) ceilf (crossings[i]  ) - self->x ),
+          x1 = MIN( self->width-1, (int) floorf(crossings[i+1]) - self->x );
+      for( x=x0; x<=x1; x++ )
+        row[x] = 1;
+    }
+  }
+  free( crossings );
+  if( !Roi_Area(self) )
+  { Free_Roi(self);
+    return NULL;
+  }
+  return self;
+}
+
+SHARED_EXPORT
+Roi *Make_Roi_From_Mask( Image *mask )
+{ Roi *self;
+  int x,y,
+      x0 = mask->width, x1 = -1,
+      y0 = mask->height,y1 = -1;
+  if( mask->kind != GREY8 )
+  { warning("Region of interest mask must be an 8-bit image.\n");
+    return NULL;
+  }
+  for( y=0; y<mask->height; y++ )
+  { uint8 *row = mask->array + y*mask->width;
+    for( x=0; x<mask->width; x++ )
+      if( row[x] )
+      { x0 = MIN(x0,x); x1 = MAX(x1,x);
+        y0 = MIN(y0,y); y1 = MAX(y1,y);
+      }
+  }
+  if( x1<0 )
+    return NULL;
+  self = make_roi( x0, y0, x1-x0+1, y1-y0+1 );
+  for( y=0; y<self->height; y++ )
+  { uint8 *src = mask->array + (y+y0)*mask->width + x0,
+          *dst = self->mask->array + y*self->width;
+    for( x=0; x<self->width; x++ )
+      dst[x] = src[x]!=0;
+  }
+  return self;
+}
+
+SHARED_EXPORT
+Roi *Read_Roi_Mask( char *filename )
+{ TIFF  *tif;
+  Stack *stack;
+  Roi   *self;
+  TRY( tif = Open_Tiff(filename,"r") );   // Read_Stack doesn't fail gracefully
+  Close_Tiff(tif);
+  TRY( stack = Read_Stack(filename) );
+  self = Make_Roi_From_Mask( Select_Plane(stack,0) );
+  Free_Stack(stack);
+  return self;
+Error:
+  warning("Could not read the region of interest mask from %s\n",filename);
+  return NULL;
+}
+
+SHARED_EXPORT
+Roi *Roi_Parse( char *spec )
+{ float *v = NULL;
+  size_t maxv = 0;
+  int    n = 0;
+  char  *c = spec, *e;
+  Roi   *self = NULL;
+
+  while( *c )
+  { double d = strtod( c, &e );
+    if( e==c )
+    { if( *c==',' || *c==';' || *c==' ' || *c=='\t' ) { c++; continue; }
+      goto Error;
+    }
+    v = (float*) request_storage( v, &maxv, sizeof(float), n+1, "Roi_Parse" );
+    v[n++] = (float) d;
+    c = e;
+  }
+  if( n==4 )
+    self = Make_Roi_Rect( (int) v[0], (int) v[1], (int) v[2], (int) v[3] );
+  else if( n>=6 && !(n&1) )
+    self = Make_Roi_Polygon( v, n/2 );
+  else
+    goto Error;
+  if(v) free(v);
+  if( !self )
+    warning("Region of interest \"%s\" is empty.\n",spec);
+  return self;
+Error:
+  if(v) free(v);
+  warning("Could not parse region of interest \"%s\".\n"
+          "\tExpected x,y,width,height for a rectangle or x0,y0,x1,y1,x2,y2,... for a polygon.\n",spec);
+  return NULL;
+}
+
+SHARED_EXPORT
+int Roi_Area( Roi *self )
+{ int n = 0, i = self->width*self->height;
+  uint8 *m = self->mask->array;
+  while( i-- )
+    n += m[i]!=0;
+  return n;
+}
+
+SHARED_EXPORT
+Roi *Roi_Intersect( Roi *a, Roi *b )
+{ int x0 = MAX( a->x, b->x ),
+      y0 = MAX( a->y, b->y ),
+      x1 = MIN( a->x + a->width,  b->x + b->width  ),
+      y1 = MIN( a->y + a->height, b->y + b->height );
+  int x,y;
+  Roi *self;
+  if( x1<=x0 || y1<=y0 )
+    return NULL;
+  self = make_roi( x0, y0, x1-x0, y1-y0 );
+  for( y=y0; y<y1; y++ )
+  { uint8 *ma  = a->mask->array + (y - a->y)*a->width + (x0 - a->x),
+          *mb  = b->mask->array + (y - b->y)*b->width + (x0 - b->x),
+          *dst = self->mask->array + (y - y0)*self->width;
+    for( x=0; x<self->width; x++ )
+      dst[x] = ma[x] && mb[x];
+  }
+  if( !Roi_Area(self) )
+  { Free_Roi(self);
+    return NULL;
+  }
+  return self;
+}
+
+SHARED_EXPORT
+Roi *Roi_Clip( Roi *self, int width, int height )
+{ Roi *frame = Make_Roi_Rect( 0, 0, width, height ),
+      *out   = Roi_Intersect( self, frame );
+  Free_Roi( frame );
+  Free_Roi( self );
+  return out;
+}
+
+SHARED_EXPORT
+void Roi_Get_Window( Roi *self, int margin, int frame_width, int frame_height, Roi_Window *window )
+{ int x0 = MAX( 0, self->x - margin ) & ~1,   // even origin
+      y0 = MAX( 0, self->y - margin ) & ~1,
+      x1 = MIN( frame_width,  self->x + self->width  + margin ),
+      y1 = MIN( frame_height, self->y + self->height + margin );
+  window->x      = x0;
+  window->y      = y0;
+  window->width  = x1 - x0;
+  window->height = y1 - y0;
+}
+
+SHARED_EXPORT
+Image *Roi_Window_Mask( Roi *self, Roi_Window *window )
+{ Image *mask = Make_Image( GREY8, window->width, window->height );
+  int x0 = MAX( self->x, window->x ),
+      y0 = MAX( self->y, window->y ),
+      x1 = MIN( self->x + self->width,  window->x + window->width  ),
+      y1 = MIN( self->y + self->height, window->y + window->height ),
+      y;
+  memset( mask->array, 0, window->width*window->height );
+  for( y=y0; y<y1; y++ )
+    memcpy( mask->array + (y - window->y)*window->width + (x0 - window->x),
+            self->mask->array + (y - self->y)*self->width + (x0 - self->x),
+            MAX(0,x1-x0) );
+  return mask;
+}
+
+SHARED_EXPORT
+void Roi_Translate_Segments( Whisker_Seg *wv, int n, Roi_Window *window )
+{ float dx = (float) window->x,
+        dy = (float) window->y;
+  int i,j;
+  for( i=0; i<n; i++ )
+    for( j=0; j<wv[i].len; j++ )
+    { wv[i].x[j] += dx;
+      wv[i].y[j] += dy;
+    }
+}
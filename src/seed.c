@@ -31,12 +31,15 @@
 /*
 **  Uses a levelset and size threshold to segment an image constrained by the
 **  zone mask.
+**
+**  The returned map is reused by the next call on the same thread.  Each
+**  thread has its own.
 */
 SHARED_EXPORT
 Object_Map *find_objects(Image *image, int vthresh, int sthresh)
-{ static Object_Map mymap;
-  static int        obj_max = 0;
-  static Contour  **objects = NULL;
+{ static THREAD_LOCAL Object_Map mymap;
+  static THREAD_LOCAL int        obj_max = 0;
+  static THREAD_LOCAL Contour  **objects = NULL;
 
   static Paint_Brush zero = { 0., 0., 0. };
 
@@ -390,7 +393,7 @@ Seed *compute_seed_from_point( Image *image, int p, int maxr )
 SHARED_EXPORT
 Seed *compute_seed_from_point_ex( Image *image, int p, int maxr, float *out_m, float *out_stat)
   /* Specific for uint8 */
-{ static Seed myseed;
+{ static THREAD_LOCAL Seed myseed;
   static const float eps = 1e-3;
   int i = -1, rnpoints = 0, lnpoints = 0;
   int stride = image->width;
@@ -19,8 +19,10 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "error.h"
 #include "utilities.h"
+#include "common.h"
 #include "image_lib.h"
 #include "seq.h"
 
@@ -157,6 +159,43 @@ error:
   return NULL;
 }
 
+/* Reads the rows covering the rectangle in one contiguous read, starting at
+ * the first pixel of the rectangle and stopping after its last pixel, then
+ * packs the rectangle's rows together.
+ */
+SHARED_EXPORT
+Image *Seq_Read_Image_Rect_Static_Storage( SeqReader *h, int index, int x, int y, int width, int height )
+{ static Image *im = NULL;
+  static uint8 *buf = NULL;
+  static size_t maxbuf = 0;
+  int    bpp    = h->bitdepthreal/8,
+         stride = h->width*bpp,
+         row    = width*bpp,
+         j;
+  size_t offset = 1024 + index * (size_t)h->truesize + ((size_t)y*h->width + x)*bpp,
+         nbytes = (size_t)(height-1)*stride + row;
+
+  if( x<0 || y<0 || width<=0 || height<=0 || x+width>h->width || y+height>h->height )
+    goto error;
+  if( !im || width!=im->width || height!=im->height || bpp!=im->kind )
+  { if(im) Free_Image(im);
+    im = Make_Image( bpp, width, height );
+    if(!im) goto error;
+  }
+  buf = (uint8*) request_storage( buf, &maxbuf, 1, nbytes, "Seq_Read_Image_Rect_Static_Storage" );
+
+  SEQ_ASSERT( fseek( h->fp, offset, SEEK_SET)                );
+  SEQ_ASSERT( fread( buf, 1, nbytes, h->fp ) != nbytes       );
+  for( j=0; j<height; j++ )
+    memcpy( im->array + j*row, buf + j*stride, row );
+  return im;
+error:
+  warning("Seq reader: Couldn't read image at index %d\n",index);
+  if(im) Free_Image( im );
+  im = NULL;
+  return NULL;
+}
+
 SHARED_EXPORT
 Stack *Seq_Read_Stack ( SeqReader *r )
 { size_t offset = 1024;
@@ -0,0 +1,350 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include "utilities.h"
+#include "error.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+#define ENDL "\n"
+#define REPORT(expr) debug("%s(%d):"ENDL "\t%s"ENDL "\tExpression evaluated as false."ENDL,__FILE__,__LINE__,#expr)
+#define TRY(expr)    if(!(expr)) {REPORT(expr); goto Error;}
+
+//
+// THREADS
+//
+
+#ifdef _WIN32
+struct _thread_t    { HANDLE h; pf_thread_main fn; void *arg; void *ret; };
+struct _mutex_t     { CRITICAL_SECTION cs; };
+struct _condition_t { CONDITION_VARIABLE cv; };
+
+static DWORD WINAPI thread_trampoline(LPVOID p)
+{ thread_t *self = (thread_t*)p;
+  self->ret = self->fn(self->arg);
+  return 0;
+}
+#else
+struct _thread_t    { pthread_t h; };
+struct _mutex_t     { pthread_mutex_t m; };
+struct _condition_t { pthread_cond_t c; };
+#endif
+
+SHARED_EXPORT
+thread_t *thread_create(pf_thread_main fn, void *arg)
+{ thread_t *self = (thread_t*) Guarded_Malloc(sizeof(thread_t),"thread_create");
+  memset(self,0,sizeof(*self));
+#ifdef _WIN32
+  self->fn  = fn;
+  self->arg = arg;
+  TRY(self->h = CreateThread(NULL,0,thread_trampoline,self,0,NULL));
+#else
+  TRY(0==pthread_create(&self->h,NULL,fn,arg));
+#endif
+  return self;
+Error:
+  free(self);
+  return NULL;
+}
+
+/// Blocks till the thread exits.  Returns the value returned by the thread
+/// function and releases the thread object.
+SHARED_EXPORT
+void *thread_join(thread_t **self_)
+{ void *ret = NULL;
+  thread_t *self = *self_;
+  if(!self) return NULL;
+#ifdef _WIN32
+  WaitForSingleObject(self->h,INFINITE);
+  CloseHandle(self->h);
+  ret = self->ret;
+#else
+  pthread_join(self->h,&ret);
+#endif
+  free(self);
+  *self_ = NULL;
+  return ret;
+}
+
+//
+// MUTEX
+//
+
+SHARED_EXPORT
+mutex_t *mutex_create(void)
+{ mutex_t *self = (mutex_t*) Guarded_Malloc(sizeof(mutex_t),"mutex_create");
+#ifdef _WIN32
+  InitializeCriticalSection(&self->cs);
+#else
+  pthread_mutex_init(&self->m,NULL);
+#endif
+  return self;
+}
+
+SHARED_EXPORT
+void mutex_destroy(mutex_t **self_)
+{ mutex_t *self = *self_;
+  if(!self) return;
+#ifdef _WIN32
+  DeleteCriticalSection(&self->cs);
+#else
+  pthread_mutex_destroy(&self->m);
+#endif
+  free(self);
+  *self_ = NULL;
+}
+
+#ifdef _WIN32
+SHARED_EXPORT void mutex_lock  (mutex_t *self) {EnterCriticalSection(&self->cs);}
+SHARED_EXPORT void mutex_unlock(mutex_t *self) {LeaveCriticalSection(&self->cs);}
+#else
+SHARED_EXPORT void mutex_lock  (mutex_t *self) {pthread_mutex_lock(&self->m);}
+SHARED_EXPORT void mutex_unlock(mutex_t *self) {pthread_mutex_unlock(&self->m);}
+#endif
+
+#ifdef _WIN32
+static SRWLOCK         g_lazy_lock = SRWLOCK_INIT;
+#define LAZY_LOCK      AcquireSRWLockExclusive(&g_lazy_lock)
+#define LAZY_UNLOCK    ReleaseSRWLockExclusive(&g_lazy_lock)
+#else
+static pthread_mutex_t g_lazy_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LAZY_LOCK      pthread_mutex_lock(&g_lazy_lock)
+#define LAZY_UNLOCK    pthread_mutex_unlock(&g_lazy_lock)
+#endif
+
+/// For function-scope or file-scope locks:
+///
+///   static mutex_t *lock = NULL;
+///   mutex_lock(mutex_lazy_create(&lock));
+SHARED_EXPORT
+mutex_t *mutex_lazy_create(mutex_t **self)
+{ mutex_t *m;
+  LAZY_LOCK;
+  if(!*self)
+    *self = mutex_create();
+  m = *self;
+  LAZY_UNLOCK;
+  return m;
+}
+
+//
+// CONDITION VARIABLES
+//
+
+SHARED_EXPORT
+condition_t *condition_create(void)
+{ condition_t *self = (condition_t*) Guarded_Malloc(sizeof(condition_t),"condition_create");
+#ifdef _WIN32
+  InitializeConditionVariable(&self->cv);
+#else
+  pthread_cond_init(&self->c,NULL);
+#endif
+  return self;
+}
+
+SHARED_EXPORT
+void condition_destroy(condition_t **self_)
+{ condition_t *self = *self_;
+  if(!self) return;
+#ifndef _WIN32
+  pthread_cond_destroy(&self->c);
+#endif
+  free(self);
+  *self_ = NULL;
+}
+
+#ifdef _WIN32
+SHARED_EXPORT void condition_wait     (condition_t *self, mutex_t *lock) {SleepConditionVariableCS(&self->cv,&lock->cs,INFINITE);}
+SHARED_EXPORT void condition_signal   (condition_t *self)                {WakeConditionVariable(&self->cv);}
+SHARED_EXPORT void condition_broadcast(condition_t *self)                {WakeAllConditionVariable(&self->cv);}
+#else
+SHARED_EXPORT void condition_wait     (condition_t *self, mutex_t *lock) {pthread_cond_wait(&self->c,&lock->m);}
+SHARED_EXPORT void condition_signal   (condition_t *self)                {pthread_cond_signal(&self->c);}
+SHARED_EXPORT void condition_broadcast(condition_t *self)                {pthread_cond_broadcast(&self->c);}
+#endif
+
+//
+// UTILITIES
+//
+
+SHARED_EXPORT
+int thread_count(void)
+{ int n = 0;
+  const char *s = getenv("WHISK_THREADS");
+  if(s)
+    n = atoi(s);
+  if(n>0)
+    return n;
+#ifdef _WIN32
+  { SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = (int)info.dwNumberOfProcessors;
+  }
+#else
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return (n>0)?n:1;
+}
+
+SHARED_EXPORT
+double wall_clock(void)
+{
+#ifdef _WIN32
+  static double period = 0.0;
+  LARGE_INTEGER t;
+  if(period==0.0)
+  { LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    period = 1.0/(double)f.QuadPart;
+  }
+  QueryPerformanceCounter(&t);
+  return period*(double)t.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+#endif
+}
+
+typedef struct _parallel_for_t
+{ mutex_t          *lock;
+  int               next,
+                    n;
+  pf_parallel_body  body;
+  void             *ctx;
+} parallel_for_t;
+
+// Nonzero on threads that are running a parallel_for body.  Nested calls run
+// serially on the calling worker rather than spawning more threads.
+static THREAD_LOCAL int g_in_parallel = 0;
+
+static void run_parallel_for(parallel_for_t *job)
+{ for(;;)
+  { int i;
+    mutex_lock(job->lock);
+    i = job->next++;
+    mutex_unlock(job->lock);
+    if(i>=job->n)
+      break;
+    job->body(job->ctx,i);
+  }
+}
+
+// The workers are started the first time they're needed and are kept for
+// the life of the process.  The scratch that tracing code keeps in
+// THREAD_LOCAL statics (and the per-thread mylib free lists) is then reused
+// by every later call instead of being dropped with a short-lived thread.
+//
+// One parallel_for at a time uses the pool.  A call made while the pool is
+// busy with another thread's call runs serially.
+static struct
+{ mutex_t        *lock;
+  condition_t    *wake,     // a job was posted
+                 *done;     // a worker left a job
+  thread_t      **workers;
+  int             nworkers;
+  parallel_for_t *job;
+  int             seats,    // workers still wanted by job
+                  running,  // workers inside job
+                  busy;
+} g_pool = {0};
+
+static void *pool_worker(void *arg)
+{ g_in_parallel = 1;
+  mutex_lock(g_pool.lock);
+  for(;;)
+  { parallel_for_t *job;
+    while(!g_pool.seats)
+      condition_wait(g_pool.wake,g_pool.lock);
+    g_pool.seats--;
+    g_pool.running++;
+    job = g_pool.job;
+    mutex_unlock(g_pool.lock);
+    run_parallel_for(job);
+    mutex_lock(g_pool.lock);
+    if(--g_pool.running==0)
+      condition_signal(g_pool.done);
+  }
+  return NULL;
+}
+
+// Claims the pool and makes sure it has at least n workers.  Returns the
+// number of workers available, or 0 if the pool is busy.
+static int pool_acquire(int n)
+{ int got;
+  mutex_lock(mutex_lazy_create(&g_pool.lock));
+  if(g_pool.busy)
+  { mutex_unlock(g_pool.lock);
+    return 0;
+  }
+  g_pool.busy = 1;
+  if(!g_pool.wake)
+  { g_pool.wake = condition_create();
+    g_pool.done = condition_create();
+  }
+  if(g_pool.nworkers<n)
+  { g_pool.workers = (thread_t**) Guarded_Realloc(g_pool.workers,sizeof(thread_t*)*n,"parallel_for");
+    while(g_pool.nworkers<n && (g_pool.workers[g_pool.nworkers]=thread_create(pool_worker,NULL)))
+      g_pool.nworkers++;
+  }
+  got = (n<g_pool.nworkers)?n:g_pool.nworkers;
+  mutex_unlock(g_pool.lock);
+  return got;
+}
+
+SHARED_EXPORT
+void parallel_for(int n, int nthreads, pf_parallel_body body, void *ctx)
+{ parallel_for_t job;
+  int i,nworkers;
+
+  if(nthreads<=0)
+    nthreads = thread_count();
+  nthreads = (nthreads<n)?nthreads:n;
+  if(g_in_parallel)
+    nthreads = 1;
+  // The calling thread does work too, so only nthreads-1 workers are used.
+  if(nthreads<2 || !(nworkers=pool_acquire(nthreads-1)))
+  { for(i=0;i<n;++i)
+      body(ctx,i);
+    return;
+  }
+
+  job.lock = mutex_create();
+  job.next = 0;
+  job.n    = n;
+  job.body = body;
+  job.ctx  = ctx;
+
+  mutex_lock(g_pool.lock);
+  g_pool.job   = &job;
+  g_pool.seats = nworkers;
+  condition_broadcast(g_pool.wake);
+  mutex_unlock(g_pool.lock);
+
+  g_in_parallel = 1;
+  run_parallel_for(&job);
+  g_in_parallel = 0;
+
+  // Every index has been handed out.  Workers that haven't joined yet aren't
+  // needed.  Wait for the ones that did.
+  mutex_lock(g_pool.lock);
+  g_pool.seats = 0;
+  while(g_pool.running)
+    condition_wait(g_pool.done,g_pool.lock);
+  g_pool.job  = NULL;
+  g_pool.busy = 0;
+  mutex_unlock(g_pool.lock);
+  mutex_destroy(&job.lock);
+}
@@ -28,6 +28,7 @@
 #include <math.h>
 #include <string.h>
 #include <float.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "utilities.h"
@@ -41,6 +42,8 @@
 //#include "distance.h"
 #include "eval.h"
 #include "seed.h"
+#include "thread.h"
+#include "profile.h"
    
 #include "parameters/param.h"
 #include "error.h"
@@ -96,10 +99,10 @@ void          initialize_paramater_ranges  (Line_Params *line, Interval *roff, I
 void breakme(void) {
 }
 
-static  int outofbounds(int q, int cwidth, int cheight)
+static  int outofbounds(int q, int cwidth, int cheight, const uint8 *mask)
 { int x = q%cwidth;
   int y = q/cwidth;
-  return (x < 1 || x >= cwidth-1 ||y < 1 || y >= cheight-1);
+  return (x < 1 || x >= cwidth-1 ||y < 1 || y >= cheight-1) || (mask && !mask[q]);
 }
 
  int is_small_angle( float angle )
@@ -232,9 +235,228 @@ Image *subtract_background_inplace(Image *a, Image *b)
   return a;
 }
 
+/*
+ * Mexican-hat response for contour seeding
+ * ----------------------------------------
+ * Equivalent to:
+ *
+ *    Convolve_Image( Mexican_Hat_2D_Filter(sigma), image )
+ *    negate, truncate below 0, rescale to [0,255] and convert to GREY8
+ *
+ * but done in a few fused passes over reusable buffers.
+ *
+ * The hat kernel (s - x^2 - y^2) exp(-(x^2+y^2)/s) splits into two separable
+ * terms, A(x)g(y) + g(x)A(y), with g(t) = exp(-t^2/s) and A(t) = (s/2-t^2)g(t).
+ * A horizontal pass computes the image filtered by g and by A; a vertical pass
+ * combines them.  Both passes are split into bands of rows that are run on
+ * worker threads.  As with Convolve_Image, the image is zero-padded.
+ *
+ * Results match the generic path up to floating-point rounding.
+ */
+#define HAT_BAND_ROWS 32
+
+struct _Hat_Filter
+{ double sigma;
+  int    radius;
+  float *g,         // separable factors, 2*radius+1 taps each
+        *a;
+  int    width,
+         height;
+  float *hg,        // horizontal pass: image filtered by g
+        *ha,        //                  image filtered by a
+        *response;  // negated and truncated hat response
+  float *bandmin,
+        *bandmax;
+  Image *grey;      // returned by Hat_Filter_Apply
+};
+
 SHARED_EXPORT
-Object_Map *get_objectmap( Image *image )
-{ static Image *hat = NULL;
+Hat_Filter *Make_Hat_Filter( double sigma )
+{ Hat_Filter *self = (Hat_Filter*) Guarded_Malloc( sizeof(Hat_Filter), "Make_Hat_Filter" );
+  int r = 3*sigma,
+      w = 2*r+1;
+  double s = 2.0*sigma,
+         norm = 0.0;
+  int i,x,y;
+
+  memset(self,0,sizeof(*self));
+  self->sigma  = sigma;
+  self->radius = r;
+  self->g = (float*) Guarded_Malloc( sizeof(float)*w, "Make_Hat_Filter" );
+  self->a = (float*) Guarded_Malloc( sizeof(float)*w, "Make_Hat_Filter" );
+  for( y=0; y<w; y++ )                       // same normalization as Mexican_Hat_2D_Filter
+    for( x=0; x<w; x++ )
+    { double r2 = (x-r)*(x-r) + (y-r)*(y-r);
+      norm += fabs( (s-r2) * exp(-r2/s) );
+    }
+  for( i=0; i<w; i++ )                       // fold the normalization into both terms
+  { double t2 = (i-r)*(i-r),
+           gi = exp(-t2/s);
+    self->g[i] = gi / sqrt(norm);
+    self->a[i] = (s/2.0-t2) * gi / sqrt(norm);
+  }
+  return self;
+}
+
+SHARED_EXPORT
+void Free_Hat_Filter( Hat_Filter *self )
+{ if(!self) return;
+  if(self->g)        free(self->g);
+  if(self->a)        free(self->a);
+  if(self->hg)       free(self->hg);
+  if(self->ha)       free(self->ha);
+  if(self->response) free(self->response);
+  if(self->bandmin)  free(self->bandmin);
+  if(self->bandmax)  free(self->bandmax);
+  if(self->grey)     Free_Image(self->grey);
+  free(self);
+}
+
+static void hat_filter_resize( Hat_Filter *self, int width, int height )
+{ size_t n = (size_t)width*height;
+  int nbands = (height+HAT_BAND_ROWS-1)/HAT_BAND_ROWS;
+  if( self->width==width && self->height==height )
+    return;
+  if(self->grey) Free_Image(self->grey);
+  self->hg       = (float*) Guarded_Realloc( self->hg,       sizeof(float)*n, "Hat_Filter" );
+  self->ha       = (float*) Guarded_Realloc( self->ha,       sizeof(float)*n, "Hat_Filter" );
+  self->response = (float*) Guarded_Realloc( self->response, sizeof(float)*n, "Hat_Filter" );
+  self->bandmin  = (float*) Guarded_Realloc( self->bandmin,  sizeof(float)*nbands, "Hat_Filter" );
+  self->bandmax  = (float*) Guarded_Realloc( self->bandmax,  sizeof(float)*nbands, "Hat_Filter" );
+  self->grey     = Make_Image( GREY8, width, height );
+  self->width    = width;
+  self->height   = height;
+}
+
+typedef struct _hat_job_t
+{ Hat_Filter *f;
+  uint8      *im;
+  float       scale,
+              lo;
+} hat_job_t;
+
+static void hat_horizontal_band( void *ctx, int iband )
+{ hat_job_t  *job = (hat_job_t*)ctx;
+  Hat_Filter *f   = job->f;
+  const int r = f->radius,
+            w = f->width,
+            y0 = iband*HAT_BAND_ROWS,
+            y1 = MIN( y0+HAT_BAND_ROWS, f->height );
+  const float *g = f->g + r,     // centered so g[-r..r] is valid
+              *a = f->a + r;
+  int x,y,k;
+  for( y=y0; y<y1; y++ )
+  { const uint8 *row = job->im + (size_t)y*w;
+    float *hg = f->hg + (size_t)y*w,
+          *ha = f->ha + (size_t)y*w;
+    for( x=0; x<w; x++ )
+    { const int k0 = MAX( -r, -x ),
+                k1 = MIN(  r, w-1-x );
+      float sg = 0.0f,
+            sa = 0.0f;
+      for( k=k0; k<=k1; k++ )
+      { float v = row[x+k];
+        sg += g[k]*v;
+        sa += a[k]*v;
+      }
+      hg[x] = sg;
+      ha[x] = sa;
+    }
+  }
+}
+
+static void hat_vertical_band( void *ctx, int iband )
+{ hat_job_t  *job = (hat_job_t*)ctx;
+  Hat_Filter *f   = job->f;
+  const int r = f->radius,
+            w = f->width,
+            h = f->height,
+            y0 = iband*HAT_BAND_ROWS,
+            y1 = MIN( y0+HAT_BAND_ROWS, h );
+  const float *g = f->g + r,
+              *a = f->a + r;
+  float mn = FLT_MAX,
+        mx = -FLT_MAX;
+  int x,y,k;
+  for( y=y0; y<y1; y++ )
+  { const int k0 = MAX( -r, -y ),
+              k1 = MIN(  r, h-1-y );
+    float *out = f->response + (size_t)y*w;
+    for( x=0; x<w; x++ )
+      out[x] = 0.0f;
+    for( k=k0; k<=k1; k++ )               // accumulate rows so the inner loop is contiguous
+    { const float *hg = f->hg + (size_t)(y+k)*w,
+                  *ha = f->ha + (size_t)(y+k)*w;
+      const float  gk = g[k],
+                   ak = a[k];
+      for( x=0; x<w; x++ )
+        out[x] += ak*hg[x] + gk*ha[x];
+    }
+    for( x=0; x<w; x++ )
+    { float v = -out[x];                  // negate and truncate below zero
+      v = (v<0.0f)?0.0f:v;
+      out[x] = v;
+      mn = MIN(mn,v);
+      mx = MAX(mx,v);
+    }
+  }
+  f->bandmin[iband] = mn;
+  f->bandmax[iband] = mx;
+}
+
+static void hat_quantize_band( void *ctx, int iband )
+{ hat_job_t  *job = (hat_job_t*)ctx;
+  Hat_Filter *f   = job->f;
+  const size_t i0 = (size_t)iband*HAT_BAND_ROWS*f->width,
+               i1 = MIN( (size_t)(iband+1)*HAT_BAND_ROWS, (size_t)f->height ) * f->width;
+  const float  *v = f->response;
+  uint8        *o = f->grey->array;
+  size_t i;
+  for( i=i0; i<i1; i++ )
+  { float t = job->scale * ( v[i] - job->lo );
+    o[i] = (uint8) MIN( t, 255.0f );
+  }
+}
+
+/* Returns a GREY8 image owned by the filter.  It is overwritten by the next
+ * call and freed by Free_Hat_Filter.  Different Hat_Filter objects may be
+ * used concurrently from different threads.  Only GREY8 input is supported;
+ * returns NULL for other kinds.
+ */
+SHARED_EXPORT
+Image *Hat_Filter_Apply( Hat_Filter *self, Image *image )
+{ hat_job_t job;
+  int i,nbands;
+  float mn = FLT_MAX,
+        mx = -FLT_MAX;
+  if( image->kind != GREY8 )
+  { warning("Hat_Filter_Apply: Only GREY8 images are supported.\n");
+    return NULL;
+  }
+  hat_filter_resize( self, image->width, image->height );
+  nbands = (image->height+HAT_BAND_ROWS-1)/HAT_BAND_ROWS;
+  job.f  = self;
+  job.im = image->array;
+  parallel_for( nbands, 0, hat_horizontal_band, &job );
+  parallel_for( nbands, 0, hat_vertical_band,   &job );
+  for( i=0; i<nbands; i++ )
+  { mn = MIN( mn, self->bandmin[i] );
+    mx = MAX( mx, self->bandmax[i] );
+  }
+  if( mx == mn )                          // monotone: Scale_Image_To_Range is a no-op
+  { job.lo    = 0.0f;
+    job.scale = (mx>255.0f) ? 255.0f/mx : 1.0f;
+  } else
+  { job.lo    = mn;
+    job.scale = 255.0f/(mx-mn);
+  }
+  parallel_for( nbands, 0, hat_quantize_band, &job );
+  return self->grey;
+}
+
+// The generic path.  Hat_Filter only takes GREY8 images.
+static Object_Map *get_objectmap_convolve( Image *image )
+{ static THREAD_LOCAL Image *hat = NULL;
   Image *imhat;
   Object_Map *omap;
   if( !hat )
@@ -245,7 +467,6 @@ Object_Map *get_objectmap( Image *image )
   Scale_Image(imhat,0,-1.,0.);
   Truncate_Image(imhat,0,0.);
   Scale_Image_To_Range(imhat,0,0.,255.);
-  //Scale_Image_To_Range(imhat,0,255,0);
   Translate_Image(imhat,GREY,1);
 
   omap = find_objects(imhat,MIN_LEVEL,MIN_SIZE);
@@ -253,6 +474,17 @@ Object_Map *get_objectmap( Image *image )
   return omap;
 }
 
+SHARED_EXPORT
+Object_Map *get_objectmap( Image *image )
+{ static THREAD_LOCAL Hat_Filter *hat = NULL;
+  if( image->kind != GREY8 )
+    return get_objectmap_convolve( image );
+  if( !hat || hat->sigma != HAT_RADIUS )
+  { Free_Hat_Filter(hat);
+    hat = Make_Hat_Filter(HAT_RADIUS);
+  }
+  return find_objects( Hat_Filter_Apply(hat,image), MIN_LEVEL, MIN_SIZE );
+}
 
 SHARED_EXPORT
 void draw_whisker_update_rasters( int *raster, float x0, float y0, float x1, float y1, int height )
@@ -306,8 +538,8 @@ void draw_whisker( Image *image, Whisker_Seg *w, int thick, uint8 value )
    * confined to an integral lattice nor are they necessarily adjacent on any
    * lattice.
    */
-{ static int *rasters = NULL; // a pairs of x values for each y in image
-  static size_t maxrasters = 0;
+{ static THREAD_LOCAL int *rasters = NULL; // a pairs of x values for each y in image
+  static THREAD_LOCAL size_t maxrasters = 0;
   float ox,oy;
 
   rasters = (int*) request_storage( rasters, &maxrasters, 2*sizeof(int), image->height, "draw_whisker - rasters");
@@ -381,25 +613,24 @@ void draw_whisker( Image *image, Whisker_Seg *w, int thick, uint8 value )
 }
 
 int _cmp_seed_scores(const void *a, const void *b)
-{ typedef struct {int i; float s;} S;
-  float d = ((S*)a)->s - ((S*)b)->s;
+{ float d = ((Seed_Candidate*)a)->score - ((Seed_Candidate*)b)->score;
   if( d==0.0 ) return 0;
   return d < 0 ? -1 : 1;
 }
 
 SHARED_EXPORT
-Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
-{ static Image *h = NULL,   // histogram from compute_seed_from_point_field_windowed_on_contour
-               *th = NULL,  // slopes                             "
-               *s = NULL,   // stats                              "
-               *mask = NULL;// Mask for keeping track of seed points
-  static int sarea = 0;
+Seed_Candidate *find_segment_seeds( Image *image, Image *mask, int *nseeds )
+{ static THREAD_LOCAL Image *h = NULL,   // histogram from compute_seed_from_point_field_windowed_on_contour
+                            *th = NULL,  // slopes                             "
+                            *s = NULL;   // stats                              "
+  static THREAD_LOCAL int sarea = 0;
+  static THREAD_LOCAL Seed_Candidate *seeds = NULL;
+  static THREAD_LOCAL size_t max_seeds = 0;
          int  area = image->width * image->height;
   Object_Map  *omap;
-  Whisker_Seg *wsegs = NULL;
-  size_t max_segs= 0;
-  int n_segs=0;
+  int n = 0;
 
+  PROFILE_BEGIN(PROFILE_SEED);
   // Prepare
   if( !h || ( sarea != area ) )
   { if(h)
@@ -410,20 +641,17 @@ Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
     h     = Make_Image(GREY8,   image->width, image->height );
     th    = Make_Image(FLOAT32, image->width, image->height );
     s     = Make_Image(FLOAT32, image->width, image->height );
-    mask  = Make_Image(GREY8,   image->width, image->height );
     sarea = area;
   }
   memset(    h->array, 0, sarea *    h->kind );
   memset(   th->array, 0, sarea *   th->kind );
   memset(    s->array, 0, sarea *    s->kind );
-  memset( mask->array, 0, sarea * mask->kind );
 
   // Get contours, and compute correlations on perimeters
   switch(SEED_METHOD)
   {
     case SEED_ON_MHAT_CONTOURS:
-      {
-        omap = get_objectmap( image );
+      { omap = get_objectmap( image );
 #ifdef DEBUG_SEEDING_FIELDS
         { Image *cim = Copy_Image( image );
           Paint_Brush brush = { 1.0, -1.0, -1.0 }; 
@@ -492,13 +720,14 @@ Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
 #endif
 
   { int i = sarea;
-    int nseeds = 0;
     float *sa    = (float*)   s->array,
           *tha   = (float*)  th->array;
     uint8 *ha    = (uint8*)   h->array,
-          *maska = (uint8*)mask->array;
+          *ma    = mask ? mask->array : NULL;
+    int stride = image->width;
+    Line_Params line;
 
-    // Compute means and mask
+    // Compute means
     while( i-- )
     { float n = (float) ha[i];
       if( n > 0.0f )
@@ -506,21 +735,15 @@ Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
     }
     i = sarea;
     while( i-- )
-    { if( sa[i] > SEED_THRESH )
-      { maska[i] = 1;
-        nseeds ++;
-      }
-    }
-
-    { typedef struct { int idx; float score; } seedrecord;
-      seedrecord *scores = malloc(sizeof(seedrecord)*nseeds);
-      int stride = image->width;
-      Line_Params line;
-      int j = 0;
+      if( sa[i] > SEED_THRESH && (!ma || ma[i]) )
+        n++;
 
+    // Score
+    seeds = (Seed_Candidate*) request_storage( seeds, &max_seeds, sizeof(Seed_Candidate), n, "find segment seeds" );
+    { int j = 0;
       i = sarea;
       while( i-- )
-      { if( maska[i]==1 )
+      { if( sa[i] > SEED_THRESH && (!ma || ma[i]) )
         { Seed seed = { i%stride,
               i/stride,
               (int) 100 * cos( tha[i] ),
@@ -528,82 +751,163 @@ Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
 
           line = line_param_from_seed( &seed );
 
-          scores[j  ].score = eval_line( &line, image, i );
-
-          scores[j  ].idx   = i;
+          seeds[j].seed  = seed;
+          seeds[j].score = eval_line( &line, image, i );
+          seeds[j].idx   = i;
           j++;
         }
       }
+    }
 
-      qsort(scores, nseeds, sizeof(seedrecord), &_cmp_seed_scores );
-
-      j = nseeds;
-      while(j--)
-      { i = scores[j].idx;
-        if( maska[i]==1 )
-        { Whisker_Seg *w;
-          Seed seed = { i%stride,
-            i/stride,
-            (int) 100 * cos( tha[i] ),
-            (int) 100 * sin( tha[i] ) };
-
-          w = trace_whisker( &seed, image );
-          if(!w)
-          { SWAP(seed.xdir,seed.ydir);
-            w = trace_whisker( &seed, image ); // try again at a right angle...sometimes when we're off by one the slope estimate is perpendicular to the whisker.
-          }
-          if (w != NULL)
-          { wsegs = (Whisker_Seg*) request_storage( wsegs, &max_segs, sizeof(Whisker_Seg), n_segs+1, "find segments" );
-            w->time = iFrame;
-            w->id  = n_segs;
-            wsegs[n_segs++] = *w;
-            draw_whisker( mask , w, SEED_SIZE_PX/2.0, 3 ); // "color" set to 3 for debug, could be anything but 1
-            free(w);
+    qsort(seeds, n, sizeof(Seed_Candidate), &_cmp_seed_scores );
+  } // end context
+  PROFILE_END(PROFILE_SEED);
+  PROFILE_COUNT(PROFILE_SEEDS,n);
+  *nseeds = n;
+  return seeds;
+}
+
+/* Intensity thresholds used by is_local_area_trusted() and
+ * is_local_area_trusted_conservative().  They are computed from the image the
+ * first time they're needed and reused while the image array stays the same.
+ * Frames are usually decoded into recycled buffers, so in practice they come
+ * from the first frame a thread traces.  Each thread keeps its own.
+ *
+ * pin_local_area_thresholds() fixes them, so a run that starts part way
+ * through a movie, or that is spread over threads, can use the ones a full
+ * run would have.
+ */
+static THREAD_LOCAL float  local_area_thresh              = -1.0,
+                           local_area_thresh_conservative = -1.0;
+static THREAD_LOCAL void  *local_area_image               = NULL,
+                          *local_area_image_conservative  = NULL;
+static THREAD_LOCAL int    local_area_pinned              = 0;
+
+SHARED_EXPORT
+Whisker_Seg *trace_segment_seeds( int iFrame, Image *image, Image *roi, Seed_Candidate *seeds, int nseeds, int *pnseg )
+{ static THREAD_LOCAL Image *mask = NULL;// Mask for keeping track of seed points
+  int  area = image->width * image->height;
+  Whisker_Seg *wsegs = NULL;
+  size_t max_segs= 0;
+  int n_segs=0;
+  uint8 *maska;
+  int i,j;
+
+  PROFILE_BEGIN(PROFILE_TRACE);
+  if( !mask || ( mask->width*mask->height != area ) )
+  { if(mask)
+      Free_Image(mask);
+    mask  = Make_Image(GREY8,   image->width, image->height );
+  }
+  memset( mask->array, 0, area * mask->kind );
+  maska = (uint8*)mask->array;
+  for( j=0; j<nseeds; j++ )
+    maska[ seeds[j].idx ] = 1;
+
+  j = nseeds;
+  while(j--)
+  { i = seeds[j].idx;
+    if( maska[i]==1 )
+    { Whisker_Seg *w;
+      Seed seed = seeds[j].seed;
+
+      w = trace_whisker_in_mask( &seed, image, roi );
+      if(!w)
+      { SWAP(seed.xdir,seed.ydir);
+        w = trace_whisker_in_mask( &seed, image, roi ); // try again at a right angle...sometimes when we're off by one the slope estimate is perpendicular to the whisker.
+      }
+      if (w != NULL)
+      { wsegs = (Whisker_Seg*) request_storage( wsegs, &max_segs, sizeof(Whisker_Seg), n_segs+1, "find segments" );
+        w->time = iFrame;
+        w->id  = n_segs;
+        wsegs[n_segs++] = *w;
+        draw_whisker( mask , w, SEED_SIZE_PX/2.0, 3 ); // "color" set to 3 for debug, could be anything but 1
+        free(w);
 #ifdef DEBUG_SEEDING_MASK
-            //Write_Image("trace_seed_mask.tif",mask);
-            Write_Image( "trace_seed_image.tif", image );
-            breakme();
+        //Write_Image("trace_seed_mask.tif",mask);
+        Write_Image( "trace_seed_image.tif", image );
+        breakme();
 #endif
-          } // ... if w
-        } // ... if maska[i]
-      }
-      free(scores);
-    }
-  } // end context
+      } // ... if w
+    } // ... if maska[i]
+  }
+  PROFILE_END(PROFILE_TRACE);
+  PROFILE_COUNT(PROFILE_FRAMES_TRACED,1);
+  PROFILE_COUNT(PROFILE_SEGMENTS,n_segs);
   *pnseg = n_segs;
   return wsegs;
 }
 
 SHARED_EXPORT
-void   median_uint8(  unsigned char *s,/* array with the data. size = n x m    */
-                      int n,           /* e.g. n pixels in an image            */
-                      int m,           /* e.g. m images in a time-series       */
-                      int stride,      /* number of bytes between planes       */
-                      unsigned char *r)/* array of size n storing the median   */
-{ unsigned long hist[256], count, half;
+Whisker_Seg *find_segments( int iFrame, Image *image, Image *bg, int *pnseg )
+{ int nseeds;
+  Seed_Candidate *seeds = find_segment_seeds( image, NULL, &nseeds );
+  return trace_segment_seeds( iFrame, image, NULL, seeds, nseeds, pnseg );
+}
+
+/*
+ * Temporal median
+ * ---------------
+ * A 256-bin histogram is accumulated for every pixel.  Pixels are processed
+ * in tiles of MEDIAN_TILE adjacent pixels so that each plane contributes one
+ * contiguous run (a cache line or two) to the tile rather than a single byte
+ * one plane-stride away.  Within a run, consecutive increments land in
+ * different histograms, so they don't serialize on the same counter and the
+ * loop is easy for the compiler to unroll.  Tiles are independent and are
+ * spread across threads.
+ */
+#define MEDIAN_TILE 32 // pixels per tile.  The tile histogram is MEDIAN_TILE*1kB.
+
+typedef struct _median_job_t
+{ unsigned char *s;
+  int            n,
+                 m,
+                 stride;
+  unsigned char *r;
+} median_job_t;
+
+static void median_uint8_tile(void *ctx, int itile)
+{ median_job_t *job = (median_job_t*)ctx;
+  uint32_t hist[MEDIAN_TILE][256];
+  const int i0   = itile*MEDIAN_TILE,
+            ntile= MIN(MEDIAN_TILE, job->n-i0);
+  const uint32_t half = job->m/2;
+  unsigned char *row = job->s + i0;
   int i,j;
-  unsigned char k;
-  unsigned char *cs;
 
-  half = m/2;
-  for( i=0; i<n; i++ )
-  { memset(hist, 0, 256*sizeof(unsigned long));
-    cs = s + i;
-    for( j=0; j<m; j++ )
-    { hist[ *(cs + j*stride) ]++;
+  memset(hist,0,sizeof(hist));
+  for( j=0; j<job->m; j++, row+=job->stride )
+  { if( ntile==MEDIAN_TILE )
+    { for( i=0; i<MEDIAN_TILE; i++ )
+        hist[i][row[i]]++;
+    } else
+    { for( i=0; i<ntile; i++ )
+        hist[i][row[i]]++;
     }
-    count = 0;
-    k = 255;
+  }
+  for( i=0; i<ntile; i++ )
+  { uint32_t count = 0,
+            *h = hist[i];
+    int k = 255;
+    job->r[i0+i] = 0;
     while( k != 0 )
-    { count += hist[k--];
+    { count += h[k--];
       if( count >= half )
-      { r[i] = k + 1;
+      { job->r[i0+i] = k + 1;
         break;
       }
     }
   }
+}
 
-  return;
+SHARED_EXPORT
+void   median_uint8(  unsigned char *s,/* array with the data. size = n x m    */
+                      int n,           /* e.g. n pixels in an image            */
+                      int m,           /* e.g. m images in a time-series       */
+                      int stride,      /* number of bytes between planes       */
+                      unsigned char *r)/* array of size n storing the median   */
+{ median_job_t job = {s,n,m,stride,r};
+  parallel_for( (n+MEDIAN_TILE-1)/MEDIAN_TILE, 0, median_uint8_tile, &job );
 }
 
 SHARED_EXPORT
@@ -643,6 +947,72 @@ error:
   return (NULL);
 }
 
+/*
+ * Streaming background estimate.
+ *
+ * Only `nsamples` frames, evenly spaced over [0,nframes), are held in memory
+ * at once so the whole movie never needs to be loaded.  If nsamples is more
+ * than nframes, every frame is used.  Frames are requested through `fetch`
+ * and released here with Free_Image.  For a video_t:
+ *
+ *    Image *fetch(void *v, int i) { return video_get((video_t*)v,i,1); }
+ *    bg = compute_background_streaming(fetch, v, video_frame_count(v), 100);
+ *
+ * Returns NULL if nframes or nsamples is not positive, or if a frame can't be
+ * read or doesn't match the first.
+ */
+SHARED_EXPORT
+Image *compute_background_streaming( pf_background_fetch fetch, void *ctx, int nframes, int nsamples )
+{ Image *bg = NULL,
+        *im = NULL;
+  uint8 *planes = NULL;
+  size_t area = 0;
+  int    i;
+
+  if( nframes <= 0 || nsamples <= 0 )
+  { warning("compute_background_streaming: Need at least one frame and one sample (got %d frames, %d samples).\n",
+        nframes, nsamples);
+    return NULL;
+  }
+  if( nsamples > nframes )
+    nsamples = nframes;
+
+  for( i=0; i<nsamples; i++ )
+  { int iframe = (int)( (double)i * nframes / nsamples );
+    if( !(im = fetch(ctx,iframe)) )
+    { warning("compute_background_streaming: Could not read frame %d\n",iframe);
+      goto error;
+    }
+    if( im->kind != GREY8 )
+    { warning("compute_background_streaming: Can only handle GREY8 data right now.\n");
+      goto error;
+    }
+    if( !planes )
+    { area = (size_t)im->width * im->height;
+      if( area > INT_MAX || area > SIZE_MAX/nsamples )
+      { warning("compute_background_streaming: Frames are too large (%d x %d)\n",im->width,im->height);
+        goto error;
+      }
+      bg     = Make_Image( GREY8, im->width, im->height );
+      planes = (uint8*) Guarded_Malloc( area*nsamples, "compute_background_streaming" );
+    } else if( im->width != bg->width || im->height != bg->height )
+    { warning("compute_background_streaming: Frame %d has a different size\n",iframe);
+      goto error;
+    }
+    memcpy( planes + i*area, im->array, area );
+    Free_Image(im);
+    im = NULL;
+  }
+  median_uint8( planes, (int)area, nsamples, (int)area, bg->array );
+  free(planes);
+  return bg;
+error:
+  if(im)     Free_Image(im);
+  if(bg)     Free_Image(bg);
+  if(planes) free(planes);
+  return NULL;
+}
+
 SHARED_EXPORT
 Zone *compute_zone(Stack *movie)
 { static Zone myzone;
@@ -1098,6 +1468,17 @@ error:
   return (NULL);
 }
 
+/* The detector banks are loaded the first time they're needed and are only
+ * read after that.  Loading them up front lets several threads trace at once.
+ */
+SHARED_EXPORT
+int load_detector_banks(void)
+{ Range o,w,a;
+  float norm;
+  return get_line_detector_bank(&o,&w,&a)!=NULL
+      && get_half_space_detector_bank(&o,&w,&a,&norm)!=NULL;
+}
+
 SHARED_EXPORT
 float *get_nearest_from_half_space_detector_bank(float offset, float width, float angle, float *norm)
 { int o,a,w;
@@ -1173,16 +1554,16 @@ int *get_offset_list( Image *image, int support, float angle, int p, int *npx )
    *      score += image->array[ pairs[2*npx] * filter[ pairs[2*npx+1] ]  
    *
    */
-{ static int *pxlist = (NULL);
-  static int snpx = 0;
-  static size_t maxsupport = 0;
-  static int lastp = -1;
-  static int last_issmallangle = -1;
+{ static THREAD_LOCAL int *pxlist = (NULL);
+  static THREAD_LOCAL int snpx = 0;
+  static THREAD_LOCAL size_t maxsupport = 0;
+  static THREAD_LOCAL int lastp = -1;
+  static THREAD_LOCAL int last_issmallangle = -1;
   int i,j, issa;
   int half = support / 2;
   int px = p%(image->width),
       py = p/(image->width);
-  int ioob = 2*support*support; // index for out-of-bounds pixels
+  int ioob = 2*support*support - 1; // index for out-of-bounds pixels, filled from the end
 
   pxlist = (int*) request_storage( pxlist, &maxsupport, sizeof(int), 2*support*support, "pixel list" );
 
@@ -1216,8 +1597,8 @@ int *get_offset_list( Image *image, int support, float angle, int p, int *npx )
         { tx = ox + j;
           if( (ty<0) || (ty>=hh) || (tx < 0) || (tx>=ww) ) //out of bounds
           { 
+            pxlist[ ioob-- ] = support * i + j;
             pxlist[ ioob-- ] = ww * MIN(MAX(0,ty),hh-1) + MIN(MAX(0,tx),ww-1); // clamps to border
-            pxlist[ ioob-- ] = support * i + j; 
           }
         }
       }
@@ -1240,8 +1621,8 @@ int *get_offset_list( Image *image, int support, float angle, int p, int *npx )
         { ty = oy + j;
           if( (ty<0) || (ty>=hh) || (tx < 0) || (tx>=ww) ) //out of bounds
           { 
+            pxlist[ ioob-- ] = support * i + j;
             pxlist[ ioob-- ] = ww * MIN(MAX(0,ty),hh-1) + MIN(MAX(0,tx),ww-1); // clamps to border
-            pxlist[ ioob-- ] = support * i + j; 
           }
         }
       }
@@ -1288,6 +1669,116 @@ float round_anchor_and_offset( Line_Params *line, int *p, int stride )
   return t;
 }
 
+/*
+ * Correlation kernels
+ *
+ * eval_line and eval_half_space correlate a support x support detector with
+ * the image around an anchor.  The generic path goes through the pixel list
+ * from get_offset_list so pixels outside the image can be clamped.  Most
+ * anchors have the whole window inside the image.  Then pixels are addressed
+ * directly.
+ *
+ * Kernels are instanced by CORRELATION_KERNELS.  The `n` instance takes the
+ * support at run time.  The others are compiled for a fixed support, so the
+ * loop bounds are constants the compiler can unroll.  The support for the
+ * default parameters (TLEN=8, 19x19) is instanced.  find_correlation_kernel
+ * picks an instance that matches the loaded TLEN.
+ *
+ * Terms are summed in the same order as in the pixel-list loops, so the
+ * results are identical.
+ *
+ * For small angles, weight (i,j) goes with image pixel (ox+j,oy+i).  For
+ * large angles the detector is transposed.  Then it goes with (ox+i,oy+j).
+ */
+
+typedef float (*pf_correlate_line)      ( const uint8 *o, int stride, int transposed, const float *w, int support );
+typedef void  (*pf_correlate_half_space)( const uint8 *o, int stride, int transposed, const float *left, const float *right, float *l, float *r, int support );
+
+#define CORRELATION_KERNELS(SUFFIX,S)                                                    \
+static float correlate_line_##SUFFIX( const uint8 *o, int stride, int transposed,       \
+                                      const float *w, int support )                     \
+{ int i,j;                                                                               \
+  float s = 0.0;                                                                         \
+  if( !transposed )                                                                      \
+  { for( i=S-1; i>=0; i-- )                                                              \
+    { const uint8 *row = o + stride*i;                                                   \
+      const float *wr  = w + (S)*i;                                                      \
+      for( j=S-1; j>=0; j-- )                                                            \
+        s += row[j] * wr[j];                                                             \
+    }                                                                                    \
+  } else                                                                                 \
+  { for( i=S-1; i>=0; i-- )                                                              \
+    { const uint8 *col = o + i;                                                          \
+      const float *wr  = w + (S)*i;                                                      \
+      for( j=S-1; j>=0; j-- )                                                            \
+        s += col[stride*j] * wr[j];                                                      \
+    }                                                                                    \
+  }                                                                                      \
+  return s;                                                                              \
+}                                                                                        \
+                                                                                         \
+static void correlate_half_space_##SUFFIX( const uint8 *o, int stride, int transposed,  \
+                                           const float *left, const float *right,       \
+                                           float *pl, float *pr, int support )          \
+{ int i,j;                                                                               \
+  float l = 0.0, r = 0.0;                                                                \
+  const float *rr = right + (S)*(S); /* right half is rotated by 180 */                  \
+  for( i=S-1; i>=0; i-- )                                                                \
+  { const float *wl = left + (S)*i,                                                      \
+                *wr = rr   - (S)*i;                                                      \
+    if( !transposed )                                                                    \
+    { const uint8 *row = o + stride*i;                                                   \
+      for( j=S-1; j>=0; j-- )                                                            \
+      { l += row[j] * wl[j];                                                             \
+        r += row[j] * wr[-j];                                                            \
+      }                                                                                  \
+    } else                                                                               \
+    { const uint8 *col = o + i;                                                          \
+      for( j=S-1; j>=0; j-- )                                                            \
+      { l += col[stride*j] * wl[j];                                                      \
+        r += col[stride*j] * wr[-j];                                                     \
+      }                                                                                  \
+    }                                                                                    \
+  }                                                                                      \
+  *pl = l;                                                                               \
+  *pr = r;                                                                               \
+}
+
+CORRELATION_KERNELS(n ,support)
+CORRELATION_KERNELS(19,19)        // TLEN = 8
+
+typedef struct _Correlation_Kernel
+{ int                     support;
+  pf_correlate_line       line;
+  pf_correlate_half_space half_space;
+} Correlation_Kernel;
+
+static const Correlation_Kernel g_correlation_kernels[] =
+{ { 19, correlate_line_19, correlate_half_space_19 },
+  {  0, correlate_line_n,  correlate_half_space_n  }, // any support
+};
+
+static const Correlation_Kernel *find_correlation_kernel( int support )
+{ const Correlation_Kernel *k = g_correlation_kernels;
+  while( k->support && k->support != support )
+    k++;
+  return k;
+}
+
+/* Returns the address of the top-left pixel of the support x support window
+ * centered at p.  Returns NULL if any of the window is outside the image.
+ */
+static const uint8 *correlation_window( Image *image, int support, int p )
+{ int half = support / 2,
+      ox   = p % image->width - half,
+      oy   = p / image->width - half;
+  if( p < 0 || ox < 0 || oy < 0 ||
+      ox + support > image->width ||
+      oy + support > image->height )
+    return NULL;
+  return image->array + image->width * oy + ox;
+}
+
 SHARED_EXPORT
 int mean_uint8( Image *im )
 { float acc = 0.0;
@@ -1360,6 +1851,7 @@ float eval_half_space( Line_Params *line, Image *image, int p, float *rr, float
   int npxlist, a = support*support;
   
   int   *pxlist;
+  const uint8 *window;
   float coff;
   float leftnorm, *lefthalf;
   float rightnorm, *righthalf;
@@ -1374,12 +1866,18 @@ float eval_half_space( Line_Params *line, Image *image, int p, float *rr, float
   //  lastim = image->array;
   //}
 
+  PROFILE_COUNT(PROFILE_EVAL_HALF_SPACE,1);
   coff = round_anchor_and_offset( line, &p, image->width );
-  pxlist    = get_offset_list( image, support, line->angle, p, &npxlist );
   lefthalf  = get_nearest_from_half_space_detector_bank( coff, line->width, line->angle, &leftnorm );
   righthalf  = get_nearest_from_half_space_detector_bank( -coff, line->width, line->angle, &rightnorm );
-  {
-    uint8* parray = image->array;
+#ifndef SHOW_HALF_SPACE_DETECTOR
+  if( (window = correlation_window( image, support, p )) )
+  { find_correlation_kernel(support)->half_space( window, image->width, !is_small_angle(line->angle),
+                                                  lefthalf, righthalf, &l, &r, support );
+  } else
+#endif
+  { uint8* parray = image->array;
+    pxlist = get_offset_list( image, support, line->angle, p, &npxlist );
     i = a; //npxlist;
     l = 0.0;
     r = 0.0;
@@ -1463,18 +1961,38 @@ int is_change_too_big( Line_Params *new, Line_Params *old, float alim, float wli
   return 0;
 }
 
+SHARED_EXPORT
+void compute_local_area_thresholds( Image *image, Local_Area_Thresholds *out )
+{ out->thresh       = threshold_bottom_fraction_uint8(image);
+  out->conservative = threshold_two_means( image->array, image->width*image->height );
+}
+
+SHARED_EXPORT
+void pin_local_area_thresholds( Local_Area_Thresholds *t )
+{ if( t )
+  { local_area_thresh              = t->thresh;
+    local_area_thresh_conservative = t->conservative;
+    local_area_pinned = 1;
+  } else
+  { local_area_thresh              = -1.0;
+    local_area_thresh_conservative = -1.0;
+    local_area_pinned = 0;
+  }
+}
+
 SHARED_EXPORT
 int is_local_area_trusted_conservative( Line_Params *line, Image *image, int p )
-{ float q,r,l;
-  static float thresh = -1.0;
-  static uint8 *lastim = NULL;
+{ float q,r,l,
+        thresh;
   q = eval_half_space( line, image, p, &r, &l );
 
-  if( thresh < 0.0 || lastim != image->array) /* recomputes when image changes */
+  if( !local_area_pinned &&
+      ( local_area_thresh_conservative < 0.0 || local_area_image_conservative != image->array) ) /* recomputes when image changes */
   { //thresh = mean_uint8( image );
-    thresh = threshold_two_means( image->array, image->width*image->height );
-    lastim = image->array;
+    local_area_thresh_conservative = threshold_two_means( image->array, image->width*image->height );
+    local_area_image_conservative  = image->array;
   }
+  thresh = local_area_thresh_conservative;
 #ifdef SHOW_HALF_SPACE_DETECTOR
   debug("\t(%5d) q:%7.3g r:%7.3g l:%7.3g thresh:%7.3g\n",p,q,r,l,thresh);
 #endif
@@ -1488,15 +2006,16 @@ int is_local_area_trusted_conservative( Line_Params *line, Image *image, int p )
 
 SHARED_EXPORT
 int is_local_area_trusted( Line_Params *line, Image *image, int p )
-{ float q,r,l;
-  static float thresh = -1.0;
-  static void  *lastim = NULL;
+{ float q,r,l,
+        thresh;
   q = eval_half_space( line, image, p, &r, &l );
 
-  if( thresh < 0.0 || lastim != image->array) /* recomputes when image changes */
-  { thresh = threshold_bottom_fraction_uint8(image);//,HALF_SPACE_FRACTION_DARK );
-    lastim = image->array;
+  if( !local_area_pinned &&
+      ( local_area_thresh < 0.0 || local_area_image != image->array) ) /* recomputes when image changes */
+  { local_area_thresh = threshold_bottom_fraction_uint8(image);//,HALF_SPACE_FRACTION_DARK );
+    local_area_image  = image->array;
   }
+  thresh = local_area_thresh;
 #ifdef SHOW_HALF_SPACE_DETECTOR
   debug("\t(%5d) q:%7.3g r:%7.3g l:%7.3g thresh:%7.3g\n",p,q,r,l,thresh);
 #endif
@@ -1516,20 +2035,28 @@ float  eval_line(Line_Params *line, Image *image, int p)
   int npxlist;
   
   int   *pxlist;
+  const uint8 *window;
   float *weights, coff;
 
   float  r,l,q,s       = 0.0;
-  static float lastscore = 0.0;
-  static float bg     = -1.0; //background is bright
-  static void *lastim = NULL;
+  static THREAD_LOCAL float lastscore = 0.0;
+  static THREAD_LOCAL float bg     = -1.0; //background is bright
+  static THREAD_LOCAL void *lastim = NULL;
+
+  PROFILE_COUNT(PROFILE_EVAL_LINE,1);
 
   // compute a nearby anchor
 
   coff      = round_anchor_and_offset( line, &p, image->width );
-  pxlist    = get_offset_list( image, support, line->angle, p, &npxlist );
-
   weights   = get_nearest_from_line_detector_bank ( coff, line->width, line->angle );
 
+#ifndef SHOW_LINE_DETECTOR
+  if( (window = correlation_window( image, support, p )) )
+    return -find_correlation_kernel(support)->line( window, image->width, !is_small_angle(line->angle),
+                                                    weights, support );
+#endif
+  pxlist    = get_offset_list( image, support, line->angle, p, &npxlist );
+
 #ifdef SHOW_LINE_DETECTOR
 #if 0 
 #define fpart(a) (10.0*( a - round(a) ))
@@ -1586,17 +2113,22 @@ float  eval_line_no_debug(Line_Params *line, Image *image, int p)
   int npxlist, a = support*support;
   int o;
   int   *pxlist;
+  const uint8 *window;
   float *weights, coff;
   float leftnorm, *lefthalf;
   float  r,l,q,s       = 0.0;
-  static float lastscore = 0.0;
-  static float bg     = -1.0; //background is bright
-  static void *lastim = NULL;
+  static THREAD_LOCAL float lastscore = 0.0;
+  static THREAD_LOCAL float bg     = -1.0; //background is bright
+  static THREAD_LOCAL void *lastim = NULL;
   
+  PROFILE_COUNT(PROFILE_EVAL_LINE,1);
   // compute a nearby anchor
   coff = round_anchor_and_offset( line, &p, image->width );
-  pxlist    = get_offset_list( image, support, line->angle, p, &npxlist );
   weights   = get_nearest_from_line_detector_bank      ( coff, line->width, line->angle );
+  if( (window = correlation_window( image, support, p )) )
+    return -find_correlation_kernel(support)->line( window, image->width, !is_small_angle(line->angle),
+                                                    weights, support );
+  pxlist    = get_offset_list( image, support, line->angle, p, &npxlist );
 
   { 
     uint8* parray = image->array;
@@ -1621,9 +2153,9 @@ float  eval_line_by_curved_detector(Line_Params *line, Image *image, int p)
   float *weights, coff;
   float leftnorm, *lefthalf;
   float  r,l,q,s       = 0.0;
-  static float lastscore = 0.0;
-  static float bg     = -1.0; //background is bright
-  static void *lastim = NULL;
+  static THREAD_LOCAL float lastscore = 0.0;
+  static THREAD_LOCAL float bg     = -1.0; //background is bright
+  static THREAD_LOCAL void *lastim = NULL;
   
 
   // compute a nearby anchor
@@ -2090,6 +2622,7 @@ int adjust_line_start(Line_Params *line, Image *image, int *pp,
   better = 1;
   while (better)
   { better = 0;
+    PROFILE_COUNT(PROFILE_LINE_ADJUST,1);
 #ifdef  DEBUG_LINE_FITTING
     printf("      %.1f(%3d) %6.1f %4.1f: S=%g\n",
             line->offset,p/image->width,line->angle*rad,line->width,line->score);
@@ -2222,9 +2755,9 @@ int move_line( Line_Params *line, int *p, int stride, int direction )
 
 SHARED_EXPORT
 int  detect_loops(int p, float o)
-{ static int phistory[10] = {-1,-1,-1,-1,-1,
+{ static THREAD_LOCAL int phistory[10] = {-1,-1,-1,-1,-1,
                              -1,-1,-1,-1,-1};
-  static float ohistory[10] = {-5.0,-5.0,-5.0,-5.0,-5.0,
+  static THREAD_LOCAL float ohistory[10] = {-5.0,-5.0,-5.0,-5.0,-5.0,
                                -5.0,-5.0,-5.0,-5.0,-5.0};
   int i,n = 10;
   i = n;
@@ -2256,14 +2789,20 @@ void initialize_paramater_ranges( Line_Params *line, Interval *roff, Interval *r
 
 SHARED_EXPORT
 Whisker_Seg *trace_whisker(Seed *s, Image *image)
+{ return trace_whisker_in_mask( s, image, NULL );
+}
+
+SHARED_EXPORT
+Whisker_Seg *trace_whisker_in_mask(Seed *s, Image *image, Image *mask)
 { typedef struct { float x; float y; float thick; float score; } record;
-  static record *ldata, *rdata;
-  static size_t maxldata = 0, maxrdata = 0;
+  static THREAD_LOCAL record *ldata, *rdata;
+  static THREAD_LOCAL size_t maxldata = 0, maxrdata = 0;
 
   int nleft = 0, nright = 0;
   float x,y,dx,dy,newoff;
   int cwidth  = image->width,
       cheight = image->height;
+  const uint8 *maska = mask ? mask->array : NULL;
   Line_Params line,rline,oldline;
   int trusted = 1;
 
@@ -2326,7 +2865,7 @@ Whisker_Seg *trace_whisker(Seed *s, Image *image)
 #if 0 //#ifdef SHOW_WHISKER_TRACE
       save_response("response.raw", image, p );
 #endif
-      if( outofbounds(p, cwidth, cheight) ) break;
+      if( outofbounds(p, cwidth, cheight, maska) ) break;
       line.score = eval_line( &line, image, p );
       oldline = line;
       oldp    = p;
@@ -2337,7 +2876,7 @@ Whisker_Seg *trace_whisker(Seed *s, Image *image)
         { oldline = line; oldp = p;
           move_line( &line, &p, cwidth, 1 );
           nmoves ++;
-          if( outofbounds(p, cwidth, cheight) ) break;
+          if( outofbounds(p, cwidth, cheight, maska) ) break;
           trusted = is_local_area_trusted( &line, image, p );
           trusted &= adjust_line_start(&line,image,&p,&roff,&rang,&rwid);
           if(trusted && line.score < sigmin) 
@@ -2396,7 +2935,7 @@ Whisker_Seg *trace_whisker(Seed *s, Image *image)
 #ifdef SHOW_WHISKER_TRACE
       save_response("response.raw", image, p );
 #endif
-      if( outofbounds(p, cwidth, cheight) ) break;
+      if( outofbounds(p, cwidth, cheight, maska) ) break;
       line.score = eval_line( &line, image, p );
       trusted = adjust_line_start(&line,image,&p,&roff,&rang,&rwid);
 
@@ -2407,7 +2946,7 @@ Whisker_Seg *trace_whisker(Seed *s, Image *image)
         { oldline = line; oldp = p;
           move_line( &line, &p, cwidth, -1 );
           nmoves ++;
-          if( outofbounds(p, cwidth, cheight) ) break;
+          if( outofbounds(p, cwidth, cheight, maska) ) break;
           trusted = is_local_area_trusted( &line, image, p );
           trusted &= adjust_line_start(&line,image,&p,&roff,&rang,&rwid);
           if(trusted && line.score < sigmin) 
@@ -2481,3 +3020,118 @@ Whisker_Seg *trace_whisker(Seed *s, Image *image)
   { return (NULL);
   }
 }
+
+#ifdef TEST_BACKGROUND_STREAMING
+/*
+ * Synthetic movie: a fixed background with a dark bar that moves across it.
+ * The bar covers any one pixel in only a few frames, so the median of the
+ * samples is the background.
+ */
+#define TEST_W 67
+#define TEST_H 31
+
+typedef struct _synth_movie_t
+{ int width, height,
+      fail_at,      // frame that can't be read, or -1
+      resize_at,    // frame with a different size, or -1
+      nfetched;
+} synth_movie_t;
+
+static uint8 synth_background( int x, int y )
+{ return (uint8)( 20 + (7*x + 3*y)%200 );
+}
+
+static void synth_frame( uint8 *p, int width, int height, int iframe )
+{ int x,y;
+  for( y=0; y<height; y++ )
+    for( x=0; x<width; x++ )
+      p[y*width+x] = ( (x - 5*iframe)%width + width )%width < 4 ? 0 : synth_background(x,y);
+}
+
+static Image *synth_fetch( void *ctx, int iframe )
+{ synth_movie_t *m = (synth_movie_t*) ctx;
+  Image *im;
+  m->nfetched++;
+  if( iframe==m->fail_at )
+    return NULL;
+  im = Make_Image( GREY8, m->width + (iframe==m->resize_at), m->height );
+  synth_frame( im->array, im->width, im->height, iframe );
+  return im;
+}
+
+// The streaming estimate matches compute_background on a stack holding the
+// same frames, and fetches each sample once.
+static int check_against_stack( int nframes, int nsamples )
+{ synth_movie_t m = { TEST_W, TEST_H, -1, -1, 0 };
+  int i, n = MIN( nsamples, nframes ), ok;
+  Stack *movie = Make_Stack( GREY8, TEST_W, TEST_H, n );
+  Image *bg, *ref;
+  for( i=0; i<n; i++ )
+    synth_frame( movie->array + (size_t)i*TEST_W*TEST_H, TEST_W, TEST_H, (int)( (double)i * nframes / n ) );
+  ref = compute_background( movie );
+  bg  = compute_background_streaming( synth_fetch, &m, nframes, nsamples );
+  ok  = bg && ref && m.nfetched==n
+     && memcmp( bg->array, ref->array, TEST_W*TEST_H )==0;
+  if( bg )
+  { int x,y;
+    for( y=0; y<TEST_H; y++ )
+      for( x=0; x<TEST_W; x++ )
+        ok &= bg->array[y*TEST_W+x]==synth_background(x,y);
+    Free_Image( bg );
+  }
+  if( ref ) Free_Image( ref );
+  Free_Stack( movie );
+  return ok;
+}
+
+static int test_subsampled( void )      { return check_against_stack( 100, 9 ); }
+static int test_every_frame( void )     { return check_against_stack( 12, 50 ); }
+
+// Non-positive counts are rejected without reading anything.
+static int test_bad_counts( void )
+{ synth_movie_t m = { TEST_W, TEST_H, -1, -1, 0 };
+  return !compute_background_streaming( synth_fetch, &m, 100, 0 )
+      && !compute_background_streaming( synth_fetch, &m, 100, -3 )
+      && !compute_background_streaming( synth_fetch, &m, 0, 10 )
+      && m.nfetched==0;
+}
+
+// A frame that can't be read, or that has a different size, fails the estimate.
+static int test_bad_frames( void )
+{ synth_movie_t fail   = { TEST_W, TEST_H, 40, -1, 0 },
+                resize = { TEST_W, TEST_H, -1, 40, 0 };
+  return !compute_background_streaming( synth_fetch, &fail,   100, 10 )
+      && !compute_background_streaming( synth_fetch, &resize, 100, 10 );
+}
+
+static int (*tests[])( void ) = { test_subsampled,
+                                  test_every_frame,
+                                  test_bad_counts,
+                                  test_bad_frames,
+                                  NULL };
+
+char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ int i, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Streaming Background Test                                    \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Estimates the background of a synthetic movie from a few     \n"
+      "| fetched frames and checks it against compute_background on   \n"
+      "| the same frames.                                             \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  for( i=0; tests[i]; i++ )
+  { int ok = tests[i]();
+    printf("--- TEST %d --- %s\n", i+1, ok?"PASSED":"FAILED");
+    nfailed += !ok;
+  }
+  return nfailed;
+}
+#endif // TEST_BACKGROUND_STREAMING
@@ -159,6 +159,7 @@ Distributions *Alloc_Distributions( int n_bins, int n_measures, int n_states )
   this->data = data;
   this->bin_min = bindata;
   this->bin_delta = bindata + n_measures;
+  this->by_state = NULL;
   return this;
 }
 
@@ -170,8 +171,9 @@ void Free_Distributions( Distributions *this )
   debug("\tdata: %p\n", this->data );
   debug("\tbindata: %p\n", this->bin_min );
 #endif
-  if( this->bin_min ) free( this->bin_min ); // also frees bin_delta
-  if( this->data    ) free( this->data    );
+  if( this->bin_min  ) free( this->bin_min  ); // also frees bin_delta
+  if( this->data     ) free( this->data     );
+  if( this->by_state ) free( this->by_state );
   free(this);
 }
 
@@ -302,14 +304,14 @@ void Measurements_Table_Append_Columns_In_Place( Measurements *table, int n_rows
 
   // 0. Realloc data buffer - invalidates all table[i].data and velocity pointers!
   buffer = Guarded_Realloc( buffer,
-      sizeof(double)*(n+n_cols_to_add)*n_rows,
+      2*sizeof(double)*ncol*n_rows, // shape data followed by velocities
       "Measurements_Table_Append_Columns_In_Place" );
 
   // 1. copy data from back to front through expanded buffer
   { double *row = buffer +    n*n_rows,
            *dst = buffer + ncol*n_rows;
     while( (row-=n) >= buffer )
-      memcpy( dst -= ncol, row, n*sizeof(double) );
+      memmove( dst -= ncol, row, n*sizeof(double) );
   }
 
   // 2. update row pointers and column count
@@ -377,6 +379,111 @@ void Measurements_Table_Select_Shape_By_State( Measurements *table, int n_rows,
   }
 }
 
+// Shape data and velocities for all rows live in one block of 2*n_rows*n
+// doubles: an (n_rows,n) row-major matrix of shape data followed by an
+// (n_rows,n) matrix of velocities.  Row i of the table lives at storage row
+// table[i].row.  Sorting the table permutes the Measurements structs but not
+// the storage, so use Measurements_Table_Pack to bring the two back in line.
+SHARED_EXPORT
+double *Measurements_Table_Data_Block( Measurements *table )
+{ return table[0].data - table[0].n*table[0].row;
+}
+
+SHARED_EXPORT
+double *Measurements_Table_Velocity_Block( Measurements *table, int n_rows )
+{ return Measurements_Table_Data_Block(table) + table[0].n*n_rows;
+}
+
+// Permutes the storage block in place so storage row i holds table row i.
+// Afterwards the blocks can be viewed as (n_rows,n) matrices in table order.
+// Uses one row of scratch and a visited mark per row.
+SHARED_EXPORT
+void Measurements_Table_Pack( Measurements *table, int n_rows )
+{ double *data,*vel,*tmp;
+  char *done;
+  int i,n;
+  size_t rowbytes;
+
+  if( n_rows<=0 ) return;
+  n        = table[0].n;
+  rowbytes = n*sizeof(double);
+  data     = Measurements_Table_Data_Block(table);
+  vel      = data + n*n_rows;
+
+  for(i=0;i<n_rows;++i)          // already packed?
+    if( table[i].row!=i ) break;
+  if( i==n_rows ) return;
+
+  tmp  = Guarded_Malloc(2*rowbytes,"Measurements_Table_Pack");
+  done = Guarded_Malloc(n_rows,"Measurements_Table_Pack");
+  memset(done,0,n_rows);
+  // Storage row table[j].row must move to storage row j.  Follow each cycle
+  // of that permutation, carrying the displaced row in tmp.
+  for(i=0;i<n_rows;++i)
+  { int j=i,k;
+    if( done[i] ) continue;
+    memcpy(tmp,     data+i*n,rowbytes);
+    memcpy(tmp+n,   vel +i*n,rowbytes);
+    while( (k=table[j].row)!=i )
+    { memcpy(data+j*n,data+k*n,rowbytes);
+      memcpy(vel +j*n,vel +k*n,rowbytes);
+      done[j]=1;
+      j=k;
+    }
+    memcpy(data+j*n,tmp,  rowbytes);
+    memcpy(vel +j*n,tmp+n,rowbytes);
+    done[j]=1;
+  }
+  for(i=0;i<n_rows;++i)
+  { table[i].row      = i;
+    table[i].data     = data + i*n;
+    table[i].velocity = vel  + i*n;
+  }
+  free(done);
+  free(tmp);
+}
+
+// Copies the integer columns out in one pass, in table order.
+// Any of the destination arrays may be NULL to skip that column.
+SHARED_EXPORT
+void Measurements_Table_Copy_Ids( Measurements *table, int n_rows, int *state, int *fid, int *wid, int *valid_velocity )
+{ int i;
+  for(i=0;i<n_rows;++i)
+  { Measurements *row = table+i;
+    if(state)          state[i]          = row->state;
+    if(fid)            fid[i]            = row->fid;
+    if(wid)            wid[i]            = row->wid;
+    if(valid_velocity) valid_velocity[i] = row->valid_velocity;
+  }
+}
+
+// Sets the state of every row from `state`, in table order.
+SHARED_EXPORT
+void Measurements_Table_Set_States( Measurements *table, int n_rows, int *state )
+{ int i;
+  for(i=0;i<n_rows;++i)
+    table[i].state = state[i];
+}
+
+// Writes the table indexes of rows with the queried state and a frame id in
+// [fid_begin,fid_end) to `index` and returns the number of matching rows.
+// Pass MEASUREMENTS_ANY_STATE to match every state.
+// If `index` is NULL, the matches are only counted.
+SHARED_EXPORT
+int Measurements_Table_Select( Measurements *table, int n_rows, int state, int fid_begin, int fid_end, int *index )
+{ int i,count=0;
+  int any = (state==MEASUREMENTS_ANY_STATE);
+  for(i=0;i<n_rows;++i)
+  { Measurements *row = table+i;
+    if( (any || row->state==state) && row->fid>=fid_begin && row->fid<fid_end )
+    { if(index)
+        index[count] = i;
+      ++count;
+    }
+  }
+  return count;
+}
+
 int test_Measurements_Table_FileIO( char* filename,  Measurements *table, int n_rows )
 { Measurements *t2;
   int nr2,i;
@@ -894,11 +1001,19 @@ Distributions *Build_Velocity_Distributions( Measurements *sorted_table, int n_r
   return d;
 }
 
+// Called by anything that changes the histograms.
+static void _discard_state_index( Distributions *d )
+{ if( d->by_state )
+    free( d->by_state );
+  d->by_state = NULL;
+}
+
 void Distributions_Normalize( Distributions *d )
 { int i,j,k;
   int measure_stride = d->n_bins,
       state_stride   = d->n_bins * d->n_measures,
       dvol           = d->n_bins * d->n_measures * d->n_states;
+  _discard_state_index(d);
   // Normalize
   for( i=0; i < d->n_states; i++ )
   { double *hists = d->data + i * state_stride;
@@ -918,6 +1033,7 @@ void Distributions_Normalize( Distributions *d )
 void Distributions_Apply_Log2( Distributions *d )
 { double *data = d->data,
          *e = d->data + d->n_states * d->n_measures * d->n_bins;
+  _discard_state_index(d);
   while(e-- > data)
     *e = log2(*e);
 }
@@ -925,10 +1041,21 @@ void Distributions_Apply_Log2( Distributions *d )
 void Distributions_Dilate( Distributions* dist )
 { int stride = dist->n_bins;
   double *a = dist->data + dist->n_bins * dist->n_measures * dist->n_states;
+  _discard_state_index(dist);
   while( (a-=stride) > dist->data )
     maxfilt_centered_double_inplace( a, stride, 3 );
 }
 
+// The bin holding v: floor((v-mn)/delta), clamped to [0,nbins-1].
+// The clamp is done before the conversion to int, so values too large for an
+// int are well defined.  NaN maps to bin 0.
+static inline int _bin( double v, double mn, double delta, int nbins )
+{ double t = (v-mn)/delta;
+  t = (t>0.0)?t:0.0;
+  t = (t<nbins-1)?t:(nbins-1);
+  return (int)t;
+}
+
 // vec must be an array of length dist->n_measures
 // Assumes distributions encodes densities as log2 probability
 SHARED_EXPORT
@@ -942,15 +1069,16 @@ double Eval_Likelihood_Log2( Distributions *dist, double *vec, int istate )
   int nbins = dist->n_bins;
 
   for(i=0; i < dist->n_measures; i++)
-  { ibin = (int) floor( ( vec[i] - dist->bin_min[i] ) / ( dist->bin_delta[i] ) );
+  {
 #ifdef DEBUG_EVAL_LIKELIHOOD_LOG2
+    ibin = (int) floor( ( vec[i] - dist->bin_min[i] ) / ( dist->bin_delta[i] ) );
     if( ibin<0 || ibin >= nbins )
       warning("In Eval_Likelihood_Log2\n"
               "\tibin out of range\n"
               "\t\tibin : %d\n"
               "\t\tnbins: %d\n", ibin,nbins);
 #endif
-    ibin = CLAMP(ibin,0,nbins-1);
+    ibin = _bin( vec[i], dist->bin_min[i], dist->bin_delta[i], nbins );
     acc += hists[measure_stride*i + ibin]; // addition here bc probs are in log space
 #ifdef DEBUG_EVAL_LIKELIHOOD_LOG2
     debug("\t%5d %f\n", ibin, hists[measure_stride*i + ibin]);
@@ -965,16 +1093,113 @@ double Eval_Likelihood_Log2( Distributions *dist, double *vec, int istate )
 // prev and next must be arrays of length dist->n_measures
 // Assumes distributions encodes densities as log2 probability
 // Distributions should be functions of the differences between next and prev
+//
+// Reentrant.  Scratch lives on the stack unless there are a lot of measures.
 SHARED_EXPORT
 double Eval_Velocity_Likelihood_Log2( Distributions *dist, double *prev, double *next, int istate )
-{ static double *vec = NULL;
-  static size_t maxn = 0;
+{ double buf[32], *vec = buf, logp;
   int i = dist->n_measures;
-  vec = (double*) request_storage( vec, &maxn, sizeof(double), i, "eval transitions");
+  if( i > (int)(sizeof(buf)/sizeof(*buf)) )
+    vec = (double*) Guarded_Malloc( sizeof(double)*i, "eval transitions");
   while(i--)
     vec[i] = _diff( next[i], prev[i] );
 
-  return Eval_Likelihood_Log2(dist,vec,istate);
+  logp = Eval_Likelihood_Log2(dist,vec,istate);
+  if( vec != buf )
+    free(vec);
+  return logp;
+}
+
+//
+// Pre-binned queries
+//
+
+SHARED_EXPORT
+void Distributions_Bin_Values( Distributions *dist, double *vec, int *bins )
+{ int i;
+  for( i=0; i<dist->n_measures; i++ )
+    bins[i] = _bin( vec[i], dist->bin_min[i], dist->bin_delta[i], dist->n_bins );
+}
+
+SHARED_EXPORT
+void Distributions_Bin_Velocity( Distributions *dist, double *prev, double *next, int *bins )
+{ int i;
+  for( i=0; i<dist->n_measures; i++ )
+    bins[i] = _bin( _diff(next[i],prev[i]), dist->bin_min[i], dist->bin_delta[i], dist->n_bins );
+}
+
+SHARED_EXPORT
+void Distributions_Bin_Table( Distributions *dist, Measurements *table, int n_rows, int *bins )
+{ int i;
+  for( i=0; i<n_rows; i++ )
+    Distributions_Bin_Values( dist, table[i].data, bins + i*dist->n_measures );
+}
+
+SHARED_EXPORT
+double Eval_Binned_Likelihood_Log2( Distributions *dist, int *bins, int istate )
+{ int nbins = dist->n_bins;
+  double *hists = dist->data + istate * nbins * dist->n_measures;
+  double acc = 0;
+  int i;
+  for( i=0; i<dist->n_measures; i++ )
+    acc += hists[nbins*i + bins[i]];
+  return acc;
+}
+
+SHARED_EXPORT
+void Distributions_Index_States( Distributions *dist )
+{ int ns = dist->n_states,
+      nm = dist->n_measures,
+      nb = dist->n_bins,
+      s,m,b;
+  if( !dist->by_state )
+    dist->by_state = (double*) Guarded_Malloc( sizeof(double)*ns*nm*nb, "Distributions_Index_States" );
+  for( s=0; s<ns; s++ )
+    for( m=0; m<nm; m++ )
+    { double *h = dist->data + (s*nm + m)*nb;
+      for( b=0; b<nb; b++ )
+        dist->by_state[ (m*nb + b)*ns + s ] = h[b];
+    }
+}
+
+// Sums over measures in the same order as Eval_Binned_Likelihood_Log2 so the
+// results are identical.
+SHARED_EXPORT
+void Eval_Binned_Likelihood_Log2_All_States( Distributions *dist, int *bins, double *log2p )
+{ int ns = dist->n_states,
+      nb = dist->n_bins,
+      s,m;
+  if( !dist->by_state )
+  { for( s=0; s<ns; s++ )
+      log2p[s] = Eval_Binned_Likelihood_Log2( dist, bins, s );
+    return;
+  }
+  for( s=0; s<ns; s++ )
+    log2p[s] = 0.0;
+  for( m=0; m<dist->n_measures; m++ )
+  { const double *h = dist->by_state + (m*nb + bins[m])*ns;
+    for( s=0; s<ns; s++ )
+      log2p[s] += h[s];
+  }
+}
+
+// Reentrant.  Scratch lives on the stack unless there are a lot of measures.
+SHARED_EXPORT
+void Eval_Likelihood_Log2_All_States( Distributions *dist, double *vec, double *log2p )
+{ int buf[32], *bins = buf;
+  if( dist->n_measures > (int)(sizeof(buf)/sizeof(*buf)) )
+    bins = (int*) Guarded_Malloc( sizeof(int)*dist->n_measures, "Eval_Likelihood_Log2_All_States" );
+  Distributions_Bin_Values( dist, vec, bins );
+  Eval_Binned_Likelihood_Log2_All_States( dist, bins, log2p );
+  if( bins != buf )
+    free( bins );
+}
+
+SHARED_EXPORT
+void Eval_Table_Likelihood_Log2_All_States( Distributions *dist, Measurements *table, int n_rows, double *log2p )
+{ int i;
+  for( i=0; i<n_rows; i++ )
+    Eval_Likelihood_Log2_All_States( dist, table[i].data, log2p + i*dist->n_states );
 }
 
 // sorted_table must be sorted in ascending time order (i.e. ascending fid)
@@ -987,139 +1212,184 @@ double Eval_Velocity_Likelihood_Log2( Distributions *dist, double *prev, double
 // where to put the data...should just pass in a pointer.  doing it this
 // way requires a copy and additional memory management.
 //
+// The work is done by a Path_Finder.  Solve() keeps one for the whole table
+// so the shape bins are only computed once.
+//
+// The lattice is a structure of arrays.  Nodes are numbered in time order:
+// the start, the rows in the gray area, then the end.  Nodes from one frame
+// are contiguous, so the transitions into a child are scored against every
+// node in the previous frame at once, with unit-stride float loops.
+
+typedef struct _Path_Finder
+{ Measurements  *table;         // rows are indexed relative to this
+  int            n_rows,
+                 n_measures;
+  Distributions *shape,
+                *velocity;
+  int           *shape_bins;    // n_rows x n_measures: the bin of each measurement in `shape`
+  float         *shape_log2p,   // float copies of the histograms
+                *vel_log2p;
+
+  // lattice - grown as needed
+  double        *x;             // n_measures x nnode: node measurements, measure-major
+  float         *node_log2p,    // shape likelihood of each node
+                *acc;           // transition scores into one child
+  int           *row,           // table index of each node
+                *argmax,        // best parent of each node
+                *frame;         // first node of each frame, then nnode
+  size_t         x_size, node_log2p_size, acc_size, row_size, argmax_size, frame_size;
+  Measurements **result;
+  size_t         result_size;
+} Path_Finder;
+
+static float *_log2p_to_float( Distributions *d )
+{ int i, n = d->n_bins * d->n_measures * d->n_states;
+  float *out = (float*) Guarded_Malloc( sizeof(float)*n, "Path_Finder - float histograms" );
+  for( i=0; i<n; i++ )
+    out[i] = (float) d->data[i];
+  return out;
+}
 
-typedef struct _LatticeNode {
-  Measurements        *row;
-  struct _LatticeNode *argmax;
-  double               max;
-  struct _LatticeNode *children;    // these are in the lattice and all the children are
-  unsigned int         nchildren;   //    sequential in memory
-} LatticeNode;
-
-SHARED_EXPORT
-Measurements **Find_Path( Measurements *sorted_table,
-                          int n_rows,
-                         Distributions *shape,
-                         Distributions *velocity,
-                         Measurements *start,
-                         Measurements *end,
-                         int minstate,
-                         int *npath)
-{
-  int pathlength = end->fid - start->fid - 1;
-  Measurements *first, *last; //marks edge of gray area in sorted_table
-  Measurements *eot = sorted_table + n_rows; //end of table
-  int target = start->state;
-  int nnode;
-  static const double baseline_log2p = -1e7;
-  static LatticeNode *lattice = NULL;
-  static size_t lattice_size = 0;
-  static Measurements **result    = NULL;
-  static size_t         result_size = 0;
+// `shape` and `velocity` should be in log2 form.  They are not copied, and
+// must outlive the path finder.
+static Path_Finder *Make_Path_Finder( Measurements *table, int n_rows, Distributions *shape, Distributions *velocity )
+{ Path_Finder *self = (Path_Finder*) Guarded_Malloc( sizeof(Path_Finder), "Make_Path_Finder" );
+  int n = shape->n_measures;
+  memset( self, 0, sizeof(Path_Finder) );
+  self->table      = table;
+  self->n_rows     = n_rows;
+  self->n_measures = n;
+  self->shape      = shape;
+  self->velocity   = velocity;
+
+  self->shape_bins = (int*) Guarded_Malloc( sizeof(int)*n_rows*n, "Make_Path_Finder - shape bins" );
+  Distributions_Bin_Table( shape, table, n_rows, self->shape_bins );
+  self->shape_log2p = _log2p_to_float( shape );
+  self->vel_log2p   = _log2p_to_float( velocity );
+  return self;
+}
 
+static void Free_Path_Finder( Path_Finder *self )
+{ if(!self) return;
+  free( self->shape_bins );
+  free( self->shape_log2p );
+  free( self->vel_log2p );
+  if( self->x          ) free( self->x          );
+  if( self->node_log2p ) free( self->node_log2p );
+  if( self->acc        ) free( self->acc        );
+  if( self->row        ) free( self->row        );
+  if( self->argmax     ) free( self->argmax     );
+  if( self->frame      ) free( self->frame      );
+  if( self->result     ) free( self->result     );
+  free( self );
+}
 
-#ifdef DEBUG_FIND_PATH
-  assert(start->state == end->state );
-  assert(pathlength>0);   // end should come after start
-  assert(start<end);      // table should be sorted
-#endif
+// Returns a pointer to storage owned by the path finder.  It is overwritten
+// by the next call.  Entries for frames with no rows are NULL.
+static Measurements **Path_Finder_Find( Path_Finder *self, Measurements *start, Measurements *end, int minstate, int *npath )
+{ static const float baseline_log2p = -1e7f;
+  Measurements *table = self->table,
+               *eot   = self->table + self->n_rows,
+               *first, *last, *r;
+  int pathlength = end->fid - start->fid - 1,
+      n          = self->n_measures,
+      st         = start->state - minstate,
+      nnode, nframe, i, k, f;
 
   if(npath) *npath = pathlength;
+  self->result = (Measurements**) request_storage( self->result, &self->result_size, sizeof(Measurements*), pathlength, "Path_Finder - result" );
+  memset( self->result, 0, sizeof(Measurements*)*pathlength );
+
+  r = start;
+  while( r < eot && r->fid == start->fid ) r++;   // scroll to first frame after
+  first = r;
+  while( r < eot && r->fid != end->fid ) r++;     // scroll to last item in gray area
+  last = r - 1;
+  if( last < first )
+    return self->result;
+  nnode = (int)(last - first) + 3;                // one extra for the end state, and one for the start
+
+  self->x          = (double*) request_storage( self->x,          &self->x_size,          sizeof(double), n*nnode, "Path_Finder - lattice" );
+  self->node_log2p = (float*)  request_storage( self->node_log2p, &self->node_log2p_size, sizeof(float),  nnode,   "Path_Finder - lattice" );
+  self->acc        = (float*)  request_storage( self->acc,        &self->acc_size,        sizeof(float),  nnode,   "Path_Finder - lattice" );
+  self->row        = (int*)    request_storage( self->row,        &self->row_size,        sizeof(int),    nnode,   "Path_Finder - lattice" );
+  self->argmax     = (int*)    request_storage( self->argmax,     &self->argmax_size,     sizeof(int),    nnode,   "Path_Finder - lattice" );
+  self->frame      = (int*)    request_storage( self->frame,      &self->frame_size,      sizeof(int),    nnode+1, "Path_Finder - lattice" );
 
   //
-  // count number of nodes (includes start and end)
+  // init lattice
   //
-  { Measurements *row = start;
-    while( row->fid == start->fid && row < eot) row++; // scroll to first frame after
-    first = row;
-    while( row->fid != end->fid && row < eot ) row++; // scroll to last item in gray area
-    last = row - 1;
-#ifdef DEBUG_FIND_PATH
-    assert( last > first );
-#endif
+  self->row[0]       = (int)(start - table);
+  self->row[nnode-1] = (int)(end   - table);
+  for( k=1, r=first; r<=last; r++, k++ )
+    self->row[k] = (int)(r - table);
+
+  nframe = 0;
+  self->frame[nframe++] = 0;
+  for( k=1; k<nnode-1; k++ )
+    if( k==1 || table[self->row[k]].fid != table[self->row[k-1]].fid )
+      self->frame[nframe++] = k;
+  self->frame[nframe++] = nnode-1;
+  self->frame[nframe]   = nnode;
+
+  for( i=0; i<n; i++ )
+  { double *x = self->x + i*nnode;
+    for( k=0; k<nnode; k++ )
+      x[k] = table[self->row[k]].data[i];
   }
-  nnode  = last - first + 3; //one extra for the end state, and one for the start
-
-  lattice = request_storage( lattice, &lattice_size, sizeof(LatticeNode), nnode, "alloc lattice" );
 
-  //
-  // init lattice
-  //
-  { Measurements *row, *next, *nextnext;
-    LatticeNode  *cur = lattice + 1;
-
-    memset(lattice, 0, sizeof(lattice)*nnode);
-
-    for( cur = lattice; cur < lattice + nnode; cur++ )
-      cur->max = baseline_log2p;
-
-    cur = lattice + 1;
-    row = first;
-    next = row;
-    while( next->fid == row->fid && next < eot)
-      next++; // scroll to first frame after
-
-    lattice[nnode-1].row = end;
-    lattice[0].row = start;
-    lattice[0].children  = lattice + 1;
-    lattice[0].nchildren = next - first;
-    while(next <= last && next < eot)
-    { nextnext = next;
-      while( nextnext->fid == next->fid && nextnext < eot)
-        nextnext++; // scroll to second frame after (for child count)
-
-      for( ; row < next; row++ )
-      { cur->row       = row;
-        cur->children  = lattice + (next-first + 1);
-        cur->nchildren = nextnext - next;
-        cur++;
-      }
-#ifdef DEBUG_FIND_PATH
-      assert( row == next );
-#endif
-      next = nextnext;
-    }
-    while(row <= last && row < eot) // last row all point to end
-    { for( ; row < next; row++ )
-      { cur->row       = row;
-        cur->children  = lattice + nnode - 1; // (next-first + 1);
-        cur->nchildren = 1;
-        cur++;
-      }
-#ifdef DEBUG_FIND_PATH
-      assert( next-first+1 == nnode-1 );
-      assert( row == next );
-#endif
-      next = nextnext;
+  { float *hists = self->shape_log2p + st * n * self->shape->n_bins;
+    int nbins = self->shape->n_bins;
+    for( k=0; k<nnode-1; k++ )  // the end is never a parent
+    { int *bins = self->shape_bins + self->row[k]*n;
+      float acc = 0.0f;
+      for( i=0; i<n; i++ )
+        acc += hists[ nbins*i + bins[i] ];
+      self->node_log2p[k] = acc;
     }
   }
 
   //
   // Find best path through lattice
-  // Note that nodes in array are already in topological order
-  // Update children's parent pointer to point to the parent maximizing
-  // probability.
+  // Each child gets the parent maximizing the transition probability.
   //
-  { LatticeNode *cur;
-    int st = start->state;
-    for( cur = lattice; cur < lattice + nnode - 1; cur++ ) //resist the urge to do the end
-    { Measurements *currow = cur->row;
-      LatticeNode *child;
-      double self_likelihood = Eval_Likelihood_Log2( shape, currow->data, st-minstate );
-      { for(child = cur->children;
-            child < cur->children + cur->nchildren;
-            child++)
-        { double logp;
-          logp = Eval_Velocity_Likelihood_Log2( velocity, currow->data, child->row->data, st-minstate )
-                + self_likelihood;
+  { float  *hists = self->vel_log2p + st * n * self->velocity->n_bins;
+    double *mn    = self->velocity->bin_min,
+           *delta = self->velocity->bin_delta;
+    int     nbins = self->velocity->n_bins;
+    for( f=0; f<nframe-1; f++ )
+    { int p0 = self->frame[f],
+          np = self->frame[f+1] - p0,
+          c;
+      float *acc  = self->acc,
+            *node = self->node_log2p + p0;
+      for( c=self->frame[f+1]; c<self->frame[f+2]; c++ )
+      { float best = baseline_log2p;
+        int   arg  = -1;
+        for( k=0; k<np; k++ )
+          acc[k] = 0.0f;
+        for( i=0; i<n; i++ )
+        { const double *xp = self->x + i*nnode + p0;
+          const double  xc = self->x[ i*nnode + c ],
+                        m  = mn[i],
+                        d  = delta[i];
+          const float  *h  = hists + nbins*i;
+          for( k=0; k<np; k++ )
+          { double v = xc - xp[k];
+            acc[k] += h[ _bin( v*v, m, d, nbins ) ];
+          }
+        }
+        for( k=0; k<np; k++ )
+        { float logp = acc[k] + node[k];
 #ifdef DEBUG_FIND_PATH
-          debug("State: %2d Max: %7.7f Cur: %7.7f %p %p\n", st, child->max, logp, currow->data, child->row->data );
+          debug("State: %2d Max: %7.7f Cur: %7.7f %d %d\n", st+minstate, best, logp, self->row[p0+k], self->row[c] );
 #endif
-          if( logp > child->max )
-          { child->max    = logp;
-            child->argmax = cur;
+          if( logp > best )
+          { best = logp;
+            arg  = p0 + k;
           }
         }
+        self->argmax[c] = arg;
       }
     }
   }
@@ -1127,20 +1397,45 @@ Measurements **Find_Path( Measurements *sorted_table,
   //
   // trace back
   //
-  result = request_storage(
-      result,
-      &result_size,
-      sizeof(Measurements*),
-      pathlength,
-      "alloc result in find paths (solve gray areas)" );
-  { LatticeNode  *node = lattice + nnode - 1;
-    Measurements **cur = result + pathlength;
-    while( (node = node->argmax) != lattice )
-      *(--cur) = node->row;
+  // Each node is written to the slot for its frame, so frames that have no
+  // rows stay NULL.
+  k = self->argmax[nnode-1];
+  while( k > 0 )
+  { Measurements *row = table + self->row[k];
+    self->result[ row->fid - start->fid - 1 ] = row;
+    k = self->argmax[k];
   }
+  return self->result;
+}
 
-  return result;
+SHARED_EXPORT
+Measurements **Find_Path( Measurements *sorted_table,
+                          int n_rows,
+                         Distributions *shape,
+                         Distributions *velocity,
+                         Measurements *start,
+                         Measurements *end,
+                         int minstate,
+                         int *npath)
+{ static Measurements **result    = NULL;
+  static size_t         result_size = 0;
+  Path_Finder *finder;
+  Measurements **path;
+  int n;
 
+#ifdef DEBUG_FIND_PATH
+  assert(start->state == end->state );
+  assert(end->fid - start->fid - 1 > 0);   // end should come after start
+  assert(start<end);      // table should be sorted
+#endif
+  // Only the rows from start to end are visited.
+  finder = Make_Path_Finder( start, (int)(end - start) + 1, shape, velocity );
+  path   = Path_Finder_Find( finder, start, end, minstate, &n );
+  result = (Measurements**) request_storage( result, &result_size, sizeof(Measurements*), n, "alloc result in find paths (solve gray areas)" );
+  memcpy( result, path, sizeof(Measurements*)*n );
+  Free_Path_Finder( finder );
+  if(npath) *npath = n;
+  return result;
 }
 
 // This function takes a table of measurements where some subset of the frames
@@ -1181,6 +1476,7 @@ void Solve( Measurements *table, int n_rows, int n_shape_bins, int n_vel_bins )
 
   { int *gray_areas = Guarded_Malloc(nframes * sizeof(int), "in solve - alloc gray_areas");
     int ngray = 0;
+    Path_Finder *finder = Make_Path_Finder( table, n_rows, shape, velocity );
 
     // Compute trajectories -
     // Each is an array, nframes long, of pointers into the table
@@ -1233,7 +1529,7 @@ void Solve( Measurements *table, int n_rows, int n_shape_bins, int n_vel_bins )
               assert(start && end);
               debug("Running find path from frame %5d to %5d\n", start->fid, end->fid);
 #endif
-              path = Find_Path( table, n_rows, shape, velocity, start, end, minstate, &npath );
+              path = Path_Finder_Find( finder, start, end, minstate, &npath );
               memcpy( t + gray_areas[j], path, sizeof(Measurements*)*npath);
 #ifdef DEBUG_SOLVE_GRAY_AREAS
               assert( start->fid == path[0]->fid      - 1 );
@@ -1262,6 +1558,7 @@ void Solve( Measurements *table, int n_rows, int n_shape_bins, int n_vel_bins )
     } // end context - trajs
 
     free( gray_areas );
+    Free_Path_Finder( finder );
   }
 #ifdef DEBUG_SOLVE_GRAY_AREAS
   debug("***  Leaving  ***************     DEBUG_SOLVE_GRAY_AREAS\n");
@@ -1367,3 +1664,247 @@ int main(int argc, char *argv[])
   return err;
 }
 #endif // TEST_SOLVE_GRAY_AREAS
+
+#if defined(TEST_FIND_PATH_BENCHMARK) || defined(TEST_FIND_PATH_GAPS)
+/*
+ * Synthetic tables for the Find_Path tests.
+ *
+ * Each frame has `whiskers` smoothly moving whiskers and `clutter` random
+ * segments, with 8 measurements per row like the ones `measure` writes.
+ * Whiskers are labelled except in a gap of `gap` frames in the middle of
+ * the movie.  The true label of every whisker row is its wid.
+ */
+static unsigned int synth_seed = 1;
+static double synth_rand(void) // uniform on [0,1)
+{ synth_seed = synth_seed*1664525u + 1013904223u;
+  return (synth_seed>>8) / 16777216.0;
+}
+
+static Measurements *synth_table( int nframes, int nwhiskers, int nclutter, int gap0, int gap1, int *n_rows )
+{ int nper = nwhiskers + nclutter,
+      n    = nframes * nper,
+      fid, k;
+  Measurements *table = Alloc_Measurements_Table( n, 8 );
+  for( fid=0; fid<nframes; fid++ )
+    for( k=0; k<nper; k++ )
+    { Measurements *row = table + fid*nper + k;
+      double *d = row->data;
+      row->fid = fid;
+      row->wid = k;
+      if( k < nwhiskers )
+      { double th = 2.0*M_PI*fid/50.0 + k;
+        row->state = (fid>=gap0 && fid<gap1) ? -1 : k;
+        d[0] = 150.0 + 40.0*k + 2.0*synth_rand();                      // length
+        d[1] = 500.0 + 50.0*synth_rand();                              // score
+        d[2] = -60.0 + 30.0*k + 15.0*sin(th) + synth_rand();           // angle
+        d[3] = 0.002*k + 0.001*cos(th) + 0.0002*synth_rand();          // curvature
+        d[4] = 100.0 + 25.0*k + 2.0*synth_rand();                      // follicle x
+        d[5] =  50.0 + 2.0*synth_rand();                               // follicle y
+        d[6] = d[4] + d[0]*cos(d[2]*M_PI/180.0);                       // tip x
+        d[7] = d[5] + d[0]*sin(d[2]*M_PI/180.0);                       // tip y
+      } else
+      { row->state = -1;
+        d[0] =  10.0 + 300.0*synth_rand();
+        d[1] = 100.0 + 300.0*synth_rand();
+        d[2] = -90.0 + 180.0*synth_rand();
+        d[3] = 0.02*(synth_rand()-0.5);
+        d[4] = 640.0*synth_rand();
+        d[5] = 480.0*synth_rand();
+        d[6] = 640.0*synth_rand();
+        d[7] = 480.0*synth_rand();
+      }
+    }
+  *n_rows = n;
+  return table;
+}
+
+// The solver's bin counts are parameters.
+static void synth_load_params(void)
+{ char* paramfile = "default.parameters";
+  if(Load_Params_File(paramfile))
+  { warning(
+            "Could not load parameters from file: %s\n"
+            "Writing %s\n"
+            "\tTrying again\n",paramfile,paramfile);
+    Print_Params_File(paramfile);
+    if(Load_Params_File(paramfile))
+      error("\tStill could not load parameters.\n");
+  }
+}
+#endif
+
+#ifdef TEST_FIND_PATH_BENCHMARK
+#include <time.h>
+/*
+ * Times Solve() on a synthetic table with a long gap.  Solve() has to fill in
+ * the gap.  The fraction of gap rows that get their true label back is
+ * reported alongside the time.
+ */
+char *Spec[] = {"[-h|--help] | [--frames <int>] [--whiskers <int>] [--clutter <int>] [--gap <int>] [--repeat <int>]", NULL};
+int main(int argc, char *argv[])
+{ int nframes, nwhiskers, nclutter, gap, repeat, gap0, i;
+  double elapsed = 0.0, accuracy = 0.0;
+
+  Process_Arguments(argc,argv,Spec,0);
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+      "--------------------------\n"
+      "Find_Path benchmark\n"
+      "--------------------------\n"
+      "\n"
+      "Times Solve() on a synthetic table where every whisker is unlabelled\n"
+      "for a long gap of frames.\n"
+      "\n"
+      "--frames   Number of frames.  Default: 5000\n"
+      "--whiskers Labelled whiskers per frame.  Default: 5\n"
+      "--clutter  Unlabelled segments per frame.  Default: 10\n"
+      "--gap      Number of unlabelled frames.  Default: 2000\n"
+      "--repeat   Number of runs to average.  Default: 3\n");
+  nframes   = Is_Arg_Matched("--frames")   ? Get_Int_Arg("--frames")   : 5000;
+  nwhiskers = Is_Arg_Matched("--whiskers") ? Get_Int_Arg("--whiskers") : 5;
+  nclutter  = Is_Arg_Matched("--clutter")  ? Get_Int_Arg("--clutter")  : 10;
+  gap       = Is_Arg_Matched("--gap")      ? Get_Int_Arg("--gap")      : 2000;
+  repeat    = Is_Arg_Matched("--repeat")   ? Get_Int_Arg("--repeat")   : 3;
+  synth_load_params();
+  if( gap > nframes-2 ) gap = nframes-2;
+  gap0 = (nframes-gap)/2;
+
+  for( i=0; i<repeat; i++ )
+  { Measurements *table;
+    int n_rows, r, hit = 0;
+    clock_t clock0;
+    synth_seed = 1;
+    table  = synth_table( nframes, nwhiskers, nclutter, gap0, gap0+gap, &n_rows );
+    clock0 = clock();
+    Solve( table, n_rows, IDENTITY_SOLVER_SHAPE_NBINS, IDENTITY_SOLVER_VELOCITY_NBINS );
+    elapsed += (double)(clock()-clock0)/((double)(CLOCKS_PER_SEC));
+    for( r=0; r<n_rows; r++ )
+      if( table[r].fid>=gap0 && table[r].fid<gap0+gap && table[r].wid<nwhiskers )
+        hit += ( table[r].state == table[r].wid );
+    accuracy += hit / (double)(gap*nwhiskers);
+    Free_Measurements_Table(table);
+  }
+  progress("frames %d  whiskers %d  clutter %d  gap %d\n"
+           "Solve: %8.2f ms   gap rows recovered: %5.1f%%\n",
+           nframes, nwhiskers, nclutter, gap,
+           1e3*elapsed/repeat, 100.0*accuracy/repeat );
+  return 0;
+}
+#endif // TEST_FIND_PATH_BENCHMARK
+
+#ifdef TEST_FIND_PATH_GAPS
+/*
+ * Find_Path across a gap where some frames have no rows at all.
+ * Each entry of the path belongs to one frame.  Entries for frames with no
+ * rows must be NULL and every other entry must come from its own frame.
+ */
+#define NFRAMES   60
+#define NWHISKERS 3
+#define NCLUTTER  4
+#define GAP0      20
+#define GAP1      40
+
+// Drops every row in frame `fid`.  Rows keep their data.
+static void drop_frame( Measurements *table, int *n_rows, int fid )
+{ int i, j;
+  for( i=0, j=0; i<*n_rows; i++ )
+    if( table[i].fid != fid )
+      table[j++] = table[i];
+  *n_rows = j;
+}
+
+static int is_hole( int *holes, int fid )
+{ for( ; *holes>=0; holes++ )
+    if( *holes == fid )
+      return 1;
+  return 0;
+}
+
+// `holes` is terminated by -1.
+static int check_paths( int *holes )
+{ Measurements *table;
+  Distributions *shape, *velocity;
+  int n_rows, minstate, maxstate, k, j, ok = 1;
+
+  synth_seed = 1;
+  table = synth_table( NFRAMES, NWHISKERS, NCLUTTER, GAP0, GAP1, &n_rows );
+  for( j=0; holes[j]>=0; j++ )
+    drop_frame( table, &n_rows, holes[j] );
+
+  // As in Solve()
+  Sort_Measurements_Table_State_Time( table, n_rows );
+  _count_n_states( table, n_rows, 1, &minstate, &maxstate );
+  Measurements_Table_Compute_Velocities( table, n_rows );
+  shape    = Build_Distributions( table, n_rows, IDENTITY_SOLVER_SHAPE_NBINS );
+  velocity = Build_Velocity_Distributions( table, n_rows, IDENTITY_SOLVER_VELOCITY_NBINS ); // table is now in time order
+  Distributions_Dilate( shape );
+  Distributions_Dilate( velocity );
+  Distributions_Normalize( shape );
+  Distributions_Normalize( velocity );
+  Distributions_Apply_Log2( shape );
+  Distributions_Apply_Log2( velocity );
+
+  for( k=0; k<NWHISKERS && ok; k++ )
+  { Measurements *start = NULL, *end = NULL, **path;
+    int i, npath;
+    for( i=0; i<n_rows; i++ )
+    { if( table[i].fid==GAP0-1 && table[i].state==k ) start = table+i;
+      if( table[i].fid==GAP1   && table[i].state==k ) end   = table+i;
+    }
+    path = Find_Path( table, n_rows, shape, velocity, start, end, minstate, &npath );
+    if( npath != GAP1-GAP0 )
+    { printf("\t*** Whisker %d: path has %d entries.  Expected %d.\n",k,npath,GAP1-GAP0);
+      ok = 0;
+    }
+    for( j=0; j<npath && ok; j++ )
+    { int fid = GAP0 + j;
+      if( is_hole(holes,fid) ? (path[j]!=NULL)
+                             : (!path[j] || path[j]->fid!=fid) )
+      { printf("\t*** Whisker %d: bad entry for frame %d.\n",k,fid);
+        ok = 0;
+      }
+    }
+  }
+
+  Free_Distributions( shape );
+  Free_Distributions( velocity );
+  Free_Measurements_Table( table );
+  return ok;
+}
+
+static int test_no_holes     ( void ) { int holes[] = { -1 };                 return check_paths( holes ); }
+static int test_middle_hole  ( void ) { int holes[] = { 30, -1 };             return check_paths( holes ); }
+static int test_edge_holes   ( void ) { int holes[] = { GAP0, GAP1-1, -1 };   return check_paths( holes ); }
+static int test_adjacent_holes(void ) { int holes[] = { 25, 26, 27, -1 };     return check_paths( holes ); }
+
+static int (*tests[])( void ) = { test_no_holes,
+                                  test_middle_hole,
+                                  test_edge_holes,
+                                  test_adjacent_holes,
+                                  NULL };
+
+char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ int i, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Find_Path Gap Test                                           \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Links whiskers across an unlabelled gap in a synthetic table \n"
+      "| where some frames have no rows.  Each path entry must be the \n"
+      "| whisker's row in its own frame, or NULL for an empty frame.  \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+  synth_load_params();
+
+  for( i=0; tests[i]; i++ )
+  { int ok = tests[i]();
+    printf("--- TEST %d --- %s\n", i+1, ok?"PASSED":"FAILED");
+    nfailed += !ok;
+  }
+  return nfailed;
+}
+#endif // TEST_FIND_PATH_GAPS
@@ -5,6 +5,7 @@
 #include "ffmpeg_adapt.h"
 #include "adjust_scan_bias.h"
 #include "error.h"
+#include "profile.h"
 #include <string.h>
 
 #define ENDL "\n"
@@ -159,6 +160,26 @@ static pf_fetch get_[] =
   FFMPEG_Fetch
 };
 
+/* Crop fast paths.  NULL where the crop is copied out of the full frame. */
+typedef Image*       (*pf_fetch_rect)( void*, int, int, int, int, int );
+typedef int          (*pf_set_crop)  ( void*, int, int, int, int );
+
+static Image *Seq_Fetch_Rect( void *ctx, int iframe, int x, int y, int width, int height )
+{ return Seq_Read_Image_Rect_Static_Storage( (SeqReader*)ctx, iframe, x, y, width, height );
+}
+
+static pf_fetch_rect get_rect_[] =
+{ NULL,
+  Seq_Fetch_Rect,
+  NULL
+};
+
+static pf_set_crop set_crop_[] =  // decoder crops before returning frames from get_
+{ NULL,
+  NULL,
+  FFMPEG_Set_Crop
+};
+
 static pf_get_nframes nframes_[] =
 { Stack_Get_Depth,
   Seq_Get_Depth,
@@ -211,6 +232,11 @@ typedef struct _video_t
                 mx;
   unsigned int  nframes;
           void *fp;
+           int  crop_x,       // crop rectangle.  crop_w is 0 for full frames.
+                crop_y,
+                crop_w,
+                crop_h,
+                crop_native;  // the backend's get_ already returns the crop
 } video_t;
 
 video_t* video_open(char *path)
@@ -284,13 +310,60 @@ Error:
   return 0;
 }
 
+static Image *copy_rect( Image *im, int x, int y, int width, int height )
+{ Image *out = Make_Image( im->kind, width, height );
+  int j, row = width*im->kind;
+  for( j=0; j<height; j++ )
+    memcpy( out->array + j*row, im->array + ((y+j)*im->width + x)*im->kind, row );
+  return out;
+}
+
+/// Restricts frames returned by video_get() to a rectangle.
+/// Pass width or height <= 0 to restore full frames.
+/// Scan bias statistics are computed over full frames first.  For a crop
+/// with an even origin, bias correction matches the full-frame result.
+/// \returns 1 on success, 0 otherwise
+int video_set_crop(video_t *self, int x, int y, int width, int height)
+{ kind_t k = self->kind;
+  Image *im;
+  TRY( is_valid_kind(k));
+  if( self->crop_native )
+    TRY( set_crop_[k](self->fp,0,0,0,0) );
+  self->crop_w = self->crop_h = self->crop_native = 0;
+  if( width<=0 || height<=0 )
+    return 1;
+
+  if( !self->valid_stats )
+    TRY( video_compute_stats(self,20));
+  TRY( im=get_[k](self->fp,0));
+  TRY( x>=0 && y>=0 && x+width<=im->width && y+height<=im->height );
+  self->crop_x = x;
+  self->crop_y = y;
+  self->crop_w = width;
+  self->crop_h = height;
+  if( set_crop_[k] )
+    self->crop_native = set_crop_[k](self->fp,x,y,width,height);
+  return 1;
+Error:
+  return 0;
+}
+
 Image* video_get(video_t *self, unsigned int iframe, int apply_line_bias_correction)
 { Image *im;
   kind_t k = self->kind;
+  PROFILE_BEGIN(PROFILE_DECODE);
   TRY( is_valid_kind(k));
   SILENTTRY( iframe<self->nframes);
-  TRY( im=get_[k](self->fp,iframe));
-  im = Copy_Image(im);
+  if( !self->crop_w || self->crop_native )
+  { TRY( im=get_[k](self->fp,iframe));
+    im = Copy_Image(im);
+  } else if( get_rect_[k] )
+  { TRY( im=get_rect_[k](self->fp,iframe,self->crop_x,self->crop_y,self->crop_w,self->crop_h));
+    im = Copy_Image(im);
+  } else
+  { TRY( im=get_[k](self->fp,iframe));
+    im = copy_rect(im,self->crop_x,self->crop_y,self->crop_w,self->crop_h);
+  }
   if(apply_line_bias_correction)
   { if(!self->valid_stats)
       TRY( video_compute_stats(self,20));
@@ -300,8 +373,11 @@ Image* video_get(video_t *self, unsigned int iframe, int apply_line_bias_correct
     else
       image_adjust_scan_bias_v(im,self->vgain);
   }
+  PROFILE_END(PROFILE_DECODE);
+  PROFILE_COUNT(PROFILE_FRAMES_DECODED,1);
   return im;
 Error:
+  PROFILE_END(PROFILE_DECODE);
   return NULL;
 }
 
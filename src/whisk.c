@@ -22,9 +22,13 @@
 #include "bar.h"
 #include "bar_io.h"
 #include "merge.h"
+#include "roi.h"
 
 #include "whisker_io.h"
 #include "error.h"
+#include "common.h"
+#include "thread.h"
+#include "profile.h"
 
 #include "parameters/param.h"
 
@@ -49,40 +53,276 @@ void check_usage(void)
  * load()
  */
 
+static video_t *video=NULL;
+
 Image *load(char *path, int index, int *nframes)
 { 
-  static video_t *v=NULL;
   Image *im=NULL;
   if(index>=0)
-  { if(!v)       TRY(v=video_open(path),ErrorOpen);
-    if(nframes) *nframes=video_frame_count(v);
-    TRY(im=video_get(v,index,1),ErrorRead);
+  { if(!video)   TRY(video=video_open(path),ErrorOpen);
+    if(nframes) *nframes=video_frame_count(video);
+    TRY(im=video_get(video,index,1),ErrorRead);
   } else
-  { if(v) video_close(&v);
+  { if(video) video_close(&video);
   }
   return im;
 ErrorRead:
-  video_close(&v);
+  video_close(&video);
   return NULL;
 ErrorOpen:
   return NULL;
 }
 
+/*
+ * Frame range
+ */
+
+static void parse_frames( char *spec, int depth, int *start, int *stop )
+// "start:stop" selects frames start through stop-1.  Either number may be
+// left out to mean the first or last frame.  stop is clipped to the movie.
+{ char *c = spec, *e;
+  *start = 0;
+  *stop  = depth;
+  if( *c!=':' )
+  { *start = (int) strtol( c, &e, 10 );
+    if( e==c ) goto Error;
+    c = e;
+  }
+  if( *c++!=':' ) goto Error;
+  if( *c )
+  { *stop = (int) strtol( c, &e, 10 );
+    if( e==c || *e ) goto Error;
+  }
+  *stop = MIN( *stop, depth );
+  if( *start<0 || *start>=*stop )
+    error("No frames to trace in %s.  The movie has %d frames.\n",spec,depth);
+  return;
+Error:
+  error("Could not parse --frames %s.  Expected <start>:<stop>.\n",spec);
+}
+
+static int file_has_data( char *filename )
+{ FILE *fp = fopen( filename, "rb" );
+  int64_t size = 0;
+  if( !fp )
+    return 0;
+  if( FSEEK64( fp, 0, SEEK_END )==0 )
+    size = FTELL64( fp );
+  fclose( fp );
+  return size>0;
+}
+
+/*
+ * Region of interest
+ */
+
+#define ROI_MARGIN (2*TLEN+3) // detector support.  Detectors centered in the region see real pixels.
+
+static Roi *load_roi( int width, int height )
+// Combines --roi and --mask.  Returns NULL if neither was given.
+{ Roi *roi = NULL;
+  if( Is_Arg_Matched("--roi") )
+    if( !(roi = Roi_Parse( Get_String_Arg("--roi") )) )
+      error("Could not use the region of interest given by --roi.\n");
+  if( Is_Arg_Matched("--mask") )
+  { Roi *mask = Read_Roi_Mask( Get_String_Arg("--mask") );
+    if( !mask )
+      error("Could not use the region of interest mask given by --mask.\n");
+    if( roi )
+    { Roi *both = Roi_Intersect( roi, mask );
+      Free_Roi( roi );
+      Free_Roi( mask );
+      roi = both;
+    } else
+    { roi = mask;
+    }
+  }
+  if( (Is_Arg_Matched("--roi") || Is_Arg_Matched("--mask")) &&
+      !(roi && (roi = Roi_Clip( roi, width, height ))) )
+    error("The region of interest does not overlap the movie (%d x %d).\n",width,height);
+  return roi;
+}
+
+static Image *crop_image( Image *image, Roi_Window *window )
+{ Image *out = Make_Image( image->kind, window->width, window->height );
+  int j;
+  for( j=0; j<window->height; j++ )
+    memcpy( out->array + j*window->width,
+            image->array + (window->y+j)*image->width + window->x,
+            window->width );
+  return out;
+}
+
+/* Some tracing thresholds are estimated from the first frame traced and then
+ * kept (see pin_local_area_thresholds).  A run that starts after frame 0 uses
+ * the ones from frame 0 so it traces the same as a full run would.
+ */
+static void pin_first_frame_thresholds( char *movie, Roi *roi, Roi_Window *window )
+{ Local_Area_Thresholds t;
+  Image *image;
+  if( !(image = load(movie,0,NULL)) )
+    return;
+  if( roi && ( image->width!=window->width || image->height!=window->height ) )
+  { Image *c = crop_image( image, window );
+    Free_Image( image );
+    image = c;
+  }
+  compute_local_area_thresholds( image, &t );
+  pin_local_area_thresholds( &t );
+  Free_Image( image );
+}
+
+/*
+ * Bar tracking
+ */
+
+static void invert_uint8( Image *s )
+// Invert intensity so bar is bright
+{ uint8 *p, *e = s->array + (s->width)*(s->height);
+  for( p = s->array; p < e; p++ )
+    (*p) = 255 - (*p);
+}
+
+static void locate_bar( Bar_Locator *locator, Image *image, double *x, double *y )
+// `image` is inverted in place.
+{ invert_uint8( image );
+  Compute_Bar_Location_r( locator,
+                          image,
+                          x,              // Output: x position
+                          y,              // Output: y position
+                          15,             // Neighbor distance
+                          15,             // minimum contour length
+                          0,              // minimum intensity of interest
+                          255,            // maximum intentity of interest
+                          10.0,           // minimum radius of interest
+                          30.0          );// maximum radius of interest
+}
+
+typedef struct _bar_block_t
+{ Image       **frames;
+  double       *x,
+               *y;
+  int           n;
+  Bar_Locator **locators; // one per worker
+  int           nworkers;
+} bar_block_t;
+
+static void bar_block_worker( void *ctx, int iworker )
+{ bar_block_t *job = (bar_block_t*)ctx;
+  int i;
+  for( i=iworker; i<job->n; i+=job->nworkers )
+    locate_bar( job->locators[iworker], job->frames[i], job->x+i, job->y+i );
+}
+
+/* Bar positions only.
+ * Frames are decoded in blocks on this thread and bars are located on
+ * worker threads.  Results are written in frame order.
+ */
+static int track_bar( char *movie, char *bar_file_name, int start, int stop, int coarse )
+{ bar_block_t job;
+  BarFile *bfile;
+  int i,j,nblock;
+
+  job.nworkers = thread_count();
+  nblock       = 4*job.nworkers;
+  job.frames   = (Image**)       Guarded_Malloc( sizeof(Image*)*nblock,            "track_bar" );
+  job.x        = (double*)       Guarded_Malloc( sizeof(double)*nblock,            "track_bar" );
+  job.y        = (double*)       Guarded_Malloc( sizeof(double)*nblock,            "track_bar" );
+  job.locators = (Bar_Locator**) Guarded_Malloc( sizeof(Bar_Locator*)*job.nworkers,"track_bar" );
+  for( i=0; i<job.nworkers; i++ )
+  { job.locators[i] = Make_Bar_Locator();
+    Bar_Locator_Set_Scale( job.locators[i], coarse );
+  }
+
+  bfile = Bar_File_Open( bar_file_name, "w" );
+  progress( "Finding bar positions\n" );
+  for( i=start; i<stop; i+=nblock )
+  { job.n = MIN( nblock, stop-i );
+    for( j=0; j<job.n; j++ )
+      TRY( job.frames[j]=load(movie,i+j,NULL), ErrorRead );
+    parallel_for( job.nworkers, job.nworkers, bar_block_worker, &job );
+    for( j=0; j<job.n; j++ )
+    { Bar_File_Append_Bar( bfile, Bar_Static_Cast(i+j,job.x[j],job.y[j]) );
+      Free_Image( job.frames[j] );
+    }
+    progress_meter(i+job.n-1, start, stop-1, 79, "Finding     post: [%5d/%5d]",i+job.n-1,stop);
+  }
+  printf("\n");
+  Bar_File_Close( bfile );
+  for( i=0; i<job.nworkers; i++ )
+    Free_Bar_Locator( job.locators[i] );
+  free( job.locators );
+  free( job.frames );
+  free( job.x );
+  free( job.y );
+  return 1;
+ErrorRead:
+  while( j-- )
+    Free_Image( job.frames[j] );
+  Bar_File_Close( bfile );
+  error("Could not read frame %d from %s"ENDL,i+j,movie);
+  return 0;
+}
+
 /*
  * MAIN
  */
-static char *Spec[] = { "<movie:string> <prefix:string>", NULL };
+static char *Spec[] = { "[-h|--help] | <movie:string> <prefix:string> [--bar] [--no-whisk]",
+                        "             [--coarse <int>]",
+                        "             [--frames <string>] [--resume]",
+                        "             [--roi <string>] [--mask <string>]",
+                        "             [--profile <string>] [--timeline <string>]", NULL };
 int main(int argc, char *argv[])
 { char  *whisker_file_name, *bar_file_name, *prefix;
   size_t prefix_len;
-  FILE  *fp;
   Image *bg=0, *image=0;
-  int    i,depth;
+  int    i,depth,start,stop,coarse,
+         write_failed=0;
+  Roi   *roi=NULL;
+  Roi_Window window;
+  Image *roi_mask=NULL;
 
   char * movie;
 
   /* Process Arguments */
   Process_Arguments(argc,argv,Spec,0);
+
+  help( Is_Arg_Matched("-h") || Is_Arg_Matched("--help"),
+      "----------------\n"
+      "Whisker tracing\n"
+      "----------------\n"
+      "\n"
+      "Traces whisker segments in <movie> and writes them to <prefix>.whiskers\n"
+      "\n"
+      "\t--bar       Also locate the bar (pole) in each frame and write the\n"
+      "\t            positions to <prefix>.bar.  Each frame is decoded once\n"
+      "\t            and used for both whiskers and bar.\n"
+      "\t--no-whisk  Skip whisker tracing.  Requires --bar.  Bar positions\n"
+      "\t            are computed on multiple threads (see WHISK_THREADS).\n"
+      "\t--coarse    With --bar, first look for the bar in frames shrunk by\n"
+      "\t            this factor, then refine it at full resolution near that\n"
+      "\t            estimate.  Faster on large frames.  Try 2 or 4.\n"
+      "\t--frames    Only trace frames <start> through <stop>-1, given as\n"
+      "\t            <start>:<stop>.  Either may be left out.  Use this to\n"
+      "\t            split a movie into shards.  See whisker_merge.\n"
+      "\t--resume    If <prefix>.whiskers exists, continue after the last\n"
+      "\t            frame that was completely written to it instead of\n"
+      "\t            starting over.  Not with --bar.\n"
+      "\t--roi       Only trace whiskers in this region.  Give a rectangle as\n"
+      "\t            x,y,width,height or a polygon as x0,y0,x1,y1,x2,y2,...\n"
+      "\t            Only the part of each frame around the region is decoded\n"
+      "\t            and searched.  Output is in full-frame coordinates.\n"
+      "\t--mask      Only trace whiskers where this 8-bit tiff is nonzero.\n"
+      "\t            With --roi, the region is where both agree.\n"
+      "\t--profile   Write per-stage timings and counters as JSON to this file.\n"
+      "\t--timeline  With --profile, also write a Chrome trace event timeline\n"
+      "\t            (chrome://tracing) of each stage to this file.\n"
+      "\n" );
+  if( Is_Arg_Matched("--profile") )
+    profile_start( Get_String_Arg("--profile"), Is_Arg_Matched("--timeline") ? Get_String_Arg("--timeline") : NULL );
+  else if( Is_Arg_Matched("--timeline") )
+    error("--timeline can only be used with --profile.\n");
+
   { char* paramfile = "default.parameters";
     if(Load_Params_File("default.parameters"))
     { warning(
@@ -113,6 +353,27 @@ int main(int argc, char *argv[])
   TRY(image = load(movie,0,&depth),ErrorOpen);
 
   progress("Done.\n");
+  start = 0;
+  stop  = depth;
+  if( Is_Arg_Matched("--frames") )
+    parse_frames( Get_String_Arg("--frames"), depth, &start, &stop );
+  coarse = Is_Arg_Matched("--coarse") ? Get_Int_Arg("--coarse") : 1;
+  if( coarse < 1 )
+    error("--coarse must be at least 1.\n");
+  if( Is_Arg_Matched("--resume") && Is_Arg_Matched("--bar") )
+    error("--resume can not be used with --bar.\n");
+  if( Is_Arg_Matched("--no-whisk") && !Is_Arg_Matched("--bar") )
+    error("--no-whisk needs --bar.  There is nothing else to do.\n");
+
+  if( !Is_Arg_Matched("--no-whisk") && (roi = load_roi( image->width, image->height )) )
+  { Roi_Get_Window( roi, ROI_MARGIN, image->width, image->height, &window );
+    roi_mask = Roi_Window_Mask( roi, &window );
+    progress("Tracing a %d pixel region in a %d x %d window at (%d,%d).\n",
+             Roi_Area(roi), window.width, window.height, window.x, window.y );
+    if( !Is_Arg_Matched("--bar") )  // the bar needs full frames
+      if( !video_set_crop( video, window.x, window.y, window.width, window.height ) )
+        warning("Could not crop frames while decoding.  Full frames will be decoded.\n");
+  }
 
   // No background subtraction (init to blank)
   { bg = Make_Image( image->kind, image->width, image->height );
@@ -120,69 +381,104 @@ int main(int argc, char *argv[])
   }
   Free_Image( image );
 
-#if 0
   /*
-   * Bar tracking
+   * Bar tracking only
    */
-  if( !Is_Arg_Matched("--no-bar") )
-  { double x,y;
-    BarFile *bfile = Bar_File_Open( bar_file_name, "w" );
-    progress( "Finding bar positions\n" );
-    for( i=0; i<depth; i++ )
-    { progress_meter(i, 0, depth-1, 79, "Finding     post: [%5d/%5d]",i,depth);
-      image = load(movie,i,NULL);
-      invert_uint8( image );
-      Compute_Bar_Location(   image,
-                              &x,             // Output: x position
-                              &y,             // Output: y position
-                              15,             // Neighbor distance
-                              15,             // minimum contour length
-                              0,              // minimum intensity of interest
-                              255,            // maximum intentity of interest
-                              10.0,           // minimum radius of interest
-                              30.0          );// maximum radius of interest
-      Bar_File_Append_Bar( bfile, Bar_Static_Cast(i,x,y) );
-      Free_Image(image);
-    }
-    Bar_File_Close( bfile );
-  }
-#endif
-
+  if( Is_Arg_Matched("--no-whisk") )
+  { track_bar( movie, bar_file_name, start, stop, coarse );
+  } else
   /*
-   * Trace whisker segments
+   * Trace whisker segments (and bar)
    */
-  //if( !Is_Arg_Matched("--no-whisk") )
-  { int           nTotalSegs = 0;
-    Whisker_Seg   *wv;
+  { Whisker_Seg   *wv;
     int wv_n; 
-    WhiskerFile wfile = Whisker_File_Open(whisker_file_name,"whiskbin1","w");
+    WhiskerFile wfile;
+    BarFile    *bfile = NULL;
+    Bar_Locator *locator = NULL;
+
+    if( Is_Arg_Matched("--resume") && file_has_data(whisker_file_name) )
+    { int next;
+      if( !(wfile = Whisker_File_Resume(whisker_file_name,&next)) )
+        error("Could not resume tracing into %s.\n",whisker_file_name);
+      start = MAX( start, next );
+      progress("Resuming %s at frame %d.\n",whisker_file_name,start);
+    } else
+    { wfile = Whisker_File_Open(whisker_file_name,"whiskbin1","w");
+    }
+
+    if( Is_Arg_Matched("--bar") )
+    { bfile   = Bar_File_Open( bar_file_name, "w" );
+      locator = Make_Bar_Locator();
+      Bar_Locator_Set_Scale( locator, coarse );
+    }
 
     if( !wfile )
     { fprintf(stderr, "Warning: couldn't open %s for writing.", whisker_file_name);
     } else
-    { //int step = (int) pow(10,round(log10(depth/100)));
-      for( i=0; i<depth; i++ )
+    { Whisker_File_Async( wfile, 0 );
+      if( start>0 )
+        pin_first_frame_thresholds( movie, roi, &window );
+      //int step = (int) pow(10,round(log10(depth/100)));
+      for( i=start; i<stop; i++ )
       //for( i=450; i<460; i++ )
       //for( i=0; i<depth; i+= step )
       { int k;
-        TRY(image=load(movie,i,NULL),ErrorRead);
-        progress_meter(i, 0, depth, 79, "Finding segments: [%5d/%5d]",i,depth-1);
-        wv = find_segments(i, image, bg, &wv_n);                                                // Thrashing heap
+        if( !(image=load(movie,i,NULL)) )
+        { // Keep what was traced.  The writer thread is drained and the file
+          // can be resumed.
+          Whisker_File_Close(wfile);
+          if( bfile )
+          { Bar_File_Close( bfile );
+            Free_Bar_Locator( locator );
+          }
+          goto ErrorRead;
+        }
+        progress_meter(i, start, stop, 79, "Finding segments: [%5d/%5d]",i,stop-1);
+        if( bfile )
+        { double x,y;
+          Image *inv = Copy_Image( image );
+          locate_bar( locator, inv, &x, &y );
+          Bar_File_Append_Bar( bfile, Bar_Static_Cast(i,x,y) );
+          Free_Image( inv );
+        }
+        if( roi )
+        { Seed_Candidate *seeds;
+          int nseeds;
+          if( image->width!=window.width || image->height!=window.height )
+          { Image *t = crop_image( image, &window );
+            Free_Image( image );
+            image = t;
+          }
+          seeds = find_segment_seeds( image, roi_mask, &nseeds );
+          wv    = trace_segment_seeds( i, image, roi_mask, seeds, nseeds, &wv_n );
+        } else
+        { wv = find_segments(i, image, bg, &wv_n);                                              // Thrashing heap
+        }
         k = Remove_Overlapping_Whiskers_One_Frame( wv, wv_n, 
                                                    image->width, image->height, 
                                                    2.0,    // scale down by this
                                                    2.0,    // distance threshold
                                                    0.5 );  // significant overlap fraction
+        if( roi )
+          Roi_Translate_Segments( wv, k, &window );
         Whisker_File_Append_Segments(wfile, wv, k);
         Free_Whisker_Seg_Vec( wv, wv_n );
         Free_Image(image);
       }
       printf("\n");
-      Whisker_File_Close(wfile);
+      write_failed = !Whisker_File_Close(wfile);
+    }
+    if( bfile )
+    { Bar_File_Close( bfile );
+      Free_Bar_Locator( locator );
     }
   }
   load(movie,-1,NULL); // Close (and free)
   if(bg) Free_Image( bg );
+  if(roi_mask) Free_Image( roi_mask );
+  Free_Roi( roi );
+  if( write_failed )
+    error("Could not write %s"ENDL,whisker_file_name);
   return 0;
 ErrorRead:
   load(movie,-1,NULL); // Close (and free)
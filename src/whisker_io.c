@@ -15,8 +15,13 @@
 
 #include "error.h"
 #include "trace.h"
+#include "common.h"
+#include "utilities.h"
+#include "profile.h"
+#include "thread.h"
 
 #include <string.h>
+#include <errno.h>
 
 #define WF_CALL(a,name)  (*(((_WhiskerFile*)a)->name))
 #define WF_DEREF(a,name) (((_WhiskerFile*)a)->name)
@@ -49,6 +54,14 @@ typedef void           (*pf_wf_close )           (FILE* file);
 typedef void           (*pf_wf_append_segments)  (FILE* file, Whisker_Seg *w, int n);
 typedef void           (*pf_wf_write_segments)   (FILE* file, Whisker_Seg *w, int n);
 typedef Whisker_Seg*   (*pf_wf_read_segments)    (FILE* file, int *n);                        // Gets all the segements
+typedef int            (*pf_wf_read_segment)     (FILE* file, Whisker_Seg *w);                // Gets the next segment. Returns 1, 0 at the end, -1 on error.  Optional (NULL).
+typedef int            (*pf_wf_skip_segment)     (FILE* file, Whisker_Seg *w);                // Gets only id,time,len of the next segment. Returns 1, 0 at the end, -1 on error.  Optional (NULL).
+typedef FILE*          (*pf_wf_resume)           (const char* filename, int *next_fid);       // Reopens a partly written file for appending. Optional (NULL).
+typedef int            (*pf_wf_count)            (FILE* file);                                // Number of segments in a file open for writing.  Optional (NULL).
+typedef size_t         (*pf_wf_pack_segments)    (char* buf, Whisker_Seg *w, int n);          // Serializes segments.  Returns bytes.  Sizes only if buf is NULL.  Optional (NULL).
+typedef size_t         (*pf_wf_pack_footer)      (char* buf, int count);                      // Serializes the footer.  Returns bytes.  Optional (NULL).
+
+typedef struct _wf_writer wf_writer;
 
 typedef struct __WhiskerFile
 { FILE                   *fp;
@@ -59,6 +72,16 @@ typedef struct __WhiskerFile
   pf_wf_append_segments   append_segments;
   pf_wf_write_segments    write_segments;
   pf_wf_read_segments     read_segments;
+  pf_wf_read_segment      read_segment;
+  pf_wf_skip_segment      skip_segment;
+  pf_wf_resume            resume;
+  pf_wf_count             count;
+  pf_wf_pack_segments     pack_segments;
+  pf_wf_pack_footer       pack_footer;
+  wf_writer              *writer;     // non-NULL once Whisker_File_Async has been called
+  Whisker_Seg            *loaded;     // formats without read_segment are read whole and handed out one at a time
+  int                     nloaded,    // -1 until loaded
+                          iloaded;
 } _WhiskerFile;
 
 /***********************************************************************
@@ -124,6 +147,53 @@ pf_wf_read_segments Whisker_File_Read_Segments_Table[] = {
   read_segments_whisker_old
 };
 
+pf_wf_read_segment Whisker_File_Read_Segment_Table[] = {
+  read_segment_whisker1,
+  read_segment_whiskpoly1,
+  read_segment_whiskbin1,
+  NULL
+};
+
+// whiskold has no per-segment reader.  See Whisker_File_Read_Segment.
+//
+// Text formats have no cheap way to skip a record
+pf_wf_skip_segment Whisker_File_Skip_Segment_Table[] = {
+  NULL,
+  skip_segment_whiskpoly1,
+  skip_segment_whiskbin1,
+  NULL
+};
+
+// Only whiskbin1 (what `trace` writes) can be resumed
+pf_wf_resume Whisker_File_Resume_Table[] = {
+  NULL,
+  NULL,
+  resume_whiskbin1,
+  NULL
+};
+
+// Formats that can be written by a writer thread (see Whisker_File_Async)
+pf_wf_count Whisker_File_Count_Table[] = {
+  NULL,
+  NULL,
+  peek_whiskbin1_footer,
+  NULL
+};
+
+pf_wf_pack_segments Whisker_File_Pack_Segments_Table[] = {
+  NULL,
+  NULL,
+  pack_segments_whiskbin1,
+  NULL
+};
+
+pf_wf_pack_footer Whisker_File_Pack_Footer_Table[] = {
+  NULL,
+  NULL,
+  pack_whiskbin1_footer,
+  NULL
+};
+
 
 /*********************************************************************** 
  * General interface
@@ -142,6 +212,32 @@ int Whisker_File_Autodetect( const char * filename, char** format )
   return -1; // indicate failure
 }
 
+static _WhiskerFile *alloc_whisker_file( int ifmt )
+{ _WhiskerFile *wf = (_WhiskerFile*) malloc( sizeof(_WhiskerFile) );
+  if( wf==NULL )
+  { warning("Out of memory in Whisker_File_Open\n");
+    return NULL;
+  }
+  wf->fp              = NULL;
+  wf->detect          = Whisker_File_Detectors_Table       [ifmt];
+  wf->open            = Whisker_File_Openers_Table         [ifmt];
+  wf->close           = Whisker_File_Closers_Table         [ifmt];
+  wf->append_segments = Whisker_File_Append_Segments_Table [ifmt];
+  wf->write_segments  = Whisker_File_Write_Segments_Table  [ifmt];
+  wf->read_segments   = Whisker_File_Read_Segments_Table   [ifmt];
+  wf->read_segment    = Whisker_File_Read_Segment_Table    [ifmt];
+  wf->skip_segment    = Whisker_File_Skip_Segment_Table    [ifmt];
+  wf->resume          = Whisker_File_Resume_Table          [ifmt];
+  wf->count           = Whisker_File_Count_Table           [ifmt];
+  wf->pack_segments   = Whisker_File_Pack_Segments_Table   [ifmt];
+  wf->pack_footer     = Whisker_File_Pack_Footer_Table     [ifmt];
+  wf->writer          = NULL;
+  wf->loaded          = NULL;
+  wf->nloaded         = -1;
+  wf->iloaded         = 0;
+  return wf;
+}
+
 SHARED_EXPORT
 WhiskerFile Whisker_File_Open(const char* filename, char* format, const char* mode )
 // Returns NULL on failure
@@ -179,17 +275,9 @@ WhiskerFile Whisker_File_Open(const char* filename, char* format, const char* mo
   /* 
    * Open
    */
-  { _WhiskerFile *wf = (_WhiskerFile*) malloc( sizeof(_WhiskerFile) );
+  { _WhiskerFile *wf = alloc_whisker_file( ifmt );
     if( wf==NULL )
-    { warning("Out of memory in Whisker_File_Open\n");
       goto Err;
-    }
-    wf->detect          = Whisker_File_Detectors_Table       [ifmt];
-    wf->open            = Whisker_File_Openers_Table         [ifmt];
-    wf->close           = Whisker_File_Closers_Table         [ifmt];
-    wf->append_segments = Whisker_File_Append_Segments_Table [ifmt];
-    wf->write_segments  = Whisker_File_Write_Segments_Table  [ifmt];
-    wf->read_segments   = Whisker_File_Read_Segments_Table   [ifmt];
     wf->fp = WF_CALL( wf, open )(filename, mode);
     if( wf->fp == NULL )
     { warning("Could not open file %s with mode %s.\n",filename,mode);
@@ -204,27 +292,384 @@ Err:
   return NULL;
 }
 
+/* Reopens a whiskers file that was being written by `trace` so that tracing
+ * can continue where it stopped.  Anything after the last complete frame is
+ * discarded.  *next_fid is set to the first frame to trace.  Segments should
+ * then be added with Whisker_File_Append_Segments.
+ *
+ * Returns NULL if the file can't be read or its format doesn't support
+ * resuming.
+ */
+SHARED_EXPORT
+WhiskerFile Whisker_File_Resume(const char* filename, int *next_fid )
+{ char *format;
+  _WhiskerFile *wf;
+  int ifmt = Whisker_File_Autodetect(filename,&format);
+  if( ifmt==-1 )
+    return NULL;
+  if( !Whisker_File_Resume_Table[ifmt] )
+  { warning("Can not resume writing %s.  Files in the %s format can't be appended to safely.\n",filename,format);
+    return NULL;
+  }
+  if( !(wf = alloc_whisker_file(ifmt)) )
+    return NULL;
+  if( !(wf->fp = WF_CALL( wf, resume )(filename, next_fid)) )
+  { free(wf);
+    return NULL;
+  }
+  return wf;
+}
+
+/***********************************************************************
+ * Writer thread
+ *
+ * Appended segments are serialized into blocks of about `block_bytes`.  A
+ * block is queued once it is full or WF_MAX_SECONDS after its first frame,
+ * which bounds the work lost if tracing is interrupted.  Queued blocks are
+ * written by a separate thread.  Each block goes out with a single fwrite,
+ * followed by the footer for the segments written so far.  The file position
+ * is then moved back over the footer so the next block overwrites it.
+ *
+ * A block only ever holds whole frames and its footer is written after its
+ * records, so if the process dies the file ends either at a valid footer or
+ * in the middle of the last block.  Either way it can be resumed (see
+ * Whisker_File_Resume).
+ *
+ * At most WF_MAX_QUEUED blocks wait to be written.  When the disk can't keep
+ * up, Whisker_File_Append_Segments blocks until the writer catches up.
+ */
+#define WF_DEFAULT_BLOCK (4<<20)
+#define WF_MAX_QUEUED    4
+#define WF_MAX_SECONDS   2.0
+
+typedef struct _wf_block
+{ struct _wf_block *next;
+  size_t            size;     // bytes of records
+  size_t            footer;   // bytes of footer, which follows the records
+  size_t            max;      // bytes allocated for data
+  double            t0;       // wall_clock() when the first frame was added
+  char             *data;
+} wf_block;
+
+struct _wf_writer
+{ FILE        *fp;
+  size_t       block_bytes;
+  int          count;         // segments in the file once everything queued has been written
+  wf_block    *current;       // being filled by the caller
+  wf_block    *head, *tail;   // queued for the writer thread
+  wf_block    *spare;         // written blocks kept for reuse
+  int          nqueued;
+  int          stop;
+  int          failed;        // errno of the first failed write.  Later blocks are dropped.
+  mutex_t     *lock;
+  condition_t *changed;
+  thread_t    *thread;
+};
+
+static void *writer_main( void *arg )
+{ wf_writer *w = (wf_writer*) arg;
+  mutex_lock( w->lock );
+  while( 1 )
+  { wf_block *blk;
+    size_t n;
+    while( !w->head && !w->stop )
+      condition_wait( w->changed, w->lock );
+    if( !(blk = w->head) )
+      break;
+    mutex_unlock( w->lock );
+    n = blk->size + blk->footer;
+    errno = 0;
+    if( !w->failed
+        && ( fwrite( blk->data, 1, n, w->fp ) != n
+          || fseek( w->fp, -(long)blk->footer, SEEK_CUR ) != 0 ) )
+      w->failed = errno ? errno : EIO;
+    mutex_lock( w->lock );
+    w->head = blk->next;
+    if( !w->head )
+      w->tail = NULL;
+    blk->next = w->spare;
+    w->spare  = blk;
+    w->nqueued--;
+    condition_broadcast( w->changed );
+  }
+  mutex_unlock( w->lock );
+  return NULL;
+}
+
+static wf_block *writer_take_block( wf_writer *w )
+{ wf_block *blk;
+  mutex_lock( w->lock );
+  if( (blk = w->spare) )
+    w->spare = blk->next;
+  mutex_unlock( w->lock );
+  if( !blk )
+  { blk = (wf_block*) Guarded_Malloc( sizeof(wf_block), "Whisker_File_Async" );
+    blk->data = NULL;
+    blk->max  = 0;
+  }
+  blk->next   = NULL;
+  blk->size   = 0;
+  blk->footer = 0;
+  blk->t0     = wall_clock();
+  return blk;
+}
+
+// Ends the current block and hands it to the writer thread.
+static void writer_queue( _WhiskerFile *wf )
+{ wf_writer *w = wf->writer;
+  wf_block *blk = w->current;
+  if( !blk || !blk->size )
+    return;
+  w->current  = NULL;
+  blk->footer = (*wf->pack_footer)( blk->data + blk->size, w->count );
+  mutex_lock( w->lock );
+  while( w->nqueued >= WF_MAX_QUEUED )
+    condition_wait( w->changed, w->lock );
+  if( w->tail ) w->tail->next = blk;
+  else          w->head       = blk;
+  w->tail = blk;
+  w->nqueued++;
+  condition_broadcast( w->changed );
+  mutex_unlock( w->lock );
+}
+
+// Returns the number of bytes added.
+static size_t writer_append( _WhiskerFile *wf, Whisker_Seg *wv, int n )
+{ wf_writer *w = wf->writer;
+  wf_block *blk;
+  size_t size = (*wf->pack_segments)( NULL, wv, n );
+  if( !(blk = w->current) )
+    blk = w->current = writer_take_block( w );
+  blk->data  = (char*) request_storage( blk->data, &blk->max, 1,
+                                        blk->size + size + (*wf->pack_footer)( NULL, 0 ),
+                                        "Whisker_File_Append_Segments" );
+  blk->size += (*wf->pack_segments)( blk->data + blk->size, wv, n );
+  w->count  += n;
+  if( blk->size >= w->block_bytes || wall_clock() - blk->t0 > WF_MAX_SECONDS )
+    writer_queue( wf );
+  return size;
+}
+
+static void free_blocks( wf_block *blk )
+{ while( blk )
+  { wf_block *next = blk->next;
+    if( blk->data ) free( blk->data );
+    free( blk );
+    blk = next;
+  }
+}
+
+// Writes whatever is left and stops the thread.  Returns 0 on success or the
+// errno of the first failed write.
+static int writer_close( _WhiskerFile *wf )
+{ wf_writer *w = wf->writer;
+  int failed;
+  writer_queue( wf );
+  mutex_lock( w->lock );
+  w->stop = 1;
+  condition_broadcast( w->changed );
+  mutex_unlock( w->lock );
+  thread_join( &w->thread );
+  failed = w->failed;
+  if( !failed && fflush( w->fp ) != 0 )
+    failed = errno ? errno : EIO;
+  free_blocks( w->current );
+  free_blocks( w->spare );
+  mutex_destroy( &w->lock );
+  condition_destroy( &w->changed );
+  free( w );
+  wf->writer = NULL;
+  return failed;
+}
+
+/* Hands writing over to a separate thread.  Segments passed to
+ * Whisker_File_Append_Segments are collected in memory and written in blocks
+ * of about `block_bytes` (a default is used if 0), and the segment count is
+ * kept in memory instead of being read back from the file for every frame.
+ * Call this right after Whisker_File_Open (mode "w") or Whisker_File_Resume.
+ * Don't read from the file afterwards.  Whisker_File_Close waits for
+ * everything to be written.
+ *
+ * Each call to Whisker_File_Append_Segments should add one whole frame.
+ *
+ * Returns 1 on success.  Returns 0, and leaves the file writing synchronously,
+ * if the format doesn't support it.
+ */
+SHARED_EXPORT
+int Whisker_File_Async( WhiskerFile wf, size_t block_bytes )
+{ _WhiskerFile *f = (_WhiskerFile*) wf;
+  wf_writer *w;
+  if( f->writer )
+    return 1;
+  if( !f->count || !f->pack_segments || !f->pack_footer )
+    return 0;
+  w = (wf_writer*) Guarded_Malloc( sizeof(wf_writer), "Whisker_File_Async" );
+  memset( w, 0, sizeof(wf_writer) );
+  w->fp          = f->fp;
+  w->block_bytes = block_bytes ? block_bytes : WF_DEFAULT_BLOCK;
+  w->count       = (*f->count)( f->fp );
+  w->lock        = mutex_create();
+  w->changed     = condition_create();
+  f->writer      = w;
+  if( !(w->thread = thread_create( writer_main, w )) )
+  { mutex_destroy( &w->lock );
+    condition_destroy( &w->changed );
+    free( w );
+    f->writer = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/* Closes the file, first waiting for the writer thread if there is one.
+ * Returns 1 on success, or 0 if some segments could not be written (or the
+ * stream saw an error).
+ */
 SHARED_EXPORT
-void Whisker_File_Close(WhiskerFile wf)
-{ WF_CALL( wf, close )( WF_DEREF(wf,fp) );
+int Whisker_File_Close(WhiskerFile wf)
+{ int err = 0;
+  if( WF_DEREF(wf,writer) )
+    err = writer_close( (_WhiskerFile*) wf );
+  else if( ferror( WF_DEREF(wf,fp) ) )
+    err = EIO;
+  if( err )
+    warning("Could not write whisker segments: %s\n"
+            "\tThe file may be resumed from the last segments that were written.\n",strerror(err));
+  WF_CALL( wf, close )( WF_DEREF(wf,fp) );
   WF_DEREF(wf,fp) = NULL;
   //wf->fp = NULL;
+  { _WhiskerFile *f = (_WhiskerFile*) wf; // segments that were loaded but never handed out
+    while( f->iloaded < f->nloaded )
+      Free_Whisker_Seg_Data( f->loaded + f->iloaded++ );
+    if( f->loaded ) free( f->loaded );
+  }
   free(wf);
+  return !err;
 }
 
 SHARED_EXPORT
 void Whisker_File_Append_Segments(WhiskerFile wf, Whisker_Seg *w, int n)
-{ WF_CALL( wf, append_segments )( WF_DEREF(wf,fp) ,w,n);
+{ FILE *fp = WF_DEREF(wf,fp);
+  int64_t pos;
+  if( WF_DEREF(wf,writer) )   // the file position belongs to the writer thread
+  { size_t bytes;
+    PROFILE_BEGIN(PROFILE_WRITE);
+    bytes = writer_append( (_WhiskerFile*) wf, w, n );
+    PROFILE_END(PROFILE_WRITE);
+    PROFILE_COUNT(PROFILE_BYTES_WRITTEN, bytes);
+    return;
+  }
+  pos = profile_on ? FTELL64(fp) : 0;
+  PROFILE_BEGIN(PROFILE_WRITE);
+  WF_CALL( wf, append_segments )( fp ,w,n);
+  PROFILE_END(PROFILE_WRITE);
+  PROFILE_COUNT(PROFILE_BYTES_WRITTEN, FTELL64(fp)-pos);
 }
 
 SHARED_EXPORT
 void Whisker_File_Write_Segments(WhiskerFile wf, Whisker_Seg *w, int n)
-{ WF_CALL( wf, write_segments )( WF_DEREF(wf,fp),w,n);
+{ FILE *fp = WF_DEREF(wf,fp);
+  int64_t pos;
+  if( WF_DEREF(wf,writer) )
+  { Whisker_File_Append_Segments( wf, w, n );
+    return;
+  }
+  pos = profile_on ? FTELL64(fp) : 0;
+  PROFILE_BEGIN(PROFILE_WRITE);
+  WF_CALL( wf, write_segments )( fp,w,n);
+  PROFILE_END(PROFILE_WRITE);
+  PROFILE_COUNT(PROFILE_BYTES_WRITTEN, FTELL64(fp)-pos);
 }
 
 SHARED_EXPORT
 Whisker_Seg* Whisker_File_Read_Segments(WhiskerFile wf, int *n)
-{ return WF_CALL(wf, read_segments)( WF_DEREF(wf,fp),n);
+{ FILE *fp = WF_DEREF(wf,fp);
+  int64_t pos = profile_on ? FTELL64(fp) : 0;
+  Whisker_Seg *wv;
+  PROFILE_BEGIN(PROFILE_READ);
+  wv = WF_CALL(wf, read_segments)( fp,n);
+  PROFILE_END(PROFILE_READ);
+  PROFILE_COUNT(PROFILE_BYTES_READ, FTELL64(fp)-pos);
+  return wv;
+}
+
+/* Reads the next segment into `w`.  The segment's arrays are allocated and
+ * should be released with Free_Whisker_Seg_Data.  Returns 1 on success, 0
+ * at the end of the file, and -1 if the file is truncated or can't be read.
+ *
+ * Use this to stream through a file without loading it all.  Don't mix it
+ * with Whisker_File_Read_Segments on the same WhiskerFile.  Formats that
+ * can't be read one segment at a time (whiskold) are loaded whole on the
+ * first call.
+ */
+SHARED_EXPORT
+int Whisker_File_Read_Segment(WhiskerFile wf, Whisker_Seg *w)
+{ _WhiskerFile *f = (_WhiskerFile*) wf;
+  if( f->read_segment )
+    return (*f->read_segment)( f->fp, w );
+  if( f->nloaded < 0 )
+  { int n;
+    f->loaded  = Whisker_File_Read_Segments( wf, &n );
+    f->nloaded = ( f->loaded || n==0 ) ? n : 0;
+    if( !f->loaded && n )
+      return -1;
+  }
+  if( f->iloaded >= f->nloaded )
+    return 0;
+  *w = f->loaded[ f->iloaded++ ];
+  return 1;
+}
+
+/* Reads the segments with frame id (time) in [fid_begin,fid_end).  Returns
+ * the segments in file order and sets *n to the count.  Returns NULL on
+ * failure, including when the file is truncated.  Release the result with
+ * Free_Whisker_Seg_Vec.
+ *
+ * For the binary formats, only the record headers of segments outside the
+ * range are read; their point data is skipped over.
+ */
+SHARED_EXPORT
+Whisker_Seg *Whisker_File_Read_Segments_Range(WhiskerFile wf, int fid_begin, int fid_end, int *n)
+{ FILE *fp = WF_DEREF(wf,fp);
+  pf_wf_skip_segment skip = WF_DEREF(wf,skip_segment);
+  Whisker_Seg *wv = NULL, w;
+  size_t wv_size = 0;
+  int k;
+  int64_t pos0 = profile_on ? FTELL64(fp) : 0;
+  *n = 0;
+  PROFILE_BEGIN(PROFILE_READ);
+  wv = request_storage( wv, &wv_size, sizeof(Whisker_Seg), 1, "Whisker_File_Read_Segments_Range" );
+  for(;;)
+  { if(skip)
+    { long long pos = FTELL64(fp);
+      if( (k = skip(fp,&w)) <= 0 )
+        break;
+      if( w.time<fid_begin || w.time>=fid_end )
+        continue;
+      if( pos<0 || FSEEK64(fp,pos,SEEK_SET) )
+      { k = -1;
+        break;
+      }
+    }
+    if( (k = Whisker_File_Read_Segment(wf,&w)) <= 0 )
+      break;
+    if( w.time<fid_begin || w.time>=fid_end )
+    { Free_Whisker_Seg_Data(&w);
+      continue;
+    }
+    wv = request_storage( wv, &wv_size, sizeof(Whisker_Seg), (*n)+1, "Whisker_File_Read_Segments_Range" );
+    wv[(*n)++] = w;
+  }
+  PROFILE_END(PROFILE_READ);
+  if( k<0 )
+    goto Error;
+  PROFILE_COUNT(PROFILE_BYTES_READ, FTELL64(fp)-pos0);
+  return wv;
+Error:
+  warning("Could not read the whiskers file.  It may be truncated.\n");
+  Free_Whisker_Seg_Vec( wv, *n );
+  *n = 0;
+  return NULL;
 }
 
 SHARED_EXPORT
@@ -238,6 +683,20 @@ Whisker_Seg *Load_Whiskers(const char *filename, char* format, int *n )
   return wv;
 }
 
+/* Loads the segments with frame id in [fid_begin,fid_end).
+ * See Whisker_File_Read_Segments_Range.
+ */
+SHARED_EXPORT
+Whisker_Seg *Load_Whiskers_Range(const char *filename, char* format, int fid_begin, int fid_end, int *n )
+{ Whisker_Seg *wv;
+  WhiskerFile wf = Whisker_File_Open(filename, format, "r");
+  if(!wf)
+    return NULL;
+  wv = Whisker_File_Read_Segments_Range( wf, fid_begin, fid_end, n);
+  Whisker_File_Close(wf);
+  return wv;
+}
+
 SHARED_EXPORT
 int  Save_Whiskers(const char *filename, char* format, Whisker_Seg *w, int n )
 { WhiskerFile wf;
@@ -249,10 +708,97 @@ int  Save_Whiskers(const char *filename, char* format, Whisker_Seg *w, int n )
   if(!wf)
     return 0;
   Whisker_File_Write_Segments(wf,w,n);
+  return Whisker_File_Close(wf);
+}
+
+/* Reads all the segments in a file into one flat, ragged array.
+ *
+ * The file is streamed, so only the flat arrays are held in memory.  Returns
+ * 1 on success and 0 on failure, including when the file is truncated.  On
+ * success, release `out` with Free_Whisker_Seg_Flat_Data.
+ */
+SHARED_EXPORT
+int Load_Whiskers_Flat(const char *filename, char *format, Whisker_Seg_Flat *out )
+{ WhiskerFile wf;
+  Whisker_Seg w;
+  int k;
+  size_t fid_size = 0, wid_size = 0, off_size = 0,
+         x_size   = 0, y_size   = 0, t_size   = 0, s_size = 0;
+
+  memset( out, 0, sizeof(Whisker_Seg_Flat) );
+  if( !(wf = Whisker_File_Open(filename, format, "r")) )
+    return 0;
+
+  out->offset = request_storage( out->offset, &off_size, sizeof(int64_t), 1, "Load_Whiskers_Flat" );
+  out->offset[0] = 0;
+  while( (k = Whisker_File_Read_Segment(wf,&w)) > 0 )
+  { int     i = out->n;
+    int64_t a = out->npoints,
+            b = a + w.len;
+    out->fid    = request_storage( out->fid   , &fid_size, sizeof(int)    , i+1, "Load_Whiskers_Flat" );
+    out->wid    = request_storage( out->wid   , &wid_size, sizeof(int)    , i+1, "Load_Whiskers_Flat" );
+    out->offset = request_storage( out->offset, &off_size, sizeof(int64_t), i+2, "Load_Whiskers_Flat" );
+    out->x      = request_storage( out->x     , &x_size  , sizeof(float)  , b  , "Load_Whiskers_Flat" );
+    out->y      = request_storage( out->y     , &y_size  , sizeof(float)  , b  , "Load_Whiskers_Flat" );
+    out->thick  = request_storage( out->thick , &t_size  , sizeof(float)  , b  , "Load_Whiskers_Flat" );
+    out->scores = request_storage( out->scores, &s_size  , sizeof(float)  , b  , "Load_Whiskers_Flat" );
+    out->fid[i]      = w.time;
+    out->wid[i]      = w.id;
+    out->offset[i+1] = b;
+    memcpy( out->x      + a, w.x     , sizeof(float)*w.len );
+    memcpy( out->y      + a, w.y     , sizeof(float)*w.len );
+    memcpy( out->thick  + a, w.thick , sizeof(float)*w.len );
+    memcpy( out->scores + a, w.scores, sizeof(float)*w.len );
+    out->n++;
+    out->npoints = b;
+    Free_Whisker_Seg_Data( &w );
+  }
   Whisker_File_Close(wf);
+  if( k<0 )
+  { warning("Could not read %s.  It may be truncated.\n",filename);
+    Free_Whisker_Seg_Flat_Data( out );
+    return 0;
+  }
   return 1;
 }
 
+/* Writes a flat, ragged array of segments.  The point data is not copied.
+ * Returns 1 on success and 0 on failure.
+ */
+SHARED_EXPORT
+int Save_Whiskers_Flat(const char *filename, char *format, Whisker_Seg_Flat *in )
+{ Whisker_Seg *wv;
+  int i, ok;
+  wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*in->n + 1, "Save_Whiskers_Flat" );
+  for( i=0; i<in->n; i++ )
+  { int64_t a = in->offset[i];
+    wv[i].id     = in->wid[i];
+    wv[i].time   = in->fid[i];
+    wv[i].len    = (int)( in->offset[i+1] - a );
+    wv[i].x      = in->x      + a;
+    wv[i].y      = in->y      + a;
+    wv[i].thick  = in->thick  + a;
+    wv[i].scores = in->scores + a;
+  }
+  ok = Save_Whiskers( filename, format, wv, in->n );
+  free(wv);
+  return ok;
+}
+
+SHARED_EXPORT
+void Free_Whisker_Seg_Flat_Data( Whisker_Seg_Flat *w )
+{ if(w)
+  { if( w->fid    ) free( w->fid    );
+    if( w->wid    ) free( w->wid    );
+    if( w->offset ) free( w->offset );
+    if( w->x      ) free( w->x      );
+    if( w->y      ) free( w->y      );
+    if( w->thick  ) free( w->thick  );
+    if( w->scores ) free( w->scores );
+    memset( w, 0, sizeof(Whisker_Seg_Flat) );
+  }
+}
+
 #ifdef WHISKER_IO_CONVERTER
 #include "utilities.h"
 static char *Spec[] = {"<source:string> <destination:string> <format:string> | -{h|help}", NULL};
@@ -286,3 +832,741 @@ int main(int argc, char *argv[]) {
 };
 #endif
 
+
+#if defined(WHISKER_MERGE) || defined(TEST_WHISKER_MERGE)
+#include <stdlib.h>
+/*
+ * Concatenates whiskers files traced from different frame ranges of the same
+ * movie (see trace --frames).  Shards may be listed in any order.  They are
+ * ordered by their first frame and copied one segment at a time, so memory
+ * use doesn't depend on the size of the shards.
+ *
+ * If shards overlap, frames already written from an earlier shard are
+ * skipped.
+ */
+#define MERGE_BATCH 1024  // segments buffered between appends
+
+typedef struct _shard_t
+{ char *name;
+  int   first;   // first frame id, or -1 if empty
+} shard_t;
+
+static int _cmp_shard_first( const void *a, const void *b )
+{ return ((shard_t*)a)->first - ((shard_t*)b)->first;
+}
+
+// Returns the number of segments written to `dest`.
+static int merge_shards( char *dest, char **names, int nshards )
+{ WhiskerFile in, out;
+  shard_t *shards;
+  Whisker_Seg *wv, w;
+  int i, k, n, last = -1, count = 0;
+
+  shards  = (shard_t*) Guarded_Malloc( sizeof(shard_t)*nshards, "whisker_merge" );
+  for( i=0; i<nshards; i++ )
+  { shards[i].name  = names[i];
+    if( !(in = Whisker_File_Open( shards[i].name, NULL, "r" )) )
+      error("Could not open %s for reading.\n",shards[i].name);
+    shards[i].first = -1;
+    if( (k = Whisker_File_Read_Segment( in, &w )) < 0 )
+      error("Could not read %s.  It may be truncated.\n",shards[i].name);
+    if( k )
+    { shards[i].first = w.time;
+      Free_Whisker_Seg_Data( &w );
+    }
+    Whisker_File_Close( in );
+  }
+  qsort( shards, nshards, sizeof(shard_t), _cmp_shard_first );
+
+  if( !(out = Whisker_File_Open( dest, NULL, "w" )) )
+    error("Could not open %s for writing.\n",dest);
+  wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*MERGE_BATCH, "whisker_merge" );
+  for( i=0; i<nshards; i++ )
+  { int floor = last+1,   // frames before this were written by an earlier shard
+        skipped = 0;
+    if( shards[i].first<0 )
+      continue;
+    if( !(in = Whisker_File_Open( shards[i].name, NULL, "r" )) )
+      error("Could not open %s for reading.\n",shards[i].name);
+    n = 0;
+    while( (k = Whisker_File_Read_Segment( in, wv+n )) > 0 )
+    { if( wv[n].time < floor )
+      { Free_Whisker_Seg_Data( wv+n );
+        skipped++;
+        continue;
+      }
+      last = MAX( last, wv[n].time );
+      if( ++n == MERGE_BATCH )
+      { Whisker_File_Append_Segments( out, wv, n );
+        count += n;
+        while( n-- )
+          Free_Whisker_Seg_Data( wv+n );
+        n = 0;
+      }
+    }
+    if( k<0 )
+      error("Could not read %s.  It may be truncated.\n",shards[i].name);
+    Whisker_File_Append_Segments( out, wv, n );
+    count += n;
+    while( n-- )
+      Free_Whisker_Seg_Data( wv+n );
+    Whisker_File_Close( in );
+    if( skipped )
+      warning("%s overlaps an earlier shard.  Skipped %d segments before frame %d.\n",
+              shards[i].name, skipped, floor );
+    progress("%s: frames %d to %d.\n",shards[i].name,shards[i].first,last);
+  }
+  if( !Whisker_File_Close( out ) )
+    error("Could not write %s.\n",dest);
+  progress("Wrote %d segments to %s.\n",count,dest);
+  free( wv );
+  free( shards );
+  return count;
+}
+#endif
+
+#ifdef WHISKER_MERGE
+static char *Spec[] = {"[-h|--help] | <dest:string> <source:string> ...", NULL};
+int main(int argc, char *argv[])
+{ char **names;
+  int i, nshards;
+
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+  { Print_Argument_Usage(stdout,0);
+    printf(
+      "--------------------------                                                   \n"
+      " Merge whisker shards                                                         \n"
+      "--------------------------                                                   \n"
+      "                                                                              \n"
+      "  Joins whiskers files traced from different frame ranges of one movie into   \n"
+      "  a single file in frame order.  See the --frames option of `trace`.          \n"
+      "                                                                              \n"
+      "  <dest>      Whiskers file to write.                                         \n"
+      "  <source>    Whiskers files to join, in any order.  If two overlap, frames   \n"
+      "              are taken from the one that starts first.                       \n"
+      "\n");
+    return 0;
+  }
+
+  nshards = Get_Repeat_Count("source");
+  names   = (char**) Guarded_Malloc( sizeof(char*)*nshards, "whisker_merge" );
+  for( i=0; i<nshards; i++ )
+    names[i] = Get_String_Arg("source",i+1);
+  merge_shards( Get_String_Arg("dest"), names, nshards );
+  free( names );
+  return 0;
+}
+#endif
+
+#if defined(TEST_WHISKER_IO_RESUME) || defined(TEST_WHISKER_MERGE) || defined(TEST_WHISKER_IO_FLAT) \
+ || defined(TEST_WHISKER_IO_RANGE)
+#include "test_fixtures.h"
+/*
+ * Test helpers
+ *
+ * Tests write synthetic segments to files in the working directory and check
+ * what comes back.  Some frames are empty (see test_fixtures.h).
+ */
+
+static Whisker_Seg *_test_make_segments( int fid_begin, int fid_end, int *n )
+{ Whisker_Seg *wv = NULL;
+  size_t size = 0;
+  int f, k, j;
+  *n = 0;
+  for( f=fid_begin; f<fid_end; f++ )
+    for( k=0; k<TEST_ROWS_IN_FRAME(f); k++ )
+    { Whisker_Seg *w;
+      int len = 5 + (13*f+5*k)%20;
+      wv = (Whisker_Seg*) request_storage( wv, &size, sizeof(Whisker_Seg), (*n)+1, "test" );
+      w = wv + (*n)++;
+      w->id     = k;
+      w->time   = f;
+      w->len    = len;
+      w->x      = (float*) Guarded_Malloc( sizeof(float)*len, "test" );
+      w->y      = (float*) Guarded_Malloc( sizeof(float)*len, "test" );
+      w->thick  = (float*) Guarded_Malloc( sizeof(float)*len, "test" );
+      w->scores = (float*) Guarded_Malloc( sizeof(float)*len, "test" );
+      for( j=0; j<len; j++ )
+      { w->x[j]      = 10.0f*k + j + 0.5f*f;
+        w->y[j]      = 0.25f*j*(k+1);
+        w->thick[j]  = 1.0f + 0.01f*j;
+        w->scores[j] = f + k + 0.1f*j;
+      }
+    }
+  return wv;
+}
+
+static int _test_same_segments( Whisker_Seg *a, int na, Whisker_Seg *b, int nb )
+{ int i;
+  if( na!=nb )
+  { printf("\t*** Expected %d segments.  Got %d.\n",na,nb);
+    return 0;
+  }
+  for( i=0; i<na; i++ )
+  { if( a[i].id!=b[i].id || a[i].time!=b[i].time || a[i].len!=b[i].len )
+    { printf("\t*** Segment %d differs in id, time or len.\n",i);
+      return 0;
+    }
+    if(  memcmp( a[i].x,      b[i].x,      sizeof(float)*a[i].len )
+      || memcmp( a[i].y,      b[i].y,      sizeof(float)*a[i].len )
+      || memcmp( a[i].thick,  b[i].thick,  sizeof(float)*a[i].len )
+      || memcmp( a[i].scores, b[i].scores, sizeof(float)*a[i].len ) )
+    { printf("\t*** Segment %d differs in (x,y,thick,scores).\n",i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int _test_same_files( const char *a, const char *b )
+{ long na, nb;
+  char *da = _test_read_file(a,&na),
+       *db = _test_read_file(b,&nb);
+  int ok = da && db && na==nb && memcmp(da,db,na)==0;
+  if( !ok )
+    printf("\t*** %s and %s differ.\n",a,b);
+  if(da) free(da);
+  if(db) free(db);
+  return ok;
+}
+
+// Appends the segments for frames [fid_begin,fid_end) one frame at a time.
+static void _test_append_frames( WhiskerFile wf, Whisker_Seg *wv, int n, int fid_begin, int fid_end )
+{ int i = 0, j;
+  while( i<n && wv[i].time<fid_begin ) i++;
+  while( i<n && wv[i].time<fid_end )
+  { j = i+1;
+    while( j<n && wv[j].time==wv[i].time )
+      j++;
+    Whisker_File_Append_Segments( wf, wv+i, j-i );
+    i = j;
+  }
+}
+
+// Writes frames [fid_begin,fid_end) to a new whiskbin1 file.
+static int _test_write_frames( const char *name, Whisker_Seg *wv, int n, int fid_begin, int fid_end, int async )
+{ WhiskerFile wf = Whisker_File_Open( name, "whiskbin1", "w" );
+  if( !wf )
+    return 0;
+  if( async )
+    Whisker_File_Async( wf, 64 );
+  _test_append_frames( wf, wv, n, fid_begin, fid_end );
+  Whisker_File_Close( wf );
+  return 1;
+}
+
+// Writes the segments in the deprecated whiskold format, which can't be
+// written through a WhiskerFile.  Only y is stored; x is the column.
+static int _test_write_whiskold( const char *name, Whisker_Seg *wv, int n )
+{ FILE *fp = fopen( name, "w" );
+  int i, j;
+  if( !fp )
+    return 0;
+  for( i=0; i<n; i++ )
+  { fprintf( fp, "%d,%d,%d,%d", wv[i].time, wv[i].id, 0, wv[i].len-1 );
+    for( j=0; j<wv[i].len; j++ )
+      fprintf( fp, ",%g", wv[i].y[j] );
+    fprintf( fp, "\n" );
+  }
+  fclose( fp );
+  return 1;
+}
+
+// Saves the segments in `format` and cuts the file short inside the last
+// segment.
+static int _test_write_truncated( const char *name, char *format, Whisker_Seg *wv, int n )
+{ return Save_Whiskers( name, format, wv, n )
+      && _test_truncate_file( name, _test_file_size(name) - sizeof(int) - 7 );
+}
+
+static int _test_check_file( const char *name, Whisker_Seg *wv, int n )
+{ int n2, ok;
+  Whisker_Seg *wv2 = Load_Whiskers( name, NULL, &n2 );
+  if( !wv2 )
+  { printf("\t*** Could not read %s.\n",name);
+    return 0;
+  }
+  ok = _test_same_segments( wv, n, wv2, n2 );
+  Free_Whisker_Seg_Vec( wv2, n2 );
+  return ok;
+}
+#endif
+
+#ifdef TEST_WHISKER_IO_RESUME
+static const char *full_name = "test_resume_full.whiskers",
+                  *part_name = "test_resume_part.whiskers";
+
+// Resumes part_name, checks the first frame to be written and finishes it.
+static int _resume_and_finish( Whisker_Seg *wv, int n, int expect_next )
+{ int next = -1;
+  WhiskerFile wf = Whisker_File_Resume( part_name, &next );
+  if( !wf )
+  { printf("\t*** Could not resume %s.\n",part_name);
+    return 0;
+  }
+  if( next!=expect_next )
+  { printf("\t*** Expected to resume at frame %d.  Got %d.\n",expect_next,next);
+    Whisker_File_Close( wf );
+    return 0;
+  }
+  _test_append_frames( wf, wv, n, next, TEST_NFRAMES );
+  Whisker_File_Close( wf );
+  return _test_check_file( part_name, wv, n ) && _test_same_files( part_name, full_name );
+}
+
+// The last complete frame before `fid`.  Frames may be empty.
+static int _last_written_before( Whisker_Seg *wv, int n, int fid )
+{ int i, last = -1;
+  for( i=0; i<n && wv[i].time<fid; i++ )
+    last = wv[i].time;
+  return last;
+}
+
+// A file that was closed normally picks up after its last frame.
+static int test_resume_clean( Whisker_Seg *wv, int n )
+{ if( !_test_write_frames( part_name, wv, n, 0, 7, 0 ) )
+    return 0;
+  return _resume_and_finish( wv, n, _last_written_before(wv,n,7)+1 );
+}
+
+// Cut inside the last record.  The partly written frame is traced again.
+static int test_resume_cut_record( Whisker_Seg *wv, int n )
+{ if( !_test_write_frames( part_name, wv, n, 0, 8, 0 ) )
+    return 0;
+  if( !_test_truncate_file( part_name, _test_file_size(part_name) - sizeof(int) - 7 ) )
+    return 0;
+  return _resume_and_finish( wv, n, _last_written_before(wv,n,8) );
+}
+
+// Cut between the records of the last frame, before its footer was written.
+static int test_resume_cut_frame( Whisker_Seg *wv, int n )
+{ int i;
+  long record;
+  if( !_test_write_frames( part_name, wv, n, 0, 8, 0 ) )
+    return 0;
+  i = 0;                        // wv[i-1] is the last segment written
+  while( i<n && wv[i].time<8 )
+    i++;
+  record = 3*sizeof(int) + 4*sizeof(float)*wv[i-1].len;
+  if( !_test_truncate_file( part_name, _test_file_size(part_name) - sizeof(int) - record ) )
+    return 0;
+  return _resume_and_finish( wv, n, wv[i-1].time );
+}
+
+// Only the file type tag survived.
+static int test_resume_cut_header( Whisker_Seg *wv, int n )
+{ if( !_test_write_frames( part_name, wv, n, 0, 8, 0 ) )
+    return 0;
+  if( !_test_truncate_file( part_name, sizeof("bwhiskbin1\0") ) )
+    return 0;
+  return _resume_and_finish( wv, n, 0 );
+}
+
+// Frames written by the writer thread resume the same way.
+static int test_resume_async( Whisker_Seg *wv, int n )
+{ if( !_test_write_frames( part_name, wv, n, 0, 13, 1 ) )
+    return 0;
+  return _resume_and_finish( wv, n, _last_written_before(wv,n,13)+1 );
+}
+
+static int (*tests[])( Whisker_Seg*, int ) = { test_resume_clean,
+                                               test_resume_cut_record,
+                                               test_resume_cut_frame,
+                                               test_resume_cut_header,
+                                               test_resume_async,
+                                               NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Whisker_Seg *wv;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| whiskbin1 resume test                                        \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Writes a synthetic movie's segments, cuts the file short in  \n"
+      "| a few different places, resumes it and checks the result     \n"
+      "| matches a file written in one go.  Files are written to the  \n"
+      "| working directory.                                           \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  wv = _test_make_segments( 0, TEST_NFRAMES, &n );
+  if( !_test_write_frames( full_name, wv, n, 0, TEST_NFRAMES, 0 ) )
+    error("Could not write %s\n",full_name);
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](wv,n) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  remove( full_name );
+  remove( part_name );
+  Free_Whisker_Seg_Vec( wv, n );
+  return nfailed;
+}
+#endif
+
+#ifdef TEST_WHISKER_MERGE
+// Shards are listed out of order.  One is empty and one overlaps both its
+// neighbors.
+static int test_merge_shards( Whisker_Seg *wv, int n )
+{ char *names[] = { "test_merge_4_20.whiskers",
+                    "test_merge_empty.whiskers",
+                    "test_merge_3_7.whiskers",
+                    "test_merge_0_4.whiskers" };
+  int ranges[][2] = { {4,TEST_NFRAMES}, {0,0}, {3,7}, {0,4} },
+      i, count, ok;
+  for( i=0; i<4; i++ )
+    if( !_test_write_frames( names[i], wv, n, ranges[i][0], ranges[i][1], 0 ) )
+      return 0;
+  count = merge_shards( "test_merge.whiskers", names, 4 );
+  ok = count==n
+    && _test_check_file( "test_merge.whiskers", wv, n )
+    && _test_same_files( "test_merge.whiskers", "test_merge_full.whiskers" );
+  for( i=0; i<4; i++ )
+    remove( names[i] );
+  remove( "test_merge.whiskers" );
+  return ok;
+}
+
+// One shard is the whole movie.
+static int test_merge_one( Whisker_Seg *wv, int n )
+{ char *names[] = { "test_merge_full.whiskers" };
+  int ok = merge_shards( "test_merge.whiskers", names, 1 )==n
+        && _test_same_files( "test_merge.whiskers", "test_merge_full.whiskers" );
+  remove( "test_merge.whiskers" );
+  return ok;
+}
+
+static int (*tests[])( Whisker_Seg*, int ) = { test_merge_shards,
+                                               test_merge_one,
+                                               NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Whisker_Seg *wv;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| whisker_merge test                                           \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Splits a synthetic movie's segments into shards, merges them \n"
+      "| and checks the result matches a file written in one go.      \n"
+      "| Files are written to the working directory.                  \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  wv = _test_make_segments( 0, TEST_NFRAMES, &n );
+  if( !_test_write_frames( "test_merge_full.whiskers", wv, n, 0, TEST_NFRAMES, 0 ) )
+    error("Could not write test_merge_full.whiskers\n");
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](wv,n) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  remove( "test_merge_full.whiskers" );
+  Free_Whisker_Seg_Vec( wv, n );
+  return nfailed;
+}
+#endif
+
+#ifdef TEST_WHISKER_IO_FLAT
+// Checks the flat arrays hold the segments in `wv`, in order.
+static int _same_as_flat( Whisker_Seg *wv, int n, Whisker_Seg_Flat *flat )
+{ int i;
+  if( flat->n!=n )
+  { printf("\t*** Expected %d segments.  Got %d.\n",n,flat->n);
+    return 0;
+  }
+  if( flat->offset[0]!=0 || flat->offset[n]!=flat->npoints )
+  { printf("\t*** Offsets should run from 0 to npoints.\n");
+    return 0;
+  }
+  for( i=0; i<n; i++ )
+  { int64_t a = flat->offset[i];
+    if( flat->fid[i]!=wv[i].time || flat->wid[i]!=wv[i].id || flat->offset[i+1]-a!=wv[i].len )
+    { printf("\t*** Segment %d differs in fid, wid or length.\n",i);
+      return 0;
+    }
+    if(  memcmp( flat->x      + a, wv[i].x,      sizeof(float)*wv[i].len )
+      || memcmp( flat->y      + a, wv[i].y,      sizeof(float)*wv[i].len )
+      || memcmp( flat->thick  + a, wv[i].thick,  sizeof(float)*wv[i].len )
+      || memcmp( flat->scores + a, wv[i].scores, sizeof(float)*wv[i].len ) )
+    { printf("\t*** Segment %d differs in (x,y,thick,scores).\n",i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// The flat load of a file matches Load_Whiskers for each lossless format.
+static int test_flat_load( Whisker_Seg *wv, int n )
+{ char *formats[] = { "whiskbin1", "whisk1", NULL };
+  int i, ok = 1;
+  for( i=0; formats[i] && ok; i++ )
+  { Whisker_Seg_Flat flat;
+    Whisker_Seg *wv2;
+    int n2;
+    printf("\t%s\n",formats[i]);
+    if( !Save_Whiskers( "test_flat.whiskers", formats[i], wv, n ) )
+      return 0;
+    if( !(wv2 = Load_Whiskers( "test_flat.whiskers", NULL, &n2 )) )
+      return 0;
+    ok = Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+      && _same_as_flat( wv2, n2, &flat );
+    Free_Whisker_Seg_Flat_Data( &flat );
+    Free_Whisker_Seg_Vec( wv2, n2 );
+  }
+  remove( "test_flat.whiskers" );
+  return ok;
+}
+
+// Saving the flat arrays writes the same file as saving the segments.
+static int test_flat_save( Whisker_Seg *wv, int n )
+{ Whisker_Seg_Flat flat;
+  int ok;
+  if( !Save_Whiskers( "test_flat.whiskers", "whiskbin1", wv, n ) )
+    return 0;
+  ok = Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+    && Save_Whiskers_Flat( "test_flat_copy.whiskers", "whiskbin1", &flat )
+    && _test_same_files( "test_flat.whiskers", "test_flat_copy.whiskers" );
+  Free_Whisker_Seg_Flat_Data( &flat );
+  remove( "test_flat.whiskers" );
+  remove( "test_flat_copy.whiskers" );
+  return ok;
+}
+
+// An empty file gives empty arrays with the one offset.
+static int test_flat_empty( Whisker_Seg *wv, int n )
+{ Whisker_Seg_Flat flat;
+  int ok;
+  if( !Save_Whiskers( "test_flat.whiskers", "whiskbin1", wv, 0 ) )
+    return 0;
+  ok = Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+    && flat.n==0 && flat.npoints==0 && flat.offset && flat.offset[0]==0;
+  Free_Whisker_Seg_Flat_Data( &flat );
+  remove( "test_flat.whiskers" );
+  return ok;
+}
+
+// A missing file is reported, and leaves nothing to free.
+static int test_flat_missing( Whisker_Seg *wv, int n )
+{ Whisker_Seg_Flat flat;
+  remove( "test_flat.whiskers" );
+  return !Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+      && flat.n==0 && flat.offset==NULL && flat.x==NULL;
+}
+
+// whiskold has no per-segment reader.  The flat load still gets every
+// segment.
+static int test_flat_whiskold( Whisker_Seg *wv, int n )
+{ Whisker_Seg_Flat flat;
+  Whisker_Seg *wv2;
+  int n2, ok;
+  if( !_test_write_whiskold( "test_flat.whiskers", wv, n ) )
+    return 0;
+  if( !(wv2 = Load_Whiskers( "test_flat.whiskers", NULL, &n2 )) )
+    return 0;
+  ok = n2==n
+    && Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+    && _same_as_flat( wv2, n2, &flat );
+  Free_Whisker_Seg_Flat_Data( &flat );
+  Free_Whisker_Seg_Vec( wv2, n2 );
+  remove( "test_flat.whiskers" );
+  return ok;
+}
+
+// A file that was cut short is reported, and leaves nothing to free.
+static int test_flat_truncated( Whisker_Seg *wv, int n )
+{ char *formats[] = { "whiskbin1", "whiskpoly1", "whisk1", NULL };
+  int i, ok = 1;
+  for( i=0; formats[i] && ok; i++ )
+  { Whisker_Seg_Flat flat;
+    printf("\t%s\n",formats[i]);
+    if( !_test_write_truncated( "test_flat.whiskers", formats[i], wv, n ) )
+      return 0;
+    ok = !Load_Whiskers_Flat( "test_flat.whiskers", NULL, &flat )
+      && flat.n==0 && flat.offset==NULL && flat.x==NULL;
+  }
+  remove( "test_flat.whiskers" );
+  return ok;
+}
+
+static int (*tests[])( Whisker_Seg*, int ) = { test_flat_load,
+                                               test_flat_save,
+                                               test_flat_empty,
+                                               test_flat_missing,
+                                               test_flat_whiskold,
+                                               test_flat_truncated,
+                                               NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Whisker_Seg *wv;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Flat whisker I/O test                                        \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Round trips a synthetic movie's segments through             \n"
+      "| Load_Whiskers_Flat and Save_Whiskers_Flat and checks them    \n"
+      "| against the per-segment readers and writers.  Files are      \n"
+      "| written to the working directory.                            \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  wv = _test_make_segments( 0, TEST_NFRAMES, &n );
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](wv,n) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  Free_Whisker_Seg_Vec( wv, n );
+  return nfailed;
+}
+#endif
+
+#ifdef TEST_WHISKER_IO_RANGE
+// Frame ranges to read.  Frame 5 is empty and there are TEST_NFRAMES frames.
+static int ranges[][2] = { {0,TEST_NFRAMES}, {3,9}, {7,8}, {5,6}, {15,100},
+                           {-5,2}, {9,3}, {TEST_NFRAMES,TEST_NFRAMES+5} };
+
+// Each range read of the file matches the same frames picked out of the
+// whole file.
+static int _check_file_ranges( void )
+{ Whisker_Seg *all, *sel;
+  int i, j, k, nall, nsel, ok = 1;
+  if( !(all = Load_Whiskers( "test_range.whiskers", NULL, &nall )) )
+    return 0;
+  for( i=0; ok && i<(int)(sizeof(ranges)/sizeof(*ranges)); i++ )
+  { int beg = ranges[i][0],
+        end = ranges[i][1];
+    j = 0;                      // expect all[j] through all[k-1]
+    while( j<nall && all[j].time<beg )
+      j++;
+    k = j;
+    while( k<nall && all[k].time<end )
+      k++;
+    if( !(sel = Load_Whiskers_Range( "test_range.whiskers", NULL, beg, end, &nsel )) )
+    { printf("\t*** Could not read frames [%d,%d).\n",beg,end);
+      ok = 0;
+      break;
+    }
+    if( !_test_same_segments( all+j, k-j, sel, nsel ) )
+    { printf("\t*** Frames [%d,%d) differ.\n",beg,end);
+      ok = 0;
+    }
+    Free_Whisker_Seg_Vec( sel, nsel );
+  }
+  Free_Whisker_Seg_Vec( all, nall );
+  remove( "test_range.whiskers" );
+  return ok;
+}
+
+static int _check_ranges( Whisker_Seg *wv, int n, char *format )
+{ printf("\t%s\n",format);
+  return Save_Whiskers( "test_range.whiskers", format, wv, n )
+      && _check_file_ranges();
+}
+
+// Formats that skip over the point data of unselected segments.
+static int test_range_skip( Whisker_Seg *wv, int n )
+{ return _check_ranges( wv, n, "whiskbin1" )
+      && _check_ranges( wv, n, "whiskpoly1" );
+}
+
+// Formats that read every segment.
+static int test_range_read( Whisker_Seg *wv, int n )
+{ return _check_ranges( wv, n, "whisk1" );
+}
+
+// whiskold has no per-segment reader.  It is loaded whole.
+static int test_range_whiskold( Whisker_Seg *wv, int n )
+{ return _test_write_whiskold( "test_range.whiskers", wv, n )
+      && _check_file_ranges();
+}
+
+// A file that was cut short fails to read, even when the range ends before
+// the cut.  Reaching the end early must not look like the end of the file.
+static int test_range_truncated( Whisker_Seg *wv, int n )
+{ char *formats[] = { "whiskbin1", "whiskpoly1", "whisk1", NULL };
+  int i, ok = 1;
+  for( i=0; formats[i] && ok; i++ )
+  { Whisker_Seg *sel;
+    int nsel;
+    printf("\t%s\n",formats[i]);
+    if( !_test_write_truncated( "test_range.whiskers", formats[i], wv, n ) )
+      return 0;
+    if( (sel = Load_Whiskers_Range( "test_range.whiskers", NULL, 3, 9, &nsel )) )
+    { printf("\t*** Read %d segments from a truncated file.\n",nsel);
+      Free_Whisker_Seg_Vec( sel, nsel );
+      ok = 0;
+    }
+  }
+  remove( "test_range.whiskers" );
+  return ok;
+}
+
+static int (*tests[])( Whisker_Seg*, int ) = { test_range_skip,
+                                               test_range_read,
+                                               test_range_whiskold,
+                                               test_range_truncated,
+                                               NULL };
+
+static char *Spec[] = {"[-h|--help]", NULL};
+int main(int argc, char *argv[])
+{ Whisker_Seg *wv;
+  int i, n, nfailed = 0;
+
+  printf(
+      "|-----------------------                                       \n"
+      "| Whisker frame range test                                     \n"
+      "|-----------------------                                       \n"
+      "|                                                              \n"
+      "| Reads frame ranges of a synthetic movie's segments with      \n"
+      "| Load_Whiskers_Range and checks them against the whole file.  \n"
+      "| Files are written to the working directory.                  \n"
+      "|--                                                            \n");
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+    return 0;
+
+  wv = _test_make_segments( 0, TEST_NFRAMES, &n );
+  for( i=0; tests[i]; i++ )
+  { printf("--- TEST %d ----------------------------\n", i);
+    if( tests[i](wv,n) )
+      printf("--- TEST %d --- PASSED ----------------\n\n",i);
+    else
+    { printf("*** TEST %d FAILED *********************\n\n",i);
+      nfailed++;
+    }
+  }
+  Free_Whisker_Seg_Vec( wv, n );
+  return nfailed;
+}
+#endif
@@ -8,8 +8,14 @@
  */
 #include <stdio.h>
 #include <string.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "error.h"
 #include "trace.h"
+#include "common.h"
 
 #define WHISKBIN_MODE_READ  0
 #define WHISKBIN_MODE_WRITE 1
@@ -52,7 +58,7 @@ FILE* open_whiskbin1( const char* filename, const char* mode )
   if( strncmp(mode,"w",1)==0 )
   { fp = fopen(filename,"w+b");
     if( fp == NULL )
-    { warning("Could not open file (%s) for writing.\n");
+    { warning("Could not open file (%s) for writing.\n",filename);
       goto Err;
     }
     write_whiskbin1_header(fp);
@@ -75,10 +81,10 @@ void close_whiskbin1( FILE *fp )
 
 int peek_whiskbin1_footer( FILE *file )
 { int nwhiskers;
-  long pos = ftell(file);
-  fseek( file, -sizeof(int), SEEK_END);
+  int64_t pos = FTELL64(file);
+  fseek( file, -(long)sizeof(int), SEEK_END);
   fread( &nwhiskers, sizeof(int), 1, file );
-  fseek( file, pos, SEEK_SET);
+  FSEEK64( file, pos, SEEK_SET);
   return nwhiskers;
 }
 
@@ -93,37 +99,209 @@ void write_whiskbin1_segment( FILE *file, Whisker_Seg *w )
   }
 }
 
+// Reads the id, time and len of the record at the current file position.
+// Returns 1, 0 if only the footer is left, or -1 if the file ends inside a
+// record or can't be read.
+static int read_record_header_whiskbin1( FILE *file, Whisker_Seg *w )
+{ typedef struct {int id; int time; int len;} trunc_WSeg;
+  size_t n = fread( w, 1, sizeof( trunc_WSeg ), file ); //populates id,time (a.k.a frame id),len
+  if( n == sizeof( trunc_WSeg ) )
+    return ( w->len >= 0 ) ? 1 : -1;
+  if( n == sizeof(int) && feof(file) )                   //the footer is shorter than a record
+    return 0;
+  return -1;
+}
+
+// Reads the segment at the current file position.
+// Returns 1, 0 when only the footer is left, or -1 if the file is truncated
+// or can't be read.
+int read_segment_whiskbin1( FILE *file, Whisker_Seg *w )
+{ int k = read_record_header_whiskbin1( file, w );
+  if( k <= 0 )
+    return k;
+  w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
+  w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
+  w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
+  w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
+  if(  fread( w->x       , sizeof(float), w->len , file ) != (size_t) w->len
+    || fread( w->y       , sizeof(float), w->len , file ) != (size_t) w->len
+    || fread( w->thick   , sizeof(float), w->len , file ) != (size_t) w->len
+    || fread( w->scores  , sizeof(float), w->len , file ) != (size_t) w->len )
+  { Free_Whisker_Seg_Data( w );
+    return -1;
+  }
+  return 1;
+}
+
+// Reads the id, time and len of the segment at the current file position and
+// seeks past its point data.  The segment's arrays are not touched.
+// Returns 1, 0 when only the footer is left, or -1 if the file is truncated
+// or can't be read.
+int skip_segment_whiskbin1( FILE *file, Whisker_Seg *w )
+{ int k = read_record_header_whiskbin1( file, w );
+  if( k <= 0 )
+    return k;
+  if( FSEEK64( file, (int64_t) 4*sizeof(float)*w->len, SEEK_CUR ) )
+    return -1;
+  return 1;
+}
+
 // TODO: possible optimization - make a pass through the file to determine 
 //       how much memory needs to be allocated, then allocate big blocks.
 //       I think this might conflict with  how data gets freed later on though...
 Whisker_Seg *read_segments_whiskbin1( FILE *file, int *n)
-{ typedef struct {int id; int time; int len;} trunc_WSeg;
-  Whisker_Seg *wv;
+{ Whisker_Seg *wv;
   int i;
 
   *n = peek_whiskbin1_footer(file); //read in number of whiskers
   wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*(*n), "read whisker segments - format: whiskbin1");
 
   for( i=0; i<(*n); i++ )
+    if( read_segment_whiskbin1( file, wv + i ) <= 0 )
+    { warning("Read %d of %d whisker segments.  The file may be truncated.\n",i,*n);
+      *n = i;
+      break;
+    }
+  return wv;
+}
+
+/* Serializes segments in the same layout write_whiskbin1_segment() uses.
+ * Returns the number of bytes.  If buf is NULL, nothing is written and only
+ * the size is computed.
+ */
+size_t pack_segments_whiskbin1( char *buf, Whisker_Seg *wv, int n )
+{ typedef struct {int id; int time; int len;} trunc_WSeg;
+  size_t size = 0;
+  int i;
+  for( i=0; i<n; i++ )
   { Whisker_Seg *w = wv + i;
-    fread( w, sizeof( trunc_WSeg ), 1, file ); //populates id,time (a.k.a frame id),len
-    w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
-    w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
-    w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
-    w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskbin1 format)" );
-    fread( w->x       , sizeof(float), w->len , file );
-    fread( w->y       , sizeof(float), w->len , file );
-    fread( w->thick   , sizeof(float), w->len , file );
-    fread( w->scores  , sizeof(float), w->len , file );
+    size_t m = sizeof(float)*w->len;
+    if( !w->len )
+      continue;
+    if( buf )
+    { char *c = buf + size;
+      memcpy( c, w, sizeof(trunc_WSeg) ); c += sizeof(trunc_WSeg);
+      memcpy( c, w->x,      m );          c += m;
+      memcpy( c, w->y,      m );          c += m;
+      memcpy( c, w->thick,  m );          c += m;
+      memcpy( c, w->scores, m );
+    }
+    size += sizeof(trunc_WSeg) + 4*m;
   }
-  return wv;
+  return size;
+}
+
+// The footer is the segment count.  Returns the number of bytes.
+size_t pack_whiskbin1_footer( char *buf, int nwhiskers )
+{ if( buf )
+    memcpy( buf, &nwhiskers, sizeof(int) );
+  return sizeof(int);
 }
 
+// The records and the new footer go out in a single write.
 void append_segments_whiskbin1( FILE *file, Whisker_Seg *wv, int n )
-{ int count,i;
+{ static THREAD_LOCAL char  *buf = NULL;
+  static THREAD_LOCAL size_t maxbuf = 0;
+  size_t size;
+  int count;
 
   count = peek_whiskbin1_footer(file);
-  for(i=0; i<n; i++)
-    write_whiskbin1_segment( file, wv + i );
-  write_whiskbin1_footer( file, count + n );
+  size  = pack_segments_whiskbin1( NULL, wv, n );
+  buf   = (char*) request_storage( buf, &maxbuf, 1, size + sizeof(int), "append_segments_whiskbin1" );
+  pack_segments_whiskbin1( buf, wv, n );
+  pack_whiskbin1_footer( buf + size, count + n );
+  fwrite( buf, 1, size + sizeof(int), file );
+  fseek( file, -(long)sizeof(int), SEEK_CUR );
+}
+
+static int truncate_whiskbin1( FILE *file, int64_t size )
+{ fflush(file);
+#ifdef _MSC_VER
+  return _chsize_s( _fileno(file), (__int64) size )==0;
+#else
+  return ftruncate( fileno(file), (off_t) size )==0;
+#endif
+}
+
+/* Opens an existing file so more frames can be appended to it.
+ *
+ * Segments are appended a frame at a time and the footer (the segment count)
+ * is written after each frame.  If writing was interrupted, the file ends in
+ * the middle of a frame, or the footer is missing or stale.  The records are
+ * scanned from the start.  The scan stops at the first record that is cut
+ * short or doesn't look like it continues the sequence of frames.  If the
+ * scan ends exactly at a footer that agrees with the number of records, every
+ * frame is complete.  Otherwise the segments of the last frame seen are
+ * dropped, since some of them may be missing.  The file is truncated after
+ * the last complete frame and a new footer is written.
+ *
+ * *next_fid is set to the first frame that still needs to be traced: one past
+ * the last complete frame, or 0 if there is none.  Frames with no segments
+ * leave nothing in the file, so empty frames at the end of a run are traced
+ * again.
+ *
+ * Returns NULL on failure.
+ */
+FILE *resume_whiskbin1( const char *filename, int *next_fid )
+{ typedef struct {int id; int time; int len;} trunc_WSeg;
+  char type[] = "bwhiskbin1\0";
+  char buf[sizeof(type)];
+  FILE *fp;
+  trunc_WSeg r;
+  int64_t size, pos, frame_pos;
+  int count = 0, frame_count = 0, last = -1, footer;
+
+  if( !(fp = fopen(filename,"r+b")) )
+  { warning("Could not open file (%s) for appending.\n",filename);
+    return NULL;
+  }
+  if( fread(buf,sizeof(type),1,fp)!=1 || memcmp(buf,type,sizeof(type))!=0 )
+  { warning("%s is not a whiskbin1 file.\n",filename);
+    goto Err;
+  }
+  if( FSEEK64( fp, 0, SEEK_END ) || (size = FTELL64(fp))<0 )
+  { warning("Could not find the size of %s.\n",filename);
+    goto Err;
+  }
+  pos = frame_pos = sizeof(type);
+  FSEEK64( fp, pos, SEEK_SET );
+  while( pos + (int64_t)sizeof(r) <= size )
+  { int64_t end;
+    if( fread(&r,sizeof(r),1,fp)!=1 )
+      break;
+    end = pos + sizeof(r) + 4*sizeof(float)*(int64_t)r.len;
+    if( r.len<=0 || end>size || r.time<last || r.time<0 )
+      break;
+    if( r.time!=last )         // first record of a new frame
+    { frame_pos   = pos;
+      frame_count = count;
+      last        = r.time;
+    }
+    count++;
+    pos = end;
+    FSEEK64( fp, pos, SEEK_SET );
+  }
+
+  FSEEK64( fp, pos, SEEK_SET );
+  if( pos + (int64_t)sizeof(int) == size && fread(&footer,sizeof(int),1,fp)==1 && footer==count )
+  { *next_fid = last+1;        // clean end.  Everything is complete.
+  } else
+  { if( last>=0 )
+      warning("%s ends in an incomplete frame (%d).\n"
+              "\tDropping the %d segments written for that frame.\n",filename,last,count-frame_count);
+    *next_fid = (last<0) ? 0 : last;
+    pos   = frame_pos;
+    count = frame_count;
+  }
+  FSEEK64( fp, pos, SEEK_SET );
+  write_whiskbin1_footer( fp, count );
+  if( !truncate_whiskbin1( fp, pos + sizeof(int) ) )
+  { warning("Could not truncate %s.\n",filename);
+    goto Err;
+  }
+  FSEEK64( fp, pos, SEEK_SET );
+  return fp;
+Err:
+  fclose(fp);
+  return NULL;
 }
@@ -76,6 +76,31 @@ void write_segments_whisk1( FILE *file, Whisker_Seg **wv, int *sz, int nplanes )
 }
 #endif
 
+// Reads the segment at the current file position.
+// Returns 1, 0 at the end of the file, or -1 if the file is truncated or
+// can't be read.
+int read_segment_whisker1( FILE *file, Whisker_Seg *w )
+{ int k;
+  if( ftell(file) == 0 )
+  { size_t nch;
+    fskipline(file, &nch ); // skip the first (format specifying) line
+  }
+  if( (k = fscanf ( file, "%d,%d,%d,%d", &w->time, &w->id, &w->time, &w->len )) != 4 )
+    return ( k == EOF && !ferror(file) ) ? 0 : -1;
+  if( w->len < 0 )
+    return -1;
+  w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
+  w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
+  w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
+  w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
+  for( k=0; k < w->len; k++ )
+    if( fscanf ( file, ",%g,%g,%g,%g", w->x + k, w->y + k, w->thick + k, w->scores + k ) != 4 )
+    { Free_Whisker_Seg_Data( w );
+      return -1;
+    }
+  return 1;
+}
+
 Whisker_Seg *read_segments_whisker1( FILE *file, int *n)
 { Whisker_Seg *wv;
   int nwhiskers = 0;
@@ -88,20 +113,14 @@ Whisker_Seg *read_segments_whisker1( FILE *file, int *n)
   *n = nwhiskers;
   wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*nwhiskers, "read whisker segments - format: whisker1");
 
-  { int i,k;
-    Whisker_Seg *w;
+  { int i;
     rewind(file);
-    fskipline(file, &nch ); // skip the first (format specifying) line
     for( i=0; i < nwhiskers; i++ )
-    { w = wv + i;
-      fscanf ( file, "%d,%d,%d,%d", &w->time, &w->id, &w->time, &w->len );
-      w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
-      w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
-      w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
-      w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (format: whisker1)" );
-      for( k=0; k < w->len; k++ )
-        fscanf ( file, ",%g,%g,%g,%g", w->x + k, w->y + k, w->thick + k, w->scores + k );
-    }
+      if( read_segment_whisker1( file, wv + i ) <= 0 )
+      { warning("Read %d of %d whisker segments.  The file may be truncated.\n",i,nwhiskers);
+        *n = i;
+        break;
+      }
   }
   return wv;
 }
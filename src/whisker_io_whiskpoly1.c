@@ -192,12 +192,80 @@ void write_whiskpoly1_segment( FILE *file, Whisker_Seg *w )
   }
 }
 
-Whisker_Seg *read_segments_whiskpoly1( FILE *file, int *n)
+// Reads the id, time and len of the record at the current file position.
+// Returns 1, 0 if only the footer is left, or -1 if the file ends inside a
+// record or can't be read.
+static int read_record_header_whiskpoly1( FILE *file, Whisker_Seg *w )
 { typedef struct {int id; int time; int len;} trunc_WSeg;
-  Whisker_Seg *wv;
-  int i;
-  static double *t = NULL;
+  size_t n = fread( w, 1, sizeof( trunc_WSeg ), file ); //populates id,time (a.k.a frame id),len
+  if( n == sizeof( trunc_WSeg ) )
+    return ( w->len >= 0 ) ? 1 : -1;
+  if( n == sizeof(int) && feof(file) )                   //the footer is shorter than a record
+    return 0;
+  return -1;
+}
+
+// Reads the segment at the current file position.
+// Returns 1, 0 when only the footer is left, or -1 if the file is truncated
+// or can't be read.
+int read_segment_whiskpoly1( FILE *file, Whisker_Seg *w )
+{ static double *t = NULL;
   static size_t  t_size = 0;
+  int j,len,k;
+  double px[WHISKER_IO_POLY_DEGREE+1],
+         py[WHISKER_IO_POLY_DEGREE+1];
+  float s;
+  float *x, *y, *thick, *scores;
+
+  if( (k = read_record_header_whiskpoly1( file, w )) <= 0 )
+    return k;
+  if(  fread( &s, sizeof(float),  1, file ) != 1
+    || fread( px, sizeof(double), WHISKER_IO_POLY_DEGREE+1, file ) != WHISKER_IO_POLY_DEGREE+1
+    || fread( py, sizeof(double), WHISKER_IO_POLY_DEGREE+1, file ) != WHISKER_IO_POLY_DEGREE+1 )
+    return -1;
+  len = w->len;
+  linspace_d( 0.0, 1.0, len, &t, &t_size );
+
+  x      = w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
+  y      = w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
+  thick  = w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
+  scores = w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
+
+#ifdef DEBUG_WHISKER_IO_POLYFIT_READ
+  debug("   fid:%5d wid:%5d len:%5d\n"
+        "   Median score: %f\n"
+        "   px[0] %5.5g px[end] %5.5g\n"
+        "   py[0] %5.5g py[end] %5.5g\n"
+      ,w->time, w->id, w->len,s
+      ,px[0],px[WHISKER_IO_POLY_DEGREE] 
+      ,py[0],py[WHISKER_IO_POLY_DEGREE]
+      );
+#endif
+  for( j=0; j<len; j++ )
+  { x[j] = (float) polyval( px, WHISKER_IO_POLY_DEGREE, t[j] );
+    y[j] = (float) polyval( py, WHISKER_IO_POLY_DEGREE, t[j] ); 
+    thick[j]  = 1.0;
+    scores[j] = s;
+  }
+  return 1;
+}
+
+// Reads the id, time and len of the segment at the current file position and
+// seeks past the rest of the record.  The segment's arrays are not touched.
+// Returns 1, 0 when only the footer is left, or -1 if the file is truncated
+// or can't be read.
+int skip_segment_whiskpoly1( FILE *file, Whisker_Seg *w )
+{ int k = read_record_header_whiskpoly1( file, w );
+  if( k <= 0 )
+    return k;
+  if( FSEEK64( file, sizeof(float) + 2*sizeof(double)*(WHISKER_IO_POLY_DEGREE+1), SEEK_CUR ) )
+    return -1;
+  return 1;
+}
+
+Whisker_Seg *read_segments_whiskpoly1( FILE *file, int *n)
+{ Whisker_Seg *wv;
+  int i;
 
   *n = peek_whiskpoly1_footer(file); //read in number of whiskers
 #ifdef DEBUG_WHISKER_IO_POLYFIT_READ
@@ -206,42 +274,14 @@ Whisker_Seg *read_segments_whiskpoly1( FILE *file, int *n)
   wv = (Whisker_Seg*) Guarded_Malloc( sizeof(Whisker_Seg)*(*n), "read whisker segments - format: whiskpoly1");
 
   for( i=0; i<(*n); i++ )
-  { Whisker_Seg *w = wv + i;
-    int j,len;
-    double px[WHISKER_IO_POLY_DEGREE+1],
-           py[WHISKER_IO_POLY_DEGREE+1];
-    float s;
-    float *x, *y, *thick, *scores;
-
-    fread( w, sizeof( trunc_WSeg ), 1, file ); //populates id,time (a.k.a frame id),len
-    len = w->len;
-    linspace_d( 0.0, 1.0, len, &t, &t_size );
-
-    x      = w->x      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
-    y      = w->y      = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
-    thick  = w->thick  = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
-    scores = w->scores = (float*) Guarded_Malloc( sizeof(float)*(w->len), "read whisker segments (whiskpoly1 format)" );
-
-    fread( &s, sizeof(float),  1, file );
-    fread( px, sizeof(double), WHISKER_IO_POLY_DEGREE+1, file );
-    fread( py, sizeof(double), WHISKER_IO_POLY_DEGREE+1, file );
-
+  {
 #ifdef DEBUG_WHISKER_IO_POLYFIT_READ
-    debug("Row: %d\n"
-          "   fid:%5d wid:%5d len:%5d\n"
-          "   Median score: %f\n"
-          "   px[0] %5.5g px[end] %5.5g\n"
-          "   py[0] %5.5g py[end] %5.5g\n"
-        ,i,w->time, w->id, w->len,s
-        ,px[0],px[WHISKER_IO_POLY_DEGREE] 
-        ,py[0],py[WHISKER_IO_POLY_DEGREE]
-        );
+    debug("Row: %d\n",i);
 #endif
-    for( j=0; j<len; j++ )
-    { x[j] = (float) polyval( px, WHISKER_IO_POLY_DEGREE, t[j] );
-      y[j] = (float) polyval( py, WHISKER_IO_POLY_DEGREE, t[j] ); 
-      thick[j]  = 1.0;
-      scores[j] = s;
+    if( read_segment_whiskpoly1( file, wv + i ) <= 0 )
+    { warning("Read %d of %d whisker segments.  The file may be truncated.\n",i,*n);
+      *n = i;
+      break;
     }
   }
   return wv;
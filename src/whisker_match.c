@@ -0,0 +1,314 @@
+/*
+ * Copyright 2010 Howard Hughes Medical Institute.
+ * All rights reserved.
+ * Use is subject to Janelia Farm Research Campus Software Copyright 1.1
+ * license terms (http://license.janelia.org/license/jfrc_copyright_1_1.html).
+ */
+#include "whisker_match.h"
+#include "match.h"
+#include "utilities.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ENDL "\n"
+#define REPORT(expr) debug("%s(%d):"ENDL "\t%s"ENDL "\tExpression evaluated as false."ENDL,__FILE__,__LINE__,#expr)
+#define TRY(expr)    if(!(expr)) {REPORT(expr); goto Error;}
+
+#define K WHISKER_MATCH_NSAMPLES
+
+/*
+ * Shapes are stored as a structure of arrays.  The samples for segment i are
+ * x[i*K .. i*K+K-1].  A reversed copy (rx,ry) is kept so both orientations
+ * are compared with contiguous, unit-stride loops.
+ */
+struct _Whisker_Shapes
+{ int    n;
+  float *xmin, *xmax,
+        *ymin, *ymax,
+        *cx,   *cy;
+  float *x,    *y,
+        *rx,   *ry;
+};
+
+//
+// SHAPES
+//
+
+// Samples the polyline at K points evenly spaced along its arc length.
+static void resample( Whisker_Seg *w, float *x, float *y )
+{ int i,k;
+  float total = 0.0f, step, s0, t;
+  if( w->len < 1 )
+  { memset( x, 0, sizeof(float)*K );
+    memset( y, 0, sizeof(float)*K );
+    return;
+  }
+  for( i=1; i<w->len; i++ )
+    total += hypotf( w->x[i]-w->x[i-1], w->y[i]-w->y[i-1] );
+  if( total <= 0.0f )
+  { for( k=0; k<K; k++ )
+    { x[k] = w->x[0];
+      y[k] = w->y[0];
+    }
+    return;
+  }
+  step = total/(K-1);
+  s0 = 0.0f;  // arc length at w[i-1]
+  i  = 1;
+  for( k=0; k<K; k++ )
+  { float s = step*k, seg;
+    while( i<w->len-1 && s0 + (seg=hypotf(w->x[i]-w->x[i-1],w->y[i]-w->y[i-1])) < s )
+    { s0 += seg;
+      i++;
+    }
+    seg = hypotf( w->x[i]-w->x[i-1], w->y[i]-w->y[i-1] );
+    t = (seg>0.0f) ? (s-s0)/seg : 0.0f;
+    t = (t<0.0f)?0.0f:((t>1.0f)?1.0f:t);
+    x[k] = w->x[i-1] + t*(w->x[i]-w->x[i-1]);
+    y[k] = w->y[i-1] + t*(w->y[i]-w->y[i-1]);
+  }
+}
+
+SHARED_EXPORT
+Whisker_Shapes *Make_Whisker_Shapes( Whisker_Seg *wv, int n )
+{ Whisker_Shapes *self;
+  float *block;
+  int i,k;
+  size_t m = (n>0)?n:1;
+
+  self  = (Whisker_Shapes*) Guarded_Malloc( sizeof(Whisker_Shapes), "Make_Whisker_Shapes" );
+  block = (float*) Guarded_Malloc( sizeof(float)*m*(6+4*K), "Make_Whisker_Shapes" );
+  self->n    = n;
+  self->xmin = block;
+  self->xmax = block +   m;
+  self->ymin = block + 2*m;
+  self->ymax = block + 3*m;
+  self->cx   = block + 4*m;
+  self->cy   = block + 5*m;
+  self->x    = block + 6*m;
+  self->y    = self->x  + m*K;
+  self->rx   = self->y  + m*K;
+  self->ry   = self->rx + m*K;
+
+  for( i=0; i<n; i++ )
+  { float *x  = self->x  + i*K, *y  = self->y  + i*K,
+          *rx = self->rx + i*K, *ry = self->ry + i*K;
+    float sx = 0.0f, sy = 0.0f;
+    resample( wv+i, x, y );
+    self->xmin[i] = self->xmax[i] = x[0];
+    self->ymin[i] = self->ymax[i] = y[0];
+    for( k=0; k<K; k++ )
+    { rx[k] = x[K-1-k];
+      ry[k] = y[K-1-k];
+      sx += x[k];
+      sy += y[k];
+      if( x[k] < self->xmin[i] ) self->xmin[i] = x[k];
+      if( x[k] > self->xmax[i] ) self->xmax[i] = x[k];
+      if( y[k] < self->ymin[i] ) self->ymin[i] = y[k];
+      if( y[k] > self->ymax[i] ) self->ymax[i] = y[k];
+    }
+    self->cx[i] = sx/K;
+    self->cy[i] = sy/K;
+  }
+  return self;
+}
+
+SHARED_EXPORT
+void Free_Whisker_Shapes( Whisker_Shapes *self )
+{ if(!self) return;
+  free( self->xmin );  // the block
+  free( self );
+}
+
+SHARED_EXPORT
+int Whisker_Shapes_Count( Whisker_Shapes *self )
+{ return self->n;
+}
+
+//
+// DISTANCE
+//
+
+static inline float mean_sample_distance( const float *ax, const float *ay, const float *bx, const float *by )
+{ float s = 0.0f;
+  int k;
+  for( k=0; k<K; k++ )
+  { float dx = ax[k]-bx[k],
+          dy = ay[k]-by[k];
+    s += sqrtf( dx*dx + dy*dy );
+  }
+  return s/K;
+}
+
+SHARED_EXPORT
+float Whisker_Shapes_Distance( Whisker_Shapes *a, int i, Whisker_Shapes *b, int j )
+{ const float *ax = a->x + i*K, *ay = a->y + i*K;
+  float fwd = mean_sample_distance( ax, ay, b->x  + j*K, b->y  + j*K ),
+        rev = mean_sample_distance( ax, ay, b->rx + j*K, b->ry + j*K );
+  return (fwd<rev)?fwd:rev;
+}
+
+// Lower bounds on the distance.  Every sample lies in its segment's box, so no
+// pair of samples is closer than the gap between the boxes.  The distance
+// between the centroids is the length of the mean difference vector, which is
+// no more than the mean difference length.
+static inline int is_candidate( Whisker_Shapes *a, int i, Whisker_Shapes *b, int j, float radius )
+{ float dx, dy;
+  if( a->xmin[i] - radius > b->xmax[j] || b->xmin[j] - radius > a->xmax[i] ||
+      a->ymin[i] - radius > b->ymax[j] || b->ymin[j] - radius > a->ymax[i] )
+    return 0;
+  dx = a->cx[i] - b->cx[j];
+  dy = a->cy[i] - b->cy[j];
+  return dx*dx + dy*dy <= radius*radius;
+}
+
+SHARED_EXPORT
+Whisker_Distance_Matrix *Whisker_Distance_Matrix_Pruned( Whisker_Shapes *a, Whisker_Shapes *b, float radius )
+{ Whisker_Distance_Matrix *self = NULL;
+  size_t cap = 0;
+  int i,j;
+
+  TRY( a && b && radius>=0.0f );
+  self = (Whisker_Distance_Matrix*) Guarded_Malloc( sizeof(Whisker_Distance_Matrix), "Whisker_Distance_Matrix_Pruned" );
+  memset( self, 0, sizeof(*self) );
+  self->nrows  = a->n;
+  self->ncols  = b->n;
+  self->rowptr = (int*) Guarded_Malloc( sizeof(int)*(a->n+1), "Whisker_Distance_Matrix_Pruned" );
+  cap = 4*(size_t)( (a->n>b->n)?a->n:b->n ) + 1;
+  self->col  = (int*)   Guarded_Malloc( sizeof(int)*cap,   "Whisker_Distance_Matrix_Pruned" );
+  self->dist = (float*) Guarded_Malloc( sizeof(float)*cap, "Whisker_Distance_Matrix_Pruned" );
+
+  for( i=0; i<a->n; i++ )
+  { self->rowptr[i] = self->nnz;
+    for( j=0; j<b->n; j++ )
+    { float d;
+      if( !is_candidate(a,i,b,j,radius) )
+        continue;
+      d = Whisker_Shapes_Distance(a,i,b,j);
+      if( d > radius )
+        continue;
+      if( (size_t)self->nnz >= cap )
+      { cap *= 2;
+        self->col  = (int*)   Guarded_Realloc( self->col,  sizeof(int)*cap,   "Whisker_Distance_Matrix_Pruned" );
+        self->dist = (float*) Guarded_Realloc( self->dist, sizeof(float)*cap, "Whisker_Distance_Matrix_Pruned" );
+      }
+      self->col [self->nnz] = j;
+      self->dist[self->nnz] = d;
+      self->nnz++;
+    }
+  }
+  self->rowptr[a->n] = self->nnz;
+  return self;
+Error:
+  return NULL;
+}
+
+SHARED_EXPORT
+void Free_Whisker_Distance_Matrix( Whisker_Distance_Matrix *self )
+{ if(!self) return;
+  free( self->rowptr );
+  free( self->col );
+  free( self->dist );
+  free( self );
+}
+
+//
+// MATCHING
+//
+
+SHARED_EXPORT
+int Whisker_Match_Frames( Whisker_Shapes *a, Whisker_Shapes *b, float radius, int *assignment, double *cost )
+{ Whisker_Distance_Matrix *m = NULL;
+  double c = 0.0;
+  int nmatched;
+  TRY( m = Whisker_Distance_Matrix_Pruned(a,b,radius) );
+  TRY( (nmatched = assignmentsparse( assignment, &c, m->rowptr, m->col, m->dist, m->nrows, m->ncols, radius )) >= 0 );
+  if( cost )
+    *cost = c;
+  Free_Whisker_Distance_Matrix(m);
+  return nmatched;
+Error:
+  Free_Whisker_Distance_Matrix(m);
+  return -1;
+}
+
+#undef K
+
+#ifdef WHISKER_MATCH_FRAMES
+#include "whisker_io.h"
+
+static int cmp_time_id( const void *a, const void *b )
+{ const Whisker_Seg *u = (const Whisker_Seg*)a,
+                    *v = (const Whisker_Seg*)b;
+  if( u->time != v->time ) return (u->time < v->time)?-1:1;
+  return u->id - v->id;
+}
+
+static char *Spec[] = {"[-h|--help] | <source:string> [--radius <double>]", NULL};
+int main(int argc, char *argv[])
+{ Whisker_Seg *wv;
+  Whisker_Shapes *last = NULL;
+  int *assignment = NULL;
+  size_t assignment_size = 0;
+  int n, beg, end, lastbeg = 0;
+  float radius;
+
+  Process_Arguments(argc,argv,Spec,0);
+  if( Is_Arg_Matched("-h") || Is_Arg_Matched("--help") )
+  { Print_Argument_Usage(stdout,0);
+    printf(
+      "--------------------------                                                   \n"
+      " Match whiskers across frames                                                 \n"
+      "--------------------------                                                   \n"
+      "                                                                              \n"
+      "  Pairs each segment with a segment in the next traced frame so the total     \n"
+      "  distance between paired segments is minimal.  One line is written for each  \n"
+      "  segment that has a partner:                                                 \n"
+      "                                                                              \n"
+      "      <time> <id> <next time> <next id> <distance>                            \n"
+      "                                                                              \n"
+      "  The distance is the mean distance in pixels between points spaced evenly    \n"
+      "  along each segment.                                                         \n"
+      "                                                                              \n"
+      "  <source>    Whiskers file to read.                                          \n"
+      "  --radius    Segments farther apart than this are never paired.  Default: 10 \n"
+      "\n");
+    return 0;
+  }
+  radius = Is_Arg_Matched("--radius") ? (float)Get_Double_Arg("--radius") : 10.0f;
+
+  wv = Load_Whiskers( Get_String_Arg("source"), NULL, &n );
+  if( !wv )
+    error("Could not read whiskers from %s\n", Get_String_Arg("source"));
+  qsort( wv, n, sizeof(Whisker_Seg), cmp_time_id );
+
+  for( beg=0; beg<n; beg=end )
+  { Whisker_Shapes *cur;
+    int i;
+    for( end=beg; end<n && wv[end].time==wv[beg].time; end++ );
+    cur = Make_Whisker_Shapes( wv+beg, end-beg );
+    if( last )
+    { assignment = (int*) request_storage( assignment, &assignment_size, sizeof(int), Whisker_Shapes_Count(last), "whisker_match - assignment" );
+      if( Whisker_Match_Frames( last, cur, radius, assignment, NULL ) < 0 )
+        error("Matching failed at frame %d\n", wv[beg].time);
+      for( i=0; i<Whisker_Shapes_Count(last); i++ )
+        if( assignment[i] >= 0 )
+          printf( "%d\t%d\t%d\t%d\t%f\n",
+                  wv[lastbeg+i].time, wv[lastbeg+i].id,
+                  wv[beg+assignment[i]].time, wv[beg+assignment[i]].id,
+                  Whisker_Shapes_Distance( last, i, cur, assignment[i] ) );
+      Free_Whisker_Shapes( last );
+    }
+    last    = cur;
+    lastbeg = beg;
+  }
+  Free_Whisker_Shapes( last );
+  if( assignment ) free( assignment );
+  Free_Whisker_Seg_Vec( wv, n );
+  return 0;
+}
+#endif